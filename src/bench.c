@@ -0,0 +1,187 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/*
+ * In-kernel microbenchmark of the lock-free skiplist inserts.
+ * Built only with "make type=lf bench=1" (see Kbuild).
+ *
+ * Usage:
+ * echo "<threads> <inserts per thread> <xorshift|legacy>" > /sys/module/lsbdd/parameters/bench_sl_insert
+ * cat /sys/module/lsbdd/parameters/bench_sl_insert
+ *
+ * "legacy" switches random_levels() back to get_random_u32() + atomic inc of max_lvl,
+ * so both level generators can be compared on the same build.
+ */
+
+#include <linux/completion.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include "skiplist.h"
+#include "atomic_ops.h"
+#include "utils/mag_cache.h"
+#include "utils/value_redir.h"
+
+#define LSBDD_BENCH_MAX_THREADS 64
+#define LSBDD_BENCH_RES_LEN 128
+
+struct sl_bench_ctx {
+	struct skiplist *sl;
+	struct kmem_cache *node_cache;
+	struct kmem_cache *value_cache;
+	u32 threads;
+	u64 ops;
+	atomic_t running;
+	struct completion start;
+	struct completion done;
+};
+
+struct sl_bench_worker {
+	struct sl_bench_ctx *ctx;
+	u32 id;
+};
+
+static DEFINE_MUTEX(sl_bench_lock);
+static char sl_bench_res[LSBDD_BENCH_RES_LEN];
+
+static s32 sl_bench_thread(void *data)
+{
+	struct sl_bench_worker *worker = data;
+	struct sl_bench_ctx *ctx = worker->ctx;
+	sector_t key = 0;
+	u64 i = 0;
+
+	wait_for_completion(&ctx->start);
+
+	// interleaved keys, so all the threads contend on the same towers
+	for (i = 0; i < ctx->ops; i++) {
+		key = (i * ctx->threads + worker->id + 1) * LSBDD_COMPACT_BLOCK_SECTORS;
+		skiplist_insert(ctx->sl, key, lsbdd_value_compact(key, LSBDD_COMPACT_BLOCK_SIZE), ctx->node_cache, ctx->value_cache);
+	}
+
+	if (atomic_dec_and_test(&ctx->running))
+		complete(&ctx->done);
+
+	return 0;
+}
+
+static s32 sl_bench_run(u32 threads, u64 ops, bool legacy)
+{
+	struct sl_bench_worker *workers = NULL;
+	struct sl_bench_ctx ctx = { 0 };
+	struct task_struct *task = NULL;
+	u64 start_ns = 0;
+	u64 elapsed_ns = 0;
+	s32 status = 0;
+	u32 i = 0;
+
+	workers = kcalloc(threads, sizeof(struct sl_bench_worker), GFP_KERNEL);
+	ctx.value_cache = kmem_cache_create("lsbdd_bench_value_cache", sizeof(struct lsbdd_value_redir), 0, 0, NULL);
+	ctx.node_cache = lsbdd_mag_cache_create("lsbdd_bench_sl_cache", sizeof(struct skiplist_node) + MAX_LVL * sizeof(struct skiplist_node *),
+						0, SLAB_HWCACHE_ALIGN);
+	if (!workers || !ctx.value_cache || !ctx.node_cache)
+		goto mem_err;
+
+	ctx.sl = skiplist_init(ctx.node_cache);
+	if (!ctx.sl)
+		goto mem_err;
+
+	ctx.threads = threads;
+	ctx.ops = ops;
+	atomic_set(&ctx.running, threads);
+	init_completion(&ctx.start);
+	init_completion(&ctx.done);
+	WRITE_ONCE(sl_legacy_levels, legacy);
+
+	for (i = 0; i < threads; i++) {
+		workers[i].ctx = &ctx;
+		workers[i].id = i;
+		task = kthread_run(sl_bench_thread, &workers[i], "lsbdd_bench/%u", i);
+		if (IS_ERR(task)) {
+			// the rest of threads still have to finish, so just count the missing ones as done
+			pr_err("Failed to start bench thread %u\n", i);
+			status = PTR_ERR(task);
+			if (atomic_sub_and_test(threads - i, &ctx.running))
+				complete(&ctx.done);
+			break;
+		}
+	}
+
+	start_ns = ktime_get_ns();
+	complete_all(&ctx.start);
+	wait_for_completion(&ctx.done);
+	elapsed_ns = ktime_get_ns() - start_ns;
+
+	WRITE_ONCE(sl_legacy_levels, false);
+
+	if (!status)
+		scnprintf(sl_bench_res, LSBDD_BENCH_RES_LEN, "threads=%u ops=%llu gen=%s ns=%llu kops_per_sec=%llu max_lvl=%lld\n", threads,
+			  threads * ops, legacy ? "legacy" : "xorshift", elapsed_ns,
+			  div64_u64(threads * ops * NSEC_PER_MSEC, elapsed_ns ?: 1), ATOMIC_LREAD(&ctx.sl->max_lvl));
+
+	skiplist_free(ctx.sl, ctx.node_cache, ctx.value_cache); // destroys the node cache
+	kmem_cache_destroy(ctx.value_cache);
+	kfree(workers);
+
+	return status;
+
+mem_err:
+	pr_err("Memory allocation failed\n");
+	lsbdd_mag_cache_destroy(ctx.node_cache);
+	kmem_cache_destroy(ctx.value_cache);
+	kfree(workers);
+	return -ENOMEM;
+}
+
+/**
+ * Runs the skiplist insert benchmark.
+ *
+ * @param arg - "threads ops_per_thread generator"
+ *
+ * @return 0 on success, -EINVAL/-ENOMEM on error
+ */
+static s32 lsbdd_bench_sl_insert(const char *arg, const struct kernel_param *kp)
+{
+	char gen[16];
+	u32 threads = 0;
+	u64 ops = 0;
+	s32 status = 0;
+
+	if (sscanf(arg, "%u %llu %15s", &threads, &ops, gen) != 3) {
+		pr_err("Wrong input, 3 values are required\n");
+		return -EINVAL;
+	}
+
+	if (!threads || threads > LSBDD_BENCH_MAX_THREADS || !ops) {
+		pr_err("Threads should be in 1..%d, ops > 0\n", LSBDD_BENCH_MAX_THREADS);
+		return -EINVAL;
+	}
+
+	if (strcmp(gen, "xorshift") && strcmp(gen, "legacy")) {
+		pr_err("%s generator is not supported (xorshift/legacy)\n", gen);
+		return -EINVAL;
+	}
+
+	mutex_lock(&sl_bench_lock);
+	status = sl_bench_run(threads, ops, !strcmp(gen, "legacy"));
+	mutex_unlock(&sl_bench_lock);
+
+	pr_info("bench: %s", sl_bench_res);
+
+	return status;
+}
+
+static s32 lsbdd_get_bench_sl_insert(char *buf, const struct kernel_param *kp)
+{
+	return scnprintf(buf, PAGE_SIZE, "%s", sl_bench_res);
+}
+
+static const struct kernel_param_ops lsbdd_bench_sl_ops = {
+	.set = lsbdd_bench_sl_insert,
+	.get = lsbdd_get_bench_sl_insert,
+};
+
+MODULE_PARM_DESC(bench_sl_insert, "Run skiplist insert benchmark: \"threads ops_per_thread xorshift|legacy\"");
+module_param_cb(bench_sl_insert, &lsbdd_bench_sl_ops, NULL, 0644);
@@ -0,0 +1,203 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+/**
+ * Tracepoints of the submit, redirect and completion path (events/lsbdd/ in tracefs).
+ *
+ * Sectors of the original BIO (LBA) are on the virtual disk, redirected ones (PBA) and the split
+ * fragments are on the backing device (dev of lsbdd_remap and lsbdd_split is the backing one too).
+ * A request is followed by its LBA:
+ * lsbdd_submit -> [lsbdd_map_remove] lsbdd_map_insert (writes) -> lsbdd_split* -> lsbdd_remap -> lsbdd_complete.
+ *
+ * perf trace -e 'lsbdd:*'
+ * bpftrace -e 'tracepoint:lsbdd:lsbdd_remap { @[args->rwbs] = hist(args->nr_sector); }'
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM lsbdd
+
+#if !defined(_LSBDD_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _LSBDD_TRACE_H
+
+#include <linux/blkdev.h>
+#include <linux/blktrace_api.h>
+#include <linux/tracepoint.h>
+
+// BIO that came to the virtual disk
+TRACE_EVENT(lsbdd_submit,
+
+	TP_PROTO(struct bio *bio),
+
+	TP_ARGS(bio),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(sector_t, sector)
+		__field(u32, nr_sector)
+		__array(char, rwbs, RWBS_LEN)
+	),
+
+	TP_fast_assign(
+		__entry->dev = bio_dev(bio);
+		__entry->sector = bio->bi_iter.bi_sector;
+		__entry->nr_sector = bio_sectors(bio);
+		blk_fill_rwbs(__entry->rwbs, bio->bi_opf);
+	),
+
+	TP_printk("%d,%d %s %llu + %u", MAJOR(__entry->dev), MINOR(__entry->dev), __entry->rwbs,
+		  (unsigned long long)__entry->sector, __entry->nr_sector)
+);
+
+// BIO (or the part of it in the first extent) is sent to the backing device, dev is the backing one
+TRACE_EVENT(lsbdd_remap,
+
+	TP_PROTO(struct bio *bio, sector_t lba),
+
+	TP_ARGS(bio, lba),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(sector_t, lba)
+		__field(sector_t, pba)
+		__field(u32, nr_sector)
+		__array(char, rwbs, RWBS_LEN)
+	),
+
+	TP_fast_assign(
+		__entry->dev = bio_dev(bio);
+		__entry->lba = lba;
+		__entry->pba = bio->bi_iter.bi_sector;
+		__entry->nr_sector = bio_sectors(bio);
+		blk_fill_rwbs(__entry->rwbs, bio->bi_opf);
+	),
+
+	TP_printk("%d,%d %s %llu + %u <- %llu", MAJOR(__entry->dev), MINOR(__entry->dev), __entry->rwbs,
+		  (unsigned long long)__entry->pba, __entry->nr_sector, (unsigned long long)__entry->lba)
+);
+
+// Fragment split off the BIO: multi-extent reads and zone appends above the append limit
+TRACE_EVENT(lsbdd_split,
+
+	TP_PROTO(struct bio *split, struct bio *rest),
+
+	TP_ARGS(split, rest),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(sector_t, sector)
+		__field(u32, nr_sector)
+		__field(u32, rest_sector)
+		__array(char, rwbs, RWBS_LEN)
+	),
+
+	TP_fast_assign(
+		__entry->dev = bio_dev(split);
+		__entry->sector = split->bi_iter.bi_sector;
+		__entry->nr_sector = bio_sectors(split);
+		__entry->rest_sector = bio_sectors(rest);
+		blk_fill_rwbs(__entry->rwbs, split->bi_opf);
+	),
+
+	TP_printk("%d,%d %s %llu + %u, rest %u", MAJOR(__entry->dev), MINOR(__entry->dev), __entry->rwbs,
+		  (unsigned long long)__entry->sector, __entry->nr_sector, __entry->rest_sector)
+);
+
+// Unmapped read passed through as is (check_system_bio)
+TRACE_EVENT(lsbdd_system_bio,
+
+	TP_PROTO(struct bio *bio, sector_t lba, sector_t last_key),
+
+	TP_ARGS(bio, lba, last_key),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(sector_t, lba)
+		__field(sector_t, last_key)
+		__field(u32, nr_sector)
+	),
+
+	TP_fast_assign(
+		__entry->dev = bio_dev(bio);
+		__entry->lba = lba;
+		__entry->last_key = last_key;
+		__entry->nr_sector = bio_sectors(bio);
+	),
+
+	TP_printk("%d,%d %llu + %u, last key %llu", MAJOR(__entry->dev), MINOR(__entry->dev),
+		  (unsigned long long)__entry->lba, __entry->nr_sector, (unsigned long long)__entry->last_key)
+);
+
+DECLARE_EVENT_CLASS(lsbdd_map,
+
+	TP_PROTO(struct gendisk *disk, sector_t lba, sector_t pba, u32 size),
+
+	TP_ARGS(disk, lba, pba, size),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(sector_t, lba)
+		__field(sector_t, pba)
+		__field(u32, size)
+	),
+
+	TP_fast_assign(
+		__entry->dev = disk_devt(disk);
+		__entry->lba = lba;
+		__entry->pba = pba;
+		__entry->size = size;
+	),
+
+	TP_printk("%d,%d %llu -> %llu, %u bytes", MAJOR(__entry->dev), MINOR(__entry->dev),
+		  (unsigned long long)__entry->lba, (unsigned long long)__entry->pba, __entry->size)
+);
+
+DEFINE_EVENT(lsbdd_map, lsbdd_map_insert,
+
+	TP_PROTO(struct gendisk *disk, sector_t lba, sector_t pba, u32 size),
+
+	TP_ARGS(disk, lba, pba, size)
+);
+
+DEFINE_EVENT(lsbdd_map, lsbdd_map_remove,
+
+	TP_PROTO(struct gendisk *disk, sector_t lba, sector_t pba, u32 size),
+
+	TP_ARGS(disk, lba, pba, size)
+);
+
+/**
+ * Completion of the redirected I/O (the clone or the BIO remapped in place), the original BIO is completed
+ * right after it. dev and sector are the virtual disk ones, as in lsbdd_submit.
+ */
+TRACE_EVENT(lsbdd_complete,
+
+	TP_PROTO(dev_t dev, sector_t lba, u32 nr_sector, blk_opf_t opf, blk_status_t status),
+
+	TP_ARGS(dev, lba, nr_sector, opf, status),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(sector_t, sector)
+		__field(u32, nr_sector)
+		__field(s32, error)
+		__array(char, rwbs, RWBS_LEN)
+	),
+
+	TP_fast_assign(
+		__entry->dev = dev;
+		__entry->sector = lba;
+		__entry->nr_sector = nr_sector;
+		__entry->error = blk_status_to_errno(status);
+		blk_fill_rwbs(__entry->rwbs, opf);
+	),
+
+	TP_printk("%d,%d %s %llu + %u [%d]", MAJOR(__entry->dev), MINOR(__entry->dev), __entry->rwbs,
+		  (unsigned long long)__entry->sector, __entry->nr_sector, __entry->error)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE lsbdd_trace
+#include <trace/define_trace.h>
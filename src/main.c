@@ -2,17 +2,49 @@
 
 #include <linux/bio.h>
 #include <linux/blkdev.h>
+#include <linux/debugfs.h>
 #include <linux/list.h>
 #include <linux/moduleparam.h>
+#include <linux/seq_file.h>
+#include <linux/sizes.h>
+#include <linux/sort.h>
+#include "utils/compress.h"
+#include "utils/csum.h"
+#include "utils/dedup.h"
 #include "utils/ds_control.h"
+#include "utils/flush.h"
+#include "utils/lat_hist.h"
+#include "utils/mag_cache.h"
+#include "utils/rcache.h"
+#include "utils/readahead.h"
+#include "utils/stats.h"
+#include "utils/value_redir.h"
+#include "utils/wbuf.h"
+#include "utils/zoned.h"
 #include "main.h"
 
+#define CREATE_TRACE_POINTS
+#include "lsbdd_trace.h"
+
+#ifdef LF_MODE
+#include "backoff.h"
+#endif
+
 MODULE_DESCRIPTION("Log-Structured virtual Block Device Driver module");
 MODULE_AUTHOR("Mikhail Gavrilenko - @qrutyy");
 MODULE_LICENSE("GPL v2");
 
 s32 bdd_major;
 char sel_ds[LSBDD_MAX_DS_NAME_LEN + 1];
+enum lsbdd_value_enc sel_value_enc = LSBDD_VALUE_FULL;
+bool discard_passthrough;
+bool write_buffer;
+u32 read_cache_size; // MiB, 0 - disabled
+bool readahead;
+bool compression;
+u32 dedup_index_size; // MiB of unique blocks, 0 - disabled
+bool checksums;
+u32 scrub_rate; // MiB/s, 0 - scrubber is disabled
 char ds_type[2 + 1];
 struct bio_set *bdd_pool;
 struct list_head bd_list;
@@ -20,6 +52,7 @@ atomic64_t next_free_sector = ATOMIC_INIT(LSBDD_SECTOR_OFFSET);
 
 static struct kmem_cache *lsbdd_value_cache;
 struct lsbdd_cache_mng *lsbdd_cache_mng;
+static struct dentry *lsbdd_debugfs; // /sys/kernel/debug/lsbdd
 
 static void vector_add_bd(struct lsbdd_bd_mng *curr_bdev_mng)
 {
@@ -71,64 +104,156 @@ static inline struct file *open_bd_on_rw(char *bd_path)
 	return bdev_file_open_by_path(bd_path, BLK_OPEN_WRITE | BLK_OPEN_READ, NULL, NULL);
 }
 
+/**
+ * Drops the read cache and readahead copies of the LBA range.
+ * Must be called after the mapping of the range is updated (check utils/rcache.h), and once more
+ * when a write of the range completes: reads resolved with the new mapping meanwhile got the old device content.
+ */
+static inline void invalidate_cached(struct lsbdd_bd_mng *redir_mng, sector_t start, sector_t nr_sects)
+{
+	lsbdd_rcache_invalidate(&redir_mng->rcache, start, nr_sects);
+	lsbdd_ra_invalidate(&redir_mng->ra, start, nr_sects);
+}
+
 static void bdd_bio_end_io(struct bio *bio)
 {
-	bio_endio(bio->bi_private);
+	struct bio *main_bio = bio->bi_private;
+	struct lsbdd_bd_mng *redir_mng = main_bio->bi_bdev->bd_disk->private_data;
+
+	trace_lsbdd_complete(bio_dev(main_bio), main_bio->bi_iter.bi_sector, bio_sectors(main_bio), main_bio->bi_opf, bio->bi_status);
+	main_bio->bi_status = bio->bi_status;
+	if (bio_op(main_bio) == REQ_OP_READ)
+		lsbdd_rcache_fill(&redir_mng->rcache, main_bio);
+	else if (bio_op(main_bio) == REQ_OP_WRITE)
+		invalidate_cached(redir_mng, main_bio->bi_iter.bi_sector, bio_sectors(main_bio));
+	bio_endio(main_bio);
 	bio_put(bio);
 }
 
 /**
- * Configures write operations in clone segments for the specified BIO.
- * Allocates memory for original and redirected sector data, retrieves the current
- * redirection info from the chosen data structure, and updates the mapping if necessary.
- * The redirected sector is then set in the clone BIO for processing.
+ * End of the flush/FUA write clone: the data is written, so the original bio waits only for the
+ * buffered segments and the group commit device flush.
+ */
+static void bdd_bio_end_io_flush(struct bio *bio)
+{
+	struct bio *main_bio = bio->bi_private;
+	struct lsbdd_bd_mng *redir_mng = main_bio->bi_bdev->bd_disk->private_data;
+
+	invalidate_cached(redir_mng, main_bio->bi_iter.bi_sector, bio_sectors(main_bio));
+	if (unlikely(bio->bi_status)) {
+		main_bio->bi_status = bio->bi_status;
+		bio_endio(main_bio);
+	} else {
+		lsbdd_wbuf_flush(&redir_mng->wbuf, main_bio);
+	}
+	bio_put(bio);
+}
+
+/**
+ * End of the zone append write clone: the written sector is known only now, so the mapping update
+ * (and the original bio completion) is deferred to the workqueue (check zone_append_complete).
+ */
+static void bdd_bio_end_io_append(struct bio *bio)
+{
+	struct bio *main_bio = bio->bi_private;
+	struct lsbdd_bd_mng *redir_mng = main_bio->bi_bdev->bd_disk->private_data;
+
+	lsbdd_zones_end_io(&redir_mng->zones, bio);
+}
+
+/**
+ * Builds the mapping value of the extent: packs it into the pointer slot on the compact
+ * devices (if the extent is 4K-aligned, isn't compressed and has no checksum), allocates it from lsbdd_value_cache otherwise.
  *
- * @param main_bio - the original BIO representing the main device I/O operation.
- * @param clone_bio - the clone BIO representing the redirected I/O operation.
- * @param lsbdd_bd_mng - mng that stores information about used ds and bdd in whole.
+ * @param redir_mng - mng of the BD (holds the value encoding)
+ * @param ext - extent (redirected sector, size in bytes, compression info and checksum)
  *
- * @param 0 on success, -ENOMEM if memory allocation fails.
+ * @return value on success, NULL if memory allocation fails.
  */
-static s32 setup_write_in_clone_segments(struct bio *main_bio, struct bio *clone_bio, struct lsbdd_bd_mng *redir_mng)
+static void *build_value(struct lsbdd_bd_mng *redir_mng, const struct lsbdd_value_redir *ext)
 {
-	s8 status;
-	sector_t orig_sector = 0;
-	struct lsbdd_value_redir *old_value = NULL;
-	struct lsbdd_value_redir *curr_value = NULL;
+	struct lsbdd_value_redir *full_value = NULL;
 
-	curr_value = kmem_cache_alloc(lsbdd_value_cache, GFP_KERNEL);
+	if (redir_mng->value_enc == LSBDD_VALUE_COMPACT && !lsbdd_value_is_compressed(ext) && !ext->has_csum &&
+	    lsbdd_value_can_compact(ext->redirected_sector, ext->block_size))
+		return lsbdd_value_compact(ext->redirected_sector, ext->block_size);
 
-	if (unlikely(!curr_value))
-		goto mem_err;
+	full_value = lsbdd_mag_alloc(lsbdd_value_cache, GFP_KERNEL);
+	if (unlikely(!full_value))
+		return NULL;
 
-	orig_sector = main_bio->bi_iter.bi_sector;
+	*full_value = *ext;
 
-	pr_debug("Original sector: bi_sector = %llu, block_size %u\n", main_bio->bi_iter.bi_sector, clone_bio->bi_iter.bi_size);
+	return full_value;
+}
 
-	curr_value->block_size = main_bio->bi_iter.bi_size;
-	old_value = ds_lookup(redir_mng->sel_ds, orig_sector);
-	curr_value->redirected_sector = atomic64_fetch_add(curr_value->block_size / SECTOR_SIZE, &next_free_sector); // always get new pba
-	pr_debug("WRITE: Old rs %p\n", old_value);
-	pr_debug("WRITE: key: %llu, sec: %llu\n", orig_sector, curr_value->redirected_sector);
+/**
+ * Builds the mapping value of [from, to) part of the extent (head or tail that is left after unmap).
+ * Plain parts point to the corresponding physical sectors, compressed ones keep the blob and
+ * move the offset in the decompressed data. Checksum covers the whole extent, so parts lose it.
+ *
+ * @param redir_mng - mng of the BD
+ * @param ext - original extent
+ * @param key - LBA of the original extent start
+ * @param from - first LBA sector of the part
+ * @param to - first LBA sector after the part
+ *
+ * @return value on success, NULL if memory allocation fails.
+ */
+static void *build_trimmed_value(struct lsbdd_bd_mng *redir_mng, const struct lsbdd_value_redir *ext, sector_t key, sector_t from,
+				 sector_t to)
+{
+	struct lsbdd_value_redir part = *ext;
+
+	part.block_size = (to - from) * SECTOR_SIZE;
+	if (part.block_size != ext->block_size)
+		part.has_csum = false;
+	if (lsbdd_value_is_compressed(ext))
+		part.comp_offset += (from - key) * SECTOR_SIZE;
+	else if (!lsbdd_value_is_zero(ext))
+		part.redirected_sector += from - key;
+
+	return build_value(redir_mng, &part);
+}
+
+/**
+ * Replaces the mapping of LBA by the new extent.
+ *
+ * @param redir_mng - mng of the BD
+ * @param lba - original sector
+ * @param ext - new extent
+ *
+ * @return 0 on success, -ENOMEM if memory allocation fails.
+ */
+static s32 update_mapping(struct lsbdd_bd_mng *redir_mng, sector_t lba, const struct lsbdd_value_redir *ext)
+{
+	s32 status = 0;
+	void *old_value = NULL;
+	void *curr_value = NULL;
+
+	old_value = ds_lookup(redir_mng->sel_ds, lba);
+
+	curr_value = build_value(redir_mng, ext);
+	if (unlikely(!curr_value))
+		goto mem_err;
 
 	if (old_value) {
-		pr_debug("WRITE: remove old mapping key %lld old_val: %lld, new_val %lld\n", orig_sector,
-			 old_value->redirected_sector, curr_value->redirected_sector);
-		ds_remove(redir_mng->sel_ds, orig_sector, lsbdd_value_cache);
+		trace_lsbdd_map_remove(redir_mng->vbd_disk, lba, lsbdd_value_get(old_value).redirected_sector,
+				       lsbdd_value_get(old_value).block_size);
+		lsbdd_dedup_put(&redir_mng->dedup, lsbdd_value_get(old_value).redirected_sector);
+		ds_remove(redir_mng->sel_ds, lba, lsbdd_value_cache);
 	}
 
-	status = ds_insert(redir_mng->sel_ds, orig_sector, curr_value, lsbdd_cache_mng, lsbdd_value_cache);
+	status = ds_insert(redir_mng->sel_ds, lba, curr_value, lsbdd_cache_mng, lsbdd_value_cache);
 	if (unlikely(status))
 		goto insert_err;
 
-	clone_bio->bi_iter.bi_sector = curr_value->redirected_sector;
-	pr_debug("original %llu, redirected %llu\n", orig_sector, curr_value->redirected_sector);
-
+	trace_lsbdd_map_insert(redir_mng->vbd_disk, lba, ext->redirected_sector, ext->block_size);
 	return 0;
 
 insert_err:
-	pr_err("Failed inserting key: %llu vallue: %p in _\n", orig_sector, curr_value);
-	kmem_cache_free(lsbdd_value_cache, curr_value);
+	pr_err("Failed inserting key: %llu vallue: %p in _\n", lba, curr_value);
+	lsbdd_value_free(lsbdd_value_cache, curr_value);
 	return status;
 
 mem_err:
@@ -136,11 +261,173 @@ mem_err:
 	return -ENOMEM;
 }
 
+/**
+ * Completes the zone append write (called from the workqueue): maps LBA to the sector the device
+ * has written the data to and completes the original bio (flush/FUA ones wait for the group commit).
+ *
+ * @param clone - completed zone append clone, bi_sector holds the written sector
+ *
+ * @return void
+ */
+static void zone_append_complete(struct bio *clone)
+{
+	struct bio *main_bio = clone->bi_private;
+	struct lsbdd_bd_mng *redir_mng = main_bio->bi_bdev->bd_disk->private_data;
+	struct lsbdd_value_redir ext = { .redirected_sector = clone->bi_iter.bi_sector, .block_size = main_bio->bi_iter.bi_size };
+	s32 status = 0;
+
+	if (unlikely(clone->bi_status)) {
+		main_bio->bi_status = clone->bi_status;
+		bio_endio(main_bio);
+		goto out;
+	}
+
+	if (redir_mng->csum.enabled) {
+		ext.csum = lsbdd_csum_bio(main_bio);
+		ext.has_csum = true;
+	}
+
+	status = update_mapping(redir_mng, main_bio->bi_iter.bi_sector, &ext);
+	invalidate_cached(redir_mng, main_bio->bi_iter.bi_sector, bio_sectors(main_bio));
+	if (unlikely(status)) {
+		pr_err("Mapping update of zone append failed with %d\n", status);
+		bio_io_error(main_bio);
+		goto out;
+	}
+
+	if (op_is_flush(main_bio->bi_opf))
+		lsbdd_wbuf_flush(&redir_mng->wbuf, main_bio);
+	else
+		bio_endio(main_bio);
+
+out:
+	bio_put(clone);
+}
+
+/**
+ * Compresses the buffered write and packs the compressed data into the write buffer segment
+ * (check utils/compress.h), the mapping points to the blob and records its size.
+ *
+ * @param main_bio - the original write BIO, fits into the write buffer
+ * @param redir_mng - mng of the BD
+ *
+ * @return LSBDD_BIO_DONE if the write was compressed and buffered, 0 if it should be written as is
+ * (data is incompressible or there is no free segment), -ENOMEM if memory allocation fails.
+ */
+static s32 write_compressed(struct bio *main_bio, struct lsbdd_bd_mng *redir_mng)
+{
+	struct lsbdd_value_redir ext = { .block_size = main_bio->bi_iter.bi_size };
+	struct lsbdd_comp_ctx *ctx = NULL;
+	struct lsbdd_wbuf_seg *seg = NULL;
+	sector_t orig_sector = main_bio->bi_iter.bi_sector;
+	u32 comp_size = 0;
+	s32 status = 0;
+
+	ctx = lsbdd_comp_begin(main_bio, &comp_size);
+	if (!ctx)
+		return 0;
+
+	seg = lsbdd_wbuf_reserve(&redir_mng->wbuf, round_up(comp_size, SECTOR_SIZE), &ext.redirected_sector);
+	if (!seg) {
+		lsbdd_comp_end(ctx);
+		return 0;
+	}
+
+	lsbdd_wbuf_copy_in_buf(seg, ext.redirected_sector, ctx->dst, comp_size);
+	lsbdd_comp_end(ctx);
+
+	ext.comp_size = comp_size;
+	status = update_mapping(redir_mng, orig_sector, &ext);
+	invalidate_cached(redir_mng, orig_sector, ext.block_size / SECTOR_SIZE);
+	lsbdd_wbuf_commit(seg);
+	if (unlikely(status))
+		return status;
+
+	bio_endio(main_bio);
+	return LSBDD_BIO_DONE;
+}
+
+/**
+ * Configures write operations in clone segments for the specified BIO.
+ * Reserves a new PBA, updates the mapping (check update_mapping) and invalidates the cached copies of the range.
+ * Small writes are copied (or compressed, if it is enabled) into the write buffer segment (check utils/wbuf.h)
+ * and completed without the clone, the rest get the redirected sector set in the clone BIO.
+ * Extents that aren't compressed get the checksum of their data, if checksums are enabled (check utils/csum.h).
+ * On zoned redirect devices the clone becomes zone append, the mapping is updated on its completion.
+ *
+ * @param main_bio - the original BIO representing the main device I/O operation.
+ * @param clone_bio - the clone BIO representing the redirected I/O operation.
+ * @param lsbdd_bd_mng - mng that stores information about used ds and bdd in whole.
+ *
+ * @param 0 on success, LSBDD_BIO_DONE if the write was buffered, -ENOMEM if memory allocation fails.
+ */
+static s32 setup_write_in_clone_segments(struct bio *main_bio, struct bio *clone_bio, struct lsbdd_bd_mng *redir_mng)
+{
+	s32 status = 0;
+	sector_t orig_sector = 0;
+	u32 block_size = 0;
+	struct lsbdd_value_redir ext = { 0 };
+	struct lsbdd_wbuf_seg *seg = NULL;
+
+	orig_sector = main_bio->bi_iter.bi_sector;
+	block_size = main_bio->bi_iter.bi_size;
+	ext.block_size = block_size;
+
+	if (redir_mng->zones.enabled) { // PBA is known only on completion, mapping is updated by zone_append_complete
+		status = lsbdd_zones_prep_append(&redir_mng->zones, clone_bio, block_size / SECTOR_SIZE);
+		if (unlikely(status))
+			return status;
+
+		clone_bio->bi_end_io = bdd_bio_end_io_append;
+		return 0;
+	}
+
+	if (redir_mng->compress && lsbdd_wbuf_fits(&redir_mng->wbuf, main_bio)) {
+		status = write_compressed(main_bio, redir_mng);
+		if (status)
+			return status;
+	}
+
+	// pages of the write are stable (BLK_FEAT_STABLE_WRITES), so the data doesn't change until the clone completes
+	if (redir_mng->csum.enabled) {
+		ext.csum = lsbdd_csum_bio(main_bio);
+		ext.has_csum = true;
+	}
+
+	if (lsbdd_wbuf_fits(&redir_mng->wbuf, main_bio)) {
+		seg = lsbdd_wbuf_reserve(&redir_mng->wbuf, block_size, &ext.redirected_sector);
+		if (seg) {
+			// data is copied before the mapping is visible, segment isn't submitted until the commit
+			lsbdd_wbuf_copy_in(seg, ext.redirected_sector, main_bio);
+			status = update_mapping(redir_mng, orig_sector, &ext);
+			invalidate_cached(redir_mng, orig_sector, block_size / SECTOR_SIZE);
+			lsbdd_wbuf_commit(seg);
+			if (unlikely(status))
+				return status;
+
+			bio_endio(main_bio);
+			return LSBDD_BIO_DONE;
+		}
+	}
+
+	ext.redirected_sector = atomic64_fetch_add(block_size / SECTOR_SIZE, &next_free_sector); // always get new pba
+
+	status = update_mapping(redir_mng, orig_sector, &ext);
+	// cached blocks are dropped after the mapping is updated, so reads with the old mapping aren't cached
+	invalidate_cached(redir_mng, orig_sector, block_size / SECTOR_SIZE);
+	if (unlikely(status))
+		return status;
+
+	clone_bio->bi_iter.bi_sector = ext.redirected_sector;
+
+	return 0;
+}
+
 /**
  * Prepares a BIO split for partial handling of a clone BIO. Splits the clone BIO
  * s32 o two parts, so the first half (split_bio) can be processed independently.
  * This function submits the split_bio to be read separately from the remaining
- * data in clone_bio.
+ * data in clone_bio (or serves it from the write buffer).
  *
  * @clone_bio - the clone BIO to be split.
  * @main_bio - the main BIO containing the primary I/O request data.
@@ -150,20 +437,19 @@ mem_err:
  */
 static s32 setup_bio_split(struct bio *clone_bio, struct bio *main_bio, s32 nearest_bs)
 {
+	struct lsbdd_bd_mng *redir_mng = main_bio->bi_bdev->bd_disk->private_data;
 	struct bio *split_bio = NULL; // first half of splitted bio
+	u64 lat_start = lsbdd_lat_start();
 
 	split_bio = bio_split(clone_bio, nearest_bs / SECTOR_SIZE, GFP_KERNEL, bdd_pool);
+	lsbdd_lat_end(LSBDD_LAT_BIO_SPLIT, lat_start);
 	IF_NULL_RETURN(split_bio, -1);
 
-	pr_debug("RECURSIVE READ p1: bs = %u, main to read = %u, st sec = %llu\n", split_bio->bi_iter.bi_size, main_bio->bi_iter.bi_size,
-		 split_bio->bi_iter.bi_sector);
-	pr_debug("RECURSIVE READ p2: bs = %u, main to read = %u,  st sec = %llu\n", clone_bio->bi_iter.bi_size, main_bio->bi_iter.bi_size,
-		 clone_bio->bi_iter.bi_sector);
-
+	trace_lsbdd_split(split_bio, clone_bio);
 	bio_chain(split_bio, clone_bio);
-	submit_bio_noacct(split_bio);
-
-	pr_debug("Submitted bio first part of splitted main_bio\n\n");
+	lsbdd_stats_inc(&redir_mng->stats, LSBDD_STAT_READ_FRAGS);
+	if (!lsbdd_wbuf_read(&redir_mng->wbuf, split_bio))
+		submit_bio_noacct(split_bio);
 
 	return nearest_bs;
 }
@@ -194,21 +480,148 @@ static s16 check_system_bio(struct lsbdd_bd_mng *redir_mng, sector_t orig_sector
 
 	if (unlikely(ds_empty_check(redir_mng->sel_ds))) {
 		bio->bi_iter.bi_sector = orig_sector;
-		pr_debug("Recognised system bio\n");
+		lsbdd_stats_inc(&redir_mng->stats, LSBDD_STAT_SYSTEM_BIOS);
+		trace_lsbdd_system_bio(bio, orig_sector, 0);
 		return -1;
 	}
 
 	last_key = ds_last(redir_mng->sel_ds, orig_sector);
-	pr_debug("READ: last_key = %llu\n", last_key);
 
 	if (unlikely(orig_sector > last_key || orig_sector == 0)) {
 		bio->bi_iter.bi_sector = orig_sector;
-		pr_debug("Recognised system bio\n");
+		lsbdd_stats_inc(&redir_mng->stats, LSBDD_STAT_SYSTEM_BIOS);
+		trace_lsbdd_system_bio(bio, orig_sector, last_key);
 		return -1;
 	}
 	return 0;
 }
 
+/**
+ * Splits the read BIO at the extent end, if it goes beyond it: the rest is resubmitted and
+ * goes through lsbdd_submit_bio again. It is counted there once more, so it is taken back
+ * from the read stats here and the original read is counted once.
+ *
+ * @param bio - the original BIO
+ * @param ext_end - first LBA sector after the extent
+ *
+ * @return part of the BIO that lies in the extent (bio itself, if it isn't split), NULL on split error.
+ */
+static struct bio *split_at_extent_end(struct bio *bio, sector_t ext_end)
+{
+	struct lsbdd_bd_mng *redir_mng = bio->bi_bdev->bd_disk->private_data;
+	struct bio *split_bio = NULL;
+	u64 lat_start = 0;
+
+	if (bio->bi_iter.bi_sector >= ext_end || bio_end_sector(bio) <= ext_end)
+		return bio;
+
+	lat_start = lsbdd_lat_start();
+	split_bio = bio_split(bio, ext_end - bio->bi_iter.bi_sector, GFP_NOIO, bdd_pool);
+	lsbdd_lat_end(LSBDD_LAT_BIO_SPLIT, lat_start);
+	if (IS_ERR_OR_NULL(split_bio))
+		return NULL;
+
+	trace_lsbdd_split(split_bio, bio);
+	bio_chain(split_bio, bio);
+	lsbdd_stats_sub(&redir_mng->stats, LSBDD_STAT_READS, 1);
+	lsbdd_stats_sub(&redir_mng->stats, LSBDD_STAT_READ_BYTES, bio->bi_iter.bi_size);
+	submit_bio_noacct(bio);
+
+	return split_bio;
+}
+
+/**
+ * Completes the read of zero extent (discarded or zeroed range) without I/O.
+ * If the BIO goes beyond the extent - it is split (check split_at_extent_end).
+ *
+ * @param main_bio - the original BIO
+ * @param key - LBA of the zero extent start
+ * @param ext - zero extent
+ *
+ * @return LSBDD_BIO_DONE on success, -1 on split error.
+ */
+static s32 read_zero_extent(struct bio *main_bio, sector_t key, struct lsbdd_value_redir *ext)
+{
+	sector_t ext_end = key + ext->block_size / SECTOR_SIZE;
+
+	main_bio = split_at_extent_end(main_bio, ext_end);
+	if (!main_bio)
+		return -1;
+
+	zero_fill_bio(main_bio);
+	bio_endio(main_bio);
+
+	return LSBDD_BIO_DONE;
+}
+
+/**
+ * Reads the compressed extent: the blob is read and decompressed asynchronously, the original BIO
+ * is completed after it (check utils/compress.h). Decompressed data isn't cached, so the read cache
+ * placeholders of the BIO are dropped before the read is issued.
+ *
+ * @param main_bio - the original BIO, doesn't go beyond the extent (check lsbdd_submit_bio)
+ * @param redir_mng - mng of the BD
+ * @param key - LBA of the compressed extent start
+ * @param ext - compressed extent
+ *
+ * @return LSBDD_BIO_DONE
+ */
+static s32 read_compressed_extent(struct bio *main_bio, struct lsbdd_bd_mng *redir_mng, sector_t key, struct lsbdd_value_redir *ext)
+{
+	u32 offset = ext->comp_offset + (main_bio->bi_iter.bi_sector - key) * SECTOR_SIZE;
+
+	lsbdd_rcache_cancel(&redir_mng->rcache, main_bio, main_bio->bi_iter.bi_sector, main_bio->bi_iter.bi_size);
+	lsbdd_comp_read(main_bio, file_bdev(redir_mng->bd_file), bdd_pool, &redir_mng->wbuf, ext, offset);
+
+	return LSBDD_BIO_DONE;
+}
+
+/**
+ * Splits the read before the extents that can't be read by the clone (check split_at_extent_end).
+ * Compressed extents are decompressed as a whole, so on compressing devices each extent
+ * is read separately and resolved through the mapping on its own. On the others the clone reads
+ * the following data extents too, so the read is split only before the first zero or compressed one.
+ *
+ * @param bio - the original read BIO
+ * @param redir_mng - mng of the BD
+ *
+ * @return part of the BIO that is read first (bio itself, if it isn't mapped or isn't split),
+ * NULL on split error.
+ */
+static struct bio *split_read_at_extent_end(struct bio *bio, struct lsbdd_bd_mng *redir_mng)
+{
+	struct lsbdd_value_redir ext = { 0 };
+	sector_t key = bio->bi_iter.bi_sector;
+	sector_t ext_end = 0;
+	void *value = NULL;
+
+	if (ds_empty_check(redir_mng->sel_ds))
+		return bio;
+
+	value = ds_lookup(redir_mng->sel_ds, key);
+	if (!value)
+		value = ds_prev(redir_mng->sel_ds, bio->bi_iter.bi_sector, &key);
+	if (!value)
+		return bio;
+
+	ext_end = key + lsbdd_value_get(value).block_size / SECTOR_SIZE;
+	if (redir_mng->compress || ext_end <= bio->bi_iter.bi_sector)
+		return split_at_extent_end(bio, ext_end);
+
+	while (ext_end < bio_end_sector(bio)) {
+		value = ds_lookup(redir_mng->sel_ds, ext_end);
+		if (!value)
+			break;
+
+		ext = lsbdd_value_get(value);
+		if (lsbdd_value_is_zero(&ext) || lsbdd_value_is_compressed(&ext))
+			return split_at_extent_end(bio, ext_end);
+		ext_end += ext.block_size / SECTOR_SIZE;
+	}
+
+	return bio;
+}
+
 /**
  * Configures read operations for clone segments based on redirection info from
  * the chosen data structure. This function retrieves the mapped or previous sector information,
@@ -220,13 +633,16 @@ static s16 check_system_bio(struct lsbdd_bd_mng *redir_mng, sector_t orig_sector
  * @param clone_bio - the clone BIO representing the redirected I/O operation.
  * @param redir_mng - manages redirection data for mapped sectors.
  *
- * @return 0 on success, -ENOMEM if memory allocation fails, or -1 on split error.
+ * @return 0 on success, LSBDD_BIO_DONE if the read is completed without clone (zero or compressed extent),
+ * -ENOMEM if memory allocation fails, or -1 on split error.
  */
 static s32 setup_read_from_clone_segments(struct bio *main_bio, struct bio *clone_bio, struct lsbdd_bd_mng *redir_mng)
 {
-	struct lsbdd_value_redir *curr_value = NULL;
-	struct lsbdd_value_redir *next_value = NULL;
-	struct lsbdd_value_redir *prev_value = NULL;
+	void *curr_value = NULL;
+	void *next_value = NULL;
+	void *prev_value = NULL;
+	struct lsbdd_value_redir curr = { 0 };
+	struct lsbdd_value_redir prev = { 0 };
 	sector_t orig_sector = 0;
 	sector_t redirect_sector = 0;
 	sector_t prev_sector_val = 0;
@@ -238,28 +654,30 @@ static s32 setup_read_from_clone_segments(struct bio *main_bio, struct bio *clon
 	orig_sector = main_bio->bi_iter.bi_sector;
 	curr_value = ds_lookup(redir_mng->sel_ds, orig_sector);
 
-	pr_debug("READ: key: %llu, value %p\n", orig_sector, curr_value);
+	if (curr_value)
+		curr = lsbdd_value_get(curr_value);
 
 	if (!curr_value) { // Read & Write sector starts aren't equal.
 		status = check_system_bio(redir_mng, orig_sector, clone_bio);
 		if (status)
 			return 0;
 
-		pr_debug("READ: Sector: %llu isnt mapped\n", orig_sector);
-
 		prev_value = ds_prev(redir_mng->sel_ds, orig_sector, prev_sector);
 		IF_NULL_RETURN(prev_value, 0);
+		prev = lsbdd_value_get(prev_value);
+
+		if (lsbdd_value_is_zero(&prev) && orig_sector < *prev_sector + prev.block_size / SECTOR_SIZE)
+			return read_zero_extent(main_bio, *prev_sector, &prev);
 
-		redirect_sector = prev_value->redirected_sector * SECTOR_SIZE + (orig_sector - *prev_sector) * SECTOR_SIZE;
-		to_end_of_block = (prev_value->redirected_sector * SECTOR_SIZE + prev_value->block_size) - redirect_sector;
+		if (lsbdd_value_is_compressed(&prev) && orig_sector < *prev_sector + prev.block_size / SECTOR_SIZE)
+			return read_compressed_extent(main_bio, redir_mng, *prev_sector, &prev);
+
+		redirect_sector = prev.redirected_sector * SECTOR_SIZE + (orig_sector - *prev_sector) * SECTOR_SIZE;
+		to_end_of_block = (prev.redirected_sector * SECTOR_SIZE + prev.block_size) - redirect_sector;
 		to_read_in_clone = main_bio->bi_iter.bi_size - to_end_of_block;
 		/* Address of main block end (reading from operation pba + bi_size) - End of previous block */
 
-		clone_bio->bi_iter.bi_sector = prev_value->redirected_sector + (prev_value->block_size - to_end_of_block) / SECTOR_SIZE;
-
-		pr_debug("To read = %d, to end = %d, main size = %u, prev_rs bs = %u, prev_rs sector = %llu\n", to_read_in_clone,
-			 to_end_of_block, main_bio->bi_iter.bi_size, prev_value->block_size, prev_value->redirected_sector);
-		pr_debug("Clone bio: sector = %llu, size = %u\n", clone_bio->bi_iter.bi_sector, clone_bio->bi_iter.bi_size);
+		clone_bio->bi_iter.bi_sector = prev.redirected_sector + (prev.block_size - to_end_of_block) / SECTOR_SIZE;
 
 		if (to_read_in_clone < main_bio->bi_iter.bi_size && to_read_in_clone != 0) {
 			while (to_end_of_block > 0) {
@@ -267,48 +685,410 @@ static s32 setup_read_from_clone_segments(struct bio *main_bio, struct bio *clon
 				if (unlikely(status < 0))
 					goto split_err;
 
-				if (to_read_in_clone > prev_value->block_size) {
-					to_read_in_clone -= prev_value->block_size;
-					to_end_of_block = prev_value->block_size;
+				if (to_read_in_clone > prev.block_size) {
+					to_read_in_clone -= prev.block_size;
+					to_end_of_block = prev.block_size;
 				} else {
 					break;
 				}
 			}
 		}
 		clone_bio->bi_iter.bi_size = (to_read_in_clone <= 0) ? to_end_of_block : to_read_in_clone;
-	} else if (curr_value->redirected_sector) { // Read & Write start sectors are equal.
-		pr_debug("Found redirected sector: %llu, rs_bs = %u, main_bs = %u\n", (curr_value->redirected_sector),
-			 curr_value->block_size, main_bio->bi_iter.bi_size);
-
-		to_read_in_clone = main_bio->bi_iter.bi_size - curr_value->block_size;
-		clone_bio->bi_iter.bi_sector = curr_value->redirected_sector;
+	} else if (lsbdd_value_is_zero(&curr)) {
+		return read_zero_extent(main_bio, orig_sector, &curr);
+	} else if (lsbdd_value_is_compressed(&curr)) {
+		return read_compressed_extent(main_bio, redir_mng, orig_sector, &curr);
+	} else { // Read & Write start sectors are equal.
+		to_read_in_clone = main_bio->bi_iter.bi_size - curr.block_size;
+		clone_bio->bi_iter.bi_sector = curr.redirected_sector;
 
 		while (to_read_in_clone > 0) {
-			to_read_in_clone -= setup_bio_split(clone_bio, main_bio, curr_value->block_size);
-			next_value = ds_lookup(redir_mng->sel_ds, orig_sector + curr_value->block_size);
+			to_read_in_clone -= setup_bio_split(clone_bio, main_bio, curr.block_size);
+			next_value = ds_lookup(redir_mng->sel_ds, orig_sector + curr.block_size);
 			if (next_value != NULL)
-				clone_bio->bi_iter.bi_sector = next_value->redirected_sector;
+				clone_bio->bi_iter.bi_sector = lsbdd_value_get(next_value).redirected_sector;
 			if (unlikely(status < 0))
 				goto split_err;
 		}
 
-		clone_bio->bi_iter.bi_size = (to_read_in_clone < 0) ? curr_value->block_size + to_read_in_clone : curr_value->block_size;
+		clone_bio->bi_iter.bi_size = (to_read_in_clone < 0) ? curr.block_size + to_read_in_clone : curr.block_size;
+
+		// checksum covers the whole extent, partial and multi-extent reads are left to the scrubber
+		if (curr.has_csum && main_bio->bi_iter.bi_size == curr.block_size)
+			lsbdd_csum_verify(&redir_mng->csum, clone_bio, curr.csum);
 
-		pr_debug("End of read, Clone: size: %u, sector %llu, to_read = %d\n", clone_bio->bi_iter.bi_size,
-			 clone_bio->bi_iter.bi_sector, to_read_in_clone);
 	}
 	return 0;
 
 split_err:
 	pr_err("Bio split went wrong\n");
-	bio_io_error(main_bio);
 	return -1;
 }
 
+/**
+ * Discards the dead physical extent on the backing device.
+ * Discard BIOs are chained to the main one, so it completes only after all of them.
+ *
+ * @param main_bio - the original DISCARD/WRITE_ZEROES BIO
+ * @param redir_mng - mng of the BD
+ * @param pba - start of the physical extent
+ * @param nr_sects - extent length in sectors
+ *
+ * @return void
+ */
+static void forward_discard(struct bio *main_bio, struct lsbdd_bd_mng *redir_mng, sector_t pba, sector_t nr_sects)
+{
+	struct block_device *bdev = file_bdev(redir_mng->bd_file);
+	struct bio *discard_bio = NULL;
+	sector_t max_sects = min_t(sector_t, bdev_max_discard_sectors(bdev), UINT_MAX >> SECTOR_SHIFT);
+	sector_t len = 0;
+
+	if (!max_sects)
+		return;
+
+	while (nr_sects) {
+		len = min(nr_sects, max_sects);
+
+		discard_bio = bio_alloc_bioset(bdev, 0, REQ_OP_DISCARD, GFP_NOIO, bdd_pool);
+		discard_bio->bi_iter.bi_sector = pba;
+		discard_bio->bi_iter.bi_size = len << SECTOR_SHIFT;
+		bio_chain(discard_bio, main_bio);
+		submit_bio(discard_bio);
+
+		pba += len;
+		nr_sects -= len;
+	}
+}
+
+/**
+ * Removes the mappings of [start, end) LBA range, walking the extents from the end by ds_prev.
+ * Extents partially covered by the range are trimmed: the head is kept under the same key with reduced size,
+ * the tail is reinserted with key = end (check build_trimmed_value). PBA's are never reused, so the cut physical
+ * parts are dead from now on and are discarded on the backing device if discard_passthrough is set
+ * (except the compressed and deduplicated ones, their blocks can be shared).
+ *
+ * @param main_bio - the original DISCARD/WRITE_ZEROES BIO
+ * @param redir_mng - mng of the BD
+ * @param start - first LBA sector of the range
+ * @param end - first LBA sector after the range
+ *
+ * @return 0 on success, -ENOMEM if memory allocation fails.
+ */
+static s32 unmap_range(struct bio *main_bio, struct lsbdd_bd_mng *redir_mng, sector_t start, sector_t end)
+{
+	struct lsbdd_value_redir ext = { 0 };
+	sector_t cursor = end;
+	sector_t key = 0;
+	sector_t ext_end = 0;
+	sector_t cut_start = 0;
+	sector_t cut_end = 0;
+	void *value = NULL;
+	void *tail_value = NULL;
+	void *head_value = NULL;
+	s32 status = 0;
+
+	while (!ds_empty_check(redir_mng->sel_ds)) {
+		head_value = tail_value = NULL;
+		value = ds_prev(redir_mng->sel_ds, cursor, &key);
+		if (!value || key >= cursor)
+			break;
+
+		ext = lsbdd_value_get(value);
+		ext_end = key + ext.block_size / SECTOR_SIZE;
+		if (ext_end <= start)
+			break; // extents don't overlap, so the rest are before the range too
+
+		cut_start = max(key, start);
+		cut_end = min(ext_end, end);
+
+		if (ext_end > end && !ds_lookup(redir_mng->sel_ds, end)) {
+			tail_value = build_trimmed_value(redir_mng, &ext, key, end, ext_end);
+			if (unlikely(!tail_value))
+				goto mem_err;
+
+			status = ds_insert(redir_mng->sel_ds, end, tail_value, lsbdd_cache_mng, lsbdd_value_cache);
+			if (unlikely(status))
+				goto insert_err;
+			trace_lsbdd_map_insert(redir_mng->vbd_disk, end, lsbdd_value_get(tail_value).redirected_sector,
+					       lsbdd_value_get(tail_value).block_size);
+		}
+
+		if (key < start) {
+			head_value = build_trimmed_value(redir_mng, &ext, key, key, start);
+			if (unlikely(!head_value))
+				goto mem_err;
+		}
+
+		ds_remove(redir_mng->sel_ds, key, lsbdd_value_cache); // value is freed, ext holds its copy
+		trace_lsbdd_map_remove(redir_mng->vbd_disk, key, ext.redirected_sector, ext.block_size);
+		if (head_value) {
+			status = ds_insert(redir_mng->sel_ds, key, head_value, lsbdd_cache_mng, lsbdd_value_cache);
+			if (unlikely(status))
+				goto insert_err;
+			trace_lsbdd_map_insert(redir_mng->vbd_disk, key, lsbdd_value_get(head_value).redirected_sector,
+					       lsbdd_value_get(head_value).block_size);
+		}
+
+		if (key >= start && ext_end <= end) // whole extent is unmapped
+			lsbdd_dedup_put(&redir_mng->dedup, ext.redirected_sector);
+
+		// zones aren't discarded, they can only be reset as a whole, compressed blob can be shared by the trimmed parts,
+		// deduplicated block - by other LBA's
+		if (discard_passthrough && !redir_mng->zones.enabled && !redir_mng->dedup.enabled && !lsbdd_value_is_zero(&ext) &&
+		    !lsbdd_value_is_compressed(&ext))
+			forward_discard(main_bio, redir_mng, ext.redirected_sector + (cut_start - key), cut_end - cut_start);
+
+		if (key <= start)
+			break;
+		cursor = key;
+	}
+
+	return 0;
+
+insert_err:
+	pr_err("Failed inserting trimmed extent of key: %llu\n", key);
+	lsbdd_value_free(lsbdd_value_cache, head_value ?: tail_value);
+	return status;
+
+mem_err:
+	pr_err("Memory allocation failed\n");
+	return -ENOMEM;
+}
+
+/**
+ * Handles DISCARD and WRITE_ZEROES as mapping-only operations: the range is unmapped (check unmap_range)
+ * and replaced by the zero extent, so the following reads of it complete without touching the disk.
+ * LBA 0 is never mapped (it is handled as the system sector), so the zero extent starts from sector 1.
+ *
+ * @param main_bio - DISCARD/WRITE_ZEROES BIO
+ * @param redir_mng - mng of the BD
+ *
+ * @return 0 on success, -ENOMEM if memory allocation fails.
+ */
+static s32 setup_unmap(struct bio *main_bio, struct lsbdd_bd_mng *redir_mng)
+{
+	sector_t start = main_bio->bi_iter.bi_sector;
+	sector_t end = bio_end_sector(main_bio);
+	struct lsbdd_value_redir zero = { .redirected_sector = LSBDD_ZERO_SECTOR };
+	void *zero_value = NULL;
+	s32 status = 0;
+
+	status = unmap_range(main_bio, redir_mng, start, end);
+	if (unlikely(status))
+		return status;
+
+	start = max_t(sector_t, start, 1);
+	if (start >= end)
+		return 0;
+
+	zero.block_size = (end - start) * SECTOR_SIZE;
+	zero_value = build_value(redir_mng, &zero);
+	if (unlikely(!zero_value))
+		return -ENOMEM;
+
+	status = ds_insert(redir_mng->sel_ds, start, zero_value, lsbdd_cache_mng, lsbdd_value_cache);
+	if (unlikely(status))
+		lsbdd_value_free(lsbdd_value_cache, zero_value);
+	else
+		trace_lsbdd_map_insert(redir_mng->vbd_disk, start, zero.redirected_sector, zero.block_size);
+
+	return status;
+}
+
+/**
+ * Write callback of the deduplication (check utils/dedup.h), called from the workqueue.
+ * The range is unmapped first (check unmap_range), then each block is mapped either to the same block
+ * that is already stored or to the newly written one.
+ *
+ * @param bio - the original write BIO, 4K-aligned, it is completed by the caller
+ * @param data - linear copy of the BIO data
+ *
+ * @return 0 on success, -ENOMEM if memory allocation fails, I/O error of the block write.
+ */
+static s32 dedup_write(struct bio *bio, void *data)
+{
+	struct lsbdd_bd_mng *redir_mng = bio->bi_bdev->bd_disk->private_data;
+	struct lsbdd_value_redir ext = { .block_size = LSBDD_DEDUP_BLOCK_SIZE };
+	sector_t start = bio->bi_iter.bi_sector;
+	sector_t end = bio_end_sector(bio);
+	sector_t lba = 0;
+	void *block = NULL;
+	u64 fp = 0;
+	s32 status = 0;
+
+	// blocks are mapped one by one, so the old extents can't be just replaced by key
+	status = unmap_range(bio, redir_mng, start, end);
+	if (unlikely(status))
+		goto out;
+
+	for (lba = start; lba < end; lba += LSBDD_DEDUP_BLOCK_SECTORS) {
+		block = data + ((lba - start) << SECTOR_SHIFT);
+		if (!lsbdd_dedup_find(&redir_mng->dedup, block, &fp, &ext.redirected_sector)) {
+			status = lsbdd_dedup_store(&redir_mng->dedup, block, fp, &ext.redirected_sector);
+			if (unlikely(status))
+				break;
+		}
+
+		if (redir_mng->csum.enabled) {
+			ext.csum = lsbdd_csum_buf(block, LSBDD_DEDUP_BLOCK_SIZE);
+			ext.has_csum = true;
+		}
+
+		status = update_mapping(redir_mng, lba, &ext);
+		if (unlikely(status))
+			break;
+	}
+
+out:
+	invalidate_cached(redir_mng, start, end - start);
+	return status;
+}
+
+/**
+ * Looks up the plain extent that holds the whole read.
+ *
+ * @param bio - the original read BIO
+ * @param redir_mng - mng of the BD
+ * @param pba - redirected sector of the read start is stored here
+ *
+ * @return true if the read lies in one extent, that isn't zero or compressed and
+ * doesn't need the checksum verification, false otherwise.
+ */
+static bool read_in_one_extent(struct bio *bio, struct lsbdd_bd_mng *redir_mng, sector_t *pba)
+{
+	struct lsbdd_value_redir ext = { 0 };
+	sector_t key = bio->bi_iter.bi_sector;
+	void *value = NULL;
+
+	if (ds_empty_check(redir_mng->sel_ds))
+		return false;
+
+	value = ds_lookup(redir_mng->sel_ds, key);
+	if (!value)
+		value = ds_prev(redir_mng->sel_ds, bio->bi_iter.bi_sector, &key);
+	if (!value)
+		return false;
+
+	ext = lsbdd_value_get(value);
+	if (lsbdd_value_is_zero(&ext) || lsbdd_value_is_compressed(&ext) || bio_end_sector(bio) > key + ext.block_size / SECTOR_SIZE)
+		return false;
+
+	if (ext.has_csum && redir_mng->csum.enabled && bio->bi_iter.bi_sector == key && bio->bi_iter.bi_size == ext.block_size)
+		return false;
+
+	*pba = ext.redirected_sector + (bio->bi_iter.bi_sector - key);
+	return true;
+}
+
+// Completion hook of the BIO remapped in place, set only while lsbdd_complete is traced
+struct lsbdd_remap_hook {
+	bio_end_io_t *end_io;
+	void *private;
+	dev_t dev;
+	sector_t lba;
+	u32 nr_sector;
+};
+
+static void remap_hook_end_io(struct bio *bio)
+{
+	struct lsbdd_remap_hook *hook = bio->bi_private;
+
+	trace_lsbdd_complete(hook->dev, hook->lba, hook->nr_sector, bio->bi_opf, bio->bi_status);
+	bio->bi_end_io = hook->end_io;
+	bio->bi_private = hook->private;
+	kfree(hook);
+	bio_endio(bio);
+}
+
+/**
+ * Hooks the completion of the BIO (the way dm_hook_bio does), so the remapped I/O gets its lsbdd_complete event too.
+ * Nothing is done if the event isn't traced, the BIO is left unhooked if the hook can't be allocated.
+ *
+ * @param bio - the original BIO, still on the virtual disk
+ *
+ * @return void
+ */
+static void remap_hook_bio(struct bio *bio)
+{
+	struct lsbdd_remap_hook *hook = NULL;
+
+	if (!trace_lsbdd_complete_enabled())
+		return;
+
+	hook = kmalloc(sizeof(*hook), GFP_NOWAIT);
+	if (!hook)
+		return;
+
+	hook->end_io = bio->bi_end_io;
+	hook->private = bio->bi_private;
+	hook->dev = bio_dev(bio);
+	hook->lba = bio->bi_iter.bi_sector;
+	hook->nr_sector = bio_sectors(bio);
+	bio->bi_end_io = remap_hook_end_io;
+	bio->bi_private = hook;
+}
+
+/**
+ * Remaps the BIO to the redirect BD in place (the way dm-linear does): no clone is allocated
+ * and the upper layer gets the completion of the redirected I/O directly.
+ * Only BIOs that need nothing on completion go this way: writes without flush/FUA on conventional devices,
+ * if the read cache and readahead are disabled, and reads that lie in one plain extent, if the read cache is disabled.
+ *
+ * @param bio - the original READ/WRITE BIO
+ * @param redir_mng - mng of the BD
+ *
+ * @return true if the BIO was remapped and submitted (or completed), false if it needs the clone.
+ */
+static bool remap_in_place(struct bio *bio, struct lsbdd_bd_mng *redir_mng)
+{
+	sector_t lba = bio->bi_iter.bi_sector;
+	sector_t pba = 0;
+	u64 lat_start = 0;
+	s32 status = 0;
+
+	if (bio_op(bio) == REQ_OP_WRITE) {
+		// the caches are invalidated once more when the write completes, so they need the clone
+		if (op_is_flush(bio->bi_opf) || redir_mng->zones.enabled || lsbdd_rcache_enabled(&redir_mng->rcache) ||
+		    redir_mng->ra.enabled)
+			return false;
+
+		remap_hook_bio(bio); // buffered writes are completed through it too
+		// the BIO is its own clone: buffered writes are completed here, the rest get the redirected sector
+		lat_start = lsbdd_lat_start();
+		status = setup_write_in_clone_segments(bio, bio, redir_mng);
+		lsbdd_lat_end(LSBDD_LAT_SETUP_WRITE, lat_start);
+		if (status == LSBDD_BIO_DONE)
+			return true;
+
+		if (unlikely(status)) {
+			pr_err("Setup failed with code %d\n", status);
+			bio_io_error(bio);
+			return true;
+		}
+	} else {
+		if (lsbdd_rcache_enabled(&redir_mng->rcache) || !read_in_one_extent(bio, redir_mng, &pba))
+			return false;
+
+		remap_hook_bio(bio);
+		bio->bi_iter.bi_sector = pba;
+		lsbdd_stats_inc(&redir_mng->stats, LSBDD_STAT_READ_FRAGS);
+	}
+
+	bio_set_dev(bio, file_bdev(redir_mng->bd_file));
+	trace_lsbdd_remap(bio, lba);
+
+	if (bio_op(bio) == REQ_OP_READ && lsbdd_wbuf_read(&redir_mng->wbuf, bio))
+		return true; // extent is still in the write buffer
+
+	submit_bio_noacct(bio);
+	return true;
+}
+
 /**
  * lsbdd_submit_bio() - Takes the provided bio, allocates a clone (child)
  * for a redirect_bd. Although, it changes the way both bio's will end (+ maps
  * bio address with free one from aim BD in chosen data structure) and submits them.
+ * BIOs that need no completion hook are remapped without the clone (check remap_in_place).
  *
  * @param bio - Expected bio request
  *
@@ -317,13 +1097,85 @@ split_err:
 static void lsbdd_submit_bio(struct bio *bio)
 {
 	struct bio *clone = NULL;
+	struct bio *split = NULL;
 	struct lsbdd_bd_mng *redir_mng = NULL;
+	sector_t start = bio->bi_iter.bi_sector;
+	u32 size = bio->bi_iter.bi_size;
+	u64 lat_start = 0;
 	s16 status;
 
 	redir_mng = get_lsbdd_bd_mng_by_name(bio->bi_bdev->bd_disk->disk_name);
 	if (unlikely(!redir_mng))
 		goto get_err;
 
+	trace_lsbdd_submit(bio);
+	if (bio_op(bio) == REQ_OP_DISCARD || bio_op(bio) == REQ_OP_WRITE_ZEROES) {
+		lat_start = lsbdd_lat_start();
+		status = setup_unmap(bio, redir_mng);
+		lsbdd_lat_end(LSBDD_LAT_SETUP_UNMAP, lat_start);
+		invalidate_cached(redir_mng, start, size / SECTOR_SIZE);
+		if (unlikely(status))
+			goto setup_err;
+
+		bio_endio(bio);
+		return;
+	}
+
+	if (unlikely(bio_op(bio) != REQ_OP_READ && bio_op(bio) != REQ_OP_WRITE))
+		goto op_err;
+
+	if (op_is_flush(bio->bi_opf) && !bio_sectors(bio)) {
+		lsbdd_wbuf_flush(&redir_mng->wbuf, bio); // empty flush, completed by the group commit
+		return;
+	}
+
+	if (bio_op(bio) == REQ_OP_READ) {
+		lsbdd_stats_inc(&redir_mng->stats, LSBDD_STAT_READS);
+		lsbdd_stats_add(&redir_mng->stats, LSBDD_STAT_READ_BYTES, size);
+	} else {
+		lsbdd_stats_inc(&redir_mng->stats, LSBDD_STAT_WRITES);
+		lsbdd_stats_add(&redir_mng->stats, LSBDD_STAT_WRITE_BYTES, size);
+	}
+
+	if (bio_op(bio) == REQ_OP_WRITE && lsbdd_dedup_fits(&redir_mng->dedup, bio)) {
+		lsbdd_dedup_submit(&redir_mng->dedup, bio); // mapped and completed by dedup_write from the workqueue
+		return;
+	}
+
+	if (bio_op(bio) == REQ_OP_READ) {
+		split = split_read_at_extent_end(bio, redir_mng); // before the caches, so their owner is the part that is read
+		if (unlikely(!split))
+			goto split_err;
+
+		bio = split;
+		start = bio->bi_iter.bi_sector;
+		size = bio->bi_iter.bi_size;
+	}
+
+	// cache lookups go before the mapping one, so the missed blocks are reserved before the mapping is read
+	if (bio_op(bio) == REQ_OP_READ && lsbdd_ra_read(&redir_mng->ra, bio))
+		return;
+
+	if (bio_op(bio) == REQ_OP_READ && lsbdd_rcache_read(&redir_mng->rcache, bio))
+		return;
+
+	if (bio_op(bio) == REQ_OP_WRITE && redir_mng->zones.enabled && bio_sectors(bio) > redir_mng->zones.max_append_sects) {
+		// zone appends can't be split by the block layer, the rest is resubmitted and goes through here again
+		lat_start = lsbdd_lat_start();
+		split = bio_split(bio, redir_mng->zones.max_append_sects, GFP_NOIO, bdd_pool);
+		lsbdd_lat_end(LSBDD_LAT_BIO_SPLIT, lat_start);
+		if (IS_ERR_OR_NULL(split))
+			goto clone_err;
+
+		trace_lsbdd_split(split, bio);
+		bio_chain(split, bio);
+		submit_bio_noacct(bio);
+		bio = split;
+	}
+
+	if (remap_in_place(bio, redir_mng))
+		return;
+
 	clone = bio_alloc_clone(file_bdev(redir_mng->bd_file), bio, GFP_KERNEL, bdd_pool);
 	if (unlikely(!clone))
 		goto clone_err;
@@ -331,32 +1183,69 @@ static void lsbdd_submit_bio(struct bio *bio)
 	clone->bi_private = bio;
 	clone->bi_end_io = bdd_bio_end_io;
 
-	if (bio_op(bio) == REQ_OP_READ)
+	lat_start = lsbdd_lat_start();
+	if (bio_op(bio) == REQ_OP_READ) {
 		status = setup_read_from_clone_segments(bio, clone, redir_mng);
-	else if (bio_op(bio) == REQ_OP_WRITE)
+		lsbdd_lat_end(LSBDD_LAT_SETUP_READ, lat_start);
+	} else {
 		status = setup_write_in_clone_segments(bio, clone, redir_mng);
-	else
-		pr_warn("Unknown Operation in bio\n");
+		lsbdd_lat_end(LSBDD_LAT_SETUP_WRITE, lat_start);
+	}
+
+	if (status == LSBDD_BIO_DONE) {
+		if (bio_op(clone) == REQ_OP_READ) // zero or compressed extent, bio is completed without the clone
+			lsbdd_rcache_cancel(&redir_mng->rcache, bio, start, size);
+		bio_put(clone);
+		return;
+	}
 
 	if (unlikely(status))
 		goto setup_err;
 
+	if (op_is_flush(bio->bi_opf)) {
+		// durability is provided by the group commit, it flushes the device cache after the data is written
+		clone->bi_opf &= ~(REQ_PREFLUSH | REQ_FUA);
+		if (bio_op(clone) != REQ_OP_ZONE_APPEND) // appends wait for the group commit in zone_append_complete
+			clone->bi_end_io = bdd_bio_end_io_flush;
+	}
+
+	trace_lsbdd_remap(clone, bio->bi_iter.bi_sector);
+	if (bio_op(bio) == REQ_OP_READ) {
+		lsbdd_stats_inc(&redir_mng->stats, LSBDD_STAT_READ_FRAGS);
+		if (lsbdd_wbuf_read(&redir_mng->wbuf, clone))
+			return; // extent is still in the write buffer
+	}
+
 	submit_bio(clone);
-	pr_debug("Submitted bio\n\n");
 	return;
 
 get_err:
 	pr_err("No such lsbdd_bd_mng with middle disk %s and not empty handler\n", bio->bi_bdev->bd_disk->disk_name);
-	bdd_bio_end_io(bio);
+	bio_io_error(bio);
+	return;
+
+op_err:
+	pr_warn("Unknown Operation in bio: %d\n", bio_op(bio));
+	bio->bi_status = BLK_STS_NOTSUPP;
+	bio_endio(bio);
+	return;
+
+split_err:
+	pr_err("Bio split went wrong\n");
+	bio_io_error(bio);
 	return;
 
 clone_err:
 	pr_err("Bio allocation failed\n");
+	lsbdd_rcache_cancel(&redir_mng->rcache, bio, start, size);
 	bio_io_error(bio);
 	return;
 
 setup_err:
 	pr_err("Setup failed with code %d\n", status);
+	if (clone)
+		bio_put(clone);
+	lsbdd_rcache_cancel(&redir_mng->rcache, bio, start, size);
 	bio_io_error(bio);
 	return;
 }
@@ -380,8 +1269,22 @@ static struct gendisk *init_disk_bd(char *vbd_name)
 	struct gendisk *new_disk = NULL;
 	struct lsbdd_bd_mng *linked_mng = NULL;
 	struct block_device *bd = NULL;
-
-	new_disk = blk_alloc_disk(NULL, NUMA_NO_NODE);
+	struct queue_limits lim = {
+		// discard and write zeroes are mapping-only, so any range is fine (bi_size is the only limit)
+		.max_hw_discard_sectors = UINT_MAX >> SECTOR_SHIFT,
+		.max_write_zeroes_sectors = UINT_MAX >> SECTOR_SHIFT,
+		.discard_granularity = LSBDD_DISCARD_GRANULARITY,
+		// flush/FUA are handled by the group commit
+		.features = BLK_FEAT_WRITE_CACHE | BLK_FEAT_FUA,
+	};
+
+	// checksums are computed from the pages of the write, so they must not change until it completes
+	if (!list_empty(&bd_list) && list_last_entry(&bd_list, struct lsbdd_bd_mng, list)->csum.enabled)
+		lim.features |= BLK_FEAT_STABLE_WRITES;
+
+	new_disk = blk_alloc_disk(&lim, NUMA_NO_NODE);
+	if (IS_ERR(new_disk))
+		return NULL;
 
 	new_disk->major = bdd_major;
 	new_disk->first_minor = 1;
@@ -418,37 +1321,275 @@ static s32 check_and_open_bd(char *bd_path)
 	struct lsbdd_bd_mng *bdev_mng = kzalloc(sizeof(struct lsbdd_bd_mng), GFP_KERNEL);
 	struct file *bdev_file = NULL;
 	struct lsbdd_ds *ds = kzalloc(sizeof(struct lsbdd_ds), GFP_KERNEL);
+	s32 status = 0;
+
+	if (!ds + !bdev_mng > 0)
+		goto mem_err;
+
+	bdev_file = open_bd_on_rw(bd_path);
+
+	if (IS_ERR(bdev_file))
+		goto free_bdev;
+
+	bdev_mng->bd_file = bdev_file;
+	bdev_mng->vbd_name = bd_path;
+	bdev_mng->sel_ds = ds;
+	bdev_mng->value_enc = sel_value_enc;
+
+	status = lsbdd_stats_init(&bdev_mng->stats);
+	if (status)
+		goto stats_err;
+
+	status = lsbdd_zones_init(&bdev_mng->zones, file_bdev(bdev_file), zone_append_complete);
+	if (status)
+		goto zone_err;
+
+	lsbdd_flush_init(&bdev_mng->flush, file_bdev(bdev_file));
+	// segment PBA's are reserved before the write, that's impossible with zone append
+	lsbdd_wbuf_init(&bdev_mng->wbuf, file_bdev(bdev_file), bdd_pool, &next_free_sector, &bdev_mng->flush,
+			write_buffer && !bdev_mng->zones.enabled);
+	lsbdd_rcache_init(&bdev_mng->rcache, read_cache_size << (20 - PAGE_SHIFT));
+	lsbdd_ra_init(&bdev_mng->ra, file_bdev(bdev_file), bdd_pool, ds, &bdev_mng->wbuf, readahead);
+	// missed blocks are stored through the write buffer
+	lsbdd_dedup_init(&bdev_mng->dedup, file_bdev(bdev_file), bdd_pool, &bdev_mng->wbuf, dedup_write,
+			 bdev_mng->wbuf.enabled ? dedup_index_size * (SZ_1M / LSBDD_DEDUP_BLOCK_SIZE) : 0);
+	// compressed blobs are packed into the write buffer segments only, deduplicated blocks are stored as is
+	bdev_mng->compress = compression && bdev_mng->wbuf.enabled && !bdev_mng->dedup.enabled && !lsbdd_comp_init();
+	lsbdd_csum_init(&bdev_mng->csum, file_bdev(bdev_file), bdd_pool, ds, &bdev_mng->wbuf, checksums, scrub_rate);
+
+	vector_add_bd(bdev_mng);
+
+	pr_debug("Succesfully added %s to vector\n", bd_path);
+
+	return 0;
+
+zone_err:
+	lsbdd_stats_destroy(&bdev_mng->stats);
+stats_err:
+	fput(bdev_file);
+	kfree(ds);
+	kfree(bdev_mng);
+	return status;
+
+free_bdev:
+	pr_err("Couldnt open bd by path: %s\n", bd_path);
+	kfree(ds);
+	kfree(bdev_mng);
+	return PTR_ERR(bdev_file);
+
+mem_err:
+	kfree(bdev_mng);
+	kfree(ds);
+	return -ENOMEM;
+}
+
+struct map_walk_ctx {
+	u64 live_sects;
+	u64 full_values;
+	u64 visited;
+};
+
+static s32 map_walk_ext(sector_t key, void *value, void *data)
+{
+	struct map_walk_ctx *ctx = data;
+	struct lsbdd_value_redir ext = lsbdd_value_get(value);
+
+	if (!lsbdd_value_is_zero(&ext))
+		ctx->live_sects += ext.block_size / SECTOR_SIZE;
+	if (!lsbdd_value_is_compact(value))
+		ctx->full_values++;
+
+	if (!(++ctx->visited & 1023))
+		cond_resched();
+	return 0;
+}
+
+/**
+ * Walks the mapping and sums up the extents.
+ * Goes concurrently with I/O, so the result is a snapshot of a moving map.
+ *
+ * @param redir_mng - mng of the BD
+ * @param live_sects - sectors mapped to the data (zero extents aren't counted)
+ * @param full_values - values allocated from lsbdd_value_cache
+ */
+static void map_walk(struct lsbdd_bd_mng *redir_mng, u64 *live_sects, u64 *full_values)
+{
+	struct map_walk_ctx ctx = { 0 };
+
+	ds_iter(redir_mng->sel_ds, map_walk_ext, &ctx);
+
+	*live_sects = ctx.live_sects;
+	*full_values = ctx.full_values;
+}
+
+/**
+ * Prints the I/O counters and the map state of the BD: /sys/kernel/debug/lsbdd/<vbd_name>/stats.
+ * Map entries are O(1), the rest of map state is gathered by the full map walk.
+ */
+static s32 lsbdd_bd_stats_show(struct seq_file *m, void *v)
+{
+	struct lsbdd_bd_mng *redir_mng = m->private;
+	u64 live_sects = 0;
+	u64 full_values = 0;
+	s64 allocated = 0;
+
+	map_walk(redir_mng, &live_sects, &full_values);
+
+	// log head (next_free_sector) is shared by all the conventional devices
+	if (redir_mng->zones.enabled)
+		allocated = atomic64_read(&redir_mng->zones.sectors);
+	else
+		allocated = atomic64_read(&next_free_sector) - LSBDD_SECTOR_OFFSET;
+
+	lsbdd_stats_show(&redir_mng->stats, m);
+	seq_printf(m, "map_entries %lld\n", ds_size(redir_mng->sel_ds));
+	seq_printf(m, "map_node_bytes %llu\n", ds_mem(redir_mng->sel_ds, lsbdd_cache_mng));
+	seq_printf(m, "map_value_bytes %llu\n", full_values * kmem_cache_size(lsbdd_value_cache));
+	seq_printf(m, "map_removed_nodes %llu\n", ds_removed_nodes(redir_mng->sel_ds));
+	seq_printf(m, "live_sectors %llu\n", live_sects);
+	seq_printf(m, "allocated_sectors %lld\n", allocated);
+#ifdef LF_MODE
+	seq_printf(m, "cas_retries %llu\n", lsbdd_cas_retries()); // module-wide
+#endif
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(lsbdd_bd_stats);
+
+struct map_dump_ext {
+	sector_t lba;
+	sector_t pba;
+	u32 sects;
+	char type; // d - data, z - zero (unmapped), c - compressed
+};
+
+// Snapshot of the mapping, sorted by LBA, that is streamed by the "map" file
+struct map_dump {
+	u64 nr;
+	u64 cap;
+	bool truncated; // map grew over cap while it was copied
+	struct map_dump_ext exts[];
+};
+
+static s32 map_dump_add(sector_t key, void *value, void *data)
+{
+	struct map_dump *dump = data;
+	struct map_dump_ext *dext = NULL;
+	struct lsbdd_value_redir ext = lsbdd_value_get(value);
+
+	if (dump->nr == dump->cap)
+		return -ENOSPC;
+
+	dext = &dump->exts[dump->nr++];
+	dext->lba = key;
+	dext->pba = ext.redirected_sector;
+	dext->sects = ext.block_size / SECTOR_SIZE;
+	dext->type = lsbdd_value_is_zero(&ext) ? 'z' : lsbdd_value_is_compressed(&ext) ? 'c' : 'd';
+
+	if (!(dump->nr & 1023))
+		cond_resched();
+	return 0;
+}
+
+static s32 map_dump_cmp(const void *a, const void *b)
+{
+	const struct map_dump_ext *x = a;
+	const struct map_dump_ext *y = b;
+
+	return x->lba < y->lba ? -1 : x->lba > y->lba;
+}
+
+static void *map_dump_start(struct seq_file *m, loff_t *pos)
+{
+	struct map_dump *dump = m->private;
+
+	if (!*pos)
+		return SEQ_START_TOKEN;
+
+	return *pos <= dump->nr ? &dump->exts[*pos - 1] : NULL;
+}
+
+static void *map_dump_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	struct map_dump *dump = m->private;
+
+	++*pos;
+	return *pos <= dump->nr ? &dump->exts[*pos - 1] : NULL;
+}
+
+static void map_dump_stop(struct seq_file *m, void *v)
+{
+}
+
+static s32 map_dump_show(struct seq_file *m, void *v)
+{
+	struct map_dump *dump = m->private;
+	struct map_dump_ext *dext = v;
+
+	if (v == SEQ_START_TOKEN) {
+		seq_printf(m, "# lba pba sectors type (%llu extents%s)\n", dump->nr, dump->truncated ? ", truncated" : "");
+		return 0;
+	}
+
+	seq_printf(m, "%llu %llu %u %c\n", dext->lba, dext->pba, dext->sects, dext->type);
+	return 0;
+}
 
-	if (!ds + !bdev_mng > 0)
-		goto mem_err;
+static const struct seq_operations map_dump_seq_ops = {
+	.start = map_dump_start,
+	.next = map_dump_next,
+	.stop = map_dump_stop,
+	.show = map_dump_show,
+};
 
-	bdev_file = open_bd_on_rw(bd_path);
+/**
+ * Copies the mapping of the BD into a snapshot sorted by LBA: /sys/kernel/debug/lsbdd/<vbd_name>/map.
+ * The walk goes concurrently with I/O (as the stats one), the snapshot is freed on close.
+ */
+static s32 map_dump_open(struct inode *inode, struct file *file)
+{
+	struct lsbdd_bd_mng *redir_mng = inode->i_private;
+	struct map_dump *dump = NULL;
+	u64 cap = 0;
+	s32 status = 0;
 
-	if (IS_ERR(bdev_file))
-		goto free_bdev;
+	// some slack for the keys inserted during the walk
+	cap = max_t(s64, ds_size(redir_mng->sel_ds), 0) + SZ_1K;
+	cap += cap / 8;
 
-	bdev_mng->bd_file = bdev_file;
-	bdev_mng->vbd_name = bd_path;
-	bdev_mng->sel_ds = ds;
+	dump = kvmalloc(struct_size(dump, exts, cap), GFP_KERNEL);
+	if (!dump)
+		return -ENOMEM;
 
-	vector_add_bd(bdev_mng);
+	dump->nr = 0;
+	dump->cap = cap;
+	dump->truncated = ds_iter(redir_mng->sel_ds, map_dump_add, dump) == -ENOSPC;
+	sort(dump->exts, dump->nr, sizeof(struct map_dump_ext), map_dump_cmp, NULL);
 
-	pr_debug("Succesfully added %s to vector\n", bd_path);
+	status = seq_open(file, &map_dump_seq_ops);
+	if (status) {
+		kvfree(dump);
+		return status;
+	}
 
+	((struct seq_file *)file->private_data)->private = dump;
 	return 0;
+}
 
-free_bdev:
-	pr_err("Couldnt open bd by path: %s\n", bd_path);
-	kfree(ds);
-	kfree(bdev_mng);
-	return PTR_ERR(bdev_file);
-
-mem_err:
-	kfree(bdev_mng);
-	kfree(ds);
-	return -ENOMEM;
+static s32 map_dump_release(struct inode *inode, struct file *file)
+{
+	kvfree(((struct seq_file *)file->private_data)->private);
+	return seq_release(inode, file);
 }
 
+static const struct file_operations lsbdd_map_dump_fops = {
+	.owner = THIS_MODULE,
+	.open = map_dump_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = map_dump_release,
+};
+
 static char *create_disk_name_by_index(s32 index)
 {
 	char *disk_name = kmalloc(strlen(LSBDD_BLKDEV_NAME_PREFIX) + snprintf(NULL, 0, "%d", index) + 1, GFP_KERNEL);
@@ -489,6 +1630,7 @@ static s32 create_bd(s32 name_index)
 	}
 
 	list_last_entry(&bd_list, struct lsbdd_bd_mng, list)->vbd_disk = new_disk;
+	new_disk->private_data = list_last_entry(&bd_list, struct lsbdd_bd_mng, list);
 
 	strcpy(list_last_entry(&bd_list, struct lsbdd_bd_mng, list)->vbd_disk->disk_name, disk_name);
 
@@ -501,6 +1643,13 @@ static s32 create_bd(s32 name_index)
 		goto disk_init_err;
 	}
 
+	// debugfs is optional, its errors are ignored
+	list_last_entry(&bd_list, struct lsbdd_bd_mng, list)->debugfs_dir = debugfs_create_dir(disk_name, lsbdd_debugfs);
+	debugfs_create_file("stats", 0444, list_last_entry(&bd_list, struct lsbdd_bd_mng, list)->debugfs_dir,
+			    list_last_entry(&bd_list, struct lsbdd_bd_mng, list), &lsbdd_bd_stats_fops);
+	debugfs_create_file("map", 0444, list_last_entry(&bd_list, struct lsbdd_bd_mng, list)->debugfs_dir,
+			    list_last_entry(&bd_list, struct lsbdd_bd_mng, list), &lsbdd_map_dump_fops);
+
 	return 0;
 
 mem_err:
@@ -517,21 +1666,36 @@ disk_init_err:
 
 static s8 delete_bd(u16 index)
 {
+	// waits for the readers of the stats, they walk the map
+	debugfs_remove_recursive(get_list_element_by_index(index)->debugfs_dir);
+	get_list_element_by_index(index)->debugfs_dir = NULL;
+
+	// disk goes first, so no new bios arrive after the final commit,
+	// buffered segments are written before it
+	if (get_list_element_by_index(index)->vbd_disk) {
+		del_gendisk(get_list_element_by_index(index)->vbd_disk);
+		put_disk(get_list_element_by_index(index)->vbd_disk);
+		get_list_element_by_index(index)->vbd_disk = NULL;
+	}
 	if (get_list_element_by_index(index)->bd_file) {
+		lsbdd_ra_destroy(&get_list_element_by_index(index)->ra);
+		lsbdd_dedup_destroy(&get_list_element_by_index(index)->dedup);
+		lsbdd_csum_destroy(&get_list_element_by_index(index)->csum);
+		lsbdd_wbuf_destroy(&get_list_element_by_index(index)->wbuf);
+		lsbdd_zones_drain(&get_list_element_by_index(index)->zones);
+		lsbdd_flush_destroy(&get_list_element_by_index(index)->flush);
+		lsbdd_zones_destroy(&get_list_element_by_index(index)->zones);
 		fput(get_list_element_by_index(index)->bd_file);
 		get_list_element_by_index(index)->bd_file = NULL;
 	} else {
 		pr_info("BD with num %d is empty\n", index + 1);
 	}
-	if (get_list_element_by_index(index)->vbd_disk) {
-		del_gendisk(get_list_element_by_index(index)->vbd_disk);
-		put_disk(get_list_element_by_index(index)->vbd_disk);
-		get_list_element_by_index(index)->vbd_disk = NULL;
-	}
+	lsbdd_rcache_destroy(&get_list_element_by_index(index)->rcache);
 	if (get_list_element_by_index(index)->sel_ds) {
 		ds_free(get_list_element_by_index(index)->sel_ds, lsbdd_cache_mng, lsbdd_value_cache);
 		get_list_element_by_index(index)->sel_ds = NULL;
 	}
+	lsbdd_stats_destroy(&get_list_element_by_index(index)->stats);
 
 	list_del(&(get_list_element_by_index(index)->list));
 
@@ -577,6 +1741,168 @@ static s32 lsbdd_get_vbd_names(char *buf, const struct kernel_param *kp)
 	return total_length;
 }
 
+/**
+ * lsbdd_get_mag_stats() - Prints hit/miss counters of the per-CPU magazines
+ * in front of node and value caches (check utils/mag_cache.h).
+ */
+static s32 lsbdd_get_mag_stats(char *buf, const struct kernel_param *kp)
+{
+	return lsbdd_mag_stats_show(buf);
+}
+
+/**
+ * lsbdd_get_comp_stats() - Prints compression counters of all the BD's: compressed and
+ * stored as is writes, compression ratio and decompressed reads (check utils/compress.h).
+ */
+static s32 lsbdd_get_comp_stats(char *buf, const struct kernel_param *kp)
+{
+	return lsbdd_comp_stats_show(buf);
+}
+
+/**
+ * lsbdd_get_flush_stats() - Prints group commit counters of each BD:
+ * flush/FUA requests and device flushes (check utils/flush.h).
+ */
+static s32 lsbdd_get_flush_stats(char *buf, const struct kernel_param *kp)
+{
+	struct lsbdd_bd_mng *current_mng = NULL;
+	s32 offset = 0;
+
+	offset += scnprintf(buf + offset, PAGE_SIZE - offset, "disk flushes commits\n");
+
+	list_for_each_entry(current_mng, &bd_list, list) {
+		if (current_mng->vbd_disk)
+			offset += lsbdd_flush_stats_show(&current_mng->flush, current_mng->vbd_disk->disk_name, buf, offset);
+	}
+
+	return offset;
+}
+
+/**
+ * lsbdd_get_wbuf_stats() - Prints write buffer counters of each BD:
+ * buffered and bypassed writes, written segments and reads served from memory (check utils/wbuf.h).
+ */
+static s32 lsbdd_get_wbuf_stats(char *buf, const struct kernel_param *kp)
+{
+	struct lsbdd_bd_mng *current_mng = NULL;
+	s32 offset = 0;
+
+	offset += scnprintf(buf + offset, PAGE_SIZE - offset, "disk enabled buffered bypassed segments read_hits\n");
+
+	list_for_each_entry(current_mng, &bd_list, list) {
+		if (current_mng->vbd_disk)
+			offset += lsbdd_wbuf_stats_show(&current_mng->wbuf, current_mng->vbd_disk->disk_name, buf, offset);
+	}
+
+	return offset;
+}
+
+/**
+ * lsbdd_get_dedup_stats() - Prints deduplication counters of each BD:
+ * index capacity, hashed blocks, hits, fingerprint collisions and evicted entries (check utils/dedup.h).
+ */
+static s32 lsbdd_get_dedup_stats(char *buf, const struct kernel_param *kp)
+{
+	struct lsbdd_bd_mng *current_mng = NULL;
+	s32 offset = 0;
+
+	offset += scnprintf(buf + offset, PAGE_SIZE - offset, "disk entries blocks hits collisions evictions\n");
+
+	list_for_each_entry(current_mng, &bd_list, list) {
+		if (current_mng->vbd_disk)
+			offset += lsbdd_dedup_stats_show(&current_mng->dedup, current_mng->vbd_disk->disk_name, buf, offset);
+	}
+
+	return offset;
+}
+
+/**
+ * lsbdd_get_csum_stats() - Prints checksum counters of each BD: verified reads, read mismatches,
+ * scrubbed extents and bytes, scrub mismatches (including failed reads) and finished passes (check utils/csum.h).
+ */
+static s32 lsbdd_get_csum_stats(char *buf, const struct kernel_param *kp)
+{
+	struct lsbdd_bd_mng *current_mng = NULL;
+	s32 offset = 0;
+
+	offset += scnprintf(buf + offset, PAGE_SIZE - offset, "disk enabled verified mismatches scrubbed scrub_bytes scrub_mismatches passes\n");
+
+	list_for_each_entry(current_mng, &bd_list, list) {
+		if (current_mng->vbd_disk)
+			offset += lsbdd_csum_stats_show(&current_mng->csum, current_mng->vbd_disk->disk_name, buf, offset);
+	}
+
+	return offset;
+}
+
+/**
+ * lsbdd_get_rcache_stats() - Prints read cache counters of each BD:
+ * capacity in pages, hits, misses, fills, evictions and invalidations (check utils/rcache.h).
+ */
+static s32 lsbdd_get_rcache_stats(char *buf, const struct kernel_param *kp)
+{
+	struct lsbdd_bd_mng *current_mng = NULL;
+	s32 offset = 0;
+
+	offset += scnprintf(buf + offset, PAGE_SIZE - offset, "disk pages hits misses fills evictions invalidations\n");
+
+	list_for_each_entry(current_mng, &bd_list, list) {
+		if (current_mng->vbd_disk)
+			offset += lsbdd_rcache_stats_show(&current_mng->rcache, current_mng->vbd_disk->disk_name, buf, offset);
+	}
+
+	return offset;
+}
+
+/**
+ * lsbdd_get_ra_stats() - Prints readahead counters of each BD:
+ * reads served from the prefetched slots, loaded and dropped slots, fragment reads (check utils/readahead.h).
+ */
+static s32 lsbdd_get_ra_stats(char *buf, const struct kernel_param *kp)
+{
+	struct lsbdd_bd_mng *current_mng = NULL;
+	s32 offset = 0;
+
+	offset += scnprintf(buf + offset, PAGE_SIZE - offset, "disk enabled hits prefetched fragments dropped\n");
+
+	list_for_each_entry(current_mng, &bd_list, list) {
+		if (current_mng->vbd_disk)
+			offset += lsbdd_ra_stats_show(&current_mng->ra, current_mng->vbd_disk->disk_name, buf, offset);
+	}
+
+	return offset;
+}
+
+/**
+ * lsbdd_get_zone_stats() - Prints zoned mode counters of each BD:
+ * number of zones, active zone, zone appends and appended sectors (check utils/zoned.h).
+ */
+static s32 lsbdd_get_zone_stats(char *buf, const struct kernel_param *kp)
+{
+	struct lsbdd_bd_mng *current_mng = NULL;
+	s32 offset = 0;
+
+	offset += scnprintf(buf + offset, PAGE_SIZE - offset, "disk enabled zones active appends sectors\n");
+
+	list_for_each_entry(current_mng, &bd_list, list) {
+		if (current_mng->vbd_disk)
+			offset += lsbdd_zones_stats_show(&current_mng->zones, current_mng->vbd_disk->disk_name, buf, offset);
+	}
+
+	return offset;
+}
+
+#ifdef LF_MODE
+/**
+ * lsbdd_get_cas_stats() - Prints CAS retry counters of the lock-free data structures
+ * (check utils/lock-free/backoff.h).
+ */
+static s32 lsbdd_get_cas_stats(char *buf, const struct kernel_param *kp)
+{
+	return lsbdd_cas_stats_show(buf);
+}
+#endif
+
 /**
  * lsbdd_delete_bd() - Deletes bdev according to index from printed list (check
  * lsbdd_get_vbd_names)
@@ -656,6 +1982,58 @@ static s32 lsbdd_set_ds(const char *arg, const struct kernel_param *kp)
 	return 0;
 }
 
+static s32 lsbdd_get_value_enc(char *buf, const struct kernel_param *kp)
+{
+	u8 i = 0;
+	u8 offset = 0;
+	u8 length = 0;
+	u8 total_length = 0;
+
+	for (i = 0; i < ARRAY_SIZE(available_value_enc); i++) {
+		length = sprintf(buf + offset, "%d. %s%s\n", i, available_value_enc[i], i == sel_value_enc ? " (selected)" : "");
+
+		if (length < 0) {
+			pr_err("Error in formatting string\n");
+			return -EFAULT;
+		}
+
+		offset += length;
+		total_length += length;
+	}
+
+	return total_length;
+}
+
+/**
+ * Function sets the encoding of mapping values for the BD's that will be linked next.
+ * "compact" packs 4K-aligned extents right into the data structure's value slot,
+ * "full" allocates a separate struct lsbdd_value_redir for each of them.
+ *
+ * @param arg - "full" or "compact"
+ *
+ * @return 0 on success, -EINVAL on error
+ */
+static s32 lsbdd_set_value_enc(const char *arg, const struct kernel_param *kp)
+{
+	char enc[8];
+	u8 i = 0;
+
+	if (sscanf(arg, "%7s", enc) != 1) {
+		pr_err("Wrong input, 1 vallue required\n");
+		return -EINVAL;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(available_value_enc); i++) {
+		if (!strcmp(available_value_enc[i], enc)) {
+			sel_value_enc = i;
+			return 0;
+		}
+	}
+
+	pr_err("%s encoding is not supported. Check available ones by set_value_encoding\n", enc);
+	return -EINVAL;
+}
+
 /**
  * Function links 'middle' BD and the finite one. (creates,
  * opens and links)
@@ -694,9 +2072,10 @@ static s32 lsbdd_set_redirect_bd(const char *arg, const struct kernel_param *kp)
 
 static inline void lsbdd_ds_cache_destroy(void)
 {
-	kmem_cache_destroy(lsbdd_cache_mng->ht_cache);
-	kmem_cache_destroy(lsbdd_cache_mng->sl_cache);
-	// to add rb-tree and b+ caches
+	lsbdd_mag_cache_destroy(lsbdd_cache_mng->ht_cache);
+	lsbdd_mag_cache_destroy(lsbdd_cache_mng->sl_cache);
+	lsbdd_mag_cache_destroy(lsbdd_cache_mng->rb_cache);
+	// b+tree nodes are allocated by lib/btree from its own mempool
 	kfree(lsbdd_cache_mng);
 }
 
@@ -714,29 +2093,77 @@ static s32 __init lsbdd_init(void)
 
 	bdd_pool = kzalloc(sizeof(struct bio_set), GFP_KERNEL);
 	if (!bdd_pool)
-		goto mem_err;
+		goto pool_err;
 
 	status = bioset_init(bdd_pool, BIO_POOL_SIZE, 0, 0);
 
 	if (status) {
 		pr_err("Couldn't allocate bio set\n");
-		goto mem_err;
+		goto bioset_err;
 	}
 
 	INIT_LIST_HEAD(&bd_list);
 
-	lsbdd_value_cache = kmem_cache_create("lsbdd_value_cache", sizeof(struct lsbdd_value_redir), 0, SLAB_HWCACHE_ALIGN, NULL);
+	lsbdd_value_cache = lsbdd_mag_cache_create("lsbdd_value_cache", sizeof(struct lsbdd_value_redir), 0, SLAB_HWCACHE_ALIGN);
 	if (!lsbdd_value_cache)
-		goto mem_err;
+		goto value_cache_err;
 
 	lsbdd_cache_mng = kzalloc(sizeof(struct lsbdd_cache_mng), GFP_KERNEL);
 	if (!lsbdd_cache_mng)
-		goto mem_err;
+		goto cache_mng_err;
+
+	status = lsbdd_flush_wq_init();
+	if (status)
+		goto flush_wq_err;
+
+	status = lsbdd_wbuf_wq_init();
+	if (status)
+		goto wbuf_wq_err;
+
+	status = lsbdd_zones_wq_init();
+	if (status)
+		goto zones_wq_err;
+
+	status = lsbdd_comp_wq_init();
+	if (status)
+		goto comp_wq_err;
+
+	status = lsbdd_dedup_wq_init();
+	if (status)
+		goto dedup_wq_err;
+
+	status = lsbdd_csum_wq_init();
+	if (status)
+		goto csum_wq_err;
+
+	lsbdd_debugfs = debugfs_create_dir("lsbdd", NULL);
+	lsbdd_lat_debugfs_init(lsbdd_debugfs);
 
 	return 0;
 
-mem_err:
+csum_wq_err:
+	lsbdd_dedup_wq_destroy();
+dedup_wq_err:
+	lsbdd_comp_wq_destroy();
+comp_wq_err:
+	lsbdd_zones_wq_destroy();
+zones_wq_err:
+	lsbdd_wbuf_wq_destroy();
+wbuf_wq_err:
+	lsbdd_flush_wq_destroy();
+flush_wq_err:
+	kfree(lsbdd_cache_mng);
+	lsbdd_cache_mng = NULL;
+cache_mng_err:
+	lsbdd_mag_cache_destroy(lsbdd_value_cache);
+	lsbdd_value_cache = NULL;
+value_cache_err:
+	bioset_exit(bdd_pool);
+bioset_err:
 	kfree(bdd_pool);
+	bdd_pool = NULL;
+pool_err:
+	unregister_blkdev(bdd_major, LSBDD_BLKDEV_NAME_PREFIX);
 	pr_err("Memory allocation failed\n");
 	return -ENOMEM;
 }
@@ -757,8 +2184,17 @@ static void __exit lsbdd_exit(void)
 		kfree(entry);
 	}
 
+	debugfs_remove_recursive(lsbdd_debugfs);
+	lsbdd_csum_wq_destroy();
+	lsbdd_dedup_wq_destroy();
+	lsbdd_comp_wq_destroy();
+	lsbdd_comp_destroy();
+	lsbdd_zones_wq_destroy();
+	lsbdd_wbuf_wq_destroy();
+	lsbdd_flush_wq_destroy();
+
 	pr_info("Destroyed lsbdd_value_cache");
-	kmem_cache_destroy(lsbdd_value_cache);
+	lsbdd_mag_cache_destroy(lsbdd_value_cache);
 	// !NOTE: node cache was already destroyed in the delete_bd
 
 	bioset_exit(bdd_pool);
@@ -787,6 +2223,103 @@ static const struct kernel_param_ops lsbdd_ds_ops = {
 	.get = lsbdd_get_ds,
 };
 
+static const struct kernel_param_ops lsbdd_flush_stats_ops = {
+	.set = NULL,
+	.get = lsbdd_get_flush_stats,
+};
+
+static const struct kernel_param_ops lsbdd_wbuf_stats_ops = {
+	.set = NULL,
+	.get = lsbdd_get_wbuf_stats,
+};
+
+static const struct kernel_param_ops lsbdd_dedup_stats_ops = {
+	.set = NULL,
+	.get = lsbdd_get_dedup_stats,
+};
+
+static const struct kernel_param_ops lsbdd_csum_stats_ops = {
+	.set = NULL,
+	.get = lsbdd_get_csum_stats,
+};
+
+static const struct kernel_param_ops lsbdd_rcache_stats_ops = {
+	.set = NULL,
+	.get = lsbdd_get_rcache_stats,
+};
+
+static const struct kernel_param_ops lsbdd_ra_stats_ops = {
+	.set = NULL,
+	.get = lsbdd_get_ra_stats,
+};
+
+static const struct kernel_param_ops lsbdd_zone_stats_ops = {
+	.set = NULL,
+	.get = lsbdd_get_zone_stats,
+};
+
+static const struct kernel_param_ops lsbdd_comp_stats_ops = {
+	.set = NULL,
+	.get = lsbdd_get_comp_stats,
+};
+
+static const struct kernel_param_ops lsbdd_mag_stats_ops = {
+	.set = NULL,
+	.get = lsbdd_get_mag_stats,
+};
+
+#ifdef LF_MODE
+static const struct kernel_param_ops lsbdd_cas_stats_ops = {
+	.set = NULL,
+	.get = lsbdd_get_cas_stats,
+};
+#endif
+
+static const struct kernel_param_ops lsbdd_discard_passthrough_ops = {
+	.set = param_set_bool,
+	.get = param_get_bool,
+};
+
+static const struct kernel_param_ops lsbdd_write_buffer_ops = {
+	.set = param_set_bool,
+	.get = param_get_bool,
+};
+
+static const struct kernel_param_ops lsbdd_read_cache_size_ops = {
+	.set = param_set_uint,
+	.get = param_get_uint,
+};
+
+static const struct kernel_param_ops lsbdd_readahead_ops = {
+	.set = param_set_bool,
+	.get = param_get_bool,
+};
+
+static const struct kernel_param_ops lsbdd_dedup_index_size_ops = {
+	.set = param_set_uint,
+	.get = param_get_uint,
+};
+
+static const struct kernel_param_ops lsbdd_compression_ops = {
+	.set = param_set_bool,
+	.get = param_get_bool,
+};
+
+static const struct kernel_param_ops lsbdd_checksums_ops = {
+	.set = param_set_bool,
+	.get = param_get_bool,
+};
+
+static const struct kernel_param_ops lsbdd_scrub_rate_ops = {
+	.set = param_set_uint,
+	.get = param_get_uint,
+};
+
+static const struct kernel_param_ops lsbdd_value_enc_ops = {
+	.set = lsbdd_set_value_enc,
+	.get = lsbdd_get_value_enc,
+};
+
 MODULE_PARM_DESC(delete_bd, "Delete BD");
 module_param_cb(delete_bd, &lsbdd_delete_ops, NULL, 0200);
 
@@ -799,5 +2332,64 @@ module_param_cb(set_redirect_bd, &lsbdd_redirect_ops, NULL, 0200);
 MODULE_PARM_DESC(set_data_structure, "Set data structure to be used in mapping");
 module_param_cb(set_data_structure, &lsbdd_ds_ops, NULL, 0644);
 
+MODULE_PARM_DESC(set_value_encoding, "Set mapping value encoding (full/compact) for the next linked BD");
+module_param_cb(set_value_encoding, &lsbdd_value_enc_ops, NULL, 0644);
+
+MODULE_PARM_DESC(set_discard_passthrough, "Forward discards of unmapped physical extents to the redirect BD (0/1)");
+module_param_cb(set_discard_passthrough, &lsbdd_discard_passthrough_ops, &discard_passthrough, 0644);
+
+MODULE_PARM_DESC(set_write_buffer, "Pack small writes of the next linked BD into large log segments (0/1)");
+module_param_cb(set_write_buffer, &lsbdd_write_buffer_ops, &write_buffer, 0644);
+
+MODULE_PARM_DESC(set_read_cache_size, "Set read cache size (MiB) for the next linked BD, 0 disables it");
+module_param_cb(set_read_cache_size, &lsbdd_read_cache_size_ops, &read_cache_size, 0644);
+
+MODULE_PARM_DESC(set_readahead, "Prefetch the mapped fragments of sequential reads on the next linked BD (0/1)");
+module_param_cb(set_readahead, &lsbdd_readahead_ops, &readahead, 0644);
+
+MODULE_PARM_DESC(set_compression, "Compress the buffered writes of the next linked BD with " LSBDD_COMP_ALG " (0/1)");
+module_param_cb(set_compression, &lsbdd_compression_ops, &compression, 0644);
+
+MODULE_PARM_DESC(set_dedup_index_size, "Set deduplication index size (MiB of unique blocks) for the next linked BD, 0 disables it");
+module_param_cb(set_dedup_index_size, &lsbdd_dedup_index_size_ops, &dedup_index_size, 0644);
+
+MODULE_PARM_DESC(set_checksums, "Checksum the written extents of the next linked BD and verify their reads (0/1)");
+module_param_cb(set_checksums, &lsbdd_checksums_ops, &checksums, 0644);
+
+MODULE_PARM_DESC(set_scrub_rate, "Set background scrub rate (MiB/s) for the next linked BD with checksums, 0 disables it");
+module_param_cb(set_scrub_rate, &lsbdd_scrub_rate_ops, &scrub_rate, 0644);
+
+MODULE_PARM_DESC(get_flush_stats, "Get flush group commit statistics of each BD");
+module_param_cb(get_flush_stats, &lsbdd_flush_stats_ops, NULL, 0444);
+
+MODULE_PARM_DESC(get_wbuf_stats, "Get write buffer statistics of each BD");
+module_param_cb(get_wbuf_stats, &lsbdd_wbuf_stats_ops, NULL, 0444);
+
+MODULE_PARM_DESC(get_dedup_stats, "Get deduplication statistics of each BD");
+module_param_cb(get_dedup_stats, &lsbdd_dedup_stats_ops, NULL, 0444);
+
+MODULE_PARM_DESC(get_csum_stats, "Get checksum verification and scrub statistics of each BD");
+module_param_cb(get_csum_stats, &lsbdd_csum_stats_ops, NULL, 0444);
+
+MODULE_PARM_DESC(get_rcache_stats, "Get read cache statistics of each BD");
+module_param_cb(get_rcache_stats, &lsbdd_rcache_stats_ops, NULL, 0444);
+
+MODULE_PARM_DESC(get_ra_stats, "Get readahead statistics of each BD");
+module_param_cb(get_ra_stats, &lsbdd_ra_stats_ops, NULL, 0444);
+
+MODULE_PARM_DESC(get_zone_stats, "Get zoned redirect device statistics of each BD");
+module_param_cb(get_zone_stats, &lsbdd_zone_stats_ops, NULL, 0444);
+
+MODULE_PARM_DESC(get_comp_stats, "Get inline compression statistics");
+module_param_cb(get_comp_stats, &lsbdd_comp_stats_ops, NULL, 0444);
+
+MODULE_PARM_DESC(get_mag_stats, "Get per-CPU allocation magazines hit rate");
+module_param_cb(get_mag_stats, &lsbdd_mag_stats_ops, NULL, 0444);
+
+#ifdef LF_MODE
+MODULE_PARM_DESC(get_cas_stats, "Get CAS retry statistics of lock-free data structures");
+module_param_cb(get_cas_stats, &lsbdd_cas_stats_ops, NULL, 0444);
+#endif
+
 module_init(lsbdd_init);
 module_exit(lsbdd_exit);
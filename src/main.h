@@ -7,6 +7,8 @@
 #define LSBDD_MAX_DS_NAME_LEN 2
 #define LSBDD_BLKDEV_NAME_PREFIX "lsvbd"
 #define LSBDD_SECTOR_OFFSET 32
+#define LSBDD_DISCARD_GRANULARITY 4096
+#define LSBDD_BIO_DONE 1 // bio was completed by the driver itself, clone isn't submitted
 
 static const char *available_ds[] = { "bt", "sl", "ht", "rb" };
 
@@ -17,10 +19,7 @@ static const char *available_ds[] = { "bt", "sl", "ht", "rb" };
 			return ret_val;                                                                                                    \
 	} while (0)
 
-struct lsbdd_value_redir {
-	sector_t redirected_sector;
-	u32 block_size;
-};
+static const char *available_value_enc[] = { "full", "compact" };
 
 // Block device mng structure for saving the linked meta data
 struct lsbdd_bd_mng {
@@ -28,5 +27,16 @@ struct lsbdd_bd_mng {
 	struct gendisk *vbd_disk;
 	struct file *bd_file;
 	struct lsbdd_ds *sel_ds;
+	enum lsbdd_value_enc value_enc;
+	bool compress; // buffered writes are compressed (check utils/compress.h)
+	struct lsbdd_zones zones;
+	struct lsbdd_flush flush;
+	struct lsbdd_wbuf wbuf;
+	struct lsbdd_dedup dedup;
+	struct lsbdd_csum csum;
+	struct lsbdd_rcache rcache;
+	struct lsbdd_ra ra;
+	struct lsbdd_stats stats;
+	struct dentry *debugfs_dir; // stats of the BD (check lsbdd_bd_stats_show)
 	struct list_head list;
 };
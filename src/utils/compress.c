@@ -0,0 +1,294 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <crypto/acompress.h>
+#include <linux/kernel.h>
+#include <linux/mempool.h>
+#include <linux/mm.h>
+#include <linux/percpu.h>
+#include <linux/scatterlist.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include "compress.h"
+
+// Read of the compressed extent in flight
+struct lsbdd_comp_read {
+	struct bio *bio; // original bio
+	void *buf; // compressed blob
+	u32 comp_size;
+	u32 offset;
+	struct work_struct work;
+};
+
+static struct lsbdd_comp_ctx __percpu *lsbdd_comp_ctx;
+static mempool_t *lsbdd_comp_read_pool;
+static mempool_t *lsbdd_comp_buf_pool;
+static struct workqueue_struct *lsbdd_comp_wq;
+static DEFINE_MUTEX(lsbdd_comp_init_lock);
+
+// stats
+static atomic64_t comp_writes = ATOMIC64_INIT(0);
+static atomic64_t comp_skipped = ATOMIC64_INIT(0);
+static atomic64_t comp_bytes_in = ATOMIC64_INIT(0);
+static atomic64_t comp_bytes_out = ATOMIC64_INIT(0);
+static atomic64_t comp_reads = ATOMIC64_INIT(0);
+static atomic64_t comp_errors = ATOMIC64_INIT(0);
+
+static void comp_ctx_free(struct lsbdd_comp_ctx *ctx)
+{
+	if (ctx->req)
+		acomp_request_free(ctx->req);
+	if (!IS_ERR_OR_NULL(ctx->tfm))
+		crypto_free_acomp(ctx->tfm);
+	kfree(ctx->src);
+	kfree(ctx->dst);
+	memset(ctx, 0, sizeof(*ctx));
+}
+
+static s32 comp_ctx_alloc(struct lsbdd_comp_ctx *ctx)
+{
+	mutex_init(&ctx->mutex);
+
+	// synchronous implementation only, requests are processed in the caller context
+	ctx->tfm = crypto_alloc_acomp(LSBDD_COMP_ALG, 0, CRYPTO_ALG_ASYNC);
+	if (IS_ERR(ctx->tfm))
+		return PTR_ERR(ctx->tfm);
+
+	ctx->req = acomp_request_alloc(ctx->tfm);
+	ctx->src = kmalloc(LSBDD_COMP_MAX_SIZE, GFP_KERNEL);
+	ctx->dst = kmalloc(LSBDD_COMP_MAX_SIZE, GFP_KERNEL);
+	if (!ctx->req || !ctx->src || !ctx->dst)
+		return -ENOMEM;
+
+	return 0;
+}
+
+s32 lsbdd_comp_init(void)
+{
+	s32 status = 0;
+	s32 cpu = 0;
+
+	mutex_lock(&lsbdd_comp_init_lock);
+	if (lsbdd_comp_ctx)
+		goto out;
+
+	lsbdd_comp_ctx = alloc_percpu(struct lsbdd_comp_ctx);
+	if (!lsbdd_comp_ctx) {
+		status = -ENOMEM;
+		goto out;
+	}
+
+	for_each_possible_cpu(cpu) {
+		status = comp_ctx_alloc(per_cpu_ptr(lsbdd_comp_ctx, cpu));
+		if (status)
+			goto init_err;
+	}
+
+	lsbdd_comp_read_pool = mempool_create_kmalloc_pool(LSBDD_COMP_POOL_SIZE, sizeof(struct lsbdd_comp_read));
+	lsbdd_comp_buf_pool = mempool_create_kmalloc_pool(LSBDD_COMP_POOL_SIZE, LSBDD_COMP_MAX_SIZE);
+	if (!lsbdd_comp_read_pool || !lsbdd_comp_buf_pool) {
+		status = -ENOMEM;
+		goto init_err;
+	}
+
+	pr_info("Compression contexts (%s) are allocated\n", LSBDD_COMP_ALG);
+	goto out;
+
+init_err:
+	pr_err("Compression setup failed with %d\n", status);
+	mutex_unlock(&lsbdd_comp_init_lock);
+	lsbdd_comp_destroy();
+	return status;
+
+out:
+	mutex_unlock(&lsbdd_comp_init_lock);
+	return status;
+}
+
+void lsbdd_comp_destroy(void)
+{
+	s32 cpu = 0;
+
+	mutex_lock(&lsbdd_comp_init_lock);
+	if (lsbdd_comp_ctx) {
+		for_each_possible_cpu(cpu)
+			comp_ctx_free(per_cpu_ptr(lsbdd_comp_ctx, cpu));
+		free_percpu(lsbdd_comp_ctx);
+		lsbdd_comp_ctx = NULL;
+	}
+
+	mempool_destroy(lsbdd_comp_read_pool);
+	mempool_destroy(lsbdd_comp_buf_pool);
+	lsbdd_comp_read_pool = NULL;
+	lsbdd_comp_buf_pool = NULL;
+	mutex_unlock(&lsbdd_comp_init_lock);
+}
+
+struct lsbdd_comp_ctx *lsbdd_comp_begin(struct bio *bio, u32 *comp_size)
+{
+	struct lsbdd_comp_ctx *ctx = NULL;
+	struct scatterlist src;
+	struct scatterlist dst;
+	struct bvec_iter iter;
+	struct bio_vec bv;
+	u32 len = 0;
+	s32 status = 0;
+
+	BUG_ON(bio->bi_iter.bi_size > LSBDD_COMP_MAX_SIZE);
+
+	if (bio->bi_iter.bi_size <= SECTOR_SIZE)
+		return NULL;
+
+	// context may be used by the task that was preempted on this CPU, so it is a mutex, not a local lock
+	ctx = raw_cpu_ptr(lsbdd_comp_ctx);
+	mutex_lock(&ctx->mutex);
+
+	bio_for_each_segment(bv, bio, iter) {
+		memcpy_from_bvec(ctx->src + len, &bv);
+		len += bv.bv_len;
+	}
+
+	// output that doesn't save a sector is useless, compressor fails with -ENOSPC on it
+	sg_init_one(&src, ctx->src, len);
+	sg_init_one(&dst, ctx->dst, len - SECTOR_SIZE);
+	acomp_request_set_params(ctx->req, &src, &dst, len, len - SECTOR_SIZE);
+
+	status = crypto_acomp_compress(ctx->req);
+	if (status) {
+		mutex_unlock(&ctx->mutex);
+		atomic64_inc(&comp_skipped);
+		return NULL;
+	}
+
+	*comp_size = ctx->req->dlen;
+	atomic64_inc(&comp_writes);
+	atomic64_add(len, &comp_bytes_in);
+	atomic64_add(*comp_size, &comp_bytes_out);
+
+	return ctx;
+}
+
+void lsbdd_comp_end(struct lsbdd_comp_ctx *ctx)
+{
+	mutex_unlock(&ctx->mutex);
+}
+
+// Decompresses the blob and copies the requested range into the original bio
+static s32 comp_decompress(struct lsbdd_comp_read *rd)
+{
+	struct lsbdd_comp_ctx *ctx = NULL;
+	struct scatterlist src;
+	struct scatterlist dst;
+	struct bvec_iter iter;
+	struct bio_vec bv;
+	u32 offset = rd->offset;
+	s32 status = 0;
+
+	ctx = raw_cpu_ptr(lsbdd_comp_ctx);
+	mutex_lock(&ctx->mutex);
+
+	sg_init_one(&src, rd->buf, rd->comp_size);
+	sg_init_one(&dst, ctx->dst, LSBDD_COMP_MAX_SIZE);
+	acomp_request_set_params(ctx->req, &src, &dst, rd->comp_size, LSBDD_COMP_MAX_SIZE);
+
+	status = crypto_acomp_decompress(ctx->req);
+	if (unlikely(status))
+		goto out;
+
+	if (unlikely(offset + rd->bio->bi_iter.bi_size > ctx->req->dlen)) {
+		status = -EIO;
+		goto out;
+	}
+
+	bio_for_each_segment(bv, rd->bio, iter) {
+		memcpy_to_bvec(&bv, ctx->dst + offset);
+		offset += bv.bv_len;
+	}
+
+out:
+	mutex_unlock(&ctx->mutex);
+	return status;
+}
+
+static void comp_read_work(struct work_struct *work)
+{
+	struct lsbdd_comp_read *rd = container_of(work, struct lsbdd_comp_read, work);
+	s32 status = 0;
+
+	if (!rd->bio->bi_status) {
+		status = comp_decompress(rd);
+		if (unlikely(status)) {
+			pr_err("Decompression of %u bytes failed with %d\n", rd->comp_size, status);
+			atomic64_inc(&comp_errors);
+			rd->bio->bi_status = BLK_STS_IOERR;
+		}
+	}
+
+	bio_endio(rd->bio);
+	mempool_free(rd->buf, lsbdd_comp_buf_pool);
+	mempool_free(rd, lsbdd_comp_read_pool);
+}
+
+static void comp_read_end_io(struct bio *bio)
+{
+	struct lsbdd_comp_read *rd = bio->bi_private;
+
+	rd->bio->bi_status = bio->bi_status;
+	bio_put(bio);
+	queue_work(lsbdd_comp_wq, &rd->work); // decompression sleeps on the context mutex
+}
+
+void lsbdd_comp_read(struct bio *bio, struct block_device *bdev, struct bio_set *bs, struct lsbdd_wbuf *wbuf,
+		     const struct lsbdd_value_redir *ext, u32 offset)
+{
+	struct lsbdd_comp_read *rd = NULL;
+	struct bio *blob_bio = NULL;
+
+	BUG_ON(!ext->comp_size || ext->comp_size > LSBDD_COMP_MAX_SIZE);
+
+	rd = mempool_alloc(lsbdd_comp_read_pool, GFP_NOIO);
+	rd->buf = mempool_alloc(lsbdd_comp_buf_pool, GFP_NOIO);
+	rd->bio = bio;
+	rd->comp_size = ext->comp_size;
+	rd->offset = offset;
+	INIT_WORK(&rd->work, comp_read_work);
+
+	// large kmalloc buffers are physically contiguous, so one bvec covers the blob
+	blob_bio = bio_alloc_bioset(bdev, 1, REQ_OP_READ, GFP_NOIO, bs);
+	blob_bio->bi_iter.bi_sector = ext->redirected_sector;
+	__bio_add_page(blob_bio, virt_to_page(rd->buf), round_up(ext->comp_size, SECTOR_SIZE), offset_in_page(rd->buf));
+	blob_bio->bi_private = rd;
+	blob_bio->bi_end_io = comp_read_end_io;
+
+	atomic64_inc(&comp_reads);
+
+	if (!lsbdd_wbuf_read(wbuf, blob_bio)) // blob can still be in the write buffer
+		submit_bio(blob_bio);
+}
+
+s32 lsbdd_comp_stats_show(char *buf)
+{
+	u64 bytes_in = atomic64_read(&comp_bytes_in);
+	u64 bytes_out = atomic64_read(&comp_bytes_out);
+	s32 offset = 0;
+
+	offset += scnprintf(buf + offset, PAGE_SIZE - offset, "compressed stored_as_is bytes_in bytes_out ratio(%%) reads errors\n");
+	offset += scnprintf(buf + offset, PAGE_SIZE - offset, "%lld %lld %llu %llu %llu %lld %lld\n", atomic64_read(&comp_writes),
+			    atomic64_read(&comp_skipped), bytes_in, bytes_out, bytes_in ? bytes_out * 100 / bytes_in : 0,
+			    atomic64_read(&comp_reads), atomic64_read(&comp_errors));
+
+	return offset;
+}
+
+s32 lsbdd_comp_wq_init(void)
+{
+	lsbdd_comp_wq = alloc_workqueue("lsbdd_comp", WQ_MEM_RECLAIM | WQ_UNBOUND, 0);
+	if (!lsbdd_comp_wq)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void lsbdd_comp_wq_destroy(void)
+{
+	destroy_workqueue(lsbdd_comp_wq);
+}
@@ -0,0 +1,87 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/mutex.h>
+#include <linux/types.h>
+#include "value_redir.h"
+#include "wbuf.h"
+
+/**
+ * Inline LZ4 compression of the buffered writes (kernel crypto acomp API).
+ *
+ * Each write that goes through the write buffer is compressed as a whole and packed into the segment
+ * as a variable-length physical extent (rounded up to the sector). Its mapping value records the compressed
+ * size and the offset of the LBA range inside the decompressed data (check value_redir.h), so trimmed
+ * extents still point to the same blob. Writes that don't save at least one sector are stored as is.
+ *
+ * Reads of the compressed extent read the blob into a bounce buffer (or copy it from the write buffer),
+ * decompress it from the workqueue and copy the requested range into the original bio.
+ *
+ * Compression contexts (tfm, request and linear buffers) are per-CPU and are protected by a mutex,
+ * as the holder submits the sealed segment and may sleep. They are allocated when the first compressing
+ * device is linked and freed on module exit.
+ */
+
+#define LSBDD_COMP_ALG "lz4"
+#define LSBDD_COMP_MAX_SIZE LSBDD_WBUF_MAX_WRITE // only buffered writes are compressed
+#define LSBDD_COMP_POOL_SIZE 4 // reserved reads in flight
+
+struct lsbdd_comp_ctx {
+	struct mutex mutex;
+	struct crypto_acomp *tfm;
+	struct acomp_req *req;
+	void *src; // linearized bio data
+	void *dst; // compressed/decompressed data
+};
+
+/**
+ * Allocates the per-CPU compression contexts and read pools, does nothing if they are allocated already.
+ *
+ * @return 0 on success, -ENOMEM or crypto error (f.e. -ENOENT if LZ4 isn't available) otherwise
+ */
+s32 lsbdd_comp_init(void);
+
+// Frees the contexts and pools, called on module exit after all the devices are deleted
+void lsbdd_comp_destroy(void);
+
+/**
+ * Compresses the bio data with the context of the current CPU.
+ * Must be followed by lsbdd_comp_end when the compressed data (ctx->dst) isn't needed anymore.
+ *
+ * @param bio - write bio, not larger than LSBDD_COMP_MAX_SIZE
+ * @param comp_size - size of the compressed data in bytes is stored here
+ *
+ * @return locked context on success, NULL if the data is incompressible (should be written as is)
+ */
+struct lsbdd_comp_ctx *lsbdd_comp_begin(struct bio *bio, u32 *comp_size);
+
+// Releases the context taken by lsbdd_comp_begin
+void lsbdd_comp_end(struct lsbdd_comp_ctx *ctx);
+
+/**
+ * Reads the compressed extent and completes the bio with its decompressed part.
+ *
+ * @param bio - original read bio, doesn't go beyond the extent
+ * @param bdev - redirect block device
+ * @param bs - bio set for the blob read
+ * @param wbuf - write buffer of the device, blob that is still buffered is copied from it
+ * @param ext - compressed extent
+ * @param offset - offset of the bio start in the decompressed data (bytes)
+ *
+ * @return void
+ */
+void lsbdd_comp_read(struct bio *bio, struct block_device *bdev, struct bio_set *bs, struct lsbdd_wbuf *wbuf,
+		     const struct lsbdd_value_redir *ext, u32 offset);
+
+// Prints the compression statistics into buf, @return number of written bytes
+s32 lsbdd_comp_stats_show(char *buf);
+
+// Creates/destroys the decompression workqueue (shared by all the devices), called on module init/exit
+s32 lsbdd_comp_wq_init(void);
+void lsbdd_comp_wq_destroy(void);
+
+#endif
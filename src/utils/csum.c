@@ -0,0 +1,313 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/gfp.h>
+#include <linux/highmem.h>
+#include <linux/jiffies.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/mempool.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include "csum.h"
+#include "value_redir.h"
+
+// Read clone that is verified on completion
+struct lsbdd_csum_ctx {
+	struct work_struct work;
+	struct lsbdd_csum *csum;
+	struct bio *bio;
+	bio_end_io_t *end_io; // original end_io and private of the clone
+	void *private;
+	struct bvec_iter iter; // clone range, its own iterator is consumed by the completion
+	u32 expected;
+};
+
+static struct workqueue_struct *lsbdd_csum_wq;
+static mempool_t *lsbdd_csum_pool;
+
+u32 lsbdd_csum_bio(struct bio *bio)
+{
+	struct bvec_iter iter;
+	struct bio_vec bv;
+	u32 crc = LSBDD_CSUM_SEED;
+	void *data = NULL;
+
+	bio_for_each_segment(bv, bio, iter) {
+		data = bvec_kmap_local(&bv);
+		crc = crc32c(crc, data, bv.bv_len);
+		kunmap_local(data);
+	}
+
+	return crc;
+}
+
+static void csum_verify_work(struct work_struct *work)
+{
+	struct lsbdd_csum_ctx *ctx = container_of(work, struct lsbdd_csum_ctx, work);
+	struct bio *bio = ctx->bio;
+	struct bvec_iter iter;
+	struct bio_vec bv;
+	u32 crc = LSBDD_CSUM_SEED;
+	void *data = NULL;
+
+	if (!bio->bi_status) {
+		__bio_for_each_segment(bv, bio, iter, ctx->iter) {
+			data = bvec_kmap_local(&bv);
+			crc = crc32c(crc, data, bv.bv_len);
+			kunmap_local(data);
+		}
+
+		if (unlikely(crc != ctx->expected)) {
+			pr_err_ratelimited("Checksum mismatch on read of pba %llu (%u bytes): %08x, expected %08x\n", ctx->iter.bi_sector,
+					   ctx->iter.bi_size, crc, ctx->expected);
+			atomic64_inc(&ctx->csum->mismatches);
+			bio->bi_status = BLK_STS_IOERR;
+		} else {
+			atomic64_inc(&ctx->csum->verified);
+		}
+	}
+
+	bio->bi_private = ctx->private;
+	bio->bi_end_io = ctx->end_io;
+	mempool_free(ctx, lsbdd_csum_pool);
+
+	bio->bi_end_io(bio);
+}
+
+static void csum_verify_end_io(struct bio *bio)
+{
+	struct lsbdd_csum_ctx *ctx = bio->bi_private;
+
+	queue_work(lsbdd_csum_wq, &ctx->work);
+}
+
+void lsbdd_csum_verify(struct lsbdd_csum *csum, struct bio *clone, u32 expected)
+{
+	struct lsbdd_csum_ctx *ctx = NULL;
+
+	if (!csum->enabled)
+		return;
+
+	ctx = mempool_alloc(lsbdd_csum_pool, GFP_NOIO);
+	INIT_WORK(&ctx->work, csum_verify_work);
+	ctx->csum = csum;
+	ctx->bio = clone;
+	ctx->end_io = clone->bi_end_io;
+	ctx->private = clone->bi_private;
+	ctx->iter = clone->bi_iter;
+	ctx->expected = expected;
+
+	clone->bi_private = ctx;
+	clone->bi_end_io = csum_verify_end_io;
+}
+
+// Reads the extent into the scrub pages and computes its checksum
+static s32 csum_scrub_read(struct lsbdd_csum *csum, sector_t pba, u32 size, u32 *crc)
+{
+	struct bio *bio = NULL;
+	u32 nr_pages = DIV_ROUND_UP(size, PAGE_SIZE);
+	u32 len = 0;
+	u32 i = 0;
+	s32 status = 0;
+
+	bio = bio_alloc_bioset(csum->bdev, nr_pages, REQ_OP_READ, GFP_KERNEL, csum->bs);
+	bio->bi_iter.bi_sector = pba;
+	for (i = 0; i < nr_pages; i++)
+		__bio_add_page(bio, csum->scrub_pages[i], min_t(u32, PAGE_SIZE, size - i * PAGE_SIZE), 0);
+
+	if (lsbdd_wbuf_read(csum->wbuf, bio))
+		status = blk_status_to_errno(bio->bi_status);
+	else
+		status = submit_bio_wait(bio);
+	bio_put(bio);
+
+	if (unlikely(status))
+		return status;
+
+	*crc = LSBDD_CSUM_SEED;
+	for (i = 0; i < nr_pages; i++) {
+		len = min_t(u32, PAGE_SIZE, size - i * PAGE_SIZE);
+		*crc = crc32c(*crc, page_address(csum->scrub_pages[i]), len);
+	}
+
+	return 0;
+}
+
+static void csum_scrub_extent(struct lsbdd_csum *csum, sector_t key, const struct lsbdd_value_redir *ext)
+{
+	u32 crc = 0;
+	s32 status = 0;
+
+	status = csum_scrub_read(csum, ext->redirected_sector, ext->block_size, &crc);
+	if (!status && crc != ext->csum) {
+		// direct write of the extent could be in flight, mapping is updated before it
+		msleep(LSBDD_SCRUB_RETRY_MS);
+		status = csum_scrub_read(csum, ext->redirected_sector, ext->block_size, &crc);
+	}
+
+	atomic64_inc(&csum->scrubbed);
+	atomic64_add(ext->block_size, &csum->scrub_bytes);
+
+	if (unlikely(status)) {
+		pr_err_ratelimited("Scrub: read of key %llu (pba %llu) failed with %d\n", key, ext->redirected_sector, status);
+		atomic64_inc(&csum->scrub_mismatches);
+	} else if (unlikely(crc != ext->csum)) {
+		pr_err_ratelimited("Scrub: checksum mismatch of key %llu (pba %llu, %u bytes): %08x, expected %08x\n", key,
+				   ext->redirected_sector, ext->block_size, crc, ext->csum);
+		atomic64_inc(&csum->scrub_mismatches);
+	}
+}
+
+/**
+ * Walks the whole mapping from the last key down, @return after the pass or on kthread_stop.
+ * Keys are taken by ds_prev one at a time rather than by ds_iter: the pass sleeps between the extents
+ * and the mapping changes meanwhile, ds_prev of the cursor stays valid across that.
+ */
+static void csum_scrub_pass(struct lsbdd_csum *csum)
+{
+	struct lsbdd_value_redir ext = { 0 };
+	unsigned long window_end = jiffies + HZ;
+	u64 window_bytes = 0;
+	sector_t cursor = 0;
+	sector_t key = 0;
+	void *value = NULL;
+
+	if (ds_empty_check(csum->ds))
+		return;
+
+	cursor = ds_last(csum->ds, 0) + 1;
+	while (!kthread_should_stop()) {
+		if (ds_empty_check(csum->ds))
+			break;
+
+		value = ds_prev(csum->ds, cursor, &key);
+		if (!value || key >= cursor)
+			break;
+
+		ext = lsbdd_value_get(value);
+		cursor = key;
+		if (!ext.has_csum || ext.block_size > LSBDD_SCRUB_MAX_EXTENT)
+			continue;
+
+		csum_scrub_extent(csum, key, &ext);
+
+		window_bytes += ext.block_size;
+		if (window_bytes >= csum->scrub_rate) {
+			if (time_after(window_end, jiffies))
+				schedule_timeout_interruptible(window_end - jiffies);
+			window_bytes = 0;
+			window_end = jiffies + HZ;
+		} else if (time_after(jiffies, window_end)) {
+			window_bytes = 0;
+			window_end = jiffies + HZ;
+		}
+		cond_resched();
+	}
+}
+
+static s32 csum_scrub_thread(void *data)
+{
+	struct lsbdd_csum *csum = data;
+
+	while (!kthread_should_stop()) {
+		csum_scrub_pass(csum);
+		atomic64_inc(&csum->passes);
+		schedule_timeout_interruptible(LSBDD_SCRUB_INTERVAL_S * HZ);
+	}
+
+	return 0;
+}
+
+static void csum_scrub_stop(struct lsbdd_csum *csum)
+{
+	u32 i = 0;
+
+	if (csum->scrub_task)
+		kthread_stop(csum->scrub_task);
+	csum->scrub_task = NULL;
+
+	for (i = 0; i < BIO_MAX_VECS; i++) {
+		if (csum->scrub_pages[i])
+			__free_page(csum->scrub_pages[i]);
+		csum->scrub_pages[i] = NULL;
+	}
+}
+
+void lsbdd_csum_init(struct lsbdd_csum *csum, struct block_device *bdev, struct bio_set *bs, struct lsbdd_ds *ds,
+		     struct lsbdd_wbuf *wbuf, bool enabled, u32 scrub_rate)
+{
+	u32 i = 0;
+
+	BUG_ON(!csum || !bdev || !bs || !ds || !wbuf);
+
+	memset(csum->scrub_pages, 0, sizeof(csum->scrub_pages));
+	csum->scrub_task = NULL;
+	csum->scrub_rate = (u64)scrub_rate << 20;
+	csum->ds = ds;
+	csum->bdev = bdev;
+	csum->bs = bs;
+	csum->wbuf = wbuf;
+	csum->enabled = enabled;
+
+	atomic64_set(&csum->verified, 0);
+	atomic64_set(&csum->mismatches, 0);
+	atomic64_set(&csum->scrubbed, 0);
+	atomic64_set(&csum->scrub_bytes, 0);
+	atomic64_set(&csum->scrub_mismatches, 0);
+	atomic64_set(&csum->passes, 0);
+
+	if (!enabled || !scrub_rate)
+		return;
+
+	for (i = 0; i < BIO_MAX_VECS; i++) {
+		csum->scrub_pages[i] = alloc_page(GFP_KERNEL | __GFP_NOWARN);
+		if (!csum->scrub_pages[i])
+			goto scrub_err;
+	}
+
+	csum->scrub_task = kthread_run(csum_scrub_thread, csum, "lsbdd_scrub/%s", bdev->bd_disk->disk_name);
+	if (IS_ERR(csum->scrub_task)) {
+		csum->scrub_task = NULL;
+		goto scrub_err;
+	}
+
+	return;
+
+scrub_err:
+	pr_warn("Scrubber wasn't started, checksums are verified on reads only\n");
+	csum_scrub_stop(csum);
+}
+
+void lsbdd_csum_destroy(struct lsbdd_csum *csum)
+{
+	csum_scrub_stop(csum);
+	csum->enabled = false;
+}
+
+s32 lsbdd_csum_stats_show(struct lsbdd_csum *csum, const char *name, char *buf, s32 offset)
+{
+	return scnprintf(buf + offset, PAGE_SIZE - offset, "%s %d %lld %lld %lld %lld %lld %lld\n", name, csum->enabled,
+			 atomic64_read(&csum->verified), atomic64_read(&csum->mismatches), atomic64_read(&csum->scrubbed),
+			 atomic64_read(&csum->scrub_bytes), atomic64_read(&csum->scrub_mismatches), atomic64_read(&csum->passes));
+}
+
+s32 lsbdd_csum_wq_init(void)
+{
+	lsbdd_csum_pool = mempool_create_kmalloc_pool(LSBDD_CSUM_POOL_SIZE, sizeof(struct lsbdd_csum_ctx));
+	if (!lsbdd_csum_pool)
+		return -ENOMEM;
+
+	lsbdd_csum_wq = alloc_workqueue("lsbdd_csum", WQ_MEM_RECLAIM | WQ_UNBOUND, 0);
+	if (!lsbdd_csum_wq) {
+		mempool_destroy(lsbdd_csum_pool);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+void lsbdd_csum_wq_destroy(void)
+{
+	destroy_workqueue(lsbdd_csum_wq);
+	mempool_destroy(lsbdd_csum_pool);
+}
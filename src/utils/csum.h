@@ -0,0 +1,103 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef CSUM_H
+#define CSUM_H
+
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/crc32c.h>
+#include <linux/types.h>
+#include "ds_control.h"
+#include "wbuf.h"
+
+/**
+ * Per-extent data checksums.
+ *
+ * Each written extent gets crc32c of its data in the mapping value (check value_redir.h), the kernel crc32c
+ * is accelerated by the CPU (SSE4.2/PCLMUL on x86), so it is computed right on the write path.
+ * Compressed extents aren't checksummed (LZ4 decoding fails on the broken blob), trimmed parts of
+ * the extent lose the checksum, as it covers the whole extent.
+ *
+ * Reads that cover the whole extent are verified: clone end_io is replaced by the verifying one,
+ * which computes the checksum from the workqueue and calls the original end_io after it (with BLK_STS_IOERR
+ * on mismatch). The rest is covered by the scrubber.
+ *
+ * Scrubber kthread walks the mapping from the last key down (ds_prev), reads each checksummed extent
+ * and verifies it, limited by the rate (MiB/s). PBA's are never reused, so an extent that is overwritten
+ * while it is scrubbed still matches its old checksum. Mismatched extent is re-read once before it is reported,
+ * as its direct write can still be in flight. There is no redundancy, so mismatches are reported only.
+ */
+
+#define LSBDD_CSUM_SEED (~0U)
+#define LSBDD_SCRUB_MAX_EXTENT (BIO_MAX_VECS * PAGE_SIZE) // larger extents are skipped
+#define LSBDD_SCRUB_INTERVAL_S 60 // pause between the passes
+#define LSBDD_SCRUB_RETRY_MS 100
+#define LSBDD_CSUM_POOL_SIZE 16 // reserved verifications in flight
+
+struct lsbdd_csum {
+	struct task_struct *scrub_task;
+	struct page *scrub_pages[BIO_MAX_VECS];
+	u64 scrub_rate; // bytes per second
+	struct lsbdd_ds *ds;
+	struct block_device *bdev;
+	struct bio_set *bs;
+	struct lsbdd_wbuf *wbuf;
+	bool enabled;
+
+	// stats
+	atomic64_t verified;
+	atomic64_t mismatches;
+	atomic64_t scrubbed;
+	atomic64_t scrub_bytes;
+	atomic64_t scrub_mismatches;
+	atomic64_t passes;
+};
+
+// @return checksum of the linear data
+static inline u32 lsbdd_csum_buf(const void *data, u32 len)
+{
+	return crc32c(LSBDD_CSUM_SEED, data, len);
+}
+
+// @return checksum of the bio data (its current iterator range)
+u32 lsbdd_csum_bio(struct bio *bio);
+
+/**
+ * Initialises the checksums of the device and starts its scrubber.
+ *
+ * @param csum - checksum state (embedded into the device mng)
+ * @param bdev - redirect block device
+ * @param bs - bio set for the scrub reads
+ * @param ds - mapping of the device
+ * @param wbuf - write buffer of the device, extents that are still buffered are verified from it
+ * @param enabled - checksum the written extents and verify their reads
+ * @param scrub_rate - scrubber rate in MiB/s, 0 - scrubber isn't started
+ *
+ * @return void
+ */
+void lsbdd_csum_init(struct lsbdd_csum *csum, struct block_device *bdev, struct bio_set *bs, struct lsbdd_ds *ds,
+		     struct lsbdd_wbuf *wbuf, bool enabled, u32 scrub_rate);
+
+// Stops the scrubber and frees its buffer
+void lsbdd_csum_destroy(struct lsbdd_csum *csum);
+
+/**
+ * Makes the read clone verified on completion: its end_io is called from the workqueue after the check.
+ * Must be called right before the clone is submitted.
+ *
+ * @param csum - checksum state of the device
+ * @param clone - read clone of the whole extent
+ * @param expected - checksum of the extent
+ *
+ * @return void
+ */
+void lsbdd_csum_verify(struct lsbdd_csum *csum, struct bio *clone, u32 expected);
+
+// Prints the checksum statistics line of the device into buf + offset, @return number of written bytes
+s32 lsbdd_csum_stats_show(struct lsbdd_csum *csum, const char *name, char *buf, s32 offset);
+
+// Creates/destroys the verification workqueue and pool (shared by all the devices), called on module init/exit
+s32 lsbdd_csum_wq_init(void);
+void lsbdd_csum_wq_destroy(void);
+
+#endif
@@ -0,0 +1,321 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/gfp.h>
+#include <linux/hash.h>
+#include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/xxhash.h>
+#include "dedup.h"
+
+// Write in flight, linear copy of its data is hashed block by block
+struct lsbdd_dedup_write {
+	struct work_struct work;
+	struct bio *bio;
+	struct lsbdd_dedup *dd;
+	void *data;
+};
+
+static struct workqueue_struct *lsbdd_dedup_wq;
+
+static inline struct hlist_head *dedup_bucket(struct hlist_head *table, u8 bits, u64 key)
+{
+	return &table[hash_64(key, bits)];
+}
+
+static struct lsbdd_dedup_ent *dedup_lookup_fp(struct lsbdd_dedup *dd, u64 fp)
+{
+	struct lsbdd_dedup_ent *ent = NULL;
+
+	hlist_for_each_entry(ent, dedup_bucket(dd->fp_table, dd->bits, fp), fp_node) {
+		if (ent->fp == fp)
+			return ent;
+	}
+
+	return NULL;
+}
+
+static struct lsbdd_dedup_ent *dedup_lookup_pba(struct lsbdd_dedup *dd, sector_t pba)
+{
+	struct lsbdd_dedup_ent *ent = NULL;
+
+	hlist_for_each_entry(ent, dedup_bucket(dd->pba_table, dd->bits, pba), pba_node) {
+		if (ent->pba == pba)
+			return ent;
+	}
+
+	return NULL;
+}
+
+// Adds the stored block with one reference, the least recently unreferenced entry is evicted if the index is full
+static void dedup_index_add(struct lsbdd_dedup *dd, u64 fp, sector_t pba)
+{
+	struct lsbdd_dedup_ent *ent = NULL;
+	unsigned long flags = 0;
+
+	spin_lock_irqsave(&dd->lock, flags);
+	if (!list_empty(&dd->free)) {
+		ent = list_first_entry(&dd->free, struct lsbdd_dedup_ent, list);
+	} else if (!list_empty(&dd->unused)) {
+		ent = list_last_entry(&dd->unused, struct lsbdd_dedup_ent, list);
+		hlist_del(&ent->fp_node);
+		hlist_del(&ent->pba_node);
+		atomic64_inc(&dd->evictions);
+	} else {
+		spin_unlock_irqrestore(&dd->lock, flags);
+		return; // all the entries are referenced, block isn't indexed
+	}
+
+	list_del_init(&ent->list);
+	ent->fp = fp;
+	ent->pba = pba;
+	ent->refs = 1;
+	hlist_add_head(&ent->fp_node, dedup_bucket(dd->fp_table, dd->bits, fp));
+	hlist_add_head(&ent->pba_node, dedup_bucket(dd->pba_table, dd->bits, pba));
+	spin_unlock_irqrestore(&dd->lock, flags);
+}
+
+// Reads or writes one block synchronously, reads of the still buffered blocks are served by the write buffer
+static s32 dedup_rw_block(struct lsbdd_dedup *dd, blk_opf_t op, sector_t pba, void *block)
+{
+	struct bio *bio = NULL;
+	s32 status = 0;
+
+	bio = bio_alloc_bioset(dd->bdev, 1, op, GFP_NOIO, dd->bs);
+	bio->bi_iter.bi_sector = pba;
+	__bio_add_page(bio, virt_to_page(block), LSBDD_DEDUP_BLOCK_SIZE, offset_in_page(block));
+
+	if (op == REQ_OP_READ && lsbdd_wbuf_read(dd->wbuf, bio))
+		status = blk_status_to_errno(bio->bi_status);
+	else
+		status = submit_bio_wait(bio);
+
+	bio_put(bio);
+	return status;
+}
+
+bool lsbdd_dedup_find(struct lsbdd_dedup *dd, const void *block, u64 *fp, sector_t *pba)
+{
+	struct lsbdd_dedup_ent *ent = NULL;
+	struct page *page = NULL;
+	unsigned long flags = 0;
+	sector_t candidate = 0;
+	bool same = false;
+	s32 status = 0;
+
+	*fp = xxh64(block, LSBDD_DEDUP_BLOCK_SIZE, 0);
+	atomic64_inc(&dd->blocks);
+
+	spin_lock_irqsave(&dd->lock, flags);
+	ent = dedup_lookup_fp(dd, *fp);
+	if (ent)
+		candidate = ent->pba;
+	spin_unlock_irqrestore(&dd->lock, flags);
+
+	if (!ent)
+		return false;
+
+	// fingerprint match isn't enough, the stored block is compared in full
+	page = alloc_page(GFP_NOIO);
+	if (unlikely(!page))
+		return false;
+
+	status = dedup_rw_block(dd, REQ_OP_READ, candidate, page_address(page));
+	same = !status && !memcmp(page_address(page), block, LSBDD_DEDUP_BLOCK_SIZE);
+	__free_page(page);
+
+	if (!same) {
+		atomic64_inc(&dd->collisions);
+		return false;
+	}
+
+	// entry could be evicted while the block was compared, PBA data is still valid then
+	spin_lock_irqsave(&dd->lock, flags);
+	ent = dedup_lookup_pba(dd, candidate);
+	if (ent && !ent->refs++)
+		list_del_init(&ent->list);
+	spin_unlock_irqrestore(&dd->lock, flags);
+
+	atomic64_inc(&dd->hits);
+	*pba = candidate;
+
+	return true;
+}
+
+s32 lsbdd_dedup_store(struct lsbdd_dedup *dd, void *block, u64 fp, sector_t *pba)
+{
+	struct lsbdd_wbuf_seg *seg = NULL;
+	s32 status = 0;
+
+	seg = lsbdd_wbuf_reserve(dd->wbuf, LSBDD_DEDUP_BLOCK_SIZE, pba);
+	if (seg) {
+		lsbdd_wbuf_copy_in_buf(seg, *pba, block, LSBDD_DEDUP_BLOCK_SIZE);
+		lsbdd_wbuf_commit(seg);
+	} else {
+		*pba = atomic64_fetch_add(LSBDD_DEDUP_BLOCK_SECTORS, dd->wbuf->next_free_sector);
+		status = dedup_rw_block(dd, REQ_OP_WRITE, *pba, block);
+		if (unlikely(status))
+			return status;
+	}
+
+	dedup_index_add(dd, fp, *pba);
+
+	return 0;
+}
+
+void lsbdd_dedup_put(struct lsbdd_dedup *dd, sector_t pba)
+{
+	struct lsbdd_dedup_ent *ent = NULL;
+	unsigned long flags = 0;
+
+	if (!dd->enabled)
+		return;
+
+	spin_lock_irqsave(&dd->lock, flags);
+	ent = dedup_lookup_pba(dd, pba);
+	if (ent && ent->refs && !--ent->refs)
+		list_add(&ent->list, &dd->unused);
+	spin_unlock_irqrestore(&dd->lock, flags);
+}
+
+static void dedup_write_work(struct work_struct *work)
+{
+	struct lsbdd_dedup_write *w = container_of(work, struct lsbdd_dedup_write, work);
+	struct lsbdd_dedup *dd = w->dd;
+	struct bio *bio = w->bio;
+	struct bvec_iter iter;
+	struct bio_vec bv;
+	u32 offset = 0;
+	s32 status = 0;
+
+	bio_for_each_segment(bv, bio, iter) {
+		memcpy_from_bvec(w->data + offset, &bv);
+		offset += bv.bv_len;
+	}
+
+	status = dd->write(bio, w->data);
+	if (unlikely(status)) {
+		pr_err("Dedup: write of %llu failed with %d\n", bio->bi_iter.bi_sector, status);
+		bio_io_error(bio);
+	} else {
+		bio_endio(bio);
+	}
+
+	mempool_free(w->data, dd->buf_pool);
+	mempool_free(w, dd->write_pool);
+
+	if (atomic_dec_and_test(&dd->inflight))
+		wake_up(&dd->drain_wq);
+}
+
+void lsbdd_dedup_submit(struct lsbdd_dedup *dd, struct bio *bio)
+{
+	struct lsbdd_dedup_write *w = NULL;
+
+	w = mempool_alloc(dd->write_pool, GFP_NOIO);
+	w->data = mempool_alloc(dd->buf_pool, GFP_NOIO);
+	w->bio = bio;
+	w->dd = dd;
+	INIT_WORK(&w->work, dedup_write_work);
+
+	atomic_inc(&dd->inflight);
+	queue_work(lsbdd_dedup_wq, &w->work);
+}
+
+void lsbdd_dedup_init(struct lsbdd_dedup *dd, struct block_device *bdev, struct bio_set *bs, struct lsbdd_wbuf *wbuf,
+		      s32 (*write)(struct bio *bio, void *data), u32 nr_blocks)
+{
+	u32 i = 0;
+
+	BUG_ON(!dd || !bdev || !bs || !wbuf || !write);
+
+	spin_lock_init(&dd->lock);
+	INIT_LIST_HEAD(&dd->free);
+	INIT_LIST_HEAD(&dd->unused);
+	init_waitqueue_head(&dd->drain_wq);
+	atomic_set(&dd->inflight, 0);
+	dd->ents = NULL;
+	dd->fp_table = NULL;
+	dd->pba_table = NULL;
+	dd->write_pool = NULL;
+	dd->buf_pool = NULL;
+	dd->nr_ents = 0;
+	dd->write = write;
+	dd->bdev = bdev;
+	dd->bs = bs;
+	dd->wbuf = wbuf;
+	dd->enabled = false;
+
+	atomic64_set(&dd->blocks, 0);
+	atomic64_set(&dd->hits, 0);
+	atomic64_set(&dd->collisions, 0);
+	atomic64_set(&dd->evictions, 0);
+
+	if (!nr_blocks)
+		return;
+
+	dd->bits = max_t(u8, ilog2(roundup_pow_of_two(nr_blocks)), 1);
+	dd->ents = kvcalloc(nr_blocks, sizeof(struct lsbdd_dedup_ent), GFP_KERNEL);
+	dd->fp_table = kvcalloc(1U << dd->bits, sizeof(struct hlist_head), GFP_KERNEL);
+	dd->pba_table = kvcalloc(1U << dd->bits, sizeof(struct hlist_head), GFP_KERNEL);
+	dd->write_pool = mempool_create_kmalloc_pool(LSBDD_DEDUP_POOL_SIZE, sizeof(struct lsbdd_dedup_write));
+	dd->buf_pool = mempool_create_kmalloc_pool(LSBDD_DEDUP_POOL_SIZE, LSBDD_DEDUP_MAX_WRITE);
+	if (!dd->ents || !dd->fp_table || !dd->pba_table || !dd->write_pool || !dd->buf_pool)
+		goto mem_err;
+
+	for (i = 0; i < nr_blocks; i++) {
+		INIT_HLIST_NODE(&dd->ents[i].fp_node);
+		INIT_HLIST_NODE(&dd->ents[i].pba_node);
+		list_add_tail(&dd->ents[i].list, &dd->free);
+	}
+	dd->nr_ents = nr_blocks;
+	dd->enabled = true;
+
+	pr_debug("Dedup: index of %u blocks\n", dd->nr_ents);
+	return;
+
+mem_err:
+	pr_warn("Dedup index of %u blocks wasn't allocated, deduplication is disabled\n", nr_blocks);
+	lsbdd_dedup_destroy(dd);
+}
+
+void lsbdd_dedup_destroy(struct lsbdd_dedup *dd)
+{
+	if (dd->enabled)
+		wait_event(dd->drain_wq, !atomic_read(&dd->inflight));
+
+	dd->enabled = false;
+	mempool_destroy(dd->write_pool);
+	mempool_destroy(dd->buf_pool);
+	kvfree(dd->ents);
+	kvfree(dd->fp_table);
+	kvfree(dd->pba_table);
+	dd->write_pool = NULL;
+	dd->buf_pool = NULL;
+	dd->ents = NULL;
+	dd->fp_table = NULL;
+	dd->pba_table = NULL;
+	dd->nr_ents = 0;
+}
+
+s32 lsbdd_dedup_stats_show(struct lsbdd_dedup *dd, const char *name, char *buf, s32 offset)
+{
+	return scnprintf(buf + offset, PAGE_SIZE - offset, "%s %u %lld %lld %lld %lld\n", name, dd->nr_ents, atomic64_read(&dd->blocks),
+			 atomic64_read(&dd->hits), atomic64_read(&dd->collisions), atomic64_read(&dd->evictions));
+}
+
+s32 lsbdd_dedup_wq_init(void)
+{
+	lsbdd_dedup_wq = alloc_workqueue("lsbdd_dedup", WQ_MEM_RECLAIM | WQ_UNBOUND, 0);
+	if (!lsbdd_dedup_wq)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void lsbdd_dedup_wq_destroy(void)
+{
+	destroy_workqueue(lsbdd_dedup_wq);
+}
@@ -0,0 +1,137 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/list.h>
+#include <linux/mempool.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include "wbuf.h"
+
+/**
+ * Content-hash deduplication of the written blocks.
+ *
+ * 4K-aligned writes (up to LSBDD_WBUF_MAX_WRITE) are handed to the workqueue, where each block is fingerprinted
+ * with xxhash64. If the index has the block with the same fingerprint, it is read back (from the write buffer,
+ * if it is still there) and compared in full, on match the LBA is mapped to the existing PBA and nothing is written.
+ * Missed blocks are stored through the write buffer and added to the index.
+ *
+ * Index entries count the mappings that point to their PBA. Entries that aren't referenced anymore are kept
+ * in the LRU and are reused first when the index is full: PBA's are never reused, so their data stays valid.
+ *
+ * The write itself (mapping update, BIO completion) is done by the write callback of the device,
+ * it runs in the workqueue and may sleep.
+ */
+
+#define LSBDD_DEDUP_BLOCK_SIZE 4096
+#define LSBDD_DEDUP_BLOCK_SECTORS (LSBDD_DEDUP_BLOCK_SIZE >> SECTOR_SHIFT)
+#define LSBDD_DEDUP_MAX_WRITE LSBDD_WBUF_MAX_WRITE
+#define LSBDD_DEDUP_POOL_SIZE 4 // reserved writes in flight
+
+struct lsbdd_dedup_ent {
+	struct hlist_node fp_node;
+	struct hlist_node pba_node;
+	struct list_head list; // free or unused (refs == 0) list, referenced entries aren't linked
+	u64 fp;
+	sector_t pba;
+	u32 refs;
+};
+
+struct lsbdd_dedup {
+	spinlock_t lock;
+	struct lsbdd_dedup_ent *ents;
+	struct hlist_head *fp_table;
+	struct hlist_head *pba_table;
+	u8 bits;
+	u32 nr_ents;
+	struct list_head free;
+	struct list_head unused; // LRU of unreferenced entries, the least recently used ones are at the tail
+	mempool_t *write_pool;
+	mempool_t *buf_pool;
+	s32 (*write)(struct bio *bio, void *data);
+	atomic_t inflight;
+	wait_queue_head_t drain_wq;
+	struct block_device *bdev;
+	struct bio_set *bs;
+	struct lsbdd_wbuf *wbuf;
+	bool enabled;
+
+	// stats
+	atomic64_t blocks;
+	atomic64_t hits;
+	atomic64_t collisions;
+	atomic64_t evictions;
+};
+
+/**
+ * Initialises the deduplication and preallocates its index.
+ * If nr_blocks is 0 or allocation fails - deduplication stays disabled.
+ *
+ * @param dd - dedup state (embedded into the device mng)
+ * @param bdev - redirect block device
+ * @param bs - bio set for the compare reads and direct block writes
+ * @param wbuf - write buffer of the device, missed blocks are stored through it
+ * @param write - called from the workqueue for each submitted bio with its linear data,
+ *                bio is completed with its result after it
+ * @param nr_blocks - index capacity in blocks
+ *
+ * @return void
+ */
+void lsbdd_dedup_init(struct lsbdd_dedup *dd, struct block_device *bdev, struct bio_set *bs, struct lsbdd_wbuf *wbuf,
+		      s32 (*write)(struct bio *bio, void *data), u32 nr_blocks);
+
+// Waits for the writes in flight and frees the index
+void lsbdd_dedup_destroy(struct lsbdd_dedup *dd);
+
+// @return true if the write should go through the deduplication
+static inline bool lsbdd_dedup_fits(struct lsbdd_dedup *dd, struct bio *bio)
+{
+	return dd->enabled && !op_is_flush(bio->bi_opf) && bio->bi_iter.bi_size <= LSBDD_DEDUP_MAX_WRITE &&
+	       IS_ALIGNED(bio->bi_iter.bi_sector, LSBDD_DEDUP_BLOCK_SECTORS) && IS_ALIGNED(bio->bi_iter.bi_size, LSBDD_DEDUP_BLOCK_SIZE);
+}
+
+// Queues the write bio to the workqueue, it is passed to the write callback from there
+void lsbdd_dedup_submit(struct lsbdd_dedup *dd, struct bio *bio);
+
+/**
+ * Looks the block up in the index and compares it with the found one (sleeps on the read).
+ * On match the entry gets the reference of the new mapping.
+ *
+ * @param dd - dedup state of the device
+ * @param block - block data
+ * @param fp - fingerprint of the block is stored here (for lsbdd_dedup_store on miss)
+ * @param pba - PBA of the same block is stored here on match
+ *
+ * @return true if the same block is already stored
+ */
+bool lsbdd_dedup_find(struct lsbdd_dedup *dd, const void *block, u64 *fp, sector_t *pba);
+
+/**
+ * Writes the missed block (into the write buffer, or directly if it has no free segment)
+ * and adds it to the index with the reference of the new mapping.
+ *
+ * @param dd - dedup state of the device
+ * @param block - block data, page-aligned
+ * @param fp - fingerprint of the block
+ * @param pba - PBA of the written block is stored here
+ *
+ * @return 0 on success, I/O error otherwise
+ */
+s32 lsbdd_dedup_store(struct lsbdd_dedup *dd, void *block, u64 fp, sector_t *pba);
+
+// Drops the reference of the mapping that pointed to pba (no-op if pba isn't indexed)
+void lsbdd_dedup_put(struct lsbdd_dedup *dd, sector_t pba);
+
+// Prints the deduplication statistics line of the device into buf + offset, @return number of written bytes
+s32 lsbdd_dedup_stats_show(struct lsbdd_dedup *dd, const char *name, char *buf, s32 offset);
+
+// Creates/destroys the deduplication workqueue (shared by all the devices), called on module init/exit
+s32 lsbdd_dedup_wq_init(void);
+void lsbdd_dedup_wq_destroy(void);
+
+#endif
@@ -7,6 +7,9 @@
 #include "hashtable.h"
 #include "skiplist.h"
 #include "rbtree.h"
+#include "value_redir.h"
+#include "mag_cache.h"
+#include "lat_hist.h"
 
 #ifdef LF_MODE
 #include "lf_list.h"
@@ -42,11 +45,12 @@ s32 ds_init(struct lsbdd_ds *ds, char *sel_ds, struct lsbdd_cache_mng *cache_mng
 			return status;
 
 		btree_map->head = root;
+		ds_track_init(&btree_map->track);
 		ds->type = BTREE_TYPE;
 		ds->structure.map_btree = btree_map;
 	} else if (!strncmp(sel_ds, sl, 2)) {
-		cache_mng->sl_cache = kmem_cache_create(
-			"lsbdd_skiplist_cache", sizeof(struct skiplist_node) + 24 * sizeof(struct skiplist_node *), 0, SLAB_HWCACHE_ALIGN, NULL);
+		cache_mng->sl_cache = lsbdd_mag_cache_create(
+			"lsbdd_skiplist_cache", sizeof(struct skiplist_node) + 24 * sizeof(struct skiplist_node *), 0, SLAB_HWCACHE_ALIGN);
 		// TODO docs
 		if (!cache_mng->sl_cache) {
 			pr_err("ERROR DS_INIT: skiplist cache not initialized!\n");
@@ -60,10 +64,10 @@ s32 ds_init(struct lsbdd_ds *ds, char *sel_ds, struct lsbdd_cache_mng *cache_mng
 		ds->structure.map_list = skiplist;
 	} else if (!strncmp(sel_ds, ht, 2)) {
 		#ifdef LF_MODE
-		cache_mng->ht_cache = kmem_cache_create("lsbdd_hashtable_cache", sizeof(struct lf_list_node), 0, SLAB_HWCACHE_ALIGN, NULL);
+		cache_mng->ht_cache = lsbdd_mag_cache_create("lsbdd_hashtable_cache", sizeof(struct lf_list_node), 0, SLAB_HWCACHE_ALIGN);
 		#endif
 		#ifdef SY_MODE
-		cache_mng->ht_cache = kmem_cache_create("lsbdd_hashtable_cache", sizeof(struct hash_el), 0, SLAB_HWCACHE_ALIGN, NULL);
+		cache_mng->ht_cache = lsbdd_mag_cache_create("lsbdd_hashtable_cache", sizeof(struct hash_el), 0, SLAB_HWCACHE_ALIGN);
 		#endif
 		if (!cache_mng->ht_cache) {
 			pr_err("ERROR DS_INIT: hastable cache not initialized!\n");
@@ -78,8 +82,16 @@ s32 ds_init(struct lsbdd_ds *ds, char *sel_ds, struct lsbdd_cache_mng *cache_mng
 		ds->structure.map_hash = hash_table;
 		ds->structure.map_hash->max_bck_num = 0;
 	} else if (!strncmp(sel_ds, rb, 2)) {
-		rbtree_map = kzalloc(sizeof(struct rbtree), GFP_KERNEL);
-		rbtree_map = rbtree_init();
+		cache_mng->rb_cache = lsbdd_mag_cache_create("lsbdd_rbtree_cache", sizeof(struct rbtree_node), 0, SLAB_HWCACHE_ALIGN);
+		if (!cache_mng->rb_cache) {
+			pr_err("ERROR DS_INIT: rbtree cache not initialized!\n");
+			return -1;
+		}
+
+		rbtree_map = rbtree_init(cache_mng->rb_cache);
+		if (!rbtree_map)
+			goto mem_err;
+
 		ds->type = RBTREE_TYPE;
 		ds->structure.map_rbtree = rbtree_map;
 	} else {
@@ -113,13 +125,13 @@ void ds_free(struct lsbdd_ds *ds, struct lsbdd_cache_mng *cache_mng, struct kmem
 		ds->structure.map_hash = NULL;
 		break;
 	case RBTREE_TYPE:
-		rbtree_free(ds->structure.map_rbtree);
+		rbtree_free(ds->structure.map_rbtree, lsbdd_value_cache);
 		ds->structure.map_rbtree = NULL;
 		break;
 	}
 }
 
-void *ds_lookup(struct lsbdd_ds *ds, sector_t key)
+static void *__ds_lookup(struct lsbdd_ds *ds, sector_t key)
 {
 	BUG_ON(!ds);
 
@@ -156,16 +168,21 @@ void *ds_lookup(struct lsbdd_ds *ds, sector_t key)
 	return NULL;
 }
 
-void ds_remove(struct lsbdd_ds *ds, sector_t key, struct kmem_cache *lsbdd_value_cache)
+static void __ds_remove(struct lsbdd_ds *ds, sector_t key, struct kmem_cache *lsbdd_value_cache)
 {
 	BUG_ON(!ds || !lsbdd_value_cache);
 
+	void *value = NULL;
 	u64 *kp = NULL;
 
 	kp = &key;
 	switch (ds->type) {
 	case BTREE_TYPE:
-		btree_remove(ds->structure.map_btree->head, &btree_geo64, (unsigned long *)kp);
+		value = btree_remove(ds->structure.map_btree->head, &btree_geo64, (unsigned long *)kp);
+		if (value) {
+			ds_track_remove(&ds->structure.map_btree->track, key);
+			lsbdd_value_free(lsbdd_value_cache, value);
+		}
 		break;
 	case SKIPLIST_TYPE:
 		skiplist_remove(ds->structure.map_list, key, lsbdd_value_cache);
@@ -174,21 +191,25 @@ void ds_remove(struct lsbdd_ds *ds, sector_t key, struct kmem_cache *lsbdd_value
 		hashtable_remove(ds->structure.map_hash, key, lsbdd_value_cache);
 		break;
 	case RBTREE_TYPE:
-		rbtree_remove(ds->structure.map_rbtree, key);
+		rbtree_remove(ds->structure.map_rbtree, key, lsbdd_value_cache);
 		break;
 	}
 }
 
-s32 ds_insert(struct lsbdd_ds *ds, sector_t key, void *value, struct lsbdd_cache_mng *cache_mng, struct kmem_cache *lsbdd_value_cache)
+static s32 __ds_insert(struct lsbdd_ds *ds, sector_t key, void *value, struct lsbdd_cache_mng *cache_mng,
+		      struct kmem_cache *lsbdd_value_cache)
 {
 	BUG_ON(!ds || !cache_mng || !lsbdd_value_cache);
+	s32 status = 0;
 	u64 *kp = NULL;
 
 	kp = &key;
 	switch (ds->type) {
 	case  BTREE_TYPE:
-		return btree_insert(ds->structure.map_btree->head, &btree_geo64, (unsigned long *)kp, value, GFP_KERNEL);
-		break;
+		status = btree_insert(ds->structure.map_btree->head, &btree_geo64, (unsigned long *)kp, value, GFP_KERNEL);
+		if (!status)
+			ds_track_insert(&ds->structure.map_btree->track, key);
+		return status;
 	case SKIPLIST_TYPE:
 		skiplist_insert(ds->structure.map_list, key, value, cache_mng->sl_cache, lsbdd_value_cache);
 		break;
@@ -196,48 +217,38 @@ s32 ds_insert(struct lsbdd_ds *ds, sector_t key, void *value, struct lsbdd_cache
 		hashtable_insert(ds->structure.map_hash, key, value, cache_mng->ht_cache, lsbdd_value_cache);
 		break;
 	case RBTREE_TYPE:
-		rbtree_add(ds->structure.map_rbtree, key, value);
+		rbtree_add(ds->structure.map_rbtree, key, value, lsbdd_value_cache);
 		break;
 	}
 	return 0;
 }
 
+static sector_t btree_find_last(void *ds)
+{
+	struct btree *btree_map = ds;
+
+	return btree_last_no_rep(btree_map->head, &btree_geo64, NULL);
+}
+
 sector_t ds_last(struct lsbdd_ds *ds, sector_t key)
 {
 	BUG_ON(!ds);
-	#ifdef LF_MODE
-	struct lf_list_node *hm_node = NULL;
-#endif
-	#ifdef SY_MODE
-	struct hash_el *hm_node = NULL;
-	#endif
-	struct rbtree_node *rb_node = NULL;
-	u64 *kp = NULL;
 
-	kp = &key;
 	switch (ds->type) {
 	case BTREE_TYPE:
-		return btree_last_no_rep(ds->structure.map_btree->head, &btree_geo64, (unsigned long *)kp);
-		break;
+		return ds_track_last(&ds->structure.map_btree->track, btree_find_last, ds->structure.map_btree);
 	case SKIPLIST_TYPE:
 		return skiplist_last(ds->structure.map_list);
-		break;
 	case HASHTABLE_TYPE:
-		hm_node = ds->structure.map_hash->last_el;
-		if (hm_node == NULL)
-			return 0;
-		return hm_node->key;
+		return hashtable_last(ds->structure.map_hash);
 	case RBTREE_TYPE:
-		rb_node = rbtree_last(ds->structure.map_rbtree);
-		if (rb_node == NULL)
-			return 0;
-		return rb_node->key;
+		return rbtree_last(ds->structure.map_rbtree);
 	}
 	pr_err("Failed to get rs_info from get_last()\n");
 	BUG();
 }
 
-void *ds_prev(struct lsbdd_ds *ds, sector_t key, sector_t *prev_key)
+static void *__ds_prev(struct lsbdd_ds *ds, sector_t key, sector_t *prev_key)
 {
 	BUG_ON(!ds);
 
@@ -249,18 +260,27 @@ void *ds_prev(struct lsbdd_ds *ds, sector_t key, sector_t *prev_key)
 	struct hash_el *hm_node = NULL;
 	#endif
 	struct rbtree_node *rb_node = NULL;
+	void *value = NULL;
 	u64 *kp = NULL;
 
 	kp = &key;
 	switch (ds->type) {
 	case BTREE_TYPE:
+		// btree search is inclusive, others are strict
+		if (!key)
+			return NULL;
+		key--;
 		return btree_get_prev_no_rep(ds->structure.map_btree->head, &btree_geo64, (unsigned long *)kp, (unsigned long *)prev_key);
 		break;
 	case SKIPLIST_TYPE:
-		sl_node = skiplist_prev(ds->structure.map_list, key, prev_key);
-		CHECK_FOR_NULL(sl_node);
-		CHECK_VALUE_AND_RETURN(sl_node);
-		break;
+		// value of the node is swapped to NULL by a concurrent remove, the next smaller key is taken then
+		do {
+			sl_node = skiplist_prev(ds->structure.map_list, key, prev_key);
+			CHECK_FOR_NULL(sl_node);
+			value = READ_ONCE(sl_node->value);
+			key = sl_node->key;
+		} while (!value);
+		return value;
 	case HASHTABLE_TYPE:
 		hm_node = hashtable_prev(ds->structure.map_hash, key, prev_key);
 		CHECK_FOR_NULL(hm_node);
@@ -276,17 +296,161 @@ void *ds_prev(struct lsbdd_ds *ds, sector_t key, sector_t *prev_key)
 	BUG();
 }
 
+/*
+ * Timed wrappers of the map operations, the timing is compiled out without LSBDD_LAT_HIST (check lat_hist.h).
+ */
+
+void *ds_lookup(struct lsbdd_ds *ds, sector_t key)
+{
+	u64 start = lsbdd_lat_start();
+	void *value = __ds_lookup(ds, key);
+
+	lsbdd_lat_end(LSBDD_LAT_DS_LOOKUP, start);
+	return value;
+}
+
+void ds_remove(struct lsbdd_ds *ds, sector_t key, struct kmem_cache *lsbdd_value_cache)
+{
+	u64 start = lsbdd_lat_start();
+
+	__ds_remove(ds, key, lsbdd_value_cache);
+	lsbdd_lat_end(LSBDD_LAT_DS_REMOVE, start);
+}
+
+s32 ds_insert(struct lsbdd_ds *ds, sector_t key, void *value, struct lsbdd_cache_mng *cache_mng, struct kmem_cache *lsbdd_value_cache)
+{
+	u64 start = lsbdd_lat_start();
+	s32 status = __ds_insert(ds, key, value, cache_mng, lsbdd_value_cache);
+
+	lsbdd_lat_end(LSBDD_LAT_DS_INSERT, start);
+	return status;
+}
+
+void *ds_prev(struct lsbdd_ds *ds, sector_t key, sector_t *prev_key)
+{
+	u64 start = lsbdd_lat_start();
+	void *value = __ds_prev(ds, key, prev_key);
+
+	lsbdd_lat_end(LSBDD_LAT_DS_PREV, start);
+	return value;
+}
+
 bool ds_empty_check(struct lsbdd_ds *ds)
 {
 	BUG_ON(!ds);
 
-	if (ds->type == BTREE_TYPE && ds->structure.map_btree->head->height == 0)
+	if (ds->type == BTREE_TYPE && ds_track_is_empty(&ds->structure.map_btree->track))
 		return true;
 	if (ds->type == SKIPLIST_TYPE && skiplist_is_empty(ds->structure.map_list))
 		return true;
 	if (ds->type == HASHTABLE_TYPE && hashtable_is_empty(ds->structure.map_hash))
 		return true;
-	if (ds->type == RBTREE_TYPE && ds->structure.map_rbtree->node_num == 0)
+	if (ds->type == RBTREE_TYPE && rbtree_is_empty(ds->structure.map_rbtree))
 		return true;
 	return false;
 }
+
+static struct lsbdd_ds_track *ds_track(struct lsbdd_ds *ds)
+{
+	switch (ds->type) {
+	case BTREE_TYPE:
+		return &ds->structure.map_btree->track;
+	case SKIPLIST_TYPE:
+		return &ds->structure.map_list->track;
+	case HASHTABLE_TYPE:
+		return &ds->structure.map_hash->track;
+	case RBTREE_TYPE:
+		return &ds->structure.map_rbtree->track;
+	}
+	BUG();
+}
+
+s64 ds_size(struct lsbdd_ds *ds)
+{
+	BUG_ON(!ds);
+
+	return max_t(s64, ds_track_size(ds_track(ds)), 0);
+}
+
+u64 ds_mem(struct lsbdd_ds *ds, struct lsbdd_cache_mng *cache_mng)
+{
+	BUG_ON(!ds || !cache_mng);
+
+	u64 size = ds_size(ds);
+	u64 removed = ds_removed_nodes(ds);
+	u64 bt_node = 0;
+
+	switch (ds->type) {
+	case BTREE_TYPE:
+		// inner nodes are few, leaves are counted as half full (as they are right after the split)
+		bt_node = btree_geo64.no_pairs * (btree_geo64.keylen + 1) * sizeof(unsigned long);
+		return DIV_ROUND_UP(size, btree_geo64.no_pairs / 2) * bt_node;
+	case SKIPLIST_TYPE:
+		return (size + removed) * kmem_cache_size(cache_mng->sl_cache);
+	case HASHTABLE_TYPE:
+		return (size + removed) * kmem_cache_size(cache_mng->ht_cache) + sizeof(struct hashtable);
+	case RBTREE_TYPE:
+		return size * kmem_cache_size(cache_mng->rb_cache);
+	}
+	return 0;
+}
+
+u64 ds_removed_nodes(struct lsbdd_ds *ds)
+{
+	BUG_ON(!ds);
+
+#ifdef LF_MODE
+	if (ds->type == SKIPLIST_TYPE)
+		return skiplist_removed_nodes(ds->structure.map_list);
+	if (ds->type == HASHTABLE_TYPE)
+		return hashtable_removed_nodes(ds->structure.map_hash);
+#endif
+	return 0;
+}
+
+// bt walk from the last key down, btree_get_prev_no_rep is inclusive
+static s32 btree_iter(struct btree *btree_map, ds_iter_fn fn, void *data)
+{
+	unsigned long key = 0;
+	unsigned long prev_key = 0;
+	void *value = NULL;
+	s32 status = 0;
+
+	if (!btree_map->head->height)
+		return 0;
+
+	key = btree_last_no_rep(btree_map->head, &btree_geo64, NULL);
+	value = btree_lookup(btree_map->head, &btree_geo64, &key);
+	while (value) {
+		status = fn(key, value, data);
+		if (status || !key)
+			return status;
+
+		prev_key = key - 1;
+		if (!prev_key) { // zero key is out of btree_get_prev_no_rep reach
+			key = 0;
+			value = btree_lookup(btree_map->head, &btree_geo64, &key);
+			continue;
+		}
+		value = btree_get_prev_no_rep(btree_map->head, &btree_geo64, &prev_key, &key);
+	}
+
+	return 0;
+}
+
+s32 ds_iter(struct lsbdd_ds *ds, ds_iter_fn fn, void *data)
+{
+	BUG_ON(!ds || !fn);
+
+	switch (ds->type) {
+	case BTREE_TYPE:
+		return btree_iter(ds->structure.map_btree, fn, data);
+	case SKIPLIST_TYPE:
+		return skiplist_iter(ds->structure.map_list, fn, data);
+	case HASHTABLE_TYPE:
+		return hashtable_iter(ds->structure.map_hash, fn, data);
+	case RBTREE_TYPE:
+		return rbtree_iter(ds->structure.map_rbtree, fn, data);
+	}
+	return 0;
+}
@@ -46,7 +46,24 @@ void *ds_lookup(struct lsbdd_ds *ds, sector_t key);
 void ds_remove(struct lsbdd_ds *ds, sector_t key, struct kmem_cache *value_cache);
 int ds_insert(struct lsbdd_ds *ds, sector_t key, void *value, struct lsbdd_cache_mng *lsbdd_cache_mng, struct kmem_cache *value_cache);
 sector_t ds_last(struct lsbdd_ds *ds, sector_t key);
+// @return value of the greatest key < key (stored in prev_key), NULL if there is no such one
 void *ds_prev(struct lsbdd_ds *ds, sector_t key, sector_t *prev_key);
 bool ds_empty_check(struct lsbdd_ds *ds);
+// @return number of mapped keys, O(1)
+s64 ds_size(struct lsbdd_ds *ds);
+// @return estimated memory of the structure nodes in bytes (values aren't included)
+u64 ds_mem(struct lsbdd_ds *ds, struct lsbdd_cache_mng *lsbdd_cache_mng);
+// @return number of removed nodes that are kept until ds_free (lock-free sl and ht), O(n)
+u64 ds_removed_nodes(struct lsbdd_ds *ds);
+
+// Map iteration callback, non-zero return stops the iteration
+typedef s32 (*ds_iter_fn)(sector_t key, void *value, void *data);
+/**
+ * Calls fn for every mapped key. Order depends on the structure: ascending for sl and rb, descending for bt,
+ * bucket by bucket for ht. Goes concurrently with the updates, so it sees a moving map.
+ *
+ * @return first non-zero result of fn, 0 if all the keys were visited
+ */
+s32 ds_iter(struct lsbdd_ds *ds, ds_iter_fn fn, void *data);
 
 #endif
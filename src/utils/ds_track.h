@@ -0,0 +1,98 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef DS_TRACK_H
+#define DS_TRACK_H
+
+#include <linux/atomic.h>
+#include <linux/bits.h>
+#include <linux/types.h>
+
+/**
+ * Live-entry counter and max-key hint, embedded in every data structure,
+ * so emptiness and last key checks (done on every unmapped read) are O(1).
+ *
+ * last_key is always >= the real max key. Removing the max key only sets the STALE bit,
+ * the hint is recomputed lazily (by the structure specific walk) on the next ds_last call.
+ * Inserting a key >= the stale hint makes it exact again without any walk (f.e. overwrite of the last block).
+ *
+ * Data structures must call ds_track_insert() only when a new key was linked (not on value update)
+ * and ds_track_remove() only when the key was really removed.
+ */
+
+#define LSBDD_TRACK_STALE BIT_ULL(63)
+#define LSBDD_TRACK_KEY(v) ((sector_t)((v) & ~LSBDD_TRACK_STALE))
+
+struct lsbdd_ds_track {
+	atomic64_t size;
+	atomic64_t last_key;
+};
+
+static inline void ds_track_init(struct lsbdd_ds_track *track)
+{
+	atomic64_set(&track->size, 0);
+	atomic64_set(&track->last_key, 0);
+}
+
+static inline void ds_track_insert(struct lsbdd_ds_track *track, sector_t key)
+{
+	s64 old = 0;
+	s64 new = 0;
+
+	atomic64_inc(&track->size);
+
+	old = atomic64_read(&track->last_key);
+	do {
+		if (LSBDD_TRACK_KEY(old) > key || old == key)
+			return; // hint (even stale one) is still an upper bound
+		new = key; // key >= previous max (or upper bound of it), so the hint is exact again
+	} while (!atomic64_try_cmpxchg(&track->last_key, &old, new));
+}
+
+static inline void ds_track_remove(struct lsbdd_ds_track *track, sector_t key)
+{
+	s64 old = 0;
+
+	atomic64_dec(&track->size);
+
+	old = atomic64_read(&track->last_key);
+	do {
+		if (LSBDD_TRACK_KEY(old) != key || (old & LSBDD_TRACK_STALE))
+			return;
+	} while (!atomic64_try_cmpxchg(&track->last_key, &old, old | LSBDD_TRACK_STALE));
+}
+
+static inline bool ds_track_is_empty(struct lsbdd_ds_track *track)
+{
+	return atomic64_read(&track->size) <= 0;
+}
+
+static inline s64 ds_track_size(struct lsbdd_ds_track *track)
+{
+	return atomic64_read(&track->size);
+}
+
+/**
+ * Returns the max key. Walks the structure (find_last callback) only if the hint is stale.
+ * If the hint was changed concurrently with the walk - it stays stale, result of the walk is returned anyway.
+ *
+ * @param track - tracker of the structure
+ * @param find_last - structure specific max key search
+ * @param ds - structure passed to find_last
+ *
+ * @return max key, 0 if structure is empty
+ */
+static inline sector_t ds_track_last(struct lsbdd_ds_track *track, sector_t (*find_last)(void *ds), void *ds)
+{
+	s64 old = atomic64_read(&track->last_key);
+	sector_t last = 0;
+
+	if (likely(!(old & LSBDD_TRACK_STALE)))
+		return old;
+
+	last = find_last(ds);
+	atomic64_cmpxchg(&track->last_key, old, last);
+
+	return last;
+}
+
+#endif
@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/kernel.h>
+#include "flush.h"
+
+static struct workqueue_struct *lsbdd_flush_wq;
+
+/**
+ * Takes all the waiters under the lock, flushes the device cache and completes them.
+ * Device is flushed without waiters only if force is set.
+ */
+static void flush_commit(struct lsbdd_flush *flush, bool force)
+{
+	struct bio_list waiters = BIO_EMPTY_LIST;
+	struct bio *waiter = NULL;
+	blk_status_t status = BLK_STS_OK;
+	unsigned long flags = 0;
+
+	spin_lock_irqsave(&flush->lock, flags);
+	bio_list_merge(&waiters, &flush->waiters);
+	bio_list_init(&flush->waiters);
+	spin_unlock_irqrestore(&flush->lock, flags);
+
+	if (!force && bio_list_empty(&waiters))
+		return;
+
+	status = errno_to_blk_status(blkdev_issue_flush(flush->bdev));
+	atomic64_inc(&flush->commits);
+	pr_debug("Flush: commit status %d\n", status);
+
+	while ((waiter = bio_list_pop(&waiters))) {
+		waiter->bi_status = status;
+		bio_endio(waiter);
+	}
+}
+
+static void flush_commit_work(struct work_struct *work)
+{
+	flush_commit(container_of(work, struct lsbdd_flush, commit_work), false);
+}
+
+void lsbdd_flush_init(struct lsbdd_flush *flush, struct block_device *bdev)
+{
+	BUG_ON(!flush || !bdev);
+
+	spin_lock_init(&flush->lock);
+	bio_list_init(&flush->waiters);
+	INIT_WORK(&flush->commit_work, flush_commit_work);
+	flush->bdev = bdev;
+
+	atomic64_set(&flush->flushes, 0);
+	atomic64_set(&flush->commits, 0);
+}
+
+void lsbdd_flush_destroy(struct lsbdd_flush *flush)
+{
+	if (!flush->bdev)
+		return;
+
+	flush_work(&flush->commit_work);
+	flush_commit(flush, true);
+	flush->bdev = NULL;
+}
+
+void lsbdd_flush_queue(struct lsbdd_flush *flush, struct bio *bio)
+{
+	unsigned long flags = 0;
+
+	spin_lock_irqsave(&flush->lock, flags);
+	bio_list_add(&flush->waiters, bio);
+	spin_unlock_irqrestore(&flush->lock, flags);
+
+	atomic64_inc(&flush->flushes);
+	// if the commit is running now - work is requeued and the next commit takes all the waiters arrived meanwhile
+	queue_work(lsbdd_flush_wq, &flush->commit_work);
+}
+
+s32 lsbdd_flush_stats_show(struct lsbdd_flush *flush, const char *name, char *buf, s32 offset)
+{
+	return scnprintf(buf + offset, PAGE_SIZE - offset, "%s %lld %lld\n", name, atomic64_read(&flush->flushes),
+			 atomic64_read(&flush->commits));
+}
+
+s32 lsbdd_flush_wq_init(void)
+{
+	lsbdd_flush_wq = alloc_workqueue("lsbdd_flush", WQ_MEM_RECLAIM | WQ_UNBOUND, 0);
+	if (!lsbdd_flush_wq)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void lsbdd_flush_wq_destroy(void)
+{
+	destroy_workqueue(lsbdd_flush_wq);
+}
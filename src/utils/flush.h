@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef FLUSH_H
+#define FLUSH_H
+
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/workqueue.h>
+
+/**
+ * Group commit of flush and FUA requests.
+ *
+ * Only the device flush is batched here, nothing is persisted beyond the data. The disk still advertises
+ * BLK_FEAT_WRITE_CACHE | BLK_FEAT_FUA, but the mapping (LBA -> PBA) is kept in memory only: a completed flush
+ * means the data of all the writes completed before it is on the stable media of the redirect device,
+ * not that it can be found there after a crash or module reload - the mapping is never made durable.
+ *
+ * Flush and FUA BIOs don't flush the device by themselves - they are queued as waiters (after their own data
+ * and the buffered segments are written), and the commit work issues one device flush, then completes
+ * every waiter that arrived before it at once. Waiters arrived meanwhile are taken by the next commit.
+ *
+ * The flush is issued from the workqueue: BIOs submitted from ->submit_bio
+ * aren't dispatched until it returns, so waiting for them there would deadlock.
+ */
+
+struct lsbdd_flush {
+	spinlock_t lock;
+	struct bio_list waiters; // flush/FUA bios completed by the next commit
+	struct work_struct commit_work;
+	struct block_device *bdev;
+
+	// stats
+	atomic64_t flushes;
+	atomic64_t commits;
+};
+
+/**
+ * Initialises the group commit of the device.
+ *
+ * @param flush - flush structure (embedded into the device mng)
+ * @param bdev - redirect block device, its cache is flushed by the commit
+ *
+ * @return void
+ */
+void lsbdd_flush_init(struct lsbdd_flush *flush, struct block_device *bdev);
+
+// Waits for the running commit and flushes the device once more, waiters (if any) are completed
+void lsbdd_flush_destroy(struct lsbdd_flush *flush);
+
+/**
+ * Queues the bio until the next commit. It is completed (bio_endio) by the commit work,
+ * after the device flush issued after this call.
+ *
+ * @param flush - flush structure of the device
+ * @param bio - original flush/FUA bio, its data (if any) is already written
+ *
+ * @return void
+ */
+void lsbdd_flush_queue(struct lsbdd_flush *flush, struct bio *bio);
+
+// Prints the commit statistics line of the device into buf + offset, @return number of written bytes
+s32 lsbdd_flush_stats_show(struct lsbdd_flush *flush, const char *name, char *buf, s32 offset);
+
+// Creates/destroys the commit workqueue (shared by all the devices), called on module init/exit
+s32 lsbdd_flush_wq_init(void);
+void lsbdd_flush_wq_destroy(void);
+
+#endif
@@ -0,0 +1,128 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/seq_file.h>
+#include <linux/string.h>
+#include "lat_hist.h"
+
+DEFINE_PER_CPU(struct lsbdd_lat_cpu, lsbdd_lat);
+
+static const char *lat_op_names[LSBDD_LAT_OPS_NUM] = {
+	"ds_lookup", "ds_insert", "ds_remove", "ds_prev", "setup_read", "setup_write", "setup_unmap", "bio_split",
+};
+
+/**
+ * Sums the histogram of the operation over all the CPU's.
+ *
+ * @param op - operation
+ * @param buckets - array of LSBDD_LAT_BUCKETS to fill
+ * @param sum_ns - total time spent in the operation
+ *
+ * @return number of the recorded calls
+ */
+static u64 lat_read(enum lsbdd_lat_op op, u64 *buckets, u64 *sum_ns)
+{
+	struct lsbdd_lat_cpu *lat = NULL;
+	u64 count = 0;
+	s32 cpu = 0;
+	u8 i = 0;
+
+	memset(buckets, 0, LSBDD_LAT_BUCKETS * sizeof(u64));
+	*sum_ns = 0;
+
+	for_each_possible_cpu(cpu) {
+		lat = per_cpu_ptr(&lsbdd_lat, cpu);
+		for (i = 0; i < LSBDD_LAT_BUCKETS; i++)
+			buckets[i] += READ_ONCE(lat->buckets[op][i]);
+		*sum_ns += READ_ONCE(lat->sum_ns[op]);
+	}
+
+	for (i = 0; i < LSBDD_LAT_BUCKETS; i++)
+		count += buckets[i];
+
+	return count;
+}
+
+// @return upper bound (ns) of the bucket the permille'th call falls into, 0 if there were no calls
+static u64 lat_percentile(const u64 *buckets, u64 count, u32 permille)
+{
+	u64 rank = DIV_ROUND_UP(count * permille, 1000);
+	u64 seen = 0;
+	u8 i = 0;
+
+	if (!count)
+		return 0;
+
+	for (i = 0; i < LSBDD_LAT_BUCKETS - 1; i++) {
+		seen += buckets[i];
+		if (seen >= rank)
+			break;
+	}
+
+	return (1ULL << (i + 1)) - 1;
+}
+
+static s32 lsbdd_lat_show(struct seq_file *m, void *v)
+{
+	u64 buckets[LSBDD_LAT_BUCKETS];
+	u64 sum_ns = 0;
+	u64 count = 0;
+	u8 op = 0;
+	u8 i = 0;
+
+	seq_puts(m, "op count avg_ns p50_ns p99_ns p999_ns\n");
+	for (op = 0; op < LSBDD_LAT_OPS_NUM; op++) {
+		count = lat_read(op, buckets, &sum_ns);
+		seq_printf(m, "%s %llu %llu %llu %llu %llu\n", lat_op_names[op], count, count ? div64_u64(sum_ns, count) : 0,
+			   lat_percentile(buckets, count, 500), lat_percentile(buckets, count, 990),
+			   lat_percentile(buckets, count, 999));
+	}
+
+	// Raw histograms, column i counts the calls that took [2^i, 2^(i + 1)) ns
+	seq_puts(m, "\nop buckets\n");
+	for (op = 0; op < LSBDD_LAT_OPS_NUM; op++) {
+		lat_read(op, buckets, &sum_ns);
+		seq_printf(m, "%s", lat_op_names[op]);
+		for (i = 0; i < LSBDD_LAT_BUCKETS; i++)
+			seq_printf(m, " %llu", buckets[i]);
+		seq_putc(m, '\n');
+	}
+
+	return 0;
+}
+
+static s32 lsbdd_lat_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lsbdd_lat_show, inode->i_private);
+}
+
+/**
+ * Resets the histograms, the written data itself is ignored.
+ * Calls in flight on the other CPU's may still land in the old counts.
+ */
+static ssize_t lsbdd_lat_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+	s32 cpu = 0;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(&lsbdd_lat, cpu), 0, sizeof(struct lsbdd_lat_cpu));
+
+	return count;
+}
+
+static const struct file_operations lsbdd_lat_fops = {
+	.owner = THIS_MODULE,
+	.open = lsbdd_lat_open,
+	.read = seq_read,
+	.write = lsbdd_lat_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+void lsbdd_lat_debugfs_init(struct dentry *parent)
+{
+	debugfs_create_file("latency", 0644, parent, NULL, &lsbdd_lat_fops);
+}
@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef LAT_HIST_H
+#define LAT_HIST_H
+
+#include <linux/types.h>
+
+struct dentry;
+
+/**
+ * Latency histograms of the map operations and of the BIO setup paths.
+ *
+ * Built only with "make type=<lf/sy> lat=1" (LSBDD_LAT_HIST). Otherwise lsbdd_lat_start/lsbdd_lat_end are
+ * empty inlines, so the instrumented call sites compile to the plain calls.
+ *
+ * Buckets are log2 of the nanoseconds: bucket i holds the latencies in [2^i, 2^(i + 1)) ns, the last one
+ * everything above. Histograms are per-CPU and module-wide (ds_* calls don't know the device they serve),
+ * the ds_* ones are nested in the setup ones.
+ *
+ * Exported through debugfs: /sys/kernel/debug/lsbdd/latency, any write to the file resets them.
+ */
+
+#define LSBDD_LAT_BUCKETS 32
+
+enum lsbdd_lat_op {
+	LSBDD_LAT_DS_LOOKUP,
+	LSBDD_LAT_DS_INSERT,
+	LSBDD_LAT_DS_REMOVE,
+	LSBDD_LAT_DS_PREV,
+	LSBDD_LAT_SETUP_READ, // setup_read_from_clone_segments
+	LSBDD_LAT_SETUP_WRITE, // setup_write_in_clone_segments
+	LSBDD_LAT_SETUP_UNMAP,
+	LSBDD_LAT_BIO_SPLIT,
+	LSBDD_LAT_OPS_NUM
+};
+
+#ifdef LSBDD_LAT_HIST
+
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/percpu.h>
+
+struct lsbdd_lat_cpu {
+	u64 buckets[LSBDD_LAT_OPS_NUM][LSBDD_LAT_BUCKETS];
+	u64 sum_ns[LSBDD_LAT_OPS_NUM];
+};
+
+DECLARE_PER_CPU(struct lsbdd_lat_cpu, lsbdd_lat);
+
+static inline u64 lsbdd_lat_start(void)
+{
+	return ktime_get_ns();
+}
+
+static inline void lsbdd_lat_end(enum lsbdd_lat_op op, u64 start)
+{
+	u64 ns = ktime_get_ns() - start;
+	u32 bucket = ns ? min_t(u32, ilog2(ns), LSBDD_LAT_BUCKETS - 1) : 0;
+
+	this_cpu_inc(lsbdd_lat.buckets[op][bucket]);
+	this_cpu_add(lsbdd_lat.sum_ns[op], ns);
+}
+
+// Creates the "latency" file in the module's debugfs dir.
+void lsbdd_lat_debugfs_init(struct dentry *parent);
+
+#else
+
+static inline u64 lsbdd_lat_start(void)
+{
+	return 0;
+}
+
+static inline void lsbdd_lat_end(enum lsbdd_lat_op op, u64 start)
+{
+}
+
+static inline void lsbdd_lat_debugfs_init(struct dentry *parent)
+{
+}
+
+#endif
+
+#endif
@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/kernel.h>
+#include "backoff.h"
+
+DEFINE_PER_CPU(struct lsbdd_cas_stats, lsbdd_cas_stats);
+
+static const char *cas_site_names[LSBDD_CAS_SITES_NUM] = {
+	"list_lookup", "list_add", "list_remove", "sl_find", "sl_insert", "sl_update", "sl_remove",
+};
+
+s32 lsbdd_cas_stats_show(char *buf)
+{
+	struct lsbdd_cas_stats *stats = NULL;
+	u64 retries, contended, rescheds;
+	s32 offset = 0;
+	s32 cpu = 0;
+	u8 site = 0;
+
+	offset += scnprintf(buf + offset, PAGE_SIZE - offset, "site retries contended_ops rescheds\n");
+
+	for (site = 0; site < LSBDD_CAS_SITES_NUM; site++) {
+		retries = contended = rescheds = 0;
+		for_each_possible_cpu(cpu) {
+			stats = per_cpu_ptr(&lsbdd_cas_stats, cpu);
+			retries += READ_ONCE(stats->retries[site]);
+			contended += READ_ONCE(stats->contended[site]);
+			rescheds += READ_ONCE(stats->rescheds[site]);
+		}
+		offset += scnprintf(buf + offset, PAGE_SIZE - offset, "%s %llu %llu %llu\n", cas_site_names[site], retries, contended,
+				    rescheds);
+	}
+
+	return offset;
+}
+
+const char *lsbdd_cas_site_name(enum lsbdd_cas_site site)
+{
+	return cas_site_names[site];
+}
+
+u64 lsbdd_cas_retries(void)
+{
+	u64 retries = 0;
+	s32 cpu = 0;
+	u8 site = 0;
+
+	for_each_possible_cpu(cpu) {
+		for (site = 0; site < LSBDD_CAS_SITES_NUM; site++)
+			retries += READ_ONCE(per_cpu_ptr(&lsbdd_cas_stats, cpu)->retries[site]);
+	}
+
+	return retries;
+}
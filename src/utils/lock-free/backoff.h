@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef BACKOFF_H
+#define BACKOFF_H
+
+#include <linux/minmax.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+
+/**
+ * Contention manager for the CAS retry loops of lock-free data structures.
+ *
+ * Each failed attempt spins for an exponentially growing number of cpu_relax()'s
+ * (up to LSBDD_BACKOFF_MAX_SPINS), so retry loops degrade smoothly under heavy contention.
+ * Every LSBDD_BACKOFF_RESCHED attempts the CPU is yielded, but only if the context is preemptible:
+ * the structures are also used from the completion path and under rcu_read_lock,
+ * there the backoff keeps spinning.
+ */
+
+#define LSBDD_BACKOFF_MIN_SPINS 1
+#define LSBDD_BACKOFF_MAX_SPINS 1024
+#define LSBDD_BACKOFF_RESCHED 64
+
+// Retry sites, statistics are gathered per each of them
+enum lsbdd_cas_site {
+	LSBDD_CAS_LIST_LOOKUP,
+	LSBDD_CAS_LIST_ADD,
+	LSBDD_CAS_LIST_REMOVE,
+	LSBDD_CAS_SL_FIND,
+	LSBDD_CAS_SL_INSERT,
+	LSBDD_CAS_SL_UPDATE,
+	LSBDD_CAS_SL_REMOVE,
+	LSBDD_CAS_SITES_NUM
+};
+
+struct lsbdd_cas_stats {
+	u64 retries[LSBDD_CAS_SITES_NUM]; // total failed attempts
+	u64 contended[LSBDD_CAS_SITES_NUM]; // operations that needed at least one retry
+	u64 rescheds[LSBDD_CAS_SITES_NUM];
+};
+
+DECLARE_PER_CPU(struct lsbdd_cas_stats, lsbdd_cas_stats);
+
+struct lsbdd_backoff {
+	enum lsbdd_cas_site site;
+	u32 attempt;
+	u32 spins;
+};
+
+static inline void lsbdd_backoff_init(struct lsbdd_backoff *bo, enum lsbdd_cas_site site)
+{
+	bo->site = site;
+	bo->attempt = 0;
+	bo->spins = LSBDD_BACKOFF_MIN_SPINS;
+}
+
+// Called after each failed attempt, before the retry.
+static inline void lsbdd_backoff(struct lsbdd_backoff *bo)
+{
+	u32 i = 0;
+
+	if (!bo->attempt++)
+		this_cpu_inc(lsbdd_cas_stats.contended[bo->site]);
+	this_cpu_inc(lsbdd_cas_stats.retries[bo->site]);
+
+	if (unlikely(!(bo->attempt % LSBDD_BACKOFF_RESCHED)) && preemptible()) {
+		this_cpu_inc(lsbdd_cas_stats.rescheds[bo->site]);
+		bo->spins = LSBDD_BACKOFF_MIN_SPINS;
+		cond_resched();
+		return;
+	}
+
+	for (i = 0; i < bo->spins; i++)
+		cpu_relax();
+
+	bo->spins = min_t(u32, bo->spins << 1, LSBDD_BACKOFF_MAX_SPINS);
+}
+
+/**
+ * Prints per-site retry statistics (summed over all CPU's).
+ *
+ * @param buf - output buffer (PAGE_SIZE)
+ *
+ * @return number of written bytes.
+ */
+s32 lsbdd_cas_stats_show(char *buf);
+
+// @return failed CAS attempts of all the sites, summed over all CPU's
+u64 lsbdd_cas_retries(void);
+
+// @return name of the retry site, as printed in the statistics
+const char *lsbdd_cas_site_name(enum lsbdd_cas_site site);
+
+#endif
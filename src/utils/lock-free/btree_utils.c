@@ -145,7 +145,7 @@ void *btree_get_prev_no_rep(struct btree_head *head, struct btree_geo *geo, unsi
 
 	if (head->height == 0)
 		return NULL;
-
+retry:
 	node = head->node;
 	for (height = head->height; height > 1; height--) {
 		for (i = 0; i < geo->no_pairs; i++)
@@ -174,10 +174,12 @@ void *btree_get_prev_no_rep(struct btree_head *head, struct btree_geo *geo, unsi
 		}
 	}
 miss:
-	if (retry_key) {
+	// inner key is stale (smallest key of the child was removed), so the child has no keys <= key: go below it
+	if (retry_key && !keyzero(geo, retry_key)) {
 		longcpy(key, retry_key, geo->keylen);
 		retry_key = NULL;
-		pr_err("B+Tree: get_prev: key miss\n");
+		dec_key(geo, key);
+		goto retry;
 	}
 	prev_key = NULL;
 	return NULL;
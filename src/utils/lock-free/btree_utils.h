@@ -6,12 +6,14 @@
 // JUST STABS, AS LONG AS NO LOCK-FREE RBTREE IS FOUND
 
 #include <linux/btree.h>
+#include "../ds_track.h"
 
 #define LONG_PER_U64 (64 / BITS_PER_LONG) // irrational, bc driver is suitable only for 64bit systems
 #define MAX_KEYLEN (2 * LONG_PER_U64)
 
 struct btree {
 	struct btree_head *head;
+	struct lsbdd_ds_track track; // kernel btree has no counters, so it is maintained in ds_control
 };
 
 struct btree_geo {
@@ -21,17 +23,17 @@ struct btree_geo {
 };
 
 /**
- * Retrieves the smallest key present in the B-tree.
+ * Retrieves the largest key present in the B-tree.
  *
  * This function traverses to the leftmost leaf of the B-tree and returns
- * the first key stored in that leaf node.
+ * the first key stored in that leaf node (keys are stored in descending order).
  * Note: The 'key' parameter is unused in the current implementation.
  *
  * @param head - Pointer to the B-tree head structure.
  * @param geo - Pointer to the B-tree geometry structure.
  * @param key - Unused parameter (potentially intended for output, but not used).
  *
- * @return The smallest key (sector_t) in the B-tree, or 0 if the tree is empty.
+ * @return The largest key (sector_t) in the B-tree, or 0 if the tree is empty.
  */
 sector_t btree_last_no_rep(struct btree_head *head, struct btree_geo *geo, unsigned long *key);
 
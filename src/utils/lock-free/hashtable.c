@@ -5,6 +5,7 @@
 #include <linux/slab.h>
 #include "lf_list.h"
 #include "atomic_ops.h"
+#include "../value_redir.h"
 #include <linux/math.h>
 
 /**
@@ -24,8 +25,6 @@ static bool hash_ll_init(struct hashtable *ht, struct kmem_cache *lsbdd_node_cac
 		ht->head[i] = lf_list_init(lsbdd_node_cache);
 		if (!ht->head[i]) {
 			pr_err("Failed to create list for bucket %lu\n", i);
-			kfree(ht->last_el);
-			kfree(ht);
 			return false;
 		}
 	}
@@ -41,7 +40,8 @@ struct hashtable *hashtable_init(struct kmem_cache *lsbdd_node_cache)
 	if (!hash_table)
 		return NULL;
 
-	hash_table->last_el = NULL;
+	ds_track_init(&hash_table->track);
+	atomic64_set(&hash_table->min_key, S64_MAX);
 	hash_table->max_bck_num = 0;
 
 	if (!hash_ll_init(hash_table, lsbdd_node_cache)) {
@@ -59,16 +59,14 @@ struct lf_list_node *hashtable_insert(struct hashtable *ht, sector_t key, void *
 
 	BUG_ON(!ht || !value || !lsbdd_node_cache);
 	struct lf_list_node *el = NULL;
-	uint32_t bucket_num = 0;
+	s64 min_key = 0;
 
 	if (!key)
 		return NULL;
 
-	bucket_num = hash_min(key, HT_MAP_BITS);
-
-	el = lf_list_add(ht->head[bucket_num], key, value, lsbdd_node_cache);
+	el = lf_list_add(ht->head[HT_BUCKET(key)], key, value, lsbdd_node_cache);
 	if (!el) {
-		kmem_cache_free(lsbdd_value_cache, value);
+		lsbdd_value_free(lsbdd_value_cache, value);
 		pr_debug("Hashtable: failed to insert key %llu\n", key);
 		return NULL;
 	}
@@ -77,11 +75,10 @@ struct lf_list_node *hashtable_insert(struct hashtable *ht, sector_t key, void *
 	 */
 
 	pr_debug("Hashtable: key %lld written\n", key);
-	ht->max_bck_num = max(ht->max_bck_num, bucket_num);
-	if (!ht->last_el)
-		ht->last_el = el;
-	else if (ht->last_el->key < key)
-		ht->last_el = el;
+	min_key = atomic64_read(&ht->min_key);
+	while (key < min_key && !atomic64_try_cmpxchg(&ht->min_key, &min_key, key))
+		;
+	ds_track_insert(&ht->track, key);
 
 	return el;
 }
@@ -114,7 +111,7 @@ struct lf_list_node *hashtable_find_node(struct hashtable *ht, sector_t key)
 	struct lf_list_node *node = NULL;
 	struct lf_list_node *left = NULL;
 
-	list = ht->head[hash_min(key, HT_MAP_BITS)];
+	list = ht->head[HT_BUCKET(key)];
 	if (unlikely(!list))
 		return NULL;
 
@@ -132,32 +129,76 @@ struct lf_list_node *hashtable_find_node(struct hashtable *ht, sector_t key)
 	}
 }
 
+/**
+ * Slow path of hashtable_prev: walks all the buckets, skipping logically removed nodes.
+ */
+static struct lf_list_node *hashtable_prev_walk(struct hashtable *ht, sector_t key)
+{
+	struct lf_list_node *node = NULL;
+	struct lf_list_node *best = NULL;
+	size_t i = 0;
+
+	for (i = 0; i < BUCKET_COUNT; i++) {
+		if (!ht->head[i] || ATOMIC_LREAD(&ht->head[i]->size) <= 0)
+			continue;
+
+		node = (struct lf_list_node *)STRIP_TAG(ht->head[i]->head->next, 0x1);
+		// lists are sorted, so the walk of the bucket stops at the first key >= key
+		for (; node && node != ht->head[i]->tail && node->key < key; node = (struct lf_list_node *)STRIP_TAG(node->next, 0x1)) {
+			if (!HAS_MARK(node->next) && (!best || node->key > best->key))
+				best = node;
+		}
+	}
+
+	return best;
+}
+
 struct lf_list_node *hashtable_prev(struct hashtable *ht, sector_t key, sector_t *prev_key)
 {
 	BUG_ON(!ht);
-	struct lf_list_node *node = NULL, *left_node = NULL;
-	struct lf_list *list = NULL;
-	uint32_t bucket_num = hash_min(key, HT_MAP_BITS);
+	struct lf_list_node *best = NULL, *left_node = NULL;
+	sector_t min_key = (sector_t)atomic64_read(&ht->min_key);
+	sector_t chunk = key >> HT_CHUNK_SHIFT;
+	u32 scanned = 0;
 
-	list = ht->head[bucket_num];
+	// min_key is a lower bound of the stored keys (it isn't raised on remove)
+	if (key <= min_key)
+		return NULL;
 
-	node = lf_list_lookup(list, key, &left_node);
-	if (!node || !left_node || !left_node->key) {
-		if (bucket_num > 0) {
-			list = ht->head[bucket_num - 1];
-			node = lf_list_lookup(list, key, &left_node);
-			pr_info("Found node in prev bucket: %p, key = %llu\n", node, node ? node->key : 0);
-		}
-		if (!left_node || !left_node->key)
-			return NULL;
+	// keys above the max one (f.e. reads past the written region) get it without the scan
+	if (key > hashtable_last(ht)) {
+		best = hashtable_find_node(ht, hashtable_last(ht));
+		if (best)
+			goto found;
+	}
+
+	/**
+	 * Each chunk lives in one bucket, the left node of the lookup is the max key < key in it.
+	 * Chunks are checked downwards until one of them has a key (the chunks below can't have a bigger one).
+	 */
+	for (;; chunk--) {
+		if (scanned++ == HT_PREV_MAX_CHUNKS) {
+			best = hashtable_prev_walk(ht, key);
+			break;
 		}
 
+		lf_list_lookup(ht->head[HT_BUCKET(chunk << HT_CHUNK_SHIFT)], key, &left_node);
+		if (left_node && left_node->key && !HAS_MARK(left_node->next) && (!best || left_node->key > best->key))
+			best = left_node;
+
+		if ((best && best->key >= chunk << HT_CHUNK_SHIFT) || chunk <= min_key >> HT_CHUNK_SHIFT)
+			break;
+	}
+
+found:
+	if (!best)
+		return NULL;
 
-	pr_debug("Hashtable: Element (%p) with prev key - el key=%llu (%llu), val=%p\n", left_node, left_node->key, key, left_node->value);
+	pr_debug("Hashtable: Element (%p) with prev key - el key=%llu (%llu), val=%p\n", best, best->key, key, best->value);
 
-	*prev_key = left_node->key;
+	*prev_key = best->key;
 
-	return left_node;
+	return best;
 }
 
 void hashtable_remove(struct hashtable *ht, sector_t key, struct kmem_cache *lsbdd_value_cache)
@@ -166,7 +207,7 @@ void hashtable_remove(struct hashtable *ht, sector_t key, struct kmem_cache *lsb
 	struct lf_list *list = NULL;
 	bool removed = false;
 
-	list = ht->head[hash_min(key, HT_MAP_BITS)];
+	list = ht->head[HT_BUCKET(key)];
 	if (unlikely(!list))
 		return;
 
@@ -176,20 +217,89 @@ void hashtable_remove(struct hashtable *ht, sector_t key, struct kmem_cache *lsb
 		pr_debug("Hashtable: Tried to remove non-existent key %lld\n", key);
 	} else {
 		pr_debug("Hashtable: Removed key %lld\n", key);
-		// To update the last_el...?
+		ds_track_remove(&ht->track, key);
 	}
 }
 
+/**
+ * Slow path of hashtable_last: walks all the buckets, skipping logically removed nodes.
+ */
+static sector_t hashtable_find_last(void *ds)
+{
+	struct hashtable *ht = ds;
+	struct lf_list_node *node = NULL;
+	sector_t last = 0;
+	size_t i = 0;
+
+	for (i = 0; i < BUCKET_COUNT; i++) {
+		if (!ht->head[i] || ATOMIC_LREAD(&ht->head[i]->size) <= 0)
+			continue;
+
+		node = (struct lf_list_node *)STRIP_TAG(ht->head[i]->head->next, 0x1);
+		while (node && node != ht->head[i]->tail) {
+			if (!HAS_MARK(node->next) && node->key > last)
+				last = node->key;
+			node = (struct lf_list_node *)STRIP_TAG(node->next, 0x1);
+		}
+	}
+
+	return last;
+}
+
+sector_t hashtable_last(struct hashtable *ht)
+{
+	BUG_ON(!ht);
+
+	return ds_track_last(&ht->track, hashtable_find_last, ht);
+}
+
 bool hashtable_is_empty(struct hashtable *ht)
 {
 	if (!ht)
 		return true;
 
+	return ds_track_is_empty(&ht->track);
+}
+
+u64 hashtable_removed_nodes(struct hashtable *ht)
+{
+	u64 nodes = 0;
+	u32 bkt = 0;
+
+	BUG_ON(!ht);
+
+	for (bkt = 0; bkt < HASH_SIZE(ht->head); bkt++) {
+		if (ht->head[bkt])
+			nodes += lf_list_removed_nodes(ht->head[bkt]);
+	}
+
+	return nodes;
+}
+
+s32 hashtable_iter(struct hashtable *ht, s32 (*fn)(sector_t key, void *value, void *data), void *data)
+{
+	struct lf_list_node *node = NULL;
+	void *value = NULL;
+	s32 status = 0;
 	size_t i = 0;
 
+	BUG_ON(!ht || !fn);
+
 	for (i = 0; i < BUCKET_COUNT; i++) {
-		if (ht->head[i] && ATOMIC_LREAD(&ht->head[i]->size) > 0)
-			return false;
+		if (!ht->head[i] || ATOMIC_LREAD(&ht->head[i]->size) <= 0)
+			continue;
+
+		node = (struct lf_list_node *)STRIP_TAG(ht->head[i]->head->next, 0x1);
+		for (; node && node != ht->head[i]->tail; node = (struct lf_list_node *)STRIP_TAG(node->next, 0x1)) {
+			value = READ_ONCE(node->value);
+			if (HAS_MARK(node->next) || !value)
+				continue;
+
+			status = fn(node->key, value, data);
+			if (status)
+				return status;
+		}
 	}
-	return true;
+
+	return 0;
 }
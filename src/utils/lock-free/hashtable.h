@@ -8,6 +8,7 @@
 #include <linux/spinlock.h>
 #include <linux/slab.h>
 #include "lf_list.h"
+#include "../ds_track.h"
 
 /**
  * SMP modification of basic kernel hashtable using lock-free linked list (not doubly though).
@@ -20,6 +21,14 @@
 
 #define HT_MAP_BITS 18
 #define BUCKET_COUNT (1 << HT_MAP_BITS)
+/**
+ * Keys are hashed by 64K chunks (128 sectors), so the predecessor is either in the bucket of the key's chunk
+ * or in the bucket of one of the chunks below it - hashtable_prev checks them in order.
+ */
+#define HT_CHUNK_SHIFT 7
+#define HT_BUCKET(key) hash_min((sector_t)(key) >> HT_CHUNK_SHIFT, HT_MAP_BITS)
+// chunks checked by hashtable_prev before it walks all the buckets
+#define HT_PREV_MAX_CHUNKS 256
 
 #define MEM_CHECK(ptr)                                                                                                                     \
 	do {																																\
@@ -37,7 +46,8 @@
 
 struct hashtable {
 	DECLARE_LHASHTABLE(head, HT_MAP_BITS);
-	struct lf_list_node *last_el;
+	struct lsbdd_ds_track track;
+	atomic64_t min_key; // lower bound of the stored keys for hashtable_prev, isn't raised on remove
 	u8 max_bck_num;
 };
 
@@ -98,7 +108,7 @@ struct lf_list_node *hashtable_find_node(struct hashtable *ht, sector_t key);
  * @param prev_key - pointer to prev_key memory that will be changed
  *
  * @return prev_node on success, NULL if:
- *  - lf_list_lookup returned NULL
+ *  - there is no smaller key
  */
 struct lf_list_node *hashtable_prev(struct hashtable *ht, sector_t key, sector_t *prev_key);
 
@@ -117,7 +127,27 @@ void hashtable_remove(struct hashtable *ht, sector_t key, struct kmem_cache *lsb
 // Hashtable initialisator 2000 mega pro.
 void __lhash_init(struct llist_head *htm, unsigned int size);
 
+/**
+ * @return max key stored in the hashtable (O(1) unless the max key was removed), 0 if empty
+ */
+sector_t hashtable_last(struct hashtable *ht);
+
 // @return bool if empty
 bool hashtable_is_empty(struct hashtable *ht);
 
+// @return number of removed nodes kept on the removed stacks of all the buckets, O(n)
+u64 hashtable_removed_nodes(struct hashtable *ht);
+
+/**
+ * Calls fn for every live node, bucket by bucket (keys aren't ordered across the buckets),
+ * stops if it returns non-zero.
+ *
+ * @param ht - hashtable structure
+ * @param fn - callback, gets the key, the value and data
+ * @param data - callback's data
+ *
+ * @return first non-zero result of fn, 0 if all the nodes were visited
+ */
+s32 hashtable_iter(struct hashtable *ht, s32 (*fn)(sector_t key, void *value, void *data), void *data);
+
 #endif
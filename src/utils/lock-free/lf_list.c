@@ -4,11 +4,15 @@
 #include "lf_list.h"
 #include "marked_pointers.h"
 #include "atomic_ops.h"
+#include "backoff.h"
+#include "../value_redir.h"
+#include "../mag_cache.h"
 #include <linux/slab.h>
 
 #define GET_NODE(x) ((struct lf_list_node *)(x))
 // cleans the pointer from the mark
 #define STRIP_MARK(x) ((struct lf_list_node *)STRIP_TAG((x), 0x1))
+// lookup gives up after this many passes (the list is likely corrupted), callers handle NULL
 #define MAX_LOOKUP_RETRIES 10000
 
 /**
@@ -59,7 +63,7 @@ static void add_to_removed_stack(struct lf_list *list, struct lf_list_node *node
  */
 static struct lf_list_node *node_alloc(sector_t key, void *value, struct lf_list_node *next, struct kmem_cache *node_cache)
 {
-	struct lf_list_node *node = kmem_cache_zalloc(node_cache, GFP_KERNEL);
+	struct lf_list_node *node = lsbdd_mag_zalloc(node_cache, GFP_KERNEL);
 
 	if (!node)
 		return NULL;
@@ -109,11 +113,11 @@ void lf_list_free(struct lf_list *list, struct kmem_cache *lsbdd_node_cache, str
 			pr_warn("%s: Attempting to double-free node %p (key %llu) in main list. Skipping.\n", __func__, node, node->key);
 		} else {
 			if (node->value) {
-				kmem_cache_free(lsbdd_value_cache, node->value);
+				lsbdd_value_free(lsbdd_value_cache, node->value);
 				node->value = NULL;
 			}
 			pr_debug("%s: Freeing node %p (key %llu) from main list\n", __func__, node, node->key);
-			kmem_cache_free(lsbdd_node_cache, node);
+			lsbdd_mag_free(lsbdd_node_cache, node);
 			last_freed_node_addr = node;
 		}
 		node = next;
@@ -132,12 +136,12 @@ void lf_list_free(struct lf_list *list, struct kmem_cache *lsbdd_node_cache, str
 				node->key);
 		} else {
 			if (node->value) {
-				kmem_cache_free(lsbdd_value_cache, node->value);
+				lsbdd_value_free(lsbdd_value_cache, node->value);
 				node->value = NULL;
 				pr_debug("Freed value\n");
 			}
 			pr_debug("%s: Freeing node %p (key %llu) from removed_stack\n", __func__, node, node->key);
-			kmem_cache_free(lsbdd_node_cache, node);
+			lsbdd_mag_free(lsbdd_node_cache, node);
 			last_freed_node_addr = node;
 		}
 		node = next;
@@ -147,7 +151,7 @@ void lf_list_free(struct lf_list *list, struct kmem_cache *lsbdd_node_cache, str
 	if (list->head) {
 		pr_debug("%s: Freeing head node %p\n", __func__, list->head);
 		if (list->head != last_freed_node_addr) { // Check before freeing head
-			kmem_cache_free(lsbdd_node_cache, list->head);
+			lsbdd_mag_free(lsbdd_node_cache, list->head);
 			last_freed_node_addr = list->head;
 		} else {
 			pr_warn("%s: Head node %p already freed. Skipping.\n", __func__, list->head);
@@ -157,7 +161,7 @@ void lf_list_free(struct lf_list *list, struct kmem_cache *lsbdd_node_cache, str
 	if (list->tail) {
 		pr_debug("%s: Freeing tail node %p\n", __func__, list->tail);
 		if (list->tail != last_freed_node_addr) { // Check before freeing tail
-			kmem_cache_free(lsbdd_node_cache, list->tail);
+			lsbdd_mag_free(lsbdd_node_cache, list->tail);
 			// last_freed_node_addr = list->tail; // Not strictly needed after this
 		} else {
 			pr_warn("%s: Tail node %p already freed. Skipping.\n", __func__, list->tail);
@@ -177,6 +181,7 @@ struct lf_list_node *lf_list_lookup(struct lf_list *list, sector_t key, struct l
 	struct lf_list_node *left_node_next_snap = NULL; // Used for detecting the concurrent modifications of the "window"
 	struct lf_list_node *right_node = NULL;
 	struct lf_list_node *t = NULL, *t_next = NULL;
+	struct lsbdd_backoff bo;
 	u32 retry_count = 0;
 
 	pr_debug("%s: Searching for key %llu in list %p\n", __func__, key, list);
@@ -185,9 +190,10 @@ struct lf_list_node *lf_list_lookup(struct lf_list *list, sector_t key, struct l
 		return NULL;
 	}
 
+	lsbdd_backoff_init(&bo, LSBDD_CAS_LIST_LOOKUP);
+
 retry_search_outer:
-	retry_count++;
-	if (retry_count > MAX_LOOKUP_RETRIES) {
+	if (unlikely(++retry_count > MAX_LOOKUP_RETRIES)) {
 		pr_warn("%s: MAX_RETRIES (outer) for key %llu! list %p\n", __func__, key, list);
 		return NULL;
 	}
@@ -197,7 +203,7 @@ retry_search_outer:
 	t = list->head; // Current node being examined (predecessor candidate)
 	t_next = t->next;
 
-	pr_debug("%s: Outer retry %d: t=%p (key %llu), t_next=%p\n", __func__, retry_count, t, t->key, t_next);
+	pr_debug("%s: Outer retry %u: t=%p (key %llu), t_next=%p\n", __func__, bo.attempt, t, t->key, t_next);
 
 	// Find the window (left_node, right_node) where left_node->key < key <= right_node->key
 	while (HAS_MARK(t_next) || (t != list->tail && t->key < key)) {
@@ -241,6 +247,7 @@ retry_search_outer:
 			pr_debug("%s: right_node %p (key %llu) is marked for deletion. Retrying outer search.\n", __func__, right_node,
 				 right_node->key);
 			// According to reference logic, we should retry the search if the target is marked.
+			lsbdd_backoff(&bo);
 			goto retry_search_outer;
 		}
 		pr_debug("%s: Success. Returning right_node %p (key %llu).\n", __func__, right_node,
@@ -271,6 +278,7 @@ retry_search_outer:
 			// CAS failed. Means (*left_node_out)->next was changed by another thread between our read
 			// (when we set left_node_next_snap) and the CAS attempt.
 			pr_debug("%s: Cleanup CAS failed (concurrent modification). Retrying outer search.\n", __func__);
+			lsbdd_backoff(&bo);
 			goto retry_search_outer;
 		}
 	}
@@ -283,20 +291,25 @@ struct lf_list_node *lf_list_add(struct lf_list *list, sector_t key, void *val,
 {
 	struct lf_list_node *left = NULL, *right = NULL;
 	struct lf_list_node *new_node = NULL;
+	struct lsbdd_backoff bo;
 
 	new_node = node_alloc(key, val, NULL, list_node_cache);
+	if (!new_node)
+		return NULL;
+
+	lsbdd_backoff_init(&bo, LSBDD_CAS_LIST_ADD);
 
 	while (1) {
 		right = lf_list_lookup(list, key, &left);
 		if (right == NULL) {
 			pr_warn("lf_list_add: lf_list_lookup returned NULL for key %llu. Aborting add.\n", key);
 			// Free the pre-allocated new_node as it won't be inserted
-			kmem_cache_free(list_node_cache, new_node);
+			lsbdd_mag_free(list_node_cache, new_node);
 			return NULL; // Indicate failure
 		}
 		if (right != list->tail && right->key == key) {
 			pr_debug("lf_list_add: Duplicate key %llu found. Freeing new_node %p.\n", key, new_node);
-			kmem_cache_free(list_node_cache, new_node); // Free the unused node
+			lsbdd_mag_free(list_node_cache, new_node); // Free the unused node
 			return NULL;
 		}
 		new_node->next = right;
@@ -304,6 +317,7 @@ struct lf_list_node *lf_list_add(struct lf_list *list, sector_t key, void *val,
 			ATOMIC_FAI(&list->size);
 			return new_node;
 		}
+		lsbdd_backoff(&bo);
 	}
 
 	return new_node;
@@ -312,6 +326,9 @@ struct lf_list_node *lf_list_add(struct lf_list *list, sector_t key, void *val,
 bool lf_list_remove(struct lf_list *list, sector_t key)
 {
 	struct lf_list_node *left = NULL;
+	struct lsbdd_backoff bo;
+
+	lsbdd_backoff_init(&bo, LSBDD_CAS_LIST_REMOVE);
 	while (1) {
 		struct lf_list_node *right = lf_list_lookup(list, key, &left);
 		if (!right) {
@@ -328,9 +345,9 @@ bool lf_list_remove(struct lf_list *list, sector_t key)
 		struct lf_list_node *right_succ = right->next;
 
 		if (HAS_MARK(right_succ)) {
-			// Node 'right' is already logically deleted or deletion is in progress.
-			pr_debug("lf_list_remove: Node %p (key %llu) already marked. Consider removed.\n", right, right->key);
-			return true;
+			// Node 'right' is already logically deleted by another thread, that one accounts the removal.
+			pr_debug("lf_list_remove: Node %p (key %llu) already marked.\n", right, right->key);
+			return false;
 		}
 
 		// Try to mark 'right->next' to logically delete 'right'
@@ -340,5 +357,18 @@ bool lf_list_remove(struct lf_list *list, sector_t key)
 			return true;
 		}
 		// CAS failed: right->next changed. Loop and retry.
+		lsbdd_backoff(&bo);
 	}
 }
+
+u64 lf_list_removed_nodes(struct lf_list *list)
+{
+	struct lf_list_node *node = (struct lf_list_node *)ATOMIC_LREAD(&list->removed_stack_head);
+	u64 nodes = 0;
+
+	// nodes are only pushed until the list is freed, so the stack below the head never changes
+	for (; node; node = node->removed_link)
+		nodes++;
+
+	return nodes;
+}
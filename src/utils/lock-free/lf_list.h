@@ -56,7 +56,7 @@ struct lf_list_node *lf_list_add(struct lf_list *list, sector_t key, void *val,
  * @param list - pointer to general list structure
  * @param key - LBA sector_t
  *
- * @return true on success (if found and removed), false on error
+ * @return true if this call removed the node, false if not found (or already removed by another thread)
  */
 bool lf_list_remove(struct lf_list *list, sector_t key);
 
@@ -67,11 +67,11 @@ bool lf_list_remove(struct lf_list *list, sector_t key);
  *    val.
  *  - returns NULL if:
  *    - key 0 is searched (bug occures when key 0 is searched and its too hard to fix, but we've set the offset, so it shouldn't issue the fio)
- *    - MAX_RETRIES limit was passed
- *    - there is infinite loop cause (line 82)
+ *    - there is infinite loop cause (node pointing to itself)
  *
  * Encountered nodes that are marked as logically deleted are physically removed
  * from the list, yet not garbage collected.
+ * Concurrent modifications of the window are retried with backoff (check backoff.h), not failed.
  *
  * @param list - pointer to general list structure
  * @param key - LBA sector_t
@@ -81,4 +81,7 @@ bool lf_list_remove(struct lf_list *list, sector_t key);
  */
 struct lf_list_node *lf_list_lookup(struct lf_list *list, sector_t key, struct lf_list_node **left_node);
 
+// @return number of removed nodes on the removed stack (they are freed only with the list), O(n)
+u64 lf_list_removed_nodes(struct lf_list *list);
+
 #endif
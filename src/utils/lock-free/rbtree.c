@@ -14,12 +14,14 @@
 #include <linux/string.h>
 #include <linux/types.h>
 #include "rbtree.h"
+#include "../value_redir.h"
+#include "../mag_cache.h"
 
-static struct rbtree_node *create_rbtree_node(sector_t key, void **value)
+static struct rbtree_node *create_rbtree_node(struct kmem_cache *node_cache, sector_t key, void **value)
 {
 	struct rbtree_node *node = NULL;
 
-	node = kzalloc(sizeof(struct rbtree_node), GFP_KERNEL);
+	node = lsbdd_mag_zalloc(node_cache, GFP_KERNEL);
 	if (!node)
 		return NULL;
 
@@ -29,10 +31,10 @@ static struct rbtree_node *create_rbtree_node(sector_t key, void **value)
 	return node;
 }
 
-static void free_rbtree_node(struct rbtree_node *node)
+static void free_rbtree_node(struct rbtree *rbt, struct rbtree_node *node, struct kmem_cache *lsbdd_value_cache)
 {
-	kfree(node->value);
-	kfree(node);
+	lsbdd_value_free(lsbdd_value_cache, node->value);
+	lsbdd_mag_free(rbt->node_cache, node);
 }
 
 static s32 compare_keys(sector_t lkey, sector_t rkey)
@@ -69,7 +71,8 @@ static struct rbtree_node *__rbtree_underlying_search(struct rb_root *root, sect
 	return NULL;
 }
 
-static s32 __rbtree_underlying_insert(struct rb_root *root, sector_t key, void *value)
+static s32 __rbtree_underlying_insert(struct rb_root *root, struct kmem_cache *node_cache, sector_t key, void *value,
+				      struct kmem_cache *lsbdd_value_cache)
 {
 	bool overwrite = false;
 	struct rb_node **new = NULL;
@@ -93,13 +96,14 @@ static s32 __rbtree_underlying_insert(struct rb_root *root, sector_t key, void *
 			new = &((*new)->rb_right);
 		} else {
 			overwrite = true;
+			lsbdd_value_free(lsbdd_value_cache, this->value);
 			this->value = value;
 			return 0;
 		}
 	}
 
 	if (!overwrite) {
-		data = create_rbtree_node(key, value);
+		data = create_rbtree_node(node_cache, key, value);
 		if (!data)
 			goto no_mem;
 		rb_link_node(&data->node, parent, new);
@@ -111,7 +115,7 @@ no_mem:
 	return -ENOMEM;
 }
 
-struct rbtree *rbtree_init(void)
+struct rbtree *rbtree_init(struct kmem_cache *node_cache)
 {
 	struct rbtree *new_tree = NULL;
 
@@ -120,11 +124,12 @@ struct rbtree *rbtree_init(void)
 		return NULL;
 
 	new_tree->root = RB_ROOT;
-	new_tree->node_num = 0;
+	new_tree->node_cache = node_cache;
+	ds_track_init(&new_tree->track);
 	return new_tree;
 }
 
-void rbtree_free(struct rbtree *rbt)
+void rbtree_free(struct rbtree *rbt, struct kmem_cache *lsbdd_value_cache)
 {
 	if (!rbt)
 		return;
@@ -132,12 +137,12 @@ void rbtree_free(struct rbtree *rbt)
 	struct rbtree_node *pos, *node = NULL;
 
 	rbtree_postorder_for_each_entry_safe(pos, node, &(rbt->root), node)
-		free_rbtree_node(pos);
+		free_rbtree_node(rbt, pos, lsbdd_value_cache);
 
 	kfree(rbt);
 }
 
-void rbtree_remove(struct rbtree *rbt, sector_t key)
+void rbtree_remove(struct rbtree *rbt, sector_t key, struct kmem_cache *lsbdd_value_cache)
 {
 	struct rbtree_node *data = NULL;
 
@@ -146,15 +151,16 @@ void rbtree_remove(struct rbtree *rbt, sector_t key)
 		return;
 	if (data) {
 		rb_erase(&(data->node), &(rbt->root));
-		free_rbtree_node(data);
+		free_rbtree_node(rbt, data, lsbdd_value_cache);
 	}
-	rbt->node_num--;
+	ds_track_remove(&rbt->track, key);
 }
 
-void rbtree_add(struct rbtree *rbt, sector_t key, void *value)
+void rbtree_add(struct rbtree *rbt, sector_t key, void *value, struct kmem_cache *lsbdd_value_cache)
 {
-	__rbtree_underlying_insert(&(rbt->root), key, value);
-	rbt->node_num++;
+	// 0 is returned on overwrite of existing key
+	if (__rbtree_underlying_insert(&(rbt->root), rbt->node_cache, key, value, lsbdd_value_cache) > 0)
+		ds_track_insert(&rbt->track, key);
 }
 
 struct rbtree_node *rbtree_find_node(struct rbtree *rbt, sector_t key)
@@ -165,31 +171,28 @@ struct rbtree_node *rbtree_find_node(struct rbtree *rbt, sector_t key)
 	return target;
 }
 
-struct rbtree_node *rbtree_last(struct rbtree *rbt)
+/**
+ * Slow path of rbtree_last: the rightmost node.
+ */
+static sector_t rbtree_find_last(void *ds)
 {
-	struct rb_root root = rbt->root;
-	struct rb_node *node = root.rb_node;
-	struct rbtree_node *data = NULL;
+	struct rbtree *rbt = ds;
+	struct rb_node *node = rb_last(&rbt->root);
 
 	if (!node)
-		return NULL;
-
-	if (!(node->rb_left && node->rb_right))
-		return NULL;
-
-	data = container_of(node, struct rbtree_node, node);
+		return 0;
 
-	if (!(data->key && data->value))
-		return NULL;
+	return container_of(node, struct rbtree_node, node)->key;
+}
 
-	while (node) {
-		if (node->rb_right)
-			node = node->rb_right;
-		else
-			break;
-	}
+sector_t rbtree_last(struct rbtree *rbt)
+{
+	return ds_track_last(&rbt->track, rbtree_find_last, rbt);
+}
 
-	return container_of(node, struct rbtree_node, node);
+bool rbtree_is_empty(struct rbtree *rbt)
+{
+	return ds_track_is_empty(&rbt->track);
 }
 
 struct rbtree_node *rbtree_prev(struct rbtree *rbt, sector_t key, sector_t *prev_key)
@@ -212,16 +215,16 @@ struct rbtree_node *rbtree_prev(struct rbtree *rbt, sector_t key, sector_t *prev
 				ancestor = ancestor->rb_left;
 			}
 		}
+		if (!prev)
+			return NULL;
 		*prev_key = prev->key;
 		return prev;
 	}
 
-	struct rb_node *node = &curr->node;
+	// in-order predecessor, might be an ancestor if the node has no left subtree
+	struct rb_node *node = rb_prev(&curr->node);
 
 	if (node) {
-		node = node->rb_left;
-		while (node && node->rb_right)
-			node = node->rb_right;
 		curr = container_of(node, struct rbtree_node, node);
 		*prev_key = curr->key;
 		return curr;
@@ -229,3 +232,19 @@ struct rbtree_node *rbtree_prev(struct rbtree *rbt, sector_t key, sector_t *prev
 
 	return NULL;
 }
+
+s32 rbtree_iter(struct rbtree *rbt, s32 (*fn)(sector_t key, void *value, void *data), void *data)
+{
+	struct rbtree_node *curr = NULL;
+	struct rb_node *node = NULL;
+	s32 status = 0;
+
+	for (node = rb_first(&rbt->root); node; node = rb_next(node)) {
+		curr = container_of(node, struct rbtree_node, node);
+		status = fn(curr->key, curr->value, data);
+		if (status)
+			return status;
+	}
+
+	return 0;
+}
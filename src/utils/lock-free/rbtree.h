@@ -6,7 +6,9 @@
 // JUST STABS, AS LONG AS NO LOCK-FREE RBTREE IS FOUND
 
 #include <linux/rbtree.h>
+#include <linux/slab.h>
 #include <linux/types.h>
+#include "../ds_track.h"
 
 struct rbtree_node {
 	struct rb_node node;
@@ -16,28 +18,29 @@ struct rbtree_node {
 
 struct rbtree {
 	struct rb_root root;
-	u64 node_num;
-	//struct rbtree_node *last_el; can be added in future
+	struct kmem_cache *node_cache; // nodes are allocated through its magazines (check mag_cache.h)
+	struct lsbdd_ds_track track;
 };
 
 /**
  * Initialises a new tree with RB_ROOT.
  *
- * @param void
+ * @param node_cache - cache of the tree nodes (struct rbtree_node)
  *
  * @return rbtree structure
  */
-struct rbtree *rbtree_init(void);
+struct rbtree *rbtree_init(struct kmem_cache *node_cache);
 
 /**
  * Frees all the RB tree structure.
  * Iterates in postorder and deallocates all the nodes and their data.
  *
  * @param rbt - rb tree structure
+ * @param lsbdd_value_cache - value (redir) cache
  *
  * @return void
  */
-void rbtree_free(struct rbtree *rbt);
+void rbtree_free(struct rbtree *rbt, struct kmem_cache *lsbdd_value_cache);
 
 /**
  * Adds key-value pair into rb tree structure.
@@ -45,21 +48,23 @@ void rbtree_free(struct rbtree *rbt);
  *
  * @param key - LBA sector
  * @param value -  pointer to structure (lsbdd_value_redir) with PBA and meta data
+ * @param lsbdd_value_cache - value (redir) cache, the overwritten value is freed into it
  *
  * @return void
  */
-void rbtree_add(struct rbtree *rbt, sector_t key, void *value);
+void rbtree_add(struct rbtree *rbt, sector_t key, void *value, struct kmem_cache *lsbdd_value_cache);
 
 /**
  * Removes the node from the rb tree structure.
  *
  * @param rbt - rb tree structure
  * @param key - LBA sector
+ * @param lsbdd_value_cache - value (redir) cache
  *
  * @return void
  * !Note: in case of successfull remove - deallocates the mem.
  */
-void rbtree_remove(struct rbtree *rbt, sector_t key);
+void rbtree_remove(struct rbtree *rbt, sector_t key, struct kmem_cache *lsbdd_value_cache);
 
 /**
  * Searches for node in general rb tree structure.
@@ -84,14 +89,27 @@ struct rbtree_node *rbtree_find_node(struct rbtree *rbt, sector_t key);
 struct rbtree_node *rbtree_prev(struct rbtree *rbt, sector_t key, sector_t *prev_key);
 
 /**
- * Simply gets the last node by iterating the right side of the tree.
- * !Note: in case it overloads the general performance
- * - it can be optimised by adding pointer to last el into the rbtree structure.
+ * Gets the max key of the tree.
+ * It is tracked in the general structure, the right side of the tree is iterated only if the max key was removed.
  *
  * @param rbt - rb tree structure
  *
- * @return NULL on fail, node on success
+ * @return max key, 0 if tree is empty
+ */
+sector_t rbtree_last(struct rbtree *rbt);
+
+// @return true if tree has no nodes
+bool rbtree_is_empty(struct rbtree *rbt);
+
+/**
+ * Calls fn for every node in the ascending key order, stops if it returns non-zero.
+ *
+ * @param rbt - tree structure
+ * @param fn - callback, gets the key, the value and data
+ * @param data - callback's data
+ *
+ * @return first non-zero result of fn, 0 if all the nodes were visited
  */
-struct rbtree_node *rbtree_last(struct rbtree *rbt);
+s32 rbtree_iter(struct rbtree *rbt, s32 (*fn)(sector_t key, void *value, void *data), void *data);
 
 #endif
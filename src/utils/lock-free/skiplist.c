@@ -13,8 +13,12 @@
 #include "skiplist.h"
 #include <linux/random.h>
 #include <linux/atomic.h>
+#include <linux/percpu.h>
 #include "marked_pointers.h"
 #include "atomic_ops.h"
+#include "backoff.h"
+#include "../value_redir.h"
+#include "../mag_cache.h"
 
 #define GET_NODE(x) ((struct skiplist_node *)(x))
 // cleans the pointer from the mark
@@ -61,30 +65,76 @@ static void add_to_removed_stack(struct skiplist *sl, struct skiplist_node *node
 	pr_debug("Pushed node %p with key %llu", node, node->key);
 }
 
+static DEFINE_PER_CPU(u32, sl_rng_state);
+
+#ifdef LSBDD_BENCH
+bool sl_legacy_levels;
+#endif
+
+/**
+ * Per-CPU xorshift32 step. Level distribution doesn't need a CSPRNG,
+ * so get_random_u32() is used only for (lazy) seeding of each CPU's state.
+ *
+ * @return non-zero pseudo-random number
+ */
+static u32 sl_rng_next(void)
+{
+	u32 *state = get_cpu_ptr(&sl_rng_state);
+	u32 x = *state;
+
+	if (unlikely(!x))
+		x = get_random_u32() | 1; // xorshift state must never be 0
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	put_cpu_ptr(&sl_rng_state);
+
+	return x;
+}
+
 /**
  * Generates random level for inserting the node.
- * Generator is based on rand + ammount of trailing zero's. It can have a pretty
- * bad behaviour in terms of speed. Can be changed to some easier-to-compute
- * pseudo gen.
+ * Level is based on the ammount of trailing zero's in the random number (p = 1/4 per level).
  *
- * Uses atomic increment for setting up the max_lvl variable.
+ * The max_lvl high water mark grows by one at most, with a single CAS attempt. If it fails -
+ * another thread has already raised it, so our level fits in anyway. In the common case
+ * (level <= max_lvl) the shared line is only read.
  */
 static s32 random_levels(struct skiplist *sl)
 {
 	BUG_ON(!sl);
 
-	u32 r = get_random_u32();
-	s32 trail_zeros = __builtin_ctz(r);
-	s32 levels = (trail_zeros / 2);
+	u32 r = 0;
+	s32 levels = 0;
+	s64 curr_max = 0;
+
+#ifdef LSBDD_BENCH
+	r = READ_ONCE(sl_legacy_levels) ? get_random_u32() : sl_rng_next();
+	if (unlikely(!r))
+		return 1;
+#else
+	r = sl_rng_next();
+#endif
+	levels = __builtin_ctz(r) / 2;
 
 	if (levels == 0)
 		return 1;
 	if (levels > MAX_LVL)
 		levels = MAX_LVL;
-	if (levels > ATOMIC_LREAD(&sl->max_lvl)) {
-		ATOMIC_INC(&sl->max_lvl);
-		levels = ATOMIC_LREAD(&sl->max_lvl);
-		pr_debug("Skiplist(random_levels): increased high water mark to %d\n", levels);
+
+	curr_max = ATOMIC_LREAD(&sl->max_lvl);
+	if (unlikely(levels > curr_max)) {
+#ifdef LSBDD_BENCH
+		if (READ_ONCE(sl_legacy_levels)) {
+			ATOMIC_INC(&sl->max_lvl);
+			return ATOMIC_LREAD(&sl->max_lvl);
+		}
+#endif
+		levels = curr_max + 1;
+		if (ATOMIC_LCAS(&sl->max_lvl, curr_max, levels) == curr_max)
+			pr_debug("Skiplist(random_levels): increased high water mark to %d\n", levels);
 	}
 
 	return levels;
@@ -100,7 +150,7 @@ static struct skiplist_node *node_alloc(sector_t key, void *value, s32 height, s
 	BUG_ON(height <= 0 || height > MAX_LVL || !lsbdd_node_cache);
 	struct skiplist_node *node = NULL;
 
-	node = kmem_cache_zalloc(lsbdd_node_cache, GFP_KERNEL);
+	node = lsbdd_mag_zalloc(lsbdd_node_cache, GFP_KERNEL);
 	if (!node)
 		goto alloc_fail;
 
@@ -127,6 +177,7 @@ struct skiplist *skiplist_init(struct kmem_cache *lsbdd_node_cache)
 
 	atomic64_set(&sl->max_lvl, 1);
 	atomic64_set(&sl->removed_stack_head, 0);
+	ds_track_init(&sl->track);
 	sl->head = node_alloc(HEAD_KEY, HEAD_VALUE, MAX_LVL, lsbdd_node_cache);
 
 	return sl;
@@ -148,9 +199,9 @@ void skiplist_free(struct skiplist *sl, struct kmem_cache *lsbdd_node_cache, str
 	while (node) {
 		next = STRIP_MARK(node->next[0]);
 		if (node->value) {
-			kmem_cache_free(lsbdd_value_cache, node->value);
+			lsbdd_value_free(lsbdd_value_cache, node->value);
 		}
-		kmem_cache_free(lsbdd_node_cache, node);
+		lsbdd_mag_free(lsbdd_node_cache, node);
 		node = next;
 	}
 
@@ -163,9 +214,9 @@ void skiplist_free(struct skiplist *sl, struct kmem_cache *lsbdd_node_cache, str
 
 		if (node->value) {
 			pr_info("Freeing removed node %p (key %lld)\n", node, node->key);
-			kmem_cache_free(lsbdd_value_cache, node->value);
+			lsbdd_value_free(lsbdd_value_cache, node->value);
 		}
-		kmem_cache_free(lsbdd_node_cache, node);
+		lsbdd_mag_free(lsbdd_node_cache, node);
 		node = next;
 	}
 	pr_debug("Finished freeing nodes from removed stack.\n");
@@ -173,8 +224,8 @@ void skiplist_free(struct skiplist *sl, struct kmem_cache *lsbdd_node_cache, str
 	if (sl->head) {
 		pr_debug("Freeing head node %p\n", sl->head);
 		if (sl->head->value)
-			kmem_cache_free(lsbdd_value_cache, sl->head->value);
-		kmem_cache_free(lsbdd_node_cache, sl->head);
+			lsbdd_value_free(lsbdd_value_cache, sl->head->value);
+		lsbdd_mag_free(lsbdd_node_cache, sl->head);
 		sl->head = NULL;
 	}
 
@@ -182,14 +233,29 @@ void skiplist_free(struct skiplist *sl, struct kmem_cache *lsbdd_node_cache, str
 	kfree(sl);
 	pr_debug("Skiplist cleanup finished.\n");
 
-	kmem_cache_destroy(lsbdd_node_cache);
+	lsbdd_mag_cache_destroy(lsbdd_node_cache);
 	pr_info("Skiplist: Destroyed lsbdd_node_cache\n");
 }
 
 bool skiplist_is_empty(struct skiplist *sl)
 {
 	BUG_ON(!sl);
-	return sl->head->next[0] == 0;
+	return ds_track_is_empty(&sl->track);
+}
+
+u64 skiplist_removed_nodes(struct skiplist *sl)
+{
+	struct skiplist_node *node = NULL;
+	u64 nodes = 0;
+
+	BUG_ON(!sl);
+
+	// nodes are only pushed until the skiplist is freed, so the stack below the head never changes
+	node = (struct skiplist_node *)ATOMIC_LREAD(&sl->removed_stack_head);
+	for (; node; node = node->removed_link)
+		nodes++;
+
+	return nodes;
 }
 
 /**
@@ -200,16 +266,22 @@ bool skiplist_is_empty(struct skiplist *sl)
  * if it matches the target key, the node is returned. If the node is not found,
  * `NULL` is returned, and the place for inserting a new node is stored in the
  * `preds` and `succs` arrays.
+ * Traversal restarts from the head (with backoff) if it runs into a node being removed.
  */
 static struct skiplist_node *find_preds(struct skiplist_node **preds, struct skiplist_node **succs, s32 n, struct skiplist *sl,
 					sector_t key, enum unlink unlink)
 {
 	struct skiplist_node *pred = NULL;
 	struct skiplist_node *node = NULL;
+	struct lsbdd_backoff bo;
 	int d = -1;
 	size_t next, other = 0;
 
+	lsbdd_backoff_init(&bo, LSBDD_CAS_SL_FIND);
+
+retry:
 	pred = sl->head;
+	d = -1;
 	pr_debug("find_preds: searching for key %lld in skiplist (head: %p, max_lvl: %lld)\n", key, pred, ATOMIC_LREAD(&sl->max_lvl));
 
 	// Traverse the levels of sl from the top level to the bottom
@@ -231,7 +303,8 @@ static struct skiplist_node *find_preds(struct skiplist_node **preds, struct ski
 			pr_debug("Level %zd: encountered marked node %p, retrying\n", level, GET_NODE(next));
 			BUG_ON(!(level == pred->height - 1 || HAS_MARK(pred->next[level + 1])));
 			// Retry, because next is about to be removed (ftm is logically removed)
-			return find_preds(preds, succs, n, sl, key, unlink);
+			lsbdd_backoff(&bo);
+			goto retry;
 		}
 
 		node = GET_NODE(next);
@@ -255,7 +328,8 @@ static struct skiplist_node *find_preds(struct skiplist_node **preds, struct ski
 					} else {
 						if (HAS_MARK(other)) {
 							pr_debug("CAS failed due to marked node, retrying");
-							return find_preds(preds, succs, n, sl, key, unlink);
+							lsbdd_backoff(&bo);
+							goto retry;
 						}
 						node = GET_NODE(other);
 						pr_debug("Level %zd(mark): GET_NODE(%zx) returned node = %p\n", level, next, node);
@@ -314,38 +388,65 @@ struct skiplist_node *skiplist_find_node(struct skiplist *sl, sector_t key)
 }
 
 /**
- * Gets last node just by iterating at the level 0.
- * If some node has mark -> remove the mark and skip it.
+ * Gets the last live node by the top-down walk. Logically removed (marked) nodes are skipped.
+ * Used only when the last key hint is stale.
  */
+static sector_t skiplist_find_last(void *ds)
+{
+	struct skiplist *sl = ds;
+	struct skiplist_node *pred = sl->head;
+	struct skiplist_node *node = NULL;
+
+	for (ssize_t level = ATOMIC_LREAD(&sl->max_lvl) - 1; level >= 0; --level) {
+		node = STRIP_MARK(pred->next[level]);
+		while (node) {
+			if (!HAS_MARK(node->next[0]))
+				pred = node;
+			node = STRIP_MARK(node->next[level]);
+		}
+	}
+
+	return pred == sl->head ? 0 : pred->key;
+}
+
 sector_t skiplist_last(struct skiplist *sl)
 {
 	BUG_ON(!sl);
-	return sl->last_key;
+	return ds_track_last(&sl->track, skiplist_find_last, sl);
 }
 
+/**
+ * Replaces the node's value.
+ *
+ * @return old value on success, NULL if the node was removed concurrently
+ */
 static void *update_node(struct skiplist_node *node, void *new_val)
 {
+	struct lsbdd_backoff bo;
 	void *old_val = NULL;
 
-	old_val = node->value;
+	lsbdd_backoff_init(&bo, LSBDD_CAS_SL_UPDATE);
 
-	// If the node's value is 0 it means another thread removed the node out from under us.
-	if (!old_val) {
-		pr_debug("Skiplist(update_node): lost a race to another thread removing the node. retry");
-		return NULL;
-	}
+	while (1) {
+		old_val = node->value;
 
-	/** Use a CAS and not a SWAP. If the CAS fails it means another thread removed the node or updated its value.
-	  * If another thread removed the node but it is not unlinked yet and we used a SWAP, we could replace 0 with our value.
-	  * Then another thread that is updating the value could think it succeeded and return our value even though it should return 0.
-	  */
-	if (old_val == SYNC_LCAS(&node->value, old_val, new_val)) {
-		pr_debug("Skilist(update_node): the CAS succeeded. updated the value of the node\n");
-		return old_val;
-	}
-	pr_debug("Skiplist(update_node): lost a race. the CAS failed. another thread changed the node's value");
+		// If the node's value is 0 it means another thread removed the node out from under us.
+		if (!old_val) {
+			pr_debug("Skiplist(update_node): lost a race to another thread removing the node. retry");
+			return NULL;
+		}
 
-	return update_node(node, new_val); // tail call (retry)
+		/** Use a CAS and not a SWAP. If the CAS fails it means another thread removed the node or updated its value.
+		  * If another thread removed the node but it is not unlinked yet and we used a SWAP, we could replace 0 with our value.
+		  * Then another thread that is updating the value could think it succeeded and return our value even though it should return 0.
+		  */
+		if (old_val == SYNC_LCAS(&node->value, old_val, new_val)) {
+			pr_debug("Skilist(update_node): the CAS succeeded. updated the value of the node\n");
+			return old_val;
+		}
+		pr_debug("Skiplist(update_node): lost a race. the CAS failed. another thread changed the node's value");
+		lsbdd_backoff(&bo);
+	}
 }
 
 struct skiplist_node *skiplist_insert(struct skiplist *sl, sector_t key, void *value, struct kmem_cache *lsbdd_node_cache,
@@ -360,51 +461,42 @@ struct skiplist_node *skiplist_insert(struct skiplist *sl, sector_t key, void *v
 	struct skiplist_node *new_node = NULL;
 	struct skiplist_node *old_node = NULL;
 	struct skiplist_node *pred = NULL;
+	struct lsbdd_backoff bo;
 	void *ret_val = NULL;
 	size_t other, old_next, next = 0;
 	s32 n;
 
-	if (key > sl->last_key)
-		sl->last_key = key;
-	pr_debug("last: %lld\n", sl->last_key);
-
 	n = random_levels(sl);
+	lsbdd_backoff_init(&bo, LSBDD_CAS_SL_INSERT);
+
+retry:
 	old_node = find_preds(preds, nexts, n, sl, key, ASSIST_UNLINK);
 
 	// If there is already an node in the skiplist that matches the key just update its value.
 	if (old_node != NULL) {
 		ret_val = update_node(old_node, value);
-		if (IS_ERR(ret_val)) {
-			if (PTR_ERR(ret_val) == -EAGAIN) {
-				pr_debug("Skiplist(insert): update_node failed CAS for key %lld, retrying insert.\n", key);
-				return skiplist_insert(sl, key, value, lsbdd_node_cache, lsbdd_value_cache); // tail call
-			} else {
-				pr_warn("Skiplist(insert): update_node returned unexpected error %ld for key %lld\n", PTR_ERR(ret_val),
-					key);
-				return ret_val;
-			}
-		} else if (ret_val == NULL) {
+		if (ret_val == NULL) {
 			pr_debug("Skiplist(insert): update_node returned NULL for key %lld (node likely removed), retrying insert.\n", key);
-			return skiplist_insert(sl, key, value, lsbdd_node_cache, lsbdd_value_cache); // tail call
-		} else {
-			pr_debug("Skiplist(insert): Successfully updated node %p (key %lld). Old value was %p.\n", old_node, key, ret_val);
-
-			if (lsbdd_value_cache) {
-				kmem_cache_free(lsbdd_value_cache, ret_val);
-			} else {
-				pr_warn("Skiplist(insert): lsbdd_value_cache is NULL, cannot free old value %p - LEAKING MEMORY\n",
-					ret_val);
-			}
-
-			return 0;
+			lsbdd_backoff(&bo);
+			goto retry;
 		}
+
+		pr_debug("Skiplist(insert): Successfully updated node %p (key %lld). Old value was %p.\n", old_node, key, ret_val);
+		lsbdd_value_free(lsbdd_value_cache, ret_val);
+		// node could be allocated on the previous attempt
+		if (new_node)
+			lsbdd_mag_free(lsbdd_node_cache, new_node);
+
+		return old_node;
 	}
 
 	pr_debug("Skiplist(insert): attempting to insert a new node between %p and %p, height %d\n", preds[0], nexts[0], n);
 
-	new_node = node_alloc(key, value, n, lsbdd_node_cache);
-	if (!(new_node && new_node->value))
-		goto mem_err;
+	if (!new_node) {
+		new_node = node_alloc(key, value, n, lsbdd_node_cache);
+		if (!new_node)
+			goto mem_err;
+	}
 
 	// Set new_node's next pointers to their proper values
 	//	next = new_node->next[0] = (size_t)nexts[0];
@@ -426,9 +518,10 @@ struct skiplist_node *skiplist_insert(struct skiplist *sl, sector_t key, void *v
 			  new_node); // does it change only the lower one?
 	if (other != next) {
 		pr_debug("Skiplist(insert): failed to change pred's link: expected %zx found %zx\n", next, other);
-		kfree(new_node);
-		return skiplist_insert(sl, key, value, lsbdd_node_cache, lsbdd_value_cache); // retry
+		lsbdd_backoff(&bo); // new_node isn't published yet, so it is reused on retry
+		goto retry;
 	}
+	ds_track_insert(&sl->track, key);
 	pr_debug("Skiplist(insert): other = %zx new_node = %p next = %zx, pred = %p\n", other, new_node, next, pred);
 	pr_debug("Skiplist(insert): successfully inserted a new node %p at the bottom level\n", new_node);
 	pr_debug("Skiplist(insert): pred[0] = %p, pred[1] = %p\n", preds[0], preds[1]);
@@ -452,6 +545,7 @@ struct skiplist_node *skiplist_insert(struct skiplist *sl, sector_t key, void *v
 			if (other == next)
 				break;
 
+			lsbdd_backoff(&bo);
 			pr_debug("Skiplist(insert): lost a race. failed to "
 				 "change pred's link. expected %p found %ld\n",
 				 nexts[level], other);
@@ -478,7 +572,7 @@ struct skiplist_node *skiplist_insert(struct skiplist *sl, sector_t key, void *v
 				if (HAS_MARK(other)) {
 					find_preds(NULL, NULL, 0, sl, key,
 						   FORCE_UNLINK); // see comment below
-					return 0;
+					return new_node;
 				}
 			}
 		} while (1);
@@ -493,22 +587,25 @@ struct skiplist_node *skiplist_insert(struct skiplist *sl, sector_t key, void *v
 		find_preds(NULL, NULL, 0, sl, key, FORCE_UNLINK);
 	}
 
-	return 0;
+	return new_node;
 
 mem_err:
-	pr_warn("Failed to allocate node, retrying\n");
-	return skiplist_insert(sl, key, value, lsbdd_node_cache, lsbdd_value_cache);
+	pr_warn("Failed to allocate node\n");
+	return NULL;
 }
 
 void skiplist_remove(struct skiplist *sl, sector_t key, struct kmem_cache *lsbdd_value_cache)
 {
 	struct skiplist_node *preds[MAX_LVL];
 	struct skiplist_node *node = NULL;
+	struct lsbdd_backoff bo;
 	size_t old_next = 0;
 	void *val = 0;
 	ssize_t level = 0;
 	pr_debug("Skiplist(remove): removing node with key %lld from skiplist %p\n", key, sl);
 
+	lsbdd_backoff_init(&bo, LSBDD_CAS_SL_REMOVE);
+
 	node = find_preds(preds, NULL, ATOMIC_LREAD(&sl->max_lvl), sl, key, ASSIST_UNLINK);
 	if (node == NULL) {
 		pr_debug("Skiplist(remove: remove failed, an node with a matching key does not exist in the skiplist");
@@ -535,9 +632,14 @@ void skiplist_remove(struct skiplist *sl, sector_t key, struct kmem_cache *lsbdd
 					return;
 				break;
 			}
+			if (next != old_next)
+				lsbdd_backoff(&bo);
 		} while (next != old_next); // loop is necessary, bc CAS can fail
 	}
 
+	// bottom level is marked by us, so this thread is the one removing the key
+	ds_track_remove(&sl->track, key);
+
 	/* Atomically swap out the node's value in case another thread is updating the node while we are removing it.
 	  * This establishes which operation occurs first logically, the update or the remove.
 	  */
@@ -548,7 +650,7 @@ void skiplist_remove(struct skiplist *sl, sector_t key, struct kmem_cache *lsbdd
 	// unlink the node
 	find_preds(NULL, NULL, 0, sl, key, FORCE_UNLINK);
 	if (val)
-		kmem_cache_free(lsbdd_value_cache, val);
+		lsbdd_value_free(lsbdd_value_cache, val);
 
 	return;
 }
@@ -577,3 +679,24 @@ struct skiplist_node *skiplist_prev(struct skiplist *sl, sector_t key, sector_t
 		*prev_key = pred->key;
 	return pred;
 }
+
+s32 skiplist_iter(struct skiplist *sl, s32 (*fn)(sector_t key, void *value, void *data), void *data)
+{
+	struct skiplist_node *node = NULL;
+	void *value = NULL;
+	s32 status = 0;
+
+	BUG_ON(!sl || !fn);
+
+	for (node = STRIP_MARK(sl->head->next[0]); node; node = STRIP_MARK(node->next[0])) {
+		value = READ_ONCE(node->value);
+		if (HAS_MARK(node->next[0]) || !value)
+			continue; // removed: marked, its value is swapped to NULL right after
+
+		status = fn(node->key, value, data);
+		if (status)
+			return status;
+	}
+
+	return 0;
+}
@@ -4,11 +4,17 @@
 #define SKIPLIST_H
 
 #include <linux/module.h>
+#include "../ds_track.h"
 
 #define HEAD_KEY ((sector_t)0)
 #define HEAD_VALUE NULL
 #define MAX_LVL 24
 
+#ifdef LSBDD_BENCH
+// switches random_levels() to the get_random_u32() based generator (check bench.c)
+extern bool sl_legacy_levels;
+#endif
+
 // Node unlink statuses for find_pred
 enum unlink { FORCE_UNLINK, ASSIST_UNLINK, DONT_UNLINK };
 
@@ -22,8 +28,8 @@ struct skiplist_node {
 
 struct skiplist {
 	struct skiplist_node *head;
-	atomic64_t max_lvl; // max historic number of levels
-	sector_t last_key;
+	struct lsbdd_ds_track track; // size and last key hint
+	atomic64_t max_lvl ____cacheline_aligned_in_smp; // max historic number of levels, read-mostly
 	atomic64_t removed_stack_head;
 };
 
@@ -103,12 +109,27 @@ void skiplist_remove(struct skiplist *sl, sector_t key, struct kmem_cache *lsbdd
 struct skiplist_node *skiplist_prev(struct skiplist *sl, sector_t key, sector_t *prev_key);
 
 /**
- * Simply returns the last_key from skiplist.
- * It is stored in the general structure.
+ * Returns the max key of the skiplist (0 if empty).
+ * O(1), unless the max key was removed - then the top-down walk is made once (check ds_track.h).
  */
 sector_t skiplist_last(struct skiplist *sl);
 
-// Checks if the next node from head is NULL
+// Checks if there are no live nodes in the skiplist, O(1)
 bool skiplist_is_empty(struct skiplist *sl);
 
+// @return number of removed nodes on the removed stack (they are freed only with the skiplist), O(n)
+u64 skiplist_removed_nodes(struct skiplist *sl);
+
+/**
+ * Calls fn for every live node in the ascending key order, stops if it returns non-zero.
+ * Goes concurrently with the updates (as skiplist_prev does), so it sees a moving skiplist.
+ *
+ * @param sl - skiplist structure
+ * @param fn - callback, gets the key, the value and data
+ * @param data - callback's data
+ *
+ * @return first non-zero result of fn, 0 if all the nodes were visited
+ */
+s32 skiplist_iter(struct skiplist *sl, s32 (*fn)(sector_t key, void *value, void *data), void *data);
+
 #endif
@@ -0,0 +1,241 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/string.h>
+#include <linux/topology.h>
+#include "mag_cache.h"
+
+static struct lsbdd_mag_cache mag_caches[LSBDD_MAG_MAX_CACHES];
+static DEFINE_MUTEX(mag_caches_lock);
+
+/*
+ * Lockless lookup: slots are only compared by the cache pointer, magazines are
+ * dereferenced only for the matching (so, alive) cache.
+ */
+static struct lsbdd_mag_cache *mag_lookup(struct kmem_cache *cache)
+{
+	u8 i = 0;
+
+	for (i = 0; i < LSBDD_MAG_MAX_CACHES; i++) {
+		if (READ_ONCE(mag_caches[i].cache) == cache)
+			return &mag_caches[i];
+	}
+
+	return NULL;
+}
+
+struct kmem_cache *lsbdd_mag_cache_create(const char *name, u32 size, u32 align, slab_flags_t flags)
+{
+	struct kmem_cache *cache = NULL;
+	struct lsbdd_mag __percpu *mags = NULL;
+	struct lsbdd_mag_cache *slot = NULL;
+	s32 cpu = 0;
+	u8 i = 0;
+
+	cache = kmem_cache_create(name, size, align, flags, NULL);
+	if (!cache)
+		return NULL;
+
+	mags = alloc_percpu(struct lsbdd_mag);
+	if (!mags) {
+		pr_warn("Magazines for %s weren't allocated, using plain slab\n", name);
+		return cache;
+	}
+
+	for_each_possible_cpu(cpu) {
+		local_lock_init(&per_cpu_ptr(mags, cpu)->lock);
+	}
+
+	mutex_lock(&mag_caches_lock);
+	for (i = 0; i < LSBDD_MAG_MAX_CACHES; i++) {
+		if (!mag_caches[i].cache) {
+			slot = &mag_caches[i];
+			break;
+		}
+	}
+
+	if (!slot) {
+		mutex_unlock(&mag_caches_lock);
+		pr_warn("No free magazine slots for %s, using plain slab\n", name);
+		free_percpu(mags);
+		return cache;
+	}
+
+	strscpy(slot->name, name, LSBDD_MAG_NAME_LEN);
+	slot->mags = mags;
+	WRITE_ONCE(slot->cache, cache); // publish after the magazines are ready
+	mutex_unlock(&mag_caches_lock);
+
+	pr_debug("Registered magazines for %s\n", name);
+
+	return cache;
+}
+
+void lsbdd_mag_cache_destroy(struct kmem_cache *cache)
+{
+	struct lsbdd_mag_cache *mc = NULL;
+	struct lsbdd_mag *mag = NULL;
+	s32 cpu = 0;
+
+	if (!cache)
+		return;
+
+	mutex_lock(&mag_caches_lock);
+	mc = mag_lookup(cache);
+	if (mc) {
+		for_each_possible_cpu(cpu) {
+			mag = per_cpu_ptr(mc->mags, cpu);
+			kmem_cache_free_bulk(cache, mag->count, mag->objs);
+			mag->count = 0;
+		}
+		free_percpu(mc->mags);
+		mc->mags = NULL;
+		WRITE_ONCE(mc->cache, NULL);
+	}
+	mutex_unlock(&mag_caches_lock);
+
+	kmem_cache_destroy(cache);
+}
+
+/**
+ * Allocates the batch of objects on the current NUMA node.
+ * Called without the local lock, as gfp may sleep.
+ *
+ * @return number of allocated objects.
+ */
+static u32 mag_alloc_batch(struct kmem_cache *cache, gfp_t gfp, void **batch)
+{
+	s32 node = numa_mem_id();
+	u32 filled = 0;
+
+	for (filled = 0; filled < LSBDD_MAG_BATCH; filled++) {
+		batch[filled] = kmem_cache_alloc_node(cache, gfp, node);
+		if (unlikely(!batch[filled]))
+			break;
+	}
+
+	return filled;
+}
+
+void *lsbdd_mag_alloc(struct kmem_cache *cache, gfp_t gfp)
+{
+	struct lsbdd_mag_cache *mc = NULL;
+	struct lsbdd_mag *mag = NULL;
+	void *batch[LSBDD_MAG_BATCH];
+	void *obj = NULL;
+	unsigned long flags = 0;
+	u32 filled = 0;
+
+	mc = mag_lookup(cache);
+	if (unlikely(!mc))
+		return kmem_cache_alloc(cache, gfp);
+
+	local_lock_irqsave(&mc->mags->lock, flags);
+	mag = this_cpu_ptr(mc->mags);
+	if (likely(mag->count)) {
+		obj = mag->objs[--mag->count];
+		mag->hits++;
+	}
+	local_unlock_irqrestore(&mc->mags->lock, flags);
+
+	if (likely(obj))
+		return obj;
+
+	filled = mag_alloc_batch(cache, gfp, batch);
+	if (unlikely(!filled))
+		return NULL;
+
+	obj = batch[--filled];
+
+	// might be another CPU now, that's fine - objects just go to its magazine
+	local_lock_irqsave(&mc->mags->lock, flags);
+	mag = this_cpu_ptr(mc->mags);
+	mag->misses++;
+	while (filled && mag->count < LSBDD_MAG_SIZE)
+		mag->objs[mag->count++] = batch[--filled];
+	local_unlock_irqrestore(&mc->mags->lock, flags);
+
+	if (unlikely(filled))
+		kmem_cache_free_bulk(cache, filled, batch);
+
+	return obj;
+}
+
+void *lsbdd_mag_zalloc(struct kmem_cache *cache, gfp_t gfp)
+{
+	void *obj = lsbdd_mag_alloc(cache, gfp);
+
+	if (likely(obj))
+		memset(obj, 0, kmem_cache_size(cache));
+
+	return obj;
+}
+
+void lsbdd_mag_free(struct kmem_cache *cache, void *obj)
+{
+	struct lsbdd_mag_cache *mc = NULL;
+	struct lsbdd_mag *mag = NULL;
+	void *batch[LSBDD_MAG_BATCH];
+	unsigned long flags = 0;
+	u32 drained = 0;
+
+	if (unlikely(!obj))
+		return;
+
+	mc = mag_lookup(cache);
+	if (unlikely(!mc)) {
+		kmem_cache_free(cache, obj);
+		return;
+	}
+
+	local_lock_irqsave(&mc->mags->lock, flags);
+	mag = this_cpu_ptr(mc->mags);
+	if (unlikely(mag->count == LSBDD_MAG_SIZE)) {
+		drained = LSBDD_MAG_BATCH;
+		mag->count -= drained;
+		memcpy(batch, &mag->objs[mag->count], drained * sizeof(void *));
+		mag->drains++;
+	}
+	mag->objs[mag->count++] = obj;
+	mag->frees++;
+	local_unlock_irqrestore(&mc->mags->lock, flags);
+
+	if (drained)
+		kmem_cache_free_bulk(cache, drained, batch);
+}
+
+s32 lsbdd_mag_stats_show(char *buf)
+{
+	struct lsbdd_mag_cache *mc = NULL;
+	struct lsbdd_mag *mag = NULL;
+	u64 hits, misses, frees, drains;
+	s32 offset = 0;
+	s32 cpu = 0;
+	u8 i = 0;
+
+	offset += scnprintf(buf + offset, PAGE_SIZE - offset, "cache hits misses hit_rate(%%) frees drains\n");
+
+	mutex_lock(&mag_caches_lock);
+	for (i = 0; i < LSBDD_MAG_MAX_CACHES; i++) {
+		mc = &mag_caches[i];
+		if (!mc->cache)
+			continue;
+
+		hits = misses = frees = drains = 0;
+		for_each_possible_cpu(cpu) {
+			mag = per_cpu_ptr(mc->mags, cpu);
+			hits += READ_ONCE(mag->hits);
+			misses += READ_ONCE(mag->misses);
+			frees += READ_ONCE(mag->frees);
+			drains += READ_ONCE(mag->drains);
+		}
+
+		offset += scnprintf(buf + offset, PAGE_SIZE - offset, "%s %llu %llu %llu %llu %llu\n", mc->name, hits, misses,
+				    hits + misses ? div64_u64(hits * 100, hits + misses) : 0, frees, drains);
+	}
+	mutex_unlock(&mag_caches_lock);
+
+	return offset;
+}
@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef MAG_CACHE_H
+#define MAG_CACHE_H
+
+#include <linux/local_lock.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/types.h>
+
+/**
+ * Per-CPU magazine layer over the kmem_caches used in the hot I/O path
+ * (data structure nodes and mapping values). B+tree nodes are the exception:
+ * lib/btree allocates them from its own mempool and frees only the root on destroy.
+ *
+ * Each registered cache gets a per-CPU stack of free objects. Alloc/free hit the
+ * local magazine under a local lock; an empty magazine is refilled with a batch
+ * of NUMA-local objects, a full one drains half of itself back to the slab.
+ *
+ * Caches are looked up by their kmem_cache pointer, so the data structures keep
+ * passing plain (struct kmem_cache *) around. Unregistered caches fall through
+ * to the regular kmem_cache_* calls.
+ */
+
+#define LSBDD_MAG_SIZE 64
+#define LSBDD_MAG_BATCH (LSBDD_MAG_SIZE / 2)
+#define LSBDD_MAG_MAX_CACHES 8
+#define LSBDD_MAG_NAME_LEN 32
+
+struct lsbdd_mag {
+	local_lock_t lock;
+	u32 count;
+	void *objs[LSBDD_MAG_SIZE];
+	u64 hits;
+	u64 misses;
+	u64 frees;
+	u64 drains;
+};
+
+struct lsbdd_mag_cache {
+	struct kmem_cache *cache;
+	struct lsbdd_mag __percpu *mags;
+	char name[LSBDD_MAG_NAME_LEN];
+};
+
+/**
+ * Creates the kmem_cache and registers per-CPU magazines for it.
+ * If magazines can't be set up - the plain cache is returned.
+ *
+ * @return kmem_cache on success, NULL if the cache creation fails.
+ */
+struct kmem_cache *lsbdd_mag_cache_create(const char *name, u32 size, u32 align, slab_flags_t flags);
+
+/**
+ * Drains the magazines back to the slab, unregisters them and destroys the cache.
+ * Caller guarantees there is no I/O using the cache anymore.
+ */
+void lsbdd_mag_cache_destroy(struct kmem_cache *cache);
+
+void *lsbdd_mag_alloc(struct kmem_cache *cache, gfp_t gfp);
+void *lsbdd_mag_zalloc(struct kmem_cache *cache, gfp_t gfp);
+void lsbdd_mag_free(struct kmem_cache *cache, void *obj);
+
+/**
+ * Prints hit/miss statistics of all registered caches.
+ *
+ * @param buf - output buffer (PAGE_SIZE)
+ *
+ * @return number of written bytes.
+ */
+s32 lsbdd_mag_stats_show(char *buf);
+
+#endif
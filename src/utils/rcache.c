@@ -0,0 +1,388 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/gfp.h>
+#include <linux/hash.h>
+#include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include "rcache.h"
+
+static inline struct hlist_head *rcache_bucket(struct hlist_head *table, u8 bits, sector_t lba)
+{
+	return &table[hash_64(lba, bits)];
+}
+
+static struct lsbdd_rcache_ent *rcache_lookup(struct lsbdd_rcache *rcache, sector_t lba)
+{
+	struct lsbdd_rcache_ent *ent = NULL;
+
+	hlist_for_each_entry(ent, rcache_bucket(rcache->table, rcache->bits, lba), hnode) {
+		if (ent->lba == lba)
+			return ent;
+	}
+
+	return NULL;
+}
+
+static struct lsbdd_rcache_ghost *rcache_ghost_lookup(struct lsbdd_rcache *rcache, sector_t lba)
+{
+	struct lsbdd_rcache_ghost *ghost = NULL;
+
+	hlist_for_each_entry(ghost, rcache_bucket(rcache->ghost_table, rcache->bits, lba), hnode) {
+		if (ghost->lba == lba)
+			return ghost;
+	}
+
+	return NULL;
+}
+
+// Remembers the key of the block evicted from A1in, the oldest ghost is reused if there is no free one
+static void rcache_ghost_add(struct lsbdd_rcache *rcache, sector_t lba)
+{
+	struct lsbdd_rcache_ghost *ghost = NULL;
+
+	if (!rcache->nr_ghosts)
+		return;
+
+	if (!list_empty(&rcache->ghost_free)) {
+		ghost = list_first_entry(&rcache->ghost_free, struct lsbdd_rcache_ghost, list);
+	} else {
+		ghost = list_last_entry(&rcache->a1out, struct lsbdd_rcache_ghost, list);
+		hlist_del(&ghost->hnode);
+	}
+
+	ghost->lba = lba;
+	hlist_add_head(&ghost->hnode, rcache_bucket(rcache->ghost_table, rcache->bits, lba));
+	list_move(&ghost->list, &rcache->a1out);
+}
+
+// Unlinks the entry from hash and queue and returns it to the free list
+static void rcache_release(struct lsbdd_rcache *rcache, struct lsbdd_rcache_ent *ent)
+{
+	hlist_del_init(&ent->hnode);
+	if (ent->state == LSBDD_RCACHE_VALID && !ent->hot)
+		rcache->nr_a1in--;
+
+	ent->state = LSBDD_RCACHE_FREE;
+	ent->owner = NULL;
+	list_move(&ent->list, &rcache->free); // FILLING entries are unlinked (list_del_init), so it is safe too
+}
+
+// @return free entry (evicts one by 2Q rules if needed), NULL if all of them are being filled
+static struct lsbdd_rcache_ent *rcache_get_free(struct lsbdd_rcache *rcache)
+{
+	struct lsbdd_rcache_ent *victim = NULL;
+
+	if (list_empty(&rcache->free)) {
+		if (!list_empty(&rcache->a1in) && (rcache->nr_a1in > rcache->nr_ents / 4 || list_empty(&rcache->am))) {
+			victim = list_last_entry(&rcache->a1in, struct lsbdd_rcache_ent, list);
+			rcache_ghost_add(rcache, victim->lba);
+		} else if (!list_empty(&rcache->am)) {
+			victim = list_last_entry(&rcache->am, struct lsbdd_rcache_ent, list);
+		} else {
+			return NULL;
+		}
+
+		rcache_release(rcache, victim);
+		atomic64_inc(&rcache->evictions);
+	}
+
+	return list_first_entry(&rcache->free, struct lsbdd_rcache_ent, list);
+}
+
+static void rcache_reserve(struct lsbdd_rcache *rcache, const void *owner, sector_t lba)
+{
+	struct lsbdd_rcache_ghost *ghost = NULL;
+	struct lsbdd_rcache_ent *ent = NULL;
+
+	ent = rcache_get_free(rcache);
+	if (!ent)
+		return;
+
+	list_del_init(&ent->list);
+	ent->lba = lba;
+	ent->owner = owner;
+	ent->state = LSBDD_RCACHE_FILLING;
+	ent->hot = false;
+
+	ghost = rcache_ghost_lookup(rcache, lba);
+	if (ghost) { // second access after A1in - block is hot
+		hlist_del(&ghost->hnode);
+		list_move(&ghost->list, &rcache->ghost_free);
+		ent->hot = true;
+	}
+
+	hlist_add_head(&ent->hnode, rcache_bucket(rcache->table, rcache->bits, lba));
+}
+
+static void rcache_touch(struct lsbdd_rcache *rcache, struct lsbdd_rcache_ent *ent)
+{
+	if (ent->hot) // A1in is FIFO, hits there don't change the order
+		list_move(&ent->list, &rcache->am);
+}
+
+/**
+ * Copies the data between the bio and cached blocks.
+ *
+ * @param rcache - cache of the device
+ * @param bio - read bio, starts on the block boundary
+ * @param owner - only the entries filled by it are copied to (NULL means copy from VALID ones into bio)
+ *
+ * @return void
+ */
+static void rcache_copy(struct lsbdd_rcache *rcache, struct bio *bio, const void *owner)
+{
+	struct lsbdd_rcache_ent *ent = NULL;
+	struct bvec_iter iter;
+	struct bio_vec bv;
+	struct bio_vec part;
+	sector_t lba = bio->bi_iter.bi_sector;
+	void *data = NULL;
+	u32 offset = 0;
+	u32 len = 0;
+
+	bio_for_each_segment(bv, bio, iter) {
+		while (bv.bv_len) {
+			if (!offset_in_page(offset))
+				ent = rcache_lookup(rcache, lba + (offset >> PAGE_SHIFT) * LSBDD_RCACHE_BLOCK_SECTORS);
+
+			len = min_t(u32, bv.bv_len, PAGE_SIZE - offset_in_page(offset));
+			part = bv;
+			part.bv_len = len;
+
+			if (owner && ent && ent->state == LSBDD_RCACHE_FILLING && ent->owner == owner) {
+				data = page_address(ent->page) + offset_in_page(offset);
+				memcpy_from_bvec(data, &part);
+			} else if (!owner) {
+				data = page_address(ent->page) + offset_in_page(offset);
+				memcpy_to_bvec(&part, data);
+			}
+
+			bv.bv_offset += len;
+			bv.bv_len -= len;
+			offset += len;
+		}
+	}
+}
+
+static inline bool rcache_cacheable(struct lsbdd_rcache *rcache, sector_t start, u32 size)
+{
+	return rcache->nr_ents && size && size <= LSBDD_RCACHE_MAX_READ && IS_ALIGNED(start, LSBDD_RCACHE_BLOCK_SECTORS) &&
+	       IS_ALIGNED(size, PAGE_SIZE);
+}
+
+void lsbdd_rcache_init(struct lsbdd_rcache *rcache, u32 nr_pages)
+{
+	struct lsbdd_rcache_ent *ent = NULL;
+	u32 i = 0;
+
+	spin_lock_init(&rcache->lock);
+	INIT_LIST_HEAD(&rcache->free);
+	INIT_LIST_HEAD(&rcache->a1in);
+	INIT_LIST_HEAD(&rcache->am);
+	INIT_LIST_HEAD(&rcache->a1out);
+	INIT_LIST_HEAD(&rcache->ghost_free);
+	rcache->nr_ents = 0;
+	rcache->nr_ghosts = 0;
+	rcache->nr_a1in = 0;
+	rcache->ents = NULL;
+	rcache->ghosts = NULL;
+	rcache->table = NULL;
+	rcache->ghost_table = NULL;
+
+	atomic64_set(&rcache->hits, 0);
+	atomic64_set(&rcache->misses, 0);
+	atomic64_set(&rcache->fills, 0);
+	atomic64_set(&rcache->evictions, 0);
+	atomic64_set(&rcache->invalidations, 0);
+
+	if (!nr_pages)
+		return;
+
+	rcache->bits = max_t(u8, ilog2(roundup_pow_of_two(nr_pages)), 1);
+	rcache->ents = kvcalloc(nr_pages, sizeof(struct lsbdd_rcache_ent), GFP_KERNEL);
+	rcache->ghosts = kvcalloc(nr_pages / 2, sizeof(struct lsbdd_rcache_ghost), GFP_KERNEL);
+	rcache->table = kvcalloc(1U << rcache->bits, sizeof(struct hlist_head), GFP_KERNEL);
+	rcache->ghost_table = kvcalloc(1U << rcache->bits, sizeof(struct hlist_head), GFP_KERNEL);
+	if (!rcache->ents || (nr_pages / 2 && !rcache->ghosts) || !rcache->table || !rcache->ghost_table)
+		goto mem_err;
+
+	for (i = 0; i < nr_pages; i++) {
+		ent = &rcache->ents[i];
+		ent->page = alloc_page(GFP_KERNEL | __GFP_NOWARN);
+		if (!ent->page)
+			goto mem_err;
+
+		INIT_HLIST_NODE(&ent->hnode);
+		list_add_tail(&ent->list, &rcache->free);
+		rcache->nr_ents++;
+	}
+
+	for (i = 0; i < nr_pages / 2; i++) {
+		INIT_HLIST_NODE(&rcache->ghosts[i].hnode);
+		list_add_tail(&rcache->ghosts[i].list, &rcache->ghost_free);
+	}
+	rcache->nr_ghosts = nr_pages / 2;
+
+	pr_debug("Read cache: %u pages, %u ghosts\n", rcache->nr_ents, rcache->nr_ghosts);
+	return;
+
+mem_err:
+	pr_warn("Read cache of %u pages wasn't allocated, reads will bypass it\n", nr_pages);
+	lsbdd_rcache_destroy(rcache);
+}
+
+void lsbdd_rcache_destroy(struct lsbdd_rcache *rcache)
+{
+	u32 i = 0;
+
+	for (i = 0; rcache->ents && i < rcache->nr_ents; i++)
+		__free_page(rcache->ents[i].page);
+
+	kvfree(rcache->ents);
+	kvfree(rcache->ghosts);
+	kvfree(rcache->table);
+	kvfree(rcache->ghost_table);
+
+	rcache->ents = NULL;
+	rcache->ghosts = NULL;
+	rcache->table = NULL;
+	rcache->ghost_table = NULL;
+	rcache->nr_ents = 0;
+	rcache->nr_ghosts = 0;
+}
+
+bool lsbdd_rcache_read(struct lsbdd_rcache *rcache, struct bio *bio)
+{
+	struct lsbdd_rcache_ent *ent = NULL;
+	sector_t start = bio->bi_iter.bi_sector;
+	sector_t end = bio_end_sector(bio);
+	sector_t lba = 0;
+	unsigned long flags = 0;
+
+	if (!rcache_cacheable(rcache, start, bio->bi_iter.bi_size))
+		return false;
+
+	spin_lock_irqsave(&rcache->lock, flags);
+	for (lba = start; lba < end; lba += LSBDD_RCACHE_BLOCK_SECTORS) {
+		ent = rcache_lookup(rcache, lba);
+		if (!ent || ent->state != LSBDD_RCACHE_VALID)
+			goto miss;
+	}
+
+	rcache_copy(rcache, bio, NULL);
+	for (lba = start; lba < end; lba += LSBDD_RCACHE_BLOCK_SECTORS)
+		rcache_touch(rcache, rcache_lookup(rcache, lba));
+	spin_unlock_irqrestore(&rcache->lock, flags);
+
+	atomic64_inc(&rcache->hits);
+	bio_endio(bio);
+
+	return true;
+
+miss:
+	for (lba = start; lba < end; lba += LSBDD_RCACHE_BLOCK_SECTORS) {
+		if (!rcache_lookup(rcache, lba))
+			rcache_reserve(rcache, bio, lba);
+	}
+	spin_unlock_irqrestore(&rcache->lock, flags);
+
+	atomic64_inc(&rcache->misses);
+
+	return false;
+}
+
+void lsbdd_rcache_fill(struct lsbdd_rcache *rcache, struct bio *bio)
+{
+	struct lsbdd_rcache_ent *ent = NULL;
+	sector_t start = bio->bi_iter.bi_sector;
+	sector_t end = bio_end_sector(bio);
+	sector_t lba = 0;
+	unsigned long flags = 0;
+
+	if (!rcache_cacheable(rcache, start, bio->bi_iter.bi_size))
+		return;
+
+	if (unlikely(bio->bi_status)) {
+		lsbdd_rcache_cancel(rcache, bio, start, bio->bi_iter.bi_size);
+		return;
+	}
+
+	spin_lock_irqsave(&rcache->lock, flags);
+	rcache_copy(rcache, bio, bio);
+	for (lba = start; lba < end; lba += LSBDD_RCACHE_BLOCK_SECTORS) {
+		ent = rcache_lookup(rcache, lba);
+		if (!ent || ent->state != LSBDD_RCACHE_FILLING || ent->owner != bio)
+			continue;
+
+		ent->state = LSBDD_RCACHE_VALID;
+		ent->owner = NULL;
+		if (ent->hot) {
+			list_add(&ent->list, &rcache->am);
+		} else {
+			list_add(&ent->list, &rcache->a1in);
+			rcache->nr_a1in++;
+		}
+		atomic64_inc(&rcache->fills);
+	}
+	spin_unlock_irqrestore(&rcache->lock, flags);
+}
+
+void lsbdd_rcache_cancel(struct lsbdd_rcache *rcache, const void *owner, sector_t start, u32 size)
+{
+	struct lsbdd_rcache_ent *ent = NULL;
+	sector_t end = start + (size >> SECTOR_SHIFT);
+	sector_t lba = 0;
+	unsigned long flags = 0;
+
+	if (!rcache_cacheable(rcache, start, size))
+		return;
+
+	spin_lock_irqsave(&rcache->lock, flags);
+	for (lba = start; lba < end; lba += LSBDD_RCACHE_BLOCK_SECTORS) {
+		ent = rcache_lookup(rcache, lba);
+		if (ent && ent->state == LSBDD_RCACHE_FILLING && ent->owner == owner)
+			rcache_release(rcache, ent);
+	}
+	spin_unlock_irqrestore(&rcache->lock, flags);
+}
+
+void lsbdd_rcache_invalidate(struct lsbdd_rcache *rcache, sector_t start, sector_t nr_sects)
+{
+	struct lsbdd_rcache_ent *ent = NULL;
+	sector_t end = start + nr_sects;
+	sector_t lba = 0;
+	unsigned long flags = 0;
+	u32 i = 0;
+
+	if (!rcache->nr_ents || !nr_sects)
+		return;
+
+	spin_lock_irqsave(&rcache->lock, flags);
+	if ((nr_sects / LSBDD_RCACHE_BLOCK_SECTORS) > rcache->nr_ents) { // large discards - scan the entries instead
+		for (i = 0; i < rcache->nr_ents; i++) {
+			ent = &rcache->ents[i];
+			if (ent->state != LSBDD_RCACHE_FREE && ent->lba + LSBDD_RCACHE_BLOCK_SECTORS > start && ent->lba < end) {
+				rcache_release(rcache, ent);
+				atomic64_inc(&rcache->invalidations);
+			}
+		}
+	} else {
+		for (lba = round_down(start, LSBDD_RCACHE_BLOCK_SECTORS); lba < end; lba += LSBDD_RCACHE_BLOCK_SECTORS) {
+			ent = rcache_lookup(rcache, lba);
+			if (ent) {
+				rcache_release(rcache, ent);
+				atomic64_inc(&rcache->invalidations);
+			}
+		}
+	}
+	spin_unlock_irqrestore(&rcache->lock, flags);
+}
+
+s32 lsbdd_rcache_stats_show(struct lsbdd_rcache *rcache, const char *name, char *buf, s32 offset)
+{
+	return scnprintf(buf + offset, PAGE_SIZE - offset, "%s %u %lld %lld %lld %lld %lld\n", name, rcache->nr_ents,
+			 atomic64_read(&rcache->hits), atomic64_read(&rcache->misses), atomic64_read(&rcache->fills),
+			 atomic64_read(&rcache->evictions), atomic64_read(&rcache->invalidations));
+}
@@ -0,0 +1,128 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef RCACHE_H
+#define RCACHE_H
+
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+/**
+ * Read cache of hot logical blocks.
+ *
+ * Entries are page-granular and keyed by the aligned LBA, so hits skip both the mapping lookup and the backing I/O.
+ * Eviction follows 2Q (Johnson & Shasha), which keeps one-time scans from flushing the hot set:
+ * - A1in - FIFO of blocks read once, limited to 1/4 of the capacity;
+ * - A1out - ghost FIFO (keys only) of blocks evicted from A1in, 1/2 of the capacity;
+ * - Am - LRU of blocks that were read again after leaving A1in.
+ *
+ * Missed block gets a placeholder (FILLING entry owned by the bio) before the mapping lookup,
+ * it is filled by the read completion only if no write invalidated it meanwhile. Writes invalidate the range
+ * after the mapping is updated, so the block read with an old mapping never becomes VALID.
+ *
+ * All the entries are preallocated on device creation, there are no allocations on the I/O path.
+ */
+
+#define LSBDD_RCACHE_BLOCK_SECTORS (PAGE_SIZE >> SECTOR_SHIFT)
+#define LSBDD_RCACHE_MAX_READ (128 * 1024) // larger reads are sequential ones, they aren't cached
+
+enum lsbdd_rcache_state {
+	LSBDD_RCACHE_FREE,
+	LSBDD_RCACHE_FILLING,
+	LSBDD_RCACHE_VALID,
+};
+
+struct lsbdd_rcache_ent {
+	struct hlist_node hnode;
+	struct list_head list; // free, A1in or Am (FILLING entries aren't linked)
+	sector_t lba;
+	struct page *page;
+	const void *owner; // bio that fills the entry
+	u8 state;
+	bool hot; // was found in A1out, goes to Am after the fill
+};
+
+struct lsbdd_rcache_ghost {
+	struct hlist_node hnode;
+	struct list_head list; // ghost free list or A1out
+	sector_t lba;
+};
+
+struct lsbdd_rcache {
+	spinlock_t lock;
+	struct lsbdd_rcache_ent *ents;
+	struct lsbdd_rcache_ghost *ghosts;
+	struct hlist_head *table;
+	struct hlist_head *ghost_table;
+	u8 bits;
+	u32 nr_ents;
+	u32 nr_ghosts;
+	struct list_head free;
+	struct list_head a1in;
+	struct list_head am;
+	struct list_head a1out;
+	struct list_head ghost_free;
+	u32 nr_a1in;
+
+	// stats
+	atomic64_t hits;
+	atomic64_t misses;
+	atomic64_t fills;
+	atomic64_t evictions;
+	atomic64_t invalidations;
+};
+
+/**
+ * Initialises the cache and preallocates its entries.
+ * If nr_pages is 0 or allocation fails - cache stays disabled (all the reads miss without placeholders).
+ *
+ * @param rcache - cache (embedded into the device mng)
+ * @param nr_pages - capacity in pages
+ *
+ * @return void
+ */
+void lsbdd_rcache_init(struct lsbdd_rcache *rcache, u32 nr_pages);
+
+// Frees the entries, no I/O should be in flight
+void lsbdd_rcache_destroy(struct lsbdd_rcache *rcache);
+
+// @return true if the cache has entries, reads of the disabled cache get no placeholders
+static inline bool lsbdd_rcache_enabled(struct lsbdd_rcache *rcache)
+{
+	return rcache->nr_ents != 0;
+}
+
+/**
+ * Serves the read from the cache if all its blocks are cached, reserves placeholders for the missed ones otherwise.
+ *
+ * @param rcache - cache of the device
+ * @param bio - original read bio
+ *
+ * @return true if bio was served and completed, false on miss
+ */
+bool lsbdd_rcache_read(struct lsbdd_rcache *rcache, struct bio *bio);
+
+/**
+ * Fills the placeholders of the bio with the read data (drops them if the read failed).
+ * Must be called before the bio is completed, can be called from irq context.
+ */
+void lsbdd_rcache_fill(struct lsbdd_rcache *rcache, struct bio *bio);
+
+/**
+ * Drops the placeholders of the read that was completed without the backing I/O.
+ * Bio can already be completed, so the range is passed explicitly and owner is only compared.
+ */
+void lsbdd_rcache_cancel(struct lsbdd_rcache *rcache, const void *owner, sector_t start, u32 size);
+
+/**
+ * Drops the cached blocks (and placeholders) that intersect [start, start + nr_sects).
+ * Called after the mapping of the range is updated.
+ */
+void lsbdd_rcache_invalidate(struct lsbdd_rcache *rcache, sector_t start, sector_t nr_sects);
+
+// Prints the cache statistics line of the device into buf + offset, @return number of written bytes
+s32 lsbdd_rcache_stats_show(struct lsbdd_rcache *rcache, const char *name, char *buf, s32 offset);
+
+#endif
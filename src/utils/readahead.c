@@ -0,0 +1,328 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/gfp.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/string.h>
+#include "readahead.h"
+#include "value_redir.h"
+
+static struct lsbdd_ra_slot *ra_find(struct lsbdd_ra *ra, sector_t lba)
+{
+	u8 i = 0;
+
+	for (i = 0; i < LSBDD_RA_NR_SLOTS; i++) {
+		if (ra->slots[i].state != LSBDD_RA_FREE && ra->slots[i].lba == lba)
+			return &ra->slots[i];
+	}
+
+	return NULL;
+}
+
+// @return free slot (the least recently used loaded one is evicted if needed), NULL if all of them are loading
+static struct lsbdd_ra_slot *ra_get_free(struct lsbdd_ra *ra)
+{
+	struct lsbdd_ra_slot *victim = NULL;
+	u8 i = 0;
+
+	for (i = 0; i < LSBDD_RA_NR_SLOTS; i++) {
+		if (ra->slots[i].state == LSBDD_RA_FREE)
+			return &ra->slots[i];
+		if (ra->slots[i].state == LSBDD_RA_VALID && (!victim || ra->slots[i].last_use < victim->last_use))
+			victim = &ra->slots[i];
+	}
+
+	return victim;
+}
+
+// Drops the fragment (or issuing) ref of the slot, the last one makes it VALID or drops it if it is stale
+static void ra_slot_put(struct lsbdd_ra_slot *slot, blk_status_t status)
+{
+	struct lsbdd_ra *ra = slot->ra;
+	unsigned long flags = 0;
+
+	if (unlikely(status))
+		WRITE_ONCE(slot->stale, true);
+
+	if (!atomic_dec_and_test(&slot->pending))
+		return;
+
+	spin_lock_irqsave(&ra->lock, flags);
+	if (slot->stale) {
+		slot->state = LSBDD_RA_FREE;
+		atomic64_inc(&ra->dropped);
+	} else {
+		slot->state = LSBDD_RA_VALID;
+		atomic64_inc(&ra->prefetched);
+	}
+	ra->nr_loading--;
+	spin_unlock_irqrestore(&ra->lock, flags);
+
+	wake_up(&ra->drain_wq);
+}
+
+static void ra_fragment_end_io(struct bio *bio)
+{
+	ra_slot_put(bio->bi_private, bio->bi_status);
+	bio_put(bio);
+}
+
+static void ra_read_fragment(struct lsbdd_ra_slot *slot, sector_t pba, u32 offset, sector_t nr_sects)
+{
+	struct lsbdd_ra *ra = slot->ra;
+	struct bio *bio = NULL;
+
+	bio = bio_alloc_bioset(ra->bdev, 1, REQ_OP_READ, GFP_NOIO, ra->bs);
+	bio->bi_iter.bi_sector = pba;
+	__bio_add_page(bio, nth_page(slot->pages, offset >> PAGE_SHIFT), nr_sects << SECTOR_SHIFT, offset_in_page(offset));
+	bio->bi_private = slot;
+	bio->bi_end_io = ra_fragment_end_io;
+
+	atomic_inc(&slot->pending);
+	atomic64_inc(&ra->fragments);
+
+	if (!lsbdd_wbuf_read(ra->wbuf, bio)) // fragment can still be in the write buffer
+		submit_bio(bio);
+}
+
+/**
+ * Resolves the mapping of the slot range extent by extent and issues the read of each fragment.
+ * Zero extents are filled in place. Slot is marked stale if some part of it isn't mapped.
+ * Unaligned starts are resolved by ds_prev, so the extent covering them is found on every backend
+ * (hashtables included, check hashtable_prev).
+ */
+static void ra_load(struct lsbdd_ra *ra, struct lsbdd_ra_slot *slot)
+{
+	struct lsbdd_value_redir ext = { 0 };
+	sector_t lba = slot->lba;
+	sector_t end = slot->lba + LSBDD_RA_SLOT_SECTORS;
+	sector_t key = 0;
+	sector_t ext_end = 0;
+	sector_t len = 0;
+	void *value = NULL;
+
+	while (lba < end) {
+		if (ds_empty_check(ra->ds))
+			goto unmapped;
+
+		key = lba;
+		value = ds_lookup(ra->ds, lba);
+		if (!value)
+			value = ds_prev(ra->ds, lba, &key);
+		if (!value)
+			goto unmapped;
+
+		ext = lsbdd_value_get(value);
+		ext_end = key + ext.block_size / SECTOR_SIZE;
+		if (lba >= ext_end)
+			goto unmapped;
+
+		if (lsbdd_value_is_compressed(&ext)) // decompression isn't done here, slot is dropped
+			goto unmapped;
+
+		len = min(ext_end, end) - lba;
+		if (lsbdd_value_is_zero(&ext))
+			memset(slot->data + ((lba - slot->lba) << SECTOR_SHIFT), 0, len << SECTOR_SHIFT);
+		else
+			ra_read_fragment(slot, ext.redirected_sector + (lba - key), (lba - slot->lba) << SECTOR_SHIFT, len);
+
+		lba += len;
+	}
+
+	ra_slot_put(slot, BLK_STS_OK);
+	return;
+
+unmapped:
+	WRITE_ONCE(slot->stale, true);
+	ra_slot_put(slot, BLK_STS_OK);
+}
+
+// @return true if the whole bio range is in the loaded slots and was copied into it
+static bool ra_copy_locked(struct lsbdd_ra *ra, struct bio *bio)
+{
+	struct lsbdd_ra_slot *slot = NULL;
+	struct bvec_iter iter;
+	struct bio_vec bv;
+	struct bio_vec part;
+	sector_t lba = 0;
+	u32 offset = 0;
+	u32 len = 0;
+
+	for (lba = round_down(bio->bi_iter.bi_sector, LSBDD_RA_SLOT_SECTORS); lba < bio_end_sector(bio); lba += LSBDD_RA_SLOT_SECTORS) {
+		slot = ra_find(ra, lba);
+		if (!slot || slot->state != LSBDD_RA_VALID || slot->stale)
+			return false;
+	}
+
+	lba = bio->bi_iter.bi_sector;
+	bio_for_each_segment(bv, bio, iter) {
+		while (bv.bv_len) {
+			slot = ra_find(ra, round_down(lba, LSBDD_RA_SLOT_SECTORS));
+			offset = (lba - slot->lba) << SECTOR_SHIFT;
+			len = min_t(u32, bv.bv_len, LSBDD_RA_SLOT_SIZE - offset);
+
+			part = bv;
+			part.bv_len = len;
+			memcpy_to_bvec(&part, slot->data + offset);
+			slot->last_use = ++ra->clock;
+
+			bv.bv_offset += len;
+			bv.bv_len -= len;
+			lba += len >> SECTOR_SHIFT;
+		}
+	}
+
+	return true;
+}
+
+void lsbdd_ra_init(struct lsbdd_ra *ra, struct block_device *bdev, struct bio_set *bs, struct lsbdd_ds *ds, struct lsbdd_wbuf *wbuf,
+		   bool enabled)
+{
+	struct lsbdd_ra_slot *slot = NULL;
+	u8 i = 0;
+
+	BUG_ON(!ra || !bdev || !bs || !ds || !wbuf);
+
+	spin_lock_init(&ra->lock);
+	init_waitqueue_head(&ra->drain_wq);
+	ra->stream_end = 0;
+	ra->seq_reads = 0;
+	ra->clock = 0;
+	ra->nr_loading = 0;
+	ra->bdev = bdev;
+	ra->bs = bs;
+	ra->ds = ds;
+	ra->wbuf = wbuf;
+	ra->enabled = false;
+
+	atomic64_set(&ra->hits, 0);
+	atomic64_set(&ra->prefetched, 0);
+	atomic64_set(&ra->fragments, 0);
+	atomic64_set(&ra->dropped, 0);
+
+	if (!enabled)
+		return;
+
+	for (i = 0; i < LSBDD_RA_NR_SLOTS; i++) {
+		slot = &ra->slots[i];
+		slot->pages = alloc_pages(GFP_KERNEL | __GFP_NOWARN, LSBDD_RA_SLOT_ORDER);
+		if (!slot->pages)
+			goto mem_err;
+
+		slot->data = page_address(slot->pages);
+		slot->state = LSBDD_RA_FREE;
+		slot->ra = ra;
+	}
+
+	ra->enabled = true;
+	return;
+
+mem_err:
+	pr_warn("Readahead slots weren't allocated, readahead is disabled\n");
+	for (i = 0; i < LSBDD_RA_NR_SLOTS; i++) {
+		if (ra->slots[i].pages)
+			__free_pages(ra->slots[i].pages, LSBDD_RA_SLOT_ORDER);
+		ra->slots[i].pages = NULL;
+	}
+}
+
+void lsbdd_ra_destroy(struct lsbdd_ra *ra)
+{
+	u8 i = 0;
+
+	if (!ra->enabled)
+		return;
+
+	wait_event(ra->drain_wq, READ_ONCE(ra->nr_loading) == 0);
+
+	ra->enabled = false;
+	for (i = 0; i < LSBDD_RA_NR_SLOTS; i++) {
+		__free_pages(ra->slots[i].pages, LSBDD_RA_SLOT_ORDER);
+		ra->slots[i].pages = NULL;
+	}
+}
+
+bool lsbdd_ra_read(struct lsbdd_ra *ra, struct bio *bio)
+{
+	struct lsbdd_ra_slot *load[LSBDD_RA_WINDOW_SLOTS];
+	struct lsbdd_ra_slot *slot = NULL;
+	sector_t start = bio->bi_iter.bi_sector;
+	sector_t end = bio_end_sector(bio);
+	sector_t lba = 0;
+	unsigned long flags = 0;
+	bool hit = false;
+	u8 nr_load = 0;
+	u8 i = 0;
+
+	if (!ra->enabled || !bio_sectors(bio))
+		return false;
+
+	spin_lock_irqsave(&ra->lock, flags);
+	ra->seq_reads = (start == ra->stream_end) ? ra->seq_reads + 1 : 0;
+	ra->stream_end = end;
+
+	hit = ra_copy_locked(ra, bio);
+
+	if (ra->seq_reads >= LSBDD_RA_TRIGGER) {
+		for (i = 0; i < LSBDD_RA_WINDOW_SLOTS; i++) {
+			lba = round_down(end, LSBDD_RA_SLOT_SECTORS) + i * LSBDD_RA_SLOT_SECTORS;
+			if (ra_find(ra, lba))
+				continue;
+
+			slot = ra_get_free(ra);
+			if (!slot)
+				break;
+
+			// slot is reserved before its mapping is resolved, so the writes after it mark it stale
+			slot->lba = lba;
+			slot->state = LSBDD_RA_LOADING;
+			slot->stale = false;
+			slot->last_use = ++ra->clock;
+			atomic_set(&slot->pending, 1);
+			ra->nr_loading++;
+			load[nr_load++] = slot;
+		}
+	}
+	spin_unlock_irqrestore(&ra->lock, flags);
+
+	for (i = 0; i < nr_load; i++)
+		ra_load(ra, load[i]);
+
+	if (hit) {
+		atomic64_inc(&ra->hits);
+		bio_endio(bio);
+	}
+
+	return hit;
+}
+
+void lsbdd_ra_invalidate(struct lsbdd_ra *ra, sector_t start, sector_t nr_sects)
+{
+	struct lsbdd_ra_slot *slot = NULL;
+	unsigned long flags = 0;
+	u8 i = 0;
+
+	if (!ra->enabled || !nr_sects)
+		return;
+
+	spin_lock_irqsave(&ra->lock, flags);
+	for (i = 0; i < LSBDD_RA_NR_SLOTS; i++) {
+		slot = &ra->slots[i];
+		if (slot->state == LSBDD_RA_FREE || slot->lba >= start + nr_sects || slot->lba + LSBDD_RA_SLOT_SECTORS <= start)
+			continue;
+
+		if (slot->state == LSBDD_RA_LOADING) {
+			slot->stale = true;
+		} else {
+			slot->state = LSBDD_RA_FREE;
+			atomic64_inc(&ra->dropped);
+		}
+	}
+	spin_unlock_irqrestore(&ra->lock, flags);
+}
+
+s32 lsbdd_ra_stats_show(struct lsbdd_ra *ra, const char *name, char *buf, s32 offset)
+{
+	return scnprintf(buf + offset, PAGE_SIZE - offset, "%s %d %lld %lld %lld %lld\n", name, ra->enabled, atomic64_read(&ra->hits),
+			 atomic64_read(&ra->prefetched), atomic64_read(&ra->fragments), atomic64_read(&ra->dropped));
+}
@@ -0,0 +1,114 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/wait.h>
+#include "ds_control.h"
+#include "wbuf.h"
+
+/**
+ * Mapping-aware readahead.
+ *
+ * Logically sequential data is scattered over the log, so the backing device's own readahead doesn't help.
+ * Device tracks the end of the last read, after LSBDD_RA_TRIGGER sequential reads it prefetches the next
+ * LSBDD_RA_WINDOW_SLOTS LBA-aligned slots: each slot is resolved through the mapping (ds_lookup/ds_prev)
+ * and all of its fragments are read asynchronously in parallel into the slot memory.
+ * Reads fully covered by loaded slots are served from memory.
+ *
+ * Slots are reserved (LOADING) before their mapping is resolved and writes invalidate the range after
+ * the mapping is updated, so a slot loaded with the old mapping is marked stale and dropped on completion.
+ * The new mapping is visible before the write lands, so the range is invalidated once more when the write
+ * completes: a slot that read the new PBA meanwhile is dropped too (stale if it is still loading).
+ * Slots with unmapped parts (system sectors) or compressed extents are dropped too.
+ */
+
+#define LSBDD_RA_SLOT_ORDER 6 // 256K slots
+#define LSBDD_RA_SLOT_SIZE (PAGE_SIZE << LSBDD_RA_SLOT_ORDER)
+#define LSBDD_RA_SLOT_SECTORS (LSBDD_RA_SLOT_SIZE >> SECTOR_SHIFT)
+#define LSBDD_RA_NR_SLOTS 8
+#define LSBDD_RA_WINDOW_SLOTS 4 // prefetch depth, the rest are the ones being consumed
+#define LSBDD_RA_TRIGGER 2 // sequential reads in a row that start the prefetch
+
+enum lsbdd_ra_state {
+	LSBDD_RA_FREE,
+	LSBDD_RA_LOADING,
+	LSBDD_RA_VALID,
+};
+
+struct lsbdd_ra;
+
+struct lsbdd_ra_slot {
+	sector_t lba;
+	struct page *pages;
+	void *data;
+	u8 state;
+	bool stale; // invalidated (or not fully mapped) while loading, dropped on completion
+	atomic_t pending; // fragment reads in flight (+1 while they are being issued)
+	u64 last_use;
+	struct lsbdd_ra *ra;
+};
+
+struct lsbdd_ra {
+	spinlock_t lock;
+	struct lsbdd_ra_slot slots[LSBDD_RA_NR_SLOTS];
+	sector_t stream_end; // end of the last read
+	u32 seq_reads;
+	u64 clock;
+	u32 nr_loading;
+	wait_queue_head_t drain_wq;
+	struct block_device *bdev;
+	struct bio_set *bs;
+	struct lsbdd_ds *ds;
+	struct lsbdd_wbuf *wbuf;
+	bool enabled;
+
+	// stats
+	atomic64_t hits;
+	atomic64_t prefetched;
+	atomic64_t fragments;
+	atomic64_t dropped;
+};
+
+/**
+ * Initialises the readahead and allocates its slots.
+ * If slots weren't allocated (or enabled is false) - readahead stays disabled.
+ *
+ * @param ra - readahead state (embedded into the device mng)
+ * @param bdev - redirect block device
+ * @param bs - bio set for the fragment BIOs
+ * @param ds - mapping of the device
+ * @param wbuf - write buffer of the device, fragments that are still buffered are copied from it
+ * @param enabled - use readahead on this device
+ *
+ * @return void
+ */
+void lsbdd_ra_init(struct lsbdd_ra *ra, struct block_device *bdev, struct bio_set *bs, struct lsbdd_ds *ds, struct lsbdd_wbuf *wbuf,
+		   bool enabled);
+
+// Waits for the loading slots and frees the memory
+void lsbdd_ra_destroy(struct lsbdd_ra *ra);
+
+/**
+ * Updates the stream detection, serves the read from the loaded slots and starts the prefetch
+ * of the next window on sequential stream.
+ *
+ * @param ra - readahead state of the device
+ * @param bio - original read bio
+ *
+ * @return true if bio was served and completed, false if it should be read as usual
+ */
+bool lsbdd_ra_read(struct lsbdd_ra *ra, struct bio *bio);
+
+// Drops the slots that intersect [start, start + nr_sects), called after the mapping of the range is updated
+// and on the write completion, can be called from irq context
+void lsbdd_ra_invalidate(struct lsbdd_ra *ra, sector_t start, sector_t nr_sects);
+
+// Prints the readahead statistics line of the device into buf + offset, @return number of written bytes
+s32 lsbdd_ra_stats_show(struct lsbdd_ra *ra, const char *name, char *buf, s32 offset);
+
+#endif
@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/kernel.h>
+#include "stats.h"
+
+static const char *stat_item_names[LSBDD_STAT_ITEMS_NUM] = {
+	"reads", "read_bytes", "read_fragments", "writes", "write_bytes", "system_bios",
+};
+
+s32 lsbdd_stats_init(struct lsbdd_stats *stats)
+{
+	stats->cpu = alloc_percpu(struct lsbdd_stats_cpu);
+	if (!stats->cpu)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void lsbdd_stats_destroy(struct lsbdd_stats *stats)
+{
+	free_percpu(stats->cpu);
+	stats->cpu = NULL;
+}
+
+u64 lsbdd_stats_read(struct lsbdd_stats *stats, enum lsbdd_stat_item item)
+{
+	u64 sum = 0;
+	s32 cpu = 0;
+
+	for_each_possible_cpu(cpu)
+		sum += READ_ONCE(per_cpu_ptr(stats->cpu, cpu)->items[item]);
+
+	return sum;
+}
+
+void lsbdd_stats_show(struct lsbdd_stats *stats, struct seq_file *m)
+{
+	u8 item = 0;
+
+	for (item = 0; item < LSBDD_STAT_ITEMS_NUM; item++)
+		seq_printf(m, "%s %llu\n", stat_item_names[item], lsbdd_stats_read(stats, item));
+}
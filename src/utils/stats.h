@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include <linux/types.h>
+
+/**
+ * Per-device I/O counters.
+ *
+ * Counters are per-CPU and are only summed up on read, so the I/O path pays one this_cpu_add per event.
+ * Map state (entries, memory, live sectors) isn't counted here, it is read from the structure itself
+ * when the stats are shown (check lsbdd_bd_stats_show in main.c).
+ *
+ * Exported through debugfs: /sys/kernel/debug/lsbdd/<vbd_name>/stats.
+ */
+
+enum lsbdd_stat_item {
+	LSBDD_STAT_READS, // read BIOs, each one is counted once even if it is split at the extent ends
+	LSBDD_STAT_READ_BYTES,
+	LSBDD_STAT_READ_FRAGS, // parts the reads were split into on the backing device
+	LSBDD_STAT_WRITES,
+	LSBDD_STAT_WRITE_BYTES,
+	LSBDD_STAT_SYSTEM_BIOS, // reads that weren't mapped and were passed through as is (check_system_bio)
+	LSBDD_STAT_ITEMS_NUM
+};
+
+struct lsbdd_stats_cpu {
+	u64 items[LSBDD_STAT_ITEMS_NUM];
+};
+
+struct lsbdd_stats {
+	struct lsbdd_stats_cpu __percpu *cpu;
+};
+
+static inline void lsbdd_stats_add(struct lsbdd_stats *stats, enum lsbdd_stat_item item, u64 val)
+{
+	this_cpu_add(stats->cpu->items[item], val);
+}
+
+static inline void lsbdd_stats_inc(struct lsbdd_stats *stats, enum lsbdd_stat_item item)
+{
+	this_cpu_inc(stats->cpu->items[item]);
+}
+
+// Per-CPU values wrap, only their sum is meaningful
+static inline void lsbdd_stats_sub(struct lsbdd_stats *stats, enum lsbdd_stat_item item, u64 val)
+{
+	this_cpu_sub(stats->cpu->items[item], val);
+}
+
+/**
+ * Allocates the per-CPU counters.
+ *
+ * @return 0 on success, -ENOMEM on error.
+ */
+s32 lsbdd_stats_init(struct lsbdd_stats *stats);
+
+void lsbdd_stats_destroy(struct lsbdd_stats *stats);
+
+// @return counter summed over all the CPU's
+u64 lsbdd_stats_read(struct lsbdd_stats *stats, enum lsbdd_stat_item item);
+
+// Prints all the counters as "name value" lines.
+void lsbdd_stats_show(struct lsbdd_stats *stats, struct seq_file *m);
+
+#endif
@@ -3,21 +3,21 @@
 #include <linux/hashtable.h>
 #include "hashtable.h"
 #include <linux/slab.h>
+#include "../value_redir.h"
 
 struct hashtable *hashtable_init(struct kmem_cache *lsbdd_node_cache)
 {
 	BUG_ON(!lsbdd_node_cache);
 
 	struct hashtable *hash_table = NULL;
-	struct hash_el *last_hel = NULL;
 
 	hash_table = kzalloc(sizeof(struct hashtable), GFP_KERNEL);
-	last_hel = kzalloc(sizeof(struct hash_el), GFP_KERNEL);
-	hash_table->last_el = last_hel;
 	if (!hash_table)
 		return NULL;
 
 	hash_init(hash_table->head);
+	ds_track_init(&hash_table->track);
+	hash_table->min_key = U64_MAX;
 	return hash_table;
 }
 
@@ -39,8 +39,8 @@ struct hash_el *hashtable_insert(struct hashtable *ht, sector_t key, void *value
 	hlist_add_head(&el->node, &ht->head[hash_min(BUCKET_NUM, HT_MAP_BITS)]);
 
 	ht->max_bck_num = BUCKET_NUM;
-	if (ht->last_el->key < key)
-		ht->last_el = el;
+	ht->min_key = min(ht->min_key, key);
+	ds_track_insert(&ht->track, key);
 	return el;
 }
 
@@ -59,7 +59,6 @@ void hashtable_free(struct hashtable *ht, struct kmem_cache *lsbdd_node_cache, s
 			kfree(el);
 		}
 	}
-	kfree(ht->last_el);
 	kfree(ht);
 }
 
@@ -82,25 +81,40 @@ struct hash_el *hashtable_prev(struct hashtable *ht, sector_t key, sector_t *pre
 {
 	BUG_ON(!ht);
 
-	struct hash_el *prev_max_node = kzalloc(sizeof(struct hash_el), GFP_KERNEL);
+	struct hash_el *prev_max_node = NULL;
 	struct hash_el *el = NULL;
+	sector_t chunk = BUCKET_NUM;
+	u32 scanned = 0;
 
-	hlist_for_each_entry(el, &ht->head[hash_min(BUCKET_NUM, HT_MAP_BITS)], node) {
-		if (el && el->key <= key && el->key > prev_max_node->key)
-			prev_max_node = el;
+	// min_key is a lower bound of the stored keys (it isn't raised on remove)
+	if (key <= ht->min_key)
+		return NULL;
+
+	// keys above the max one (f.e. reads past the written region) get it without the scan
+	if (key > hashtable_last(ht)) {
+		prev_max_node = hashtable_find_node(ht, hashtable_last(ht));
+		goto found;
 	}
 
-	if (prev_max_node->key == 0) {
-		pr_debug("Hashtable: Element with  is in the prev bucket\n");
-		// mb execute recursively key + mb_size
-		hlist_for_each_entry(el, &ht->head[hash_min(min(BUCKET_NUM - 1, ht->max_bck_num), HT_MAP_BITS)], node) {
-			if (el && el->key <= key && el->key > prev_max_node->key)
+	/**
+	 * Chunks are checked downwards until one of them has a key smaller than the provided one.
+	 * After HASH_SIZE(ht->head) chunks every bucket was seen, so the found key is the max one.
+	 */
+	for (;; chunk--) {
+		hlist_for_each_entry(el, &ht->head[hash_min(chunk, HT_MAP_BITS)], node) {
+			if (el->key < key && (!prev_max_node || el->key > prev_max_node->key))
 				prev_max_node = el;
-			pr_debug("Hashtable: prev el key = %llu\n", el->key);
 		}
-		if (prev_max_node->key == 0)
-			return NULL;
+
+		if ((prev_max_node && prev_max_node->key >= chunk * CHUNK_SIZE) || ++scanned == HASH_SIZE(ht->head) ||
+		    chunk <= ht->min_key / CHUNK_SIZE)
+			break;
 	}
+
+found:
+	if (!prev_max_node)
+		return NULL;
+
 	pr_debug("Hashtable: Element with prev key - el key=%llu, val=%p\n", prev_max_node->key, prev_max_node->value);
 
 	*prev_key = prev_max_node->key;
@@ -111,14 +125,64 @@ void hashtable_remove(struct hashtable *ht, sector_t key, struct kmem_cache *lsb
 {
 	BUG_ON(!ht || !lsbdd_value_cache);
 
-	struct hlist_node *ht_node = NULL;
+	struct hash_el *el = NULL;
+
+	el = hashtable_find_node(ht, key);
+	if (!el) {
+		pr_debug("Hashtable: Tried to remove non-existent key %lld\n", key);
+		return;
+	}
+
+	hash_del(&el->node);
+	ds_track_remove(&ht->track, key);
+	lsbdd_value_free(lsbdd_value_cache, el->value);
+	kfree(el);
+}
+
+/**
+ * Slow path of hashtable_last: full scan, keys aren't ordered across the buckets.
+ */
+static sector_t hashtable_find_last(void *ds)
+{
+	struct hashtable *ht = ds;
+	struct hash_el *el = NULL;
+	sector_t last = 0;
+	s32 bckt_iter = 0;
+
+	hash_for_each(ht->head, bckt_iter, el, node) {
+		if (el->key > last)
+			last = el->key;
+	}
+
+	return last;
+}
+
+sector_t hashtable_last(struct hashtable *ht)
+{
+	BUG_ON(!ht);
 
-	ht_node = &hashtable_find_node(ht, key)->node;
-	hash_del(ht_node);
+	return ds_track_last(&ht->track, hashtable_find_last, ht);
 }
 
 bool hashtable_is_empty(struct hashtable *ht)
 {
 	BUG_ON(!ht);
-	return hash_empty(ht->head);
+	return ds_track_is_empty(&ht->track);
+}
+
+s32 hashtable_iter(struct hashtable *ht, s32 (*fn)(sector_t key, void *value, void *data), void *data)
+{
+	BUG_ON(!ht || !fn);
+
+	struct hash_el *el = NULL;
+	s32 bckt_iter = 0;
+	s32 status = 0;
+
+	hash_for_each(ht->head, bckt_iter, el, node) {
+		status = fn(el->key, el->value, data);
+		if (status)
+			return status;
+	}
+
+	return 0;
 }
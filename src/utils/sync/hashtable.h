@@ -5,6 +5,7 @@
 
 #include <linux/hashtable.h>
 #include <linux/slab.h>
+#include "../ds_track.h"
 
 #define HT_MAP_BITS 7
 #define CHUNK_SIZE (1024 * 2)
@@ -12,7 +13,8 @@
 
 struct hashtable {
 	DECLARE_HASHTABLE(head, HT_MAP_BITS);
-	struct hash_el *last_el;
+	struct lsbdd_ds_track track;
+	sector_t min_key; // lower bound of the stored keys for hashtable_prev, isn't raised on remove
 	u8 max_bck_num;
 };
 
@@ -75,7 +77,7 @@ struct hash_el *hashtable_find_node(struct hashtable *hm, sector_t key);
  * @param key - LBA sector
  * @param prev_key - pointer to prev_key memory that will be changed
  *
- * @return prev_node on success, NULL on fail
+ * @return prev_node on success, NULL if there is no smaller key
  */
 struct hash_el *hashtable_prev(struct hashtable *hm, sector_t key, sector_t *prev_key);
 
@@ -90,7 +92,24 @@ struct hash_el *hashtable_prev(struct hashtable *hm, sector_t key, sector_t *pre
  */
 void hashtable_remove(struct hashtable *hm, sector_t key, struct kmem_cache *lsbdd_value_cache);
 
+/**
+ * @return max key stored in the hashtable (O(1) unless the max key was removed), 0 if empty
+ */
+sector_t hashtable_last(struct hashtable *ht);
+
 // @return bool if empty
 bool hashtable_is_empty(struct hashtable *ht);
 
+/**
+ * Calls fn for every node, bucket by bucket (keys aren't ordered across the buckets),
+ * stops if it returns non-zero.
+ *
+ * @param ht - hashtable structure
+ * @param fn - callback, gets the key, the value and data
+ * @param data - callback's data
+ *
+ * @return first non-zero result of fn, 0 if all the nodes were visited
+ */
+s32 hashtable_iter(struct hashtable *ht, s32 (*fn)(sector_t key, void *value, void *data), void *data);
+
 #endif
@@ -10,6 +10,7 @@
  */
 
 #include "skiplist.h"
+#include "../mag_cache.h"
 
 static void free_node_full(struct skiplist_node *node, struct kmem_cache *lsbdd_node_cache)
 {
@@ -17,7 +18,7 @@ static void free_node_full(struct skiplist_node *node, struct kmem_cache *lsbdd_
 
 	while (node) {
 		temp = node->lower;
-		kmem_cache_free(lsbdd_node_cache, node);
+		lsbdd_mag_free(lsbdd_node_cache, node);
 		node = temp;
 	}
 	return;
@@ -33,7 +34,7 @@ static struct skiplist_node *create_node_tall(sector_t key, void **value, s32 h,
 
 	last = NULL;
 	for (curr_h = 0; curr_h < h; ++curr_h) {
-		curr = kmem_cache_zalloc(lsbdd_node_cache, GFP_KERNEL);
+		curr = lsbdd_mag_zalloc(lsbdd_node_cache, GFP_KERNEL);
 		if (!curr)
 			goto alloc_fail;
 
@@ -73,6 +74,7 @@ struct skiplist *skiplist_init(struct kmem_cache *lsbdd_node_cache)
 	sl->head_lvl = 0;
 	sl->max_lvl = MAX_LVL;
 	head->next = tail;
+	ds_track_init(&sl->track);
 
 	return sl;
 
@@ -247,6 +249,8 @@ struct skiplist_node *skiplist_insert(struct skiplist *sl, sector_t key, void *v
 	if (IS_ERR(new))
 		goto fail;
 
+	ds_track_insert(&sl->track, key);
+
 	return new;
 
 fail:
@@ -323,7 +327,7 @@ void skiplist_remove(struct skiplist *sl, sector_t key, struct kmem_cache *lsbdd
 		return;
 
 	struct skiplist_node *curr = sl->head;
-	struct skiplist_node *prev[MAX_LVL + 1];
+	struct skiplist_node *prev[MAX_LVL + 1] = { NULL };
 	s32 i;
 
 	for (i = sl->head_lvl; i >= 0; --i) {
@@ -344,6 +348,7 @@ void skiplist_remove(struct skiplist *sl, sector_t key, struct kmem_cache *lsbdd
 				prev[i]->next = curr->next;
 			curr = prev[i]->next;
 		}
+		ds_track_remove(&sl->track, key);
 
 		while (sl->head_lvl > 0 && !sl->head->next) {
 			struct skiplist_node *old_head = sl->head;
@@ -357,19 +362,31 @@ void skiplist_remove(struct skiplist *sl, sector_t key, struct kmem_cache *lsbdd
 	}
 }
 
-sector_t skiplist_last(struct skiplist *sl)
+/**
+ * Slow path of skiplist_last: top-down descent to the last node before the tail.
+ */
+static sector_t skiplist_find_last(void *ds)
 {
-	BUG_ON(!sl);
-
+	struct skiplist *sl = ds;
 	struct skiplist_node *curr = sl->head;
+	struct skiplist_node *last = curr;
 
-	while (curr->lower)
+	while (curr) {
+		while (curr->next && curr->next->key != TAIL_KEY)
+			curr = curr->next;
+
+		last = curr;
 		curr = curr->lower;
+	}
 
-	while (curr->next && curr->next->key && curr->next->key != TAIL_KEY)
-		curr = curr->next;
+	return last->key;
+}
 
-	return curr->key;
+sector_t skiplist_last(struct skiplist *sl)
+{
+	BUG_ON(!sl);
+
+	return ds_track_last(&sl->track, skiplist_find_last, sl);
 }
 
 struct skiplist_node *skiplist_prev(struct skiplist *sl, sector_t key, sector_t *prev_key)
@@ -383,6 +400,9 @@ struct skiplist_node *skiplist_prev(struct skiplist *sl, sector_t key, sector_t
 			curr = curr->next;
 
 		if (!curr->lower) {
+			// bottom head, there is no smaller key
+			if (curr->value == HEAD_VALUE)
+				return NULL;
 			*prev_key = curr->key;
 			return curr;
 		}
@@ -396,5 +416,24 @@ struct skiplist_node *skiplist_prev(struct skiplist *sl, sector_t key, sector_t
 inline bool skiplist_is_empty(struct skiplist *sl)
 {
 	BUG_ON(!sl);
-	return sl->head_lvl == 0;
+	return ds_track_is_empty(&sl->track);
+}
+
+s32 skiplist_iter(struct skiplist *sl, s32 (*fn)(sector_t key, void *value, void *data), void *data)
+{
+	BUG_ON(!sl || !fn);
+
+	struct skiplist_node *curr = sl->head;
+	s32 status = 0;
+
+	while (curr->lower)
+		curr = curr->lower;
+
+	for (curr = curr->next; curr && curr->key != TAIL_KEY; curr = curr->next) {
+		status = fn(curr->key, curr->value, data);
+		if (status)
+			return status;
+	}
+
+	return 0;
 }
@@ -12,6 +12,7 @@
 #define SKIPLIST_H
 
 #include <linux/module.h>
+#include "../ds_track.h"
 
 #define HEAD_KEY ((sector_t)0)
 #define HEAD_VALUE NULL
@@ -30,6 +31,7 @@ struct skiplist {
 	struct skiplist_node *head;
 	s32 head_lvl;
 	s32 max_lvl;
+	struct lsbdd_ds_track track;
 };
 
 /**
@@ -105,12 +107,23 @@ void skiplist_remove(struct skiplist *sl, sector_t key, struct kmem_cache *lsbdd
 struct skiplist_node *skiplist_prev(struct skiplist *sl, sector_t key, sector_t *prev_key);
 
 /**
- * Simply returns the last_key from skiplist.
- * It is stored in the general structure.
+ * Returns the max key of the skiplist.
+ * It is tracked in the general structure, the skiplist is walked only if the max key was removed.
  */
 sector_t skiplist_last(struct skiplist *sl);
 
-// Checks if the next node from head is NULL
+// Checks the live nodes counter
 bool skiplist_is_empty(struct skiplist *sl);
 
+/**
+ * Calls fn for every live node in the ascending key order, stops if it returns non-zero.
+ *
+ * @param sl - skiplist structure
+ * @param fn - callback, gets the key, the value and data
+ * @param data - callback's data
+ *
+ * @return first non-zero result of fn, 0 if all the nodes were visited
+ */
+s32 skiplist_iter(struct skiplist *sl, s32 (*fn)(sector_t key, void *value, void *data), void *data);
+
 #endif
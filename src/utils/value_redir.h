@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef VALUE_REDIR_H
+#define VALUE_REDIR_H
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/types.h>
+#include "mag_cache.h"
+
+/**
+ * LBA-PBA mapping value. Data structures store it as an opaque (void *) in one of two encodings:
+ *
+ * - full: pointer to struct lsbdd_value_redir, allocated from lsbdd_value_cache.
+ * - compact: the mapping itself packed into the pointer slot, so nothing is allocated.
+ *   Used for 4K-aligned extents only:
+ *
+ *   | 63 ......... 16 | 15 ...... 1 |  0  |
+ *   | PBA (4K units)  | len (4K blk) | tag |
+ *
+ * Slab objects are never odd, so the tag bit tells the encodings apart and both of them
+ * can live in the same map (f.e. an unaligned write on the compact device).
+ *
+ * Compressed extents (check utils/compress.h) are always stored in the full encoding:
+ * redirected_sector points to the compressed blob, block_size is the logical size and comp_offset
+ * is the offset of the extent start in the decompressed data (non-zero for trimmed extents).
+ * Blobs are at most LSBDD_WBUF_MAX_WRITE, so 16 bits are enough.
+ *
+ * Checksummed extents (check utils/csum.h) are stored in the full encoding too, csum covers
+ * the whole extent data.
+ */
+struct lsbdd_value_redir {
+	sector_t redirected_sector;
+	u32 block_size;
+	u16 comp_size; // bytes, 0 - extent isn't compressed
+	u16 comp_offset; // bytes
+	u32 csum; // crc32c of the extent data
+	bool has_csum;
+};
+
+enum lsbdd_value_enc { LSBDD_VALUE_FULL, LSBDD_VALUE_COMPACT };
+
+/*
+ * Zero extent - LBA range that was discarded or zeroed, reads of it are completed without I/O.
+ * PBA 0 is never allocated (next_free_sector starts from LSBDD_SECTOR_OFFSET), so it marks such extents
+ * in both encodings.
+ */
+#define LSBDD_ZERO_SECTOR ((sector_t)0)
+
+#define LSBDD_COMPACT_TAG 0x1UL
+#define LSBDD_COMPACT_BLOCK_SIZE 4096
+#define LSBDD_COMPACT_BLOCK_SECTORS 8
+#define LSBDD_COMPACT_LEN_SHIFT 1
+#define LSBDD_COMPACT_LEN_BITS 15
+#define LSBDD_COMPACT_PBA_SHIFT (LSBDD_COMPACT_LEN_SHIFT + LSBDD_COMPACT_LEN_BITS)
+#define LSBDD_COMPACT_MAX_BLOCKS ((1UL << LSBDD_COMPACT_LEN_BITS) - 1)
+#define LSBDD_COMPACT_MAX_PBA ((1UL << (BITS_PER_LONG - LSBDD_COMPACT_PBA_SHIFT)) - 1)
+
+static inline bool lsbdd_value_is_compact(const void *value)
+{
+	return (unsigned long)value & LSBDD_COMPACT_TAG;
+}
+
+// @return true if the extent (PBA in sectors, size in bytes) fits in the compact encoding
+static inline bool lsbdd_value_can_compact(sector_t pba, u32 size)
+{
+	return size && IS_ALIGNED(pba, LSBDD_COMPACT_BLOCK_SECTORS) && IS_ALIGNED(size, LSBDD_COMPACT_BLOCK_SIZE) &&
+	       size / LSBDD_COMPACT_BLOCK_SIZE <= LSBDD_COMPACT_MAX_BLOCKS &&
+	       pba / LSBDD_COMPACT_BLOCK_SECTORS <= LSBDD_COMPACT_MAX_PBA;
+}
+
+// Packs the extent into the pointer slot. Caller checks lsbdd_value_can_compact() first.
+static inline void *lsbdd_value_compact(sector_t pba, u32 size)
+{
+	unsigned long packed = LSBDD_COMPACT_TAG;
+
+	packed |= (unsigned long)(size / LSBDD_COMPACT_BLOCK_SIZE) << LSBDD_COMPACT_LEN_SHIFT;
+	packed |= (unsigned long)(pba / LSBDD_COMPACT_BLOCK_SECTORS) << LSBDD_COMPACT_PBA_SHIFT;
+
+	return (void *)packed;
+}
+
+// Decodes the value of either encoding into the plain structure.
+static inline struct lsbdd_value_redir lsbdd_value_get(const void *value)
+{
+	struct lsbdd_value_redir redir = { 0 };
+	unsigned long packed = (unsigned long)value;
+
+	if (!value)
+		return redir;
+
+	if (!lsbdd_value_is_compact(value))
+		return *(const struct lsbdd_value_redir *)value;
+
+	redir.block_size = ((packed >> LSBDD_COMPACT_LEN_SHIFT) & LSBDD_COMPACT_MAX_BLOCKS) * LSBDD_COMPACT_BLOCK_SIZE;
+	redir.redirected_sector = (sector_t)(packed >> LSBDD_COMPACT_PBA_SHIFT) * LSBDD_COMPACT_BLOCK_SECTORS;
+
+	return redir;
+}
+
+static inline bool lsbdd_value_is_zero(const struct lsbdd_value_redir *redir)
+{
+	return redir->redirected_sector == LSBDD_ZERO_SECTOR;
+}
+
+static inline bool lsbdd_value_is_compressed(const struct lsbdd_value_redir *redir)
+{
+	return redir->comp_size != 0;
+}
+
+// Frees the value if it was allocated from the cache (compact values own no memory).
+static inline void lsbdd_value_free(struct kmem_cache *lsbdd_value_cache, void *value)
+{
+	if (value && !lsbdd_value_is_compact(value))
+		lsbdd_mag_free(lsbdd_value_cache, value);
+}
+
+#endif
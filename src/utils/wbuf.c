@@ -0,0 +1,422 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/gfp.h>
+#include <linux/jiffies.h>
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/string.h>
+#include "wbuf.h"
+
+static struct workqueue_struct *lsbdd_wbuf_wq;
+
+/**
+ * Moves the active segment to the inflight list and gives back the unused part of its PBA range:
+ * the log head is moved back, if the range is still at its end, otherwise the part is kept as the spare one.
+ *
+ * @return sealed segment, its pending ref has to be dropped after unlock
+ */
+static struct lsbdd_wbuf_seg *wbuf_seal_locked(struct lsbdd_wbuf *wbuf)
+{
+	struct lsbdd_wbuf_seg *seg = wbuf->active;
+	s64 end = 0;
+	sector_t used_end = 0;
+
+	if (!seg)
+		return NULL;
+
+	list_add_tail(&seg->list, &wbuf->inflight);
+	wbuf->active = NULL;
+
+	end = seg->pba + (seg->capacity >> SECTOR_SHIFT);
+	used_end = seg->pba + DIV_ROUND_UP(seg->used, SECTOR_SIZE);
+	if (used_end < end && !atomic64_try_cmpxchg(wbuf->next_free_sector, &end, used_end)) {
+		wbuf->spare_pba = used_end;
+		wbuf->spare_sectors = seg->pba + (seg->capacity >> SECTOR_SHIFT) - used_end;
+	}
+
+	return seg;
+}
+
+static void wbuf_seg_put(struct lsbdd_wbuf_seg *seg)
+{
+	struct lsbdd_wbuf *wbuf = seg->wbuf;
+	unsigned long flags = 0;
+
+	if (!refcount_dec_and_test(&seg->refs))
+		return;
+
+	spin_lock_irqsave(&wbuf->lock, flags);
+	list_add(&seg->list, &wbuf->free);
+	wbuf->nr_free++;
+	spin_unlock_irqrestore(&wbuf->lock, flags);
+
+	wake_up(&wbuf->drain_wq);
+}
+
+/**
+ * Segment is written: completes the segments from the head of inflight list (only those,
+ * all the previous segments of which are written too) and hands their flush waiters to the group commit.
+ */
+static void wbuf_seg_end_io(struct bio *bio)
+{
+	struct lsbdd_wbuf_seg *seg = bio->bi_private;
+	struct lsbdd_wbuf *wbuf = seg->wbuf;
+	struct lsbdd_wbuf_seg *head = NULL;
+	struct lsbdd_wbuf_seg *tmp = NULL;
+	struct bio *waiter = NULL;
+	unsigned long flags = 0;
+	LIST_HEAD(written);
+
+	if (unlikely(bio->bi_status))
+		pr_err("Write buffer: segment %llu write failed with %d\n", seg->pba, bio->bi_status);
+
+	spin_lock_irqsave(&wbuf->lock, flags);
+	seg->done = true;
+	seg->status = bio->bi_status;
+	while (!list_empty(&wbuf->inflight)) {
+		head = list_first_entry(&wbuf->inflight, struct lsbdd_wbuf_seg, list);
+		if (!head->done)
+			break;
+		list_move_tail(&head->list, &written);
+	}
+	spin_unlock_irqrestore(&wbuf->lock, flags);
+
+	list_for_each_entry_safe(head, tmp, &written, list) {
+		list_del(&head->list);
+		while ((waiter = bio_list_pop(&head->waiters))) {
+			if (unlikely(head->status)) {
+				waiter->bi_status = head->status;
+				bio_endio(waiter);
+			} else {
+				lsbdd_flush_queue(wbuf->flush, waiter);
+			}
+		}
+		wbuf_seg_put(head);
+	}
+
+	bio_put(bio);
+}
+
+static void wbuf_seg_submit(struct lsbdd_wbuf_seg *seg)
+{
+	struct lsbdd_wbuf *wbuf = seg->wbuf;
+	struct bio *bio = NULL;
+
+	bio = bio_alloc_bioset(wbuf->bdev, 1, REQ_OP_WRITE, GFP_NOIO, wbuf->bs);
+	bio->bi_iter.bi_sector = seg->pba;
+	__bio_add_page(bio, seg->pages, seg->used, 0); // pages are contiguous, so one multi-page bvec
+	bio->bi_private = seg;
+	bio->bi_end_io = wbuf_seg_end_io;
+
+	atomic64_inc(&wbuf->segments);
+
+	submit_bio(bio);
+}
+
+static void wbuf_seg_put_pending(struct lsbdd_wbuf_seg *seg)
+{
+	if (seg && atomic_dec_and_test(&seg->pending))
+		wbuf_seg_submit(seg);
+}
+
+static void wbuf_flush_work(struct work_struct *work)
+{
+	struct lsbdd_wbuf *wbuf = container_of(work, struct lsbdd_wbuf, flush_work);
+	struct bio_list waiters = BIO_EMPTY_LIST;
+	struct lsbdd_wbuf_seg *sealed = NULL;
+	struct lsbdd_wbuf_seg *tail = NULL;
+	struct bio *waiter = NULL;
+	unsigned long flags = 0;
+
+	spin_lock_irqsave(&wbuf->lock, flags);
+	bio_list_merge(&waiters, &wbuf->flush_waiters);
+	bio_list_init(&wbuf->flush_waiters);
+
+	sealed = wbuf_seal_locked(wbuf);
+	if (!list_empty(&wbuf->inflight)) {
+		tail = list_last_entry(&wbuf->inflight, struct lsbdd_wbuf_seg, list);
+		bio_list_merge(&tail->waiters, &waiters);
+		bio_list_init(&waiters);
+	}
+	spin_unlock_irqrestore(&wbuf->lock, flags);
+
+	wbuf_seg_put_pending(sealed);
+
+	// nothing is buffered, so only the device flush is left
+	while ((waiter = bio_list_pop(&waiters)))
+		lsbdd_flush_queue(wbuf->flush, waiter);
+}
+
+static void wbuf_age_work(struct work_struct *work)
+{
+	struct lsbdd_wbuf *wbuf = container_of(to_delayed_work(work), struct lsbdd_wbuf, age_work);
+	struct lsbdd_wbuf_seg *sealed = NULL;
+	unsigned long flags = 0;
+
+	spin_lock_irqsave(&wbuf->lock, flags);
+	sealed = wbuf_seal_locked(wbuf);
+	spin_unlock_irqrestore(&wbuf->lock, flags);
+
+	wbuf_seg_put_pending(sealed);
+}
+
+static void wbuf_free_segs(struct lsbdd_wbuf *wbuf)
+{
+	u8 i = 0;
+
+	for (i = 0; i < LSBDD_WBUF_NR_SEGS; i++) {
+		if (wbuf->segs[i].pages)
+			__free_pages(wbuf->segs[i].pages, LSBDD_WBUF_SEG_ORDER);
+		wbuf->segs[i].pages = NULL;
+	}
+}
+
+void lsbdd_wbuf_init(struct lsbdd_wbuf *wbuf, struct block_device *bdev, struct bio_set *bs, atomic64_t *next_free_sector,
+		     struct lsbdd_flush *flush, bool enabled)
+{
+	struct lsbdd_wbuf_seg *seg = NULL;
+	u8 i = 0;
+
+	BUG_ON(!wbuf || !bdev || !bs || !next_free_sector || !flush);
+
+	spin_lock_init(&wbuf->lock);
+	wbuf->active = NULL;
+	INIT_LIST_HEAD(&wbuf->free);
+	INIT_LIST_HEAD(&wbuf->inflight);
+	wbuf->nr_free = 0;
+	bio_list_init(&wbuf->flush_waiters);
+	INIT_WORK(&wbuf->flush_work, wbuf_flush_work);
+	INIT_DELAYED_WORK(&wbuf->age_work, wbuf_age_work);
+	init_waitqueue_head(&wbuf->drain_wq);
+	wbuf->bdev = bdev;
+	wbuf->bs = bs;
+	wbuf->next_free_sector = next_free_sector;
+	wbuf->spare_pba = 0;
+	wbuf->spare_sectors = 0;
+	wbuf->flush = flush;
+	wbuf->enabled = false;
+
+	atomic64_set(&wbuf->buffered, 0);
+	atomic64_set(&wbuf->bypassed, 0);
+	atomic64_set(&wbuf->segments, 0);
+	atomic64_set(&wbuf->read_hits, 0);
+
+	if (!enabled)
+		return;
+
+	for (i = 0; i < LSBDD_WBUF_NR_SEGS; i++) {
+		seg = &wbuf->segs[i];
+		seg->pages = alloc_pages(GFP_KERNEL | __GFP_NOWARN, LSBDD_WBUF_SEG_ORDER);
+		if (!seg->pages)
+			goto mem_err;
+
+		seg->data = page_address(seg->pages);
+		seg->wbuf = wbuf;
+		bio_list_init(&seg->waiters);
+		list_add_tail(&seg->list, &wbuf->free);
+		wbuf->nr_free++;
+	}
+
+	wbuf->enabled = true;
+	return;
+
+mem_err:
+	pr_warn("Write buffer segments weren't allocated, writes will bypass it\n");
+	wbuf_free_segs(wbuf);
+	INIT_LIST_HEAD(&wbuf->free);
+	wbuf->nr_free = 0;
+}
+
+void lsbdd_wbuf_destroy(struct lsbdd_wbuf *wbuf)
+{
+	struct lsbdd_wbuf_seg *sealed = NULL;
+	unsigned long flags = 0;
+
+	if (!wbuf->enabled)
+		return;
+
+	cancel_delayed_work_sync(&wbuf->age_work);
+	flush_work(&wbuf->flush_work);
+
+	spin_lock_irqsave(&wbuf->lock, flags);
+	sealed = wbuf_seal_locked(wbuf);
+	spin_unlock_irqrestore(&wbuf->lock, flags);
+
+	wbuf_seg_put_pending(sealed);
+
+	wait_event(wbuf->drain_wq, READ_ONCE(wbuf->nr_free) == LSBDD_WBUF_NR_SEGS);
+
+	wbuf->enabled = false;
+	wbuf_free_segs(wbuf);
+}
+
+struct lsbdd_wbuf_seg *lsbdd_wbuf_reserve(struct lsbdd_wbuf *wbuf, u32 size, sector_t *pba)
+{
+	struct lsbdd_wbuf_seg *sealed = NULL;
+	struct lsbdd_wbuf_seg *seg = NULL;
+	unsigned long flags = 0;
+
+	spin_lock_irqsave(&wbuf->lock, flags);
+	seg = wbuf->active;
+	if (seg && seg->used + size > seg->capacity) {
+		sealed = wbuf_seal_locked(wbuf);
+		seg = NULL;
+	}
+
+	if (!seg) {
+		if (list_empty(&wbuf->free)) {
+			spin_unlock_irqrestore(&wbuf->lock, flags);
+			wbuf_seg_put_pending(sealed);
+			atomic64_inc(&wbuf->bypassed);
+			return NULL; // all the segments are being written, don't wait for them
+		}
+
+		seg = list_first_entry(&wbuf->free, struct lsbdd_wbuf_seg, list);
+		list_del_init(&seg->list);
+		wbuf->nr_free--;
+
+		// the spare tail is lost if the write doesn't fit it, that's less than LSBDD_WBUF_MAX_WRITE
+		if (size <= wbuf->spare_sectors << SECTOR_SHIFT) {
+			seg->pba = wbuf->spare_pba;
+			seg->capacity = wbuf->spare_sectors << SECTOR_SHIFT;
+		} else {
+			seg->pba = atomic64_fetch_add(LSBDD_WBUF_SEG_SECTORS, wbuf->next_free_sector);
+			seg->capacity = LSBDD_WBUF_SEG_SIZE;
+		}
+		wbuf->spare_sectors = 0;
+		seg->used = 0;
+		seg->done = false;
+		seg->status = BLK_STS_OK;
+		atomic_set(&seg->pending, 1);
+		refcount_set(&seg->refs, 1);
+		wbuf->active = seg;
+
+		mod_delayed_work(lsbdd_wbuf_wq, &wbuf->age_work, msecs_to_jiffies(LSBDD_WBUF_AGE_MS));
+	}
+
+	*pba = seg->pba + (seg->used >> SECTOR_SHIFT);
+	seg->used += size;
+	atomic_inc(&seg->pending);
+	spin_unlock_irqrestore(&wbuf->lock, flags);
+
+	wbuf_seg_put_pending(sealed);
+	atomic64_inc(&wbuf->buffered);
+
+	return seg;
+}
+
+void lsbdd_wbuf_copy_in(struct lsbdd_wbuf_seg *seg, sector_t pba, struct bio *bio)
+{
+	struct bvec_iter iter;
+	struct bio_vec bv;
+	u32 offset = (pba - seg->pba) << SECTOR_SHIFT;
+
+	bio_for_each_segment(bv, bio, iter) {
+		memcpy_from_bvec(seg->data + offset, &bv);
+		offset += bv.bv_len;
+	}
+}
+
+void lsbdd_wbuf_copy_in_buf(struct lsbdd_wbuf_seg *seg, sector_t pba, const void *data, u32 len)
+{
+	u32 offset = (pba - seg->pba) << SECTOR_SHIFT;
+
+	memcpy(seg->data + offset, data, len);
+	memset(seg->data + offset + len, 0, round_up(len, SECTOR_SIZE) - len);
+}
+
+void lsbdd_wbuf_commit(struct lsbdd_wbuf_seg *seg)
+{
+	wbuf_seg_put_pending(seg);
+}
+
+// @return segment that holds the whole [start, end) range with reader ref taken, NULL if there is no such one
+static struct lsbdd_wbuf_seg *wbuf_find_get(struct lsbdd_wbuf *wbuf, sector_t start, sector_t end)
+{
+	struct lsbdd_wbuf_seg *seg = NULL;
+	unsigned long flags = 0;
+
+	spin_lock_irqsave(&wbuf->lock, flags);
+	seg = wbuf->active;
+	if (seg && start >= seg->pba && end <= seg->pba + (seg->used >> SECTOR_SHIFT))
+		goto found;
+
+	list_for_each_entry(seg, &wbuf->inflight, list) {
+		if (start >= seg->pba && end <= seg->pba + (seg->used >> SECTOR_SHIFT))
+			goto found;
+	}
+	spin_unlock_irqrestore(&wbuf->lock, flags);
+
+	return NULL;
+
+found:
+	refcount_inc(&seg->refs);
+	spin_unlock_irqrestore(&wbuf->lock, flags);
+	return seg;
+}
+
+bool lsbdd_wbuf_read(struct lsbdd_wbuf *wbuf, struct bio *bio)
+{
+	struct lsbdd_wbuf_seg *seg = NULL;
+	struct bvec_iter iter;
+	struct bio_vec bv;
+	u32 offset = 0;
+
+	if (!wbuf->enabled || !bio->bi_iter.bi_size)
+		return false;
+
+	seg = wbuf_find_get(wbuf, bio->bi_iter.bi_sector, bio_end_sector(bio));
+	if (!seg)
+		return false;
+
+	offset = (bio->bi_iter.bi_sector - seg->pba) << SECTOR_SHIFT;
+	bio_for_each_segment(bv, bio, iter) {
+		memcpy_to_bvec(&bv, seg->data + offset);
+		offset += bv.bv_len;
+	}
+	wbuf_seg_put(seg);
+
+	atomic64_inc(&wbuf->read_hits);
+	bio_endio(bio);
+
+	return true;
+}
+
+void lsbdd_wbuf_flush(struct lsbdd_wbuf *wbuf, struct bio *bio)
+{
+	unsigned long flags = 0;
+
+	if (!wbuf->enabled) {
+		lsbdd_flush_queue(wbuf->flush, bio);
+		return;
+	}
+
+	// segment can't be submitted from irq context, so sealing is always done by the work
+	spin_lock_irqsave(&wbuf->lock, flags);
+	bio_list_add(&wbuf->flush_waiters, bio);
+	spin_unlock_irqrestore(&wbuf->lock, flags);
+
+	queue_work(lsbdd_wbuf_wq, &wbuf->flush_work);
+}
+
+s32 lsbdd_wbuf_stats_show(struct lsbdd_wbuf *wbuf, const char *name, char *buf, s32 offset)
+{
+	return scnprintf(buf + offset, PAGE_SIZE - offset, "%s %d %lld %lld %lld %lld\n", name, wbuf->enabled,
+			 atomic64_read(&wbuf->buffered), atomic64_read(&wbuf->bypassed), atomic64_read(&wbuf->segments),
+			 atomic64_read(&wbuf->read_hits));
+}
+
+s32 lsbdd_wbuf_wq_init(void)
+{
+	lsbdd_wbuf_wq = alloc_workqueue("lsbdd_wbuf", WQ_MEM_RECLAIM | WQ_UNBOUND, 0);
+	if (!lsbdd_wbuf_wq)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void lsbdd_wbuf_wq_destroy(void)
+{
+	destroy_workqueue(lsbdd_wbuf_wq);
+}
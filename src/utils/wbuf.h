@@ -0,0 +1,158 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef WBUF_H
+#define WBUF_H
+
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/refcount.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include "flush.h"
+
+/**
+ * Write-combining staging buffer.
+ *
+ * Small writes are copied into the active in-memory segment of the device and completed right away,
+ * the segment is written to the log as one large BIO when it is sealed:
+ * - it is full (next write doesn't fit),
+ * - flush/FUA request arrived,
+ * - it is older than LSBDD_WBUF_AGE_MS.
+ *
+ * PBA range of the whole segment is reserved from next_free_sector on its open, so mappings of the
+ * buffered writes point to their final location. Segments sealed before they are full (by flush or age)
+ * give the unused tail of the range back: to the log head, if nothing was allocated after it, or to the
+ * next segment otherwise (it is opened in the tail, if the write fits it), so the log isn't burnt
+ * faster than it is written. Reads of still buffered (sealed, but not written yet too)
+ * extents are served from memory.
+ *
+ * Flush waiters are attached to the last sealed segment and handed to the group commit only after all the
+ * segments sealed before them are written, so its device flush covers the buffered data too.
+ *
+ * Each segment has two counters:
+ * - pending: copies in progress (+1 while the segment is active), the one who drops it to 0 submits the segment;
+ * - refs: readers (+1 until the segment is written), the one who drops it to 0 returns the segment to the free list.
+ */
+
+#define LSBDD_WBUF_SEG_ORDER 6 // 256K segments
+#define LSBDD_WBUF_SEG_SIZE (PAGE_SIZE << LSBDD_WBUF_SEG_ORDER)
+#define LSBDD_WBUF_SEG_SECTORS (LSBDD_WBUF_SEG_SIZE >> SECTOR_SHIFT)
+#define LSBDD_WBUF_NR_SEGS 4
+#define LSBDD_WBUF_MAX_WRITE (64 * 1024) // larger writes are already big enough, they bypass the buffer
+#define LSBDD_WBUF_AGE_MS 50
+
+struct lsbdd_wbuf;
+
+struct lsbdd_wbuf_seg {
+	struct list_head list; // free or inflight list
+	struct page *pages;
+	void *data;
+	sector_t pba;
+	u32 capacity; // bytes of the reserved PBA range
+	u32 used;
+	atomic_t pending;
+	refcount_t refs;
+	bool done;
+	blk_status_t status;
+	struct bio_list waiters; // flush bios waiting for this segment to be written
+	struct lsbdd_wbuf *wbuf;
+};
+
+struct lsbdd_wbuf {
+	spinlock_t lock;
+	struct lsbdd_wbuf_seg *active;
+	struct list_head free;
+	u32 nr_free;
+	struct list_head inflight; // sealed segments, in seal order
+	sector_t spare_pba; // unused tail of the last sealed segment (check wbuf_seal_locked)
+	u32 spare_sectors;
+	struct lsbdd_wbuf_seg segs[LSBDD_WBUF_NR_SEGS];
+	struct bio_list flush_waiters; // flush bios queued from (possibly) irq context, handled by flush_work
+	struct work_struct flush_work;
+	struct delayed_work age_work;
+	wait_queue_head_t drain_wq;
+	struct block_device *bdev;
+	struct bio_set *bs;
+	atomic64_t *next_free_sector;
+	struct lsbdd_flush *flush;
+	bool enabled;
+
+	// stats
+	atomic64_t buffered;
+	atomic64_t bypassed;
+	atomic64_t segments;
+	atomic64_t read_hits;
+};
+
+/**
+ * Initialises the buffer and allocates its segments.
+ * If segments weren't allocated (or enabled is false) - buffer stays disabled and all the writes bypass it.
+ *
+ * @param wbuf - buffer (embedded into the device mng)
+ * @param bdev - redirect block device
+ * @param bs - bio set for the segment BIOs
+ * @param next_free_sector - log head, segments are allocated from it
+ * @param flush - group commit of the device, flush waiters are handed to it
+ * @param enabled - use buffer on this device
+ *
+ * @return void
+ */
+void lsbdd_wbuf_init(struct lsbdd_wbuf *wbuf, struct block_device *bdev, struct bio_set *bs, atomic64_t *next_free_sector,
+		     struct lsbdd_flush *flush, bool enabled);
+
+// Writes out everything buffered, waits for it and frees the segments
+void lsbdd_wbuf_destroy(struct lsbdd_wbuf *wbuf);
+
+// @return true if the write should go through the buffer
+static inline bool lsbdd_wbuf_fits(struct lsbdd_wbuf *wbuf, struct bio *bio)
+{
+	return wbuf->enabled && !op_is_flush(bio->bi_opf) && bio->bi_iter.bi_size <= LSBDD_WBUF_MAX_WRITE;
+}
+
+/**
+ * Reserves the space in the active segment (opens the new one if it doesn't fit).
+ * Must be followed by lsbdd_wbuf_copy_in and lsbdd_wbuf_commit.
+ *
+ * @param wbuf - buffer of the device
+ * @param size - write size in bytes
+ * @param pba - reserved PBA is stored here
+ *
+ * @return segment on success, NULL if there is no free segment (write should bypass the buffer)
+ */
+struct lsbdd_wbuf_seg *lsbdd_wbuf_reserve(struct lsbdd_wbuf *wbuf, u32 size, sector_t *pba);
+
+// Copies the bio data into the reserved space of the segment
+void lsbdd_wbuf_copy_in(struct lsbdd_wbuf_seg *seg, sector_t pba, struct bio *bio);
+
+// Copies len bytes of linear data into the reserved space of the segment, the rest of the last sector is zeroed
+void lsbdd_wbuf_copy_in_buf(struct lsbdd_wbuf_seg *seg, sector_t pba, const void *data, u32 len);
+
+// Finishes the write into segment (submits it, if it is sealed and this was the last copy)
+void lsbdd_wbuf_commit(struct lsbdd_wbuf_seg *seg);
+
+/**
+ * Serves the read from the buffer, if the whole bio range is buffered.
+ *
+ * @param wbuf - buffer of the device
+ * @param bio - read bio with PBA range (clone or its split)
+ *
+ * @return true if bio was served and completed, false if it should be submitted to the device
+ */
+bool lsbdd_wbuf_read(struct lsbdd_wbuf *wbuf, struct bio *bio);
+
+/**
+ * Seals the active segment and passes the bio to the group commit (check utils/flush.h) after all the sealed segments
+ * are written. Can be called from irq context.
+ */
+void lsbdd_wbuf_flush(struct lsbdd_wbuf *wbuf, struct bio *bio);
+
+// Prints the buffer statistics line of the device into buf + offset, @return number of written bytes
+s32 lsbdd_wbuf_stats_show(struct lsbdd_wbuf *wbuf, const char *name, char *buf, s32 offset);
+
+// Creates/destroys the segment workqueue (shared by all the devices), called on module init/exit
+s32 lsbdd_wbuf_wq_init(void);
+void lsbdd_wbuf_wq_destroy(void);
+
+#endif
@@ -0,0 +1,172 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include "value_redir.h"
+#include "zoned.h"
+
+static struct workqueue_struct *lsbdd_zones_wq;
+
+static s32 zones_report_cb(struct blk_zone *blkz, unsigned int idx, void *data)
+{
+	struct lsbdd_zones *zones = data;
+	struct lsbdd_zone *zone = &zones->zones[idx];
+
+	zone->start = blkz->start;
+	zone->capacity = blkz->capacity;
+	zone->used = blkz->wp - blkz->start;
+
+	// appends to the zone at sector 0 would get PBA LSBDD_ZERO_SECTOR, which marks the zero extents
+	if (blkz->type == BLK_ZONE_TYPE_CONVENTIONAL || blkz->cond == BLK_ZONE_COND_FULL || blkz->start == LSBDD_ZERO_SECTOR)
+		zone->used = zone->capacity;
+
+	return 0;
+}
+
+static void zones_done_work(struct work_struct *work)
+{
+	struct lsbdd_zones *zones = container_of(work, struct lsbdd_zones, done_work);
+	struct bio_list done = BIO_EMPTY_LIST;
+	struct bio *bio = NULL;
+	unsigned long flags = 0;
+
+	spin_lock_irqsave(&zones->lock, flags);
+	bio_list_merge(&done, &zones->done);
+	bio_list_init(&zones->done);
+	spin_unlock_irqrestore(&zones->lock, flags);
+
+	while ((bio = bio_list_pop(&done))) {
+		zones->complete(bio);
+		if (atomic_dec_and_test(&zones->inflight))
+			wake_up(&zones->drain_wq);
+	}
+}
+
+s32 lsbdd_zones_init(struct lsbdd_zones *zones, struct block_device *bdev, void (*complete)(struct bio *bio))
+{
+	s32 status = 0;
+
+	BUG_ON(!zones || !bdev || !complete);
+
+	spin_lock_init(&zones->lock);
+	bio_list_init(&zones->done);
+	INIT_WORK(&zones->done_work, zones_done_work);
+	init_waitqueue_head(&zones->drain_wq);
+	atomic_set(&zones->inflight, 0);
+	zones->complete = complete;
+	zones->bdev = bdev;
+	zones->zones = NULL;
+	zones->nr_zones = 0;
+	zones->active = 0;
+	zones->enabled = false;
+
+	atomic64_set(&zones->appends, 0);
+	atomic64_set(&zones->sectors, 0);
+
+	if (!bdev_is_zoned(bdev))
+		return 0;
+
+	zones->nr_zones = bdev_nr_zones(bdev);
+	zones->max_append_sects = bdev_max_zone_append_sectors(bdev);
+	zones->zones = kvcalloc(zones->nr_zones, sizeof(struct lsbdd_zone), GFP_KERNEL);
+	if (!zones->zones)
+		return -ENOMEM;
+
+	status = blkdev_zone_mgmt(bdev, REQ_OP_ZONE_RESET, 0, bdev_nr_sectors(bdev));
+	if (status)
+		goto zone_err;
+
+	status = blkdev_report_zones(bdev, 0, BLK_ALL_ZONES, zones_report_cb, zones);
+	if (status < 0)
+		goto zone_err;
+
+	zones->enabled = true;
+	pr_info("Zoned redirect device: %u zones of %llu sectors, max append %u sectors\n", zones->nr_zones,
+		bdev_zone_sectors(bdev), zones->max_append_sects);
+
+	return 0;
+
+zone_err:
+	pr_err("Zone setup failed with %d\n", status);
+	kvfree(zones->zones);
+	zones->zones = NULL;
+	return status;
+}
+
+void lsbdd_zones_drain(struct lsbdd_zones *zones)
+{
+	if (!zones->enabled)
+		return;
+
+	wait_event(zones->drain_wq, !atomic_read(&zones->inflight));
+	flush_work(&zones->done_work);
+}
+
+void lsbdd_zones_destroy(struct lsbdd_zones *zones)
+{
+	kvfree(zones->zones);
+	zones->zones = NULL;
+	zones->enabled = false;
+}
+
+s32 lsbdd_zones_prep_append(struct lsbdd_zones *zones, struct bio *bio, u32 nr_sects)
+{
+	struct lsbdd_zone *zone = NULL;
+	unsigned long flags = 0;
+
+	spin_lock_irqsave(&zones->lock, flags);
+	while (zones->active < zones->nr_zones) {
+		zone = &zones->zones[zones->active];
+		if (zone->used + nr_sects <= zone->capacity)
+			break;
+		zones->active++; // the rest of the zone is left unused, appends can't be split between the zones
+	}
+
+	if (unlikely(zones->active == zones->nr_zones)) {
+		spin_unlock_irqrestore(&zones->lock, flags);
+		pr_err("Zoned redirect device is full\n");
+		return -ENOSPC;
+	}
+	zone->used += nr_sects;
+	spin_unlock_irqrestore(&zones->lock, flags);
+
+	bio->bi_opf = REQ_OP_ZONE_APPEND | (bio->bi_opf & ~REQ_OP_MASK);
+	bio->bi_iter.bi_sector = zone->start;
+
+	atomic_inc(&zones->inflight);
+	atomic64_inc(&zones->appends);
+	atomic64_add(nr_sects, &zones->sectors);
+
+	return 0;
+}
+
+void lsbdd_zones_end_io(struct lsbdd_zones *zones, struct bio *bio)
+{
+	unsigned long flags = 0;
+
+	spin_lock_irqsave(&zones->lock, flags);
+	bio_list_add(&zones->done, bio);
+	spin_unlock_irqrestore(&zones->lock, flags);
+
+	queue_work(lsbdd_zones_wq, &zones->done_work);
+}
+
+s32 lsbdd_zones_stats_show(struct lsbdd_zones *zones, const char *name, char *buf, s32 offset)
+{
+	return scnprintf(buf + offset, PAGE_SIZE - offset, "%s %d %u %u %lld %lld\n", name, zones->enabled, zones->nr_zones,
+			 zones->active, atomic64_read(&zones->appends), atomic64_read(&zones->sectors));
+}
+
+s32 lsbdd_zones_wq_init(void)
+{
+	lsbdd_zones_wq = alloc_workqueue("lsbdd_zones", WQ_MEM_RECLAIM | WQ_UNBOUND, 0);
+	if (!lsbdd_zones_wq)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void lsbdd_zones_wq_destroy(void)
+{
+	destroy_workqueue(lsbdd_zones_wq);
+}
@@ -0,0 +1,97 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef ZONED_H
+#define ZONED_H
+
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+
+/**
+ * Zoned (ZNS/SMR) redirect device support.
+ *
+ * Sequential zones are filled one after another: space is reserved from the write pointer of the active zone
+ * and the log write is issued as REQ_OP_ZONE_APPEND to the zone start, so concurrent writers don't serialize
+ * on the exact offset. The device reports the written sector on completion, that's where the mapping points to.
+ *
+ * Append completions come in irq context, but the mapping update allocates (and may sleep in sync mode),
+ * so completed BIOs are queued and the complete callback is called for them from the workqueue.
+ *
+ * All the sequential zones are reset on device link: the mapping isn't persistent (as in the conventional mode,
+ * where the log is written from LSBDD_SECTOR_OFFSET over the old data). Conventional zones aren't used,
+ * neither is the zone at sector 0 (PBA 0 is reserved for the zero extents, check value_redir.h).
+ */
+
+struct lsbdd_zone {
+	sector_t start;
+	sector_t capacity;
+	sector_t used; // reserved sectors, so the appends in flight are counted too
+};
+
+struct lsbdd_zones {
+	spinlock_t lock;
+	struct lsbdd_zone *zones;
+	u32 nr_zones;
+	u32 active; // zone being filled
+	u32 max_append_sects;
+	struct bio_list done; // completed appends waiting for the complete callback
+	struct work_struct done_work;
+	void (*complete)(struct bio *bio);
+	atomic_t inflight;
+	wait_queue_head_t drain_wq;
+	struct block_device *bdev;
+	bool enabled;
+
+	// stats
+	atomic64_t appends;
+	atomic64_t sectors;
+};
+
+/**
+ * Initialises the zoned mode, if the redirect device is zoned: resets the sequential zones
+ * and reads their capacity.
+ *
+ * @param zones - zone allocator (embedded into the device mng)
+ * @param bdev - redirect block device
+ * @param complete - called from the workqueue for each append passed to lsbdd_zones_end_io,
+ *                   it owns the bio since then
+ *
+ * @return 0 on success (zoned mode is enabled only if bdev is zoned), -ENOMEM or zone management error otherwise
+ */
+s32 lsbdd_zones_init(struct lsbdd_zones *zones, struct block_device *bdev, void (*complete)(struct bio *bio));
+
+// Waits for the appends in flight and their complete callbacks
+void lsbdd_zones_drain(struct lsbdd_zones *zones);
+
+// Frees the zone table, zones have to be drained
+void lsbdd_zones_destroy(struct lsbdd_zones *zones);
+
+/**
+ * Turns the write bio into zone append: reserves nr_sects in the active zone (moves to the next one if it doesn't fit)
+ * and sets bio sector to the zone start. Bio completion has to be passed to lsbdd_zones_end_io, drain waits for it.
+ *
+ * @param zones - zone allocator of the device
+ * @param bio - write bio, not larger than max_append_sects
+ * @param nr_sects - bio size in sectors
+ *
+ * @return 0 on success, -ENOSPC if all the zones are full
+ */
+s32 lsbdd_zones_prep_append(struct lsbdd_zones *zones, struct bio *bio, u32 nr_sects);
+
+/**
+ * Queues the completed append, the complete callback is called for it from the workqueue.
+ * Called from the bio end_io (irq context).
+ */
+void lsbdd_zones_end_io(struct lsbdd_zones *zones, struct bio *bio);
+
+// Prints the zone statistics line of the device into buf + offset, @return number of written bytes
+s32 lsbdd_zones_stats_show(struct lsbdd_zones *zones, const char *name, char *buf, s32 offset);
+
+// Creates/destroys the completion workqueue (shared by all the devices), called on module init/exit
+s32 lsbdd_zones_wq_init(void);
+void lsbdd_zones_wq_destroy(void);
+
+#endif
@@ -0,0 +1,369 @@
+import argparse
+import csv
+import itertools
+import json
+import math
+import os
+import platform
+import sqlite3
+import statistics
+import subprocess
+import sys
+from datetime import datetime, timezone
+
+# History of the benchmark results (SQLite): "record" stores the results left in logs/ by plots.sh, wa_bench.sh and
+# scale.sh with the git revision, "compare" flags statistically significant regressions between two revisions.
+
+DB_PATH = "bench_history.db"
+LOGS_PATH = "logs"
+FIO_RESULTS_FILE = "fio_results.dat"
+MIX_RESULTS_FILE = "fio_mix_results.dat"
+WA_SUMMARY_FILE = "wa_summary.csv"
+SCALE_RESULTS_FILE = "scale_results.csv"
+
+# metric -> True if higher is better
+METRIC_DIRECTIONS = {
+    "iops": True,
+    "read_iops": True,
+    "write_iops": True,
+    "steady_iops": True,
+    "fio_iops": True,
+    "avg_lat": False,
+    "p99_lat": False,
+    "p99_clat": False,
+    "read_p99_us": False,
+    "write_p99_us": False,
+    "wa": False,
+    "space_amp": False,
+    "map_bytes_per_entry": False,
+    "cache_misses_per_io": False,
+    "llc_load_misses_per_io": False,
+}
+
+EXACT_TEST_MAX_COMBINATIONS = 20000
+
+SCHEMA = """
+CREATE TABLE IF NOT EXISTS runs (
+    id INTEGER PRIMARY KEY,
+    session TEXT UNIQUE,
+    revision TEXT,
+    dirty INTEGER,
+    recorded_at TEXT,
+    host TEXT,
+    kernel TEXT,
+    note TEXT
+);
+CREATE TABLE IF NOT EXISTS samples (
+    run_id INTEGER REFERENCES runs(id),
+    suite TEXT,
+    ds TEXT,
+    params TEXT,
+    metric TEXT,
+    rep TEXT,
+    value REAL,
+    UNIQUE (run_id, suite, ds, params, metric, rep)
+);
+"""
+
+
+def git(*git_args):
+    return subprocess.run(["git", *git_args], capture_output=True, text=True, check=False).stdout.strip()
+
+
+def current_revision():
+    """
+    @return: (HEAD commit, 1 if the tree has uncommitted changes of the tracked files)
+    """
+    revision = git("rev-parse", "HEAD") or "unknown"
+    dirty = 1 if git("status", "--porcelain", "--untracked-files=no") else 0
+    return revision, dirty
+
+
+def params_key(**params):
+    return json.dumps(params, sort_keys=True)
+
+
+def parse_fio_results(path):
+    """
+    plots.sh results: IOPS rows (run ds bs mix 0 iops IOPS rw_type iodepth numjobs) and
+    LAT rows (run ds bs mix rw_type LAT avg_slat avg_clat avg_lat max_* p99_slat p99_clat p99_lat iodepth numjobs).
+    """
+    with open(path) as f:
+        for line in f:
+            fields = line.split()
+            if len(fields) == 10 and fields[6] == "IOPS":
+                run, ds, bs, mix, _, iops, _, rw_type, iodepth, numjobs = fields
+                params = params_key(bs=bs, rw_mix=mix, rw_type=rw_type, iodepth=iodepth, numjobs=numjobs)
+                yield "general", ds, params, "iops", run, float(iops)
+            elif len(fields) == 17 and fields[5] == "LAT":
+                run, ds, bs, mix, rw_type = fields[:5]
+                params = params_key(bs=bs, rw_mix=mix, rw_type=rw_type, iodepth=fields[15], numjobs=fields[16])
+                yield "latency", ds, params, "avg_lat", run, float(fields[8])
+                yield "latency", ds, params, "p99_clat", run, float(fields[13])
+                yield "latency", ds, params, "p99_lat", run, float(fields[14])
+
+
+def parse_mix_results(path):
+    """
+    plots.sh mixed workload runs (run ds rbs wbs read dist iodepth numjobs fio_json).
+    """
+    with open(path) as f:
+        for line in f:
+            fields = line.split()
+            if len(fields) != 9:
+                continue
+            run, ds, rbs, wbs, read, dist, iodepth, numjobs, log = fields
+            try:
+                with open(log) as log_f:
+                    text = log_f.read()
+                job = json.loads(text[text.index("{"):])["jobs"][0]
+            except (OSError, ValueError, KeyError, IndexError):
+                print(f"[warn] Skipping {log}: no fio JSON")
+                continue
+
+            params = params_key(rbs=rbs, wbs=wbs, read=read, dist=dist, iodepth=iodepth, numjobs=numjobs)
+            iops = 0.0
+            for direction in ("read", "write"):
+                stats = job.get(direction, {})
+                if not stats.get("iops"):
+                    continue
+                iops += stats["iops"]
+                yield "mix", ds, params, f"{direction}_iops", run, stats["iops"]
+                p99 = stats.get("clat_ns", {}).get("percentile", {}).get("99.000000")
+                if p99 is not None:
+                    yield "mix", ds, params, f"{direction}_p99_us", run, p99 / 1000
+            yield "mix", ds, params, "iops", run, iops
+
+
+def parse_wa_summary(path):
+    with open(path) as f:
+        for row in csv.DictReader(f):
+            params = params_key(bs=row["bs"], passes=str(round(float(row["passes"]))))
+            for metric in ("wa", "space_amp", "steady_iops", "fio_iops", "map_bytes_per_entry"):
+                yield "wa", row["ds"], params, metric, "1", float(row[metric])
+
+
+def parse_scale_results(path):
+    with open(path) as f:
+        for row in csv.DictReader(f):
+            params = params_key(placement=row["placement"], cores=row["cores"])
+            iops = float(row["iops"])
+            ios = iops * float(row["runtime"])
+            yield "scale", row["ds"], params, "iops", row["run"], iops
+            if ios > 0:
+                yield "scale", row["ds"], params, "cache_misses_per_io", row["run"], float(row["cache_misses"]) / ios
+                yield "scale", row["ds"], params, "llc_load_misses_per_io", row["run"], float(row["llc_load_misses"]) / ios
+
+
+PARSERS = [
+    (FIO_RESULTS_FILE, parse_fio_results),
+    (MIX_RESULTS_FILE, parse_mix_results),
+    (WA_SUMMARY_FILE, parse_wa_summary),
+    (SCALE_RESULTS_FILE, parse_scale_results),
+]
+
+
+def record(db, args):
+    revision, dirty = current_revision()
+    session = args.session or datetime.now(timezone.utc).strftime("%Y%m%d%H%M%S") + f"-{os.getpid()}"
+
+    db.execute(
+        "INSERT OR IGNORE INTO runs (session, revision, dirty, recorded_at, host, kernel, note) VALUES (?, ?, ?, ?, ?, ?, ?)",
+        (session, revision, dirty, datetime.now(timezone.utc).isoformat(), platform.node(), platform.release(), args.note),
+    )
+    run_id = db.execute("SELECT id FROM runs WHERE session = ?", (session,)).fetchone()[0]
+
+    recorded = 0
+    for filename, parse in PARSERS:
+        path = os.path.join(args.logs, filename)
+        if not os.path.exists(path):
+            continue
+        rows = [(run_id, *sample) for sample in parse(path)]
+        # same session - the results already recorded by the previous call are skipped
+        cursor = db.executemany(
+            "INSERT OR IGNORE INTO samples (run_id, suite, ds, params, metric, rep, value) VALUES (?, ?, ?, ?, ?, ?, ?)",
+            rows,
+        )
+        recorded += cursor.rowcount
+        print(f"{path}: {len(rows)} samples")
+
+    db.commit()
+    print(f"Recorded {recorded} samples of {revision[:12]}{' (dirty)' if dirty else ''}, session {session}")
+
+
+def resolve_revision(db, rev):
+    """
+    Accepts anything git rev-parse does (HEAD~1, tags, short hashes) or a prefix of the recorded revision.
+    """
+    full = git("rev-parse", "--verify", "--quiet", f"{rev}^{{commit}}")
+    if full:
+        return full
+    row = db.execute("SELECT DISTINCT revision FROM runs WHERE revision LIKE ?", (rev + "%",)).fetchall()
+    if len(row) == 1:
+        return row[0][0]
+    sys.exit(f"Can't resolve revision '{rev}'")
+
+
+def load_samples(db, revision, include_dirty):
+    query = """
+        SELECT s.suite, s.ds, s.params, s.metric, s.value FROM samples s JOIN runs r ON s.run_id = r.id
+        WHERE r.revision = ?
+    """
+    if not include_dirty:
+        query += " AND r.dirty = 0"
+    groups = {}
+    for suite, ds, params, metric, value in db.execute(query, (revision,)):
+        groups.setdefault((suite, ds, params, metric), []).append(value)
+    return groups
+
+
+def mann_whitney_p(a, b):
+    """
+    Two-sided Mann-Whitney U test. Exact (all the splits of the pooled ranks) for small samples,
+    normal approximation with the tie correction otherwise.
+    @return: p-value
+    """
+    n_a, n_b = len(a), len(b)
+    pooled = sorted((value, idx) for idx, value in enumerate(a + b))
+    ranks = [0.0] * (n_a + n_b)
+    i = 0
+    while i < len(pooled):
+        j = i
+        while j + 1 < len(pooled) and pooled[j + 1][0] == pooled[i][0]:
+            j += 1
+        for k in range(i, j + 1):
+            ranks[pooled[k][1]] = (i + j) / 2 + 1
+        i = j + 1
+
+    u_a = sum(ranks[:n_a]) - n_a * (n_a + 1) / 2
+    mean_u = n_a * n_b / 2
+
+    if math.comb(n_a + n_b, n_a) <= EXACT_TEST_MAX_COMBINATIONS:
+        observed = abs(u_a - mean_u)
+        extreme = total = 0
+        for subset in itertools.combinations(ranks, n_a):
+            total += 1
+            if abs(sum(subset) - n_a * (n_a + 1) / 2 - mean_u) >= observed - 1e-9:
+                extreme += 1
+        return extreme / total
+
+    n = n_a + n_b
+    ties = sum(t**3 - t for t in (ranks.count(r) for r in set(ranks)))
+    sigma = math.sqrt(n_a * n_b / 12 * ((n + 1) - ties / (n * (n - 1))))
+    if sigma == 0:
+        return 1.0
+    z = (abs(u_a - mean_u) - 0.5) / sigma
+    return math.erfc(max(z, 0) / math.sqrt(2))
+
+
+def mann_whitney_min_p(n_a, n_b):
+    """
+    The smallest p-value the test can give for these sample sizes (samples without ties at the opposite ends).
+    Single samples can't be tested at all.
+    @return: minimal p-value
+    """
+    if n_a < 2 or n_b < 2:
+        return 1.0
+    if math.comb(n_a + n_b, n_a) <= EXACT_TEST_MAX_COMBINATIONS:
+        return min(1.0, 2 / math.comb(n_a + n_b, n_a))
+    return 0.0
+
+
+def compare(db, args):
+    base_rev = resolve_revision(db, args.base)
+    new_rev = resolve_revision(db, args.new)
+    base = load_samples(db, base_rev, args.include_dirty)
+    new = load_samples(db, new_rev, args.include_dirty)
+
+    if not base or not new:
+        print("No recorded results of one of the revisions (runs of uncommitted trees need --include-dirty)")
+        return 1
+
+    regressions = 0
+    insufficient = {}
+    print(f"base {base_rev[:12]} -> new {new_rev[:12]} (alpha {args.alpha}, min change {args.min_change}%)")
+    print(f"{'suite':<8} {'ds':<3} {'metric':<22} {'n':>5} {'base':>12} {'new':>12} {'change':>8} {'p':>7}  params")
+
+    for key in sorted(base.keys() & new.keys()):
+        suite, ds, params, metric = key
+        if args.suite and suite != args.suite:
+            continue
+        a, b = base[key], new[key]
+        median_a, median_b = statistics.median(a), statistics.median(b)
+        change = (median_b - median_a) / median_a * 100 if median_a else 0.0
+        worse = change < 0 if METRIC_DIRECTIONS.get(metric, True) else change > 0
+
+        # too few runs (single wa runs, 3 vs 3 runs at alpha 0.05) can't reach alpha, "no regressions" would be a lie
+        p = None
+        verdict = ""
+        if mann_whitney_min_p(len(a), len(b)) >= args.alpha:
+            insufficient.setdefault(suite, []).append(f"{len(a)}/{len(b)}")
+            verdict = "insufficient samples"
+        else:
+            p = mann_whitney_p(a, b)
+            if p < args.alpha and abs(change) >= args.min_change:
+                verdict = "REGRESSION" if worse else "improvement"
+                regressions += worse
+
+        if (verdict and p is not None) or args.all:
+            p_str = f"{p:.3f}" if p is not None else "-"
+            print(
+                f"{suite:<8} {ds:<3} {metric:<22} {len(a):>2}/{len(b):<2} {median_a:>12.2f} {median_b:>12.2f} "
+                f"{change:>+7.1f}% {p_str:>7}  {params} {verdict}"
+            )
+
+    missing = len(base.keys() ^ new.keys())
+    if missing:
+        print(f"{missing} results are only in one of the revisions")
+    for suite, sizes in sorted(insufficient.items()):
+        print(
+            f"{suite}: insufficient samples for alpha {args.alpha} in {len(sizes)} results (n {', '.join(sorted(set(sizes)))}), "
+            "record more runs or skip the suite with --suite"
+        )
+    print(f"{regressions} regressions")
+    return 1 if regressions or insufficient else 0
+
+
+def list_runs(db, args):
+    query = """
+        SELECT r.revision, r.dirty, r.recorded_at, r.host, r.session, r.note, COUNT(s.value)
+        FROM runs r LEFT JOIN samples s ON s.run_id = r.id GROUP BY r.id ORDER BY r.recorded_at
+    """
+    for revision, dirty, recorded_at, host, session, note, count in db.execute(query):
+        subject = git("log", "-1", "--format=%s", revision)
+        print(f"{revision[:12]}{'+' if dirty else ' '} {recorded_at[:19]} {host} {session} {count:>6} samples  {subject} {note or ''}")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Benchmark results history and regression checks.")
+    parser.add_argument("--db", default=DB_PATH, help="SQLite database")
+    subparsers = parser.add_subparsers(dest="command", required=True)
+
+    record_parser = subparsers.add_parser("record", help="Store the results in logs/ with the current git revision")
+    record_parser.add_argument("--logs", default=LOGS_PATH, help="Results directory")
+    record_parser.add_argument("--session", help="Id of the benchmark session, calls with the same one are merged")
+    record_parser.add_argument("--note", default="", help="Free-form note (machine, config changes)")
+
+    compare_parser = subparsers.add_parser("compare", help="Flag significant changes between two revisions")
+    compare_parser.add_argument("base", help="Base revision")
+    compare_parser.add_argument("new", nargs="?", default="HEAD", help="New revision (HEAD by default)")
+    compare_parser.add_argument("--alpha", type=float, default=0.05, help="Significance level of the Mann-Whitney U test")
+    compare_parser.add_argument("--min-change", type=float, default=5.0, help="Minimal change of the medians, %%")
+    compare_parser.add_argument("--suite", help="Compare only one suite (general/latency/mix/wa/scale)")
+    compare_parser.add_argument("--include-dirty", action="store_true", help="Use the runs of uncommitted trees too")
+    compare_parser.add_argument("--all", action="store_true", help="Print all the results, not only the flagged ones")
+
+    subparsers.add_parser("list", help="List the recorded runs")
+
+    args = parser.parse_args()
+
+    db = sqlite3.connect(args.db)
+    db.executescript(SCHEMA)
+
+    match args.command:
+        case "record":
+            record(db, args)
+        case "compare":
+            sys.exit(compare(db, args))
+        case "list":
+            list_runs(db, args)
@@ -58,9 +58,44 @@ PL_GENERAL_CONC_CFG=(
 	"8 1 32 LAT"
 )
 
+# configs for mixed read/write plotter (RW_TYPE randrw), each is run for all the read ratios and distributions
+# "read block size | write block size | numjobs | iodepth"
+# fio runs per sweep: cfgs * ratios * distributions * PL_MIX_RUNS * ds, the defaults are kept small (2 * 3 * 2 * 5 * 2 = 120),
+# the wider sweep ("4 16 8 32"/"16 4 8 32", 0/30/50/70/90/100 %, random/zipf:1.2/pareto:0.9) can be picked with the plots.sh options
+PL_MIX_CFG=(
+	"8 8 8 32"
+	"4 16 8 32"
+)
+PL_MIX_READ_RATIOS=("0" "50" "90") # rwmixread, %
+PL_MIX_DISTRIBUTIONS=("random" "zipf:1.2") # fio random_distribution
+PL_MIX_RUNS=5 # the regression check (bench_db.py compare) needs 4+ runs per side to reach p < 0.05
+
 PL_PRECOND_JOBS_NUM=10
 PL_PRECOND_IODEPTH=32
 
+######################################
+### WRITE AMPLIFICATION PARAMETERS ###
+######################################
+
+# see wa_bench.sh, backing device has to hold WA_REGION_GB * WA_PASSES (there is no GC)
+WA_REGION_GB=1 # size of the overwritten region
+WA_PASSES=4 # how many times the region is overwritten
+WA_BS_LIST=("4" "16" "64") # write block sizes in KB
+WA_SAMPLE_INTERVAL=1 # seconds between the samples of the disk state
+
+##############################
+### SCALABILITY PARAMETERS ###
+##############################
+
+# see scale.sh, one fio job per core, core counts above the online CPU's are skipped
+SC_CORES_LIST=("1" "2" "4" "8" "16" "32" "64")
+SC_PLACEMENTS=("local" "spread") # local - fill one NUMA node first, spread - round-robin over the nodes
+SC_BS=8 # block size in KB
+SC_RW="randwrite" # fio rw of the sweep (randwrite/randread/randrw)
+SC_IODEPTH=32 # per job
+SC_RUNTIME=15 # seconds
+SC_RUNS=5 # same as PL_MIX_RUNS
+
 ################################################
 ### PYTHON SCRIPTS PLOTS SPECIFIC PARAMETERS ###
 ################################################
@@ -114,7 +149,28 @@ output_config() {
 	echo "  PL_AVAILABLE_DS=(${PL_AVAILABLE_DS[*]})"
 	echo "  PL_IOPS_FOR_EACH_NJID_CFG=(${PL_IOPS_FOR_EACH_NJID_CFG[*]})"
 	echo "  PL_GENERAL_CONC_CFG=(${PL_GENERAL_CONC_CFG[*]})"
+	echo "  PL_MIX_CFG=(${PL_MIX_CFG[*]})"
+	echo "  PL_MIX_READ_RATIOS=(${PL_MIX_READ_RATIOS[*]})"
+	echo "  PL_MIX_DISTRIBUTIONS=(${PL_MIX_DISTRIBUTIONS[*]})"
+	echo "  PL_MIX_RUNS=$PL_MIX_RUNS"
 	echo "  PL_PRECOND_JOBS_NUM=$PL_PRECOND_JOBS_NUM"
 	echo "  PL_PRECOND_IODEPTH=$PL_PRECOND_IODEPTH"
 	echo
+
+	echo "SCALABILITY PARAMETERS:"
+	echo "  SC_CORES_LIST=(${SC_CORES_LIST[*]})"
+	echo "  SC_PLACEMENTS=(${SC_PLACEMENTS[*]})"
+	echo "  SC_BS=$SC_BS"
+	echo "  SC_RW=$SC_RW"
+	echo "  SC_IODEPTH=$SC_IODEPTH"
+	echo "  SC_RUNTIME=$SC_RUNTIME"
+	echo "  SC_RUNS=$SC_RUNS"
+	echo
+
+	echo "WRITE AMPLIFICATION PARAMETERS:"
+	echo "  WA_REGION_GB=$WA_REGION_GB"
+	echo "  WA_PASSES=$WA_PASSES"
+	echo "  WA_BS_LIST=(${WA_BS_LIST[*]})"
+	echo "  WA_SAMPLE_INTERVAL=$WA_SAMPLE_INTERVAL"
+	echo
 }
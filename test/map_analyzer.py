@@ -0,0 +1,172 @@
+import argparse
+import bisect
+import math
+import os
+import random
+
+# Fragmentation analysis of the mapping dump (/sys/kernel/debug/lsbdd/<vbd>/map, "lba pba sectors type" lines).
+# Optional stats file (/sys/kernel/debug/lsbdd/<vbd>/stats) adds overwrite amplification and the actual read split rate.
+
+READ_SIZES_KB = [4, 8, 16, 32, 64, 128, 256, 1024]
+WINDOW_SAMPLES = 20000
+
+parser = argparse.ArgumentParser(
+    description="Report extent-size distribution, physical scatter and overwrite amplification of the lsbdd map dump."
+)
+parser.add_argument("map", help="Copy of the map debugfs file")
+parser.add_argument("--stats", help="Copy of the stats debugfs file, taken along with the map")
+parser.add_argument("--label", default="", help="Run label (e.g. data structure) for the CSV row")
+parser.add_argument("--csv", help="Append the summary as a CSV row to this file")
+parser.add_argument("--plot", help="Save the extent size histogram to this image")
+parser.add_argument("--seed", type=int, default=1, help="Seed of the read window sampling")
+args = parser.parse_args()
+
+
+def load_map(path):
+    extents = []
+    with open(path) as f:
+        for line in f:
+            if line.startswith("#") or not line.strip():
+                continue
+            lba, pba, sects, ext_type = line.split()
+            extents.append((int(lba), int(pba), int(sects), ext_type))
+    extents.sort()
+    return extents
+
+
+def load_stats(path):
+    stats = {}
+    with open(path) as f:
+        for line in f:
+            parts = line.split()
+            if len(parts) == 2:
+                stats[parts[0]] = int(parts[1])
+    return stats
+
+
+def percentile(sorted_values, pct):
+    if not sorted_values:
+        return 0
+    return sorted_values[min(len(sorted_values) - 1, int(len(sorted_values) * pct / 100))]
+
+
+def size_distribution(data):
+    """Extent sizes in sectors: log2 buckets and percentiles."""
+    sizes = sorted(ext[2] for ext in data)
+    buckets = {}
+    for size in sizes:
+        bucket = 1 << int(math.log2(size))
+        buckets[bucket] = buckets.get(bucket, 0) + 1
+    return sizes, buckets
+
+
+def physical_scatter(data):
+    """
+    Extents adjacent in LBA are compared: a break is the pair that isn't adjacent on the backing device too.
+    Returns (logical runs, physical runs inside them, mean |pba jump| of the breaks in sectors).
+    """
+    logical_runs = 0
+    physical_runs = 0
+    jumps = []
+    prev = None
+    for ext in data:
+        lba, pba, sects, _ = ext
+        if prev is None or prev[0] + prev[2] != lba:
+            logical_runs += 1
+            physical_runs += 1
+        elif prev[1] + prev[2] != pba:
+            physical_runs += 1
+            jumps.append(abs(pba - (prev[1] + prev[2])))
+        prev = ext
+    mean_jump = sum(jumps) / len(jumps) if jumps else 0
+    return logical_runs, physical_runs, mean_jump
+
+
+def expected_fragments(extents, read_sects, rng):
+    """Mean number of extents a read of read_sects at a random mapped LBA touches (the read path splits on each)."""
+    starts = [ext[0] for ext in extents]
+    ends = [ext[0] + ext[2] for ext in extents]
+    total = 0
+    for _ in range(WINDOW_SAMPLES):
+        i = rng.randrange(len(extents))
+        lba = rng.randrange(extents[i][0], ends[i])
+        # extents are disjoint, so they overlap [lba, lba + read_sects) from i to the last one starting before its end
+        total += bisect.bisect_left(starts, lba + read_sects) - i
+    return total / WINDOW_SAMPLES
+
+
+def main():
+    extents = load_map(args.map)
+    if not extents:
+        print("Map is empty")
+        return
+
+    data = [ext for ext in extents if ext[3] != "z"]
+    zero = len(extents) - len(data)
+    compressed = sum(1 for ext in data if ext[3] == "c")
+    sizes, buckets = size_distribution(data)
+    live_sects = sum(sizes)
+    logical_runs, physical_runs, mean_jump = physical_scatter(data)
+    rng = random.Random(args.seed)
+
+    summary = {
+        "label": args.label,
+        "extents": len(extents),
+        "data_extents": len(data),
+        "zero_extents": zero,
+        "compressed_extents": compressed,
+        "live_sectors": live_sects,
+        "avg_extent_sects": round(live_sects / len(data), 2) if data else 0,
+        "p50_extent_sects": percentile(sizes, 50),
+        "p99_extent_sects": percentile(sizes, 99),
+        "max_extent_sects": sizes[-1] if sizes else 0,
+        "logical_runs": logical_runs,
+        "physical_runs": physical_runs,
+        # 1.0 - each LBA-contiguous run is contiguous on the backing device too
+        "scatter": round(physical_runs / logical_runs, 3) if logical_runs else 0,
+        "mean_pba_jump_sects": round(mean_jump, 1),
+    }
+
+    if data:
+        for kb in READ_SIZES_KB:
+            summary[f"frags_per_read_{kb}k"] = round(expected_fragments(data, kb * 2, rng), 3)
+
+    if args.stats:
+        stats = load_stats(args.stats)
+        if stats.get("live_sectors"):
+            # sectors taken from the log per live sector, log head is shared by all the conventional disks
+            summary["overwrite_amp"] = round(stats.get("allocated_sectors", 0) / stats["live_sectors"], 3)
+        if stats.get("reads"):
+            summary["actual_frags_per_read"] = round(stats.get("read_fragments", 0) / stats["reads"], 3)
+        if live_sects:
+            summary["write_amp_bytes"] = round(stats.get("write_bytes", 0) / (live_sects * 512), 3)
+
+    for key, value in summary.items():
+        print(f"{key}={value}")
+
+    print("extent size histogram (sectors: extents)")
+    for bucket in sorted(buckets):
+        print(f"  {bucket:>8}-{bucket * 2 - 1:<8} {buckets[bucket]}")
+
+    if args.csv:
+        new_file = not os.path.exists(args.csv)
+        with open(args.csv, "a") as f:
+            if new_file:
+                f.write(",".join(summary.keys()) + "\n")
+            f.write(",".join(str(v) for v in summary.values()) + "\n")
+
+    if args.plot and buckets:
+        import matplotlib.pyplot as plt
+
+        labels = [str(b) for b in sorted(buckets)]
+        plt.figure(figsize=(10, 5))
+        plt.bar(labels, [buckets[b] for b in sorted(buckets)], color="steelblue")
+        plt.xlabel("Extent size, sectors (log2 bucket)")
+        plt.ylabel("Extents")
+        plt.title(f"Extent size distribution {args.label}".strip())
+        plt.tight_layout()
+        plt.savefig(args.plot)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,128 @@
+import matplotlib.pyplot as plt
+import json
+import os
+import pandas as pd
+import config_parsers as cfg_parser
+
+# Plots of the mixed read/write runs of plots.sh (run_mixed_cases): IOPS and p99 completion latency per read ratio.
+
+RESULTS_FILE_PATH = "logs/fio_mix_results.dat"
+SUMMARY_FILE_PATH = "logs/fio_mix_summary.csv"
+PLOTS_PATH = "plots/mix"
+
+DEFAULT_DS_MAPPING = {
+    "ht": "Hash-table",
+    "sl": "Skiplist",
+    "bt": "B+ tree",
+    "rb": "Red-Black tree",
+}
+
+COLUMN_NAMES = ["RunID", "DS", "RBS", "WBS", "READ", "DIST", "IODEPTH", "NUMJOBS", "LOG"]
+
+DS_COLORS = {"sl": "steelblue", "ht": "indianred", "rb": "seagreen", "bt": "darkkhaki"}
+
+DS_MAPPING = {**DEFAULT_DS_MAPPING, **cfg_parser.load_ds_mapping()}
+
+
+def load_fio_json(path):
+    """
+    Gets per-direction IOPS and p99 completion latency (us) of a fio run with --group_reporting.
+    @return: dict of READ_IOPS, WRITE_IOPS, READ_P99, WRITE_P99 (0 for the direction without I/O)
+    """
+    metrics = {"READ_IOPS": 0.0, "WRITE_IOPS": 0.0, "READ_P99": 0.0, "WRITE_P99": 0.0}
+    try:
+        with open(path) as f:
+            text = f.read()
+        # fio may print warnings before the JSON
+        job = json.loads(text[text.index("{"):])["jobs"][0]
+    except (OSError, ValueError, KeyError, IndexError) as e:
+        print(f"[warn] Can't parse {path}: {e}")
+        return metrics
+
+    for direction in ("read", "write"):
+        stats = job.get(direction, {})
+        metrics[f"{direction.upper()}_IOPS"] = stats.get("iops", 0.0)
+        percentiles = stats.get("clat_ns", {}).get("percentile", {})
+        metrics[f"{direction.upper()}_P99"] = percentiles.get("99.000000", 0) / 1000
+    return metrics
+
+
+def process_df():
+    df = pd.read_csv(RESULTS_FILE_PATH, sep=r"\s+", names=COLUMN_NAMES, header=None)
+    metrics = pd.DataFrame([load_fio_json(path) for path in df["LOG"]])
+    df = pd.concat([df.drop(columns=["LOG"]), metrics], axis=1)
+    df["IOPS"] = df["READ_IOPS"] + df["WRITE_IOPS"]
+
+    # median over the runs
+    summary = (
+        df.groupby(["DS", "RBS", "WBS", "DIST", "NUMJOBS", "IODEPTH", "READ"])
+        [["IOPS", "READ_IOPS", "WRITE_IOPS", "READ_P99", "WRITE_P99"]]
+        .median()
+        .reset_index()
+    )
+    summary.to_csv(SUMMARY_FILE_PATH, index=False)
+    return summary
+
+
+def plot_iops(case, title_suffix, filename):
+    plt.figure(figsize=(10, 6))
+    for ds, ds_df in case.groupby("DS"):
+        ds_df = ds_df.sort_values("READ")
+        plt.plot(ds_df["READ"], ds_df["IOPS"], marker="o", color=DS_COLORS.get(ds, None), label=DS_MAPPING.get(ds, ds))
+
+    plt.xlabel("Reads in the mix (%)")
+    plt.ylabel("IOPS (ops/s)")
+    plt.title(f"Median IOPS of the mixed workload,\n{title_suffix}")
+    plt.grid(True, alpha=0.3)
+    plt.legend()
+    plt.tight_layout()
+    plt.savefig(os.path.join(PLOTS_PATH, filename))
+    plt.close()
+
+
+def plot_p99(case, title_suffix, filename):
+    """
+    Two subplots: p99 of reads and of writes, the ratio without I/O of the direction is skipped.
+    """
+    fig, axes = plt.subplots(1, 2, figsize=(14, 6))
+    for ax, direction in zip(axes, ("READ", "WRITE")):
+        for ds, ds_df in case.groupby("DS"):
+            ds_df = ds_df[ds_df[f"{direction}_IOPS"] > 0].sort_values("READ")
+            ax.plot(
+                ds_df["READ"],
+                ds_df[f"{direction}_P99"],
+                marker="o",
+                color=DS_COLORS.get(ds, None),
+                label=DS_MAPPING.get(ds, ds),
+            )
+        ax.set_xlabel("Reads in the mix (%)")
+        ax.set_ylabel("p99 completion latency (us)")
+        ax.set_title(f"{direction.capitalize()}s")
+        ax.grid(True, alpha=0.3)
+        ax.legend()
+
+    fig.suptitle(f"99-th percentiles of completion latency,\n{title_suffix}")
+    fig.tight_layout()
+    fig.savefig(os.path.join(PLOTS_PATH, filename))
+    plt.close(fig)
+
+
+def gen_mix_plots(summary):
+    if summary.empty:
+        print("No mixed workload results, no plots will be generated.")
+        return
+
+    os.makedirs(PLOTS_PATH, exist_ok=True)
+    for (rbs, wbs, dist, nj, iodepth), case in summary.groupby(["RBS", "WBS", "DIST", "NUMJOBS", "IODEPTH"]):
+        title_suffix = f"RBS={rbs}K, WBS={wbs}K, distribution={dist}, NJ={nj}, ID={iodepth}"
+        name = f"r{rbs}_w{wbs}_{dist.replace(':', '_')}_nj{nj}_id{iodepth}.png"
+
+        plot_iops(case, title_suffix, f"IOPS_mix_{name}")
+        plot_p99(case, title_suffix, f"P99_LAT_mix_{name}")
+        print(f"[ok] Saved mixed workload plots: {PLOTS_PATH}/*_mix_{name}")
+
+
+summary = process_df()
+print(summary)
+
+gen_mix_plots(summary)
@@ -8,10 +8,12 @@ source ./configurable_params.sh
 
 readonly FLAMEGRAPH_PATH="./FlameGraph"
 VERIFY="false"
+TRACE="false"
 
 # Function to display help
 usage() {
-    echo "Usage: $0 [--bd_name name_without_/dev/] [--verify true/false] [--io_depth number]"
+    echo "Usage: $0 [--bd_name name_without_/dev/] [--verify true/false] [--io_depth number] [--trace]"
+    echo "  --trace - record the lsbdd tracepoints (per-request timelines) instead of the flamegraphs"
     exit 1
 }
 
@@ -31,6 +33,9 @@ while [[ "$#" -gt 0 ]]; do
         -v|--verify)
             VERIFY="true"
             ;;
+        -t|--trace)
+            TRACE="true"
+            ;;
         -h|--help)
             usage
             ;;
@@ -47,6 +52,17 @@ if ! command -v perf &> /dev/null; then
     exit 1
 fi
 
+# Tracepoints of the driver (src/lsbdd_trace.h): submit -> map update -> split -> remap -> complete of each BIO
+if [ "$TRACE" == "true" ]; then
+	for rw in write read; do
+		echo -e "\nRecording lsbdd tracepoints on fio $rw workload..."
+		sudo perf record -e 'lsbdd:*' -a -o "perf_trace_$rw.data" -- make "fio_perf_${rw:0:1}_opt" ID="$IO_DEPTH" NJ="$JOBS_NUM"
+		sudo perf script -i "perf_trace_$rw.data" > "lsbdd_trace_$rw.txt"
+	done
+	echo -e "\nTraces saved: lsbdd_trace_write.txt and lsbdd_trace_read.txt"
+	exit 0
+fi
+
 if [[ ! -f "$FLAMEGRAPH_PATH/stackcollapse-perf.pl" || ! -f "$FLAMEGRAPH_PATH/flamegraph.pl" ]]; then
     echo "Error: FlameGraph scripts not found."
 	echo "Installing FlameGraph into $FLAMEGRAPH_PATH ."
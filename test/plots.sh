@@ -8,9 +8,19 @@ readonly RESULTS_FILE="$LOGS_PATH/fio_results.dat"
 readonly LAT_RESULTS_FILE="$LOGS_PATH/fio_results.dat"
 readonly CONC_IOPS_PLOTS_SCRIPT="iops_conc_plots.py"
 readonly CONC_GENERAL_DIFF_PLOT="general_conc_plots.py"
+readonly MIX_RESULTS_FILE="$LOGS_PATH/fio_mix_results.dat"
+readonly MIX_PLOTS_SCRIPT="mix_plots.py"
+readonly BENCH_DB_SCRIPT="bench_db.py"
+# all the results of one plots.sh call are recorded as one run of the history
+readonly BENCH_SESSION="plots-$(date +%Y%m%d%H%M%S)-$$"
 
 usage() {
-    echo "Usage: $0"
+    echo "Usage: $0 [--ds sl,ht] [--mix \"8 8 8 32,4 16 8 32\"] [--mix-ratios 0,50,90] [--mix-dist random,zipf:1.2] [--mix-runs N]"
+    echo "  --ds         - structures to benchmark (PL_AVAILABLE_DS)"
+    echo "  --mix        - mixed workload cfgs \"rbs wbs numjobs iodepth\" (PL_MIX_CFG), \"\" skips the mixed workloads"
+    echo "  --mix-ratios - rwmixread values of the mixed workloads, % (PL_MIX_READ_RATIOS)"
+    echo "  --mix-dist   - fio random_distribution values of the mixed workloads (PL_MIX_DISTRIBUTIONS)"
+    echo "  --mix-runs   - runs per mixed workload point (PL_MIX_RUNS)"
     exit 1
 }
 
@@ -311,6 +321,7 @@ run_iops_for_each_nj_id() {
 
 			echo "Data collected in $RESULTS_FILE"
 			python3 "$CONC_IOPS_PLOTS_SCRIPT"  
+			python3 "$BENCH_DB_SCRIPT" record --session "$BENCH_SESSION"
 			make clean_logs > /dev/null
 		done
 	done
@@ -376,13 +387,82 @@ run_general_conc_cases() {
 	echo "Data collected in $RESULTS_FILE"
 	cat $RESULTS_FILE
 	python3 "$CONC_GENERAL_DIFF_PLOT" "$metric"
+	python3 "$BENCH_DB_SCRIPT" record --session "$BENCH_SESSION"
+}
+
+<<docs
+Runs the mixed read/write workloads: sweeps the read ratio (PL_MIX_READ_RATIOS) and the random distribution
+(PL_MIX_DISTRIBUTIONS) with different read and write block sizes. Uses fio_perf_mix cfg from ./Makefile.
+fio JSON output of each run is kept in the logs, mix_plots.py gets per-direction IOPS and p99 from it.
+
+@param rbs - read block size
+@param wbs - write block size
+@param nj - numjobs
+@param id - iodepth
+docs
+run_mixed_cases() {
+	local rbs=$1 wbs=$2 nj=$3 id=$4 log_file
+
+	echo -e "---Starting Mixed Read/Write Benchmark on $BD_NAME (RBS = $rbs, WBS = $wbs)...---\n"
+
+	for ds in "${PL_AVAILABLE_DS[@]}"; do
+		for dist in "${PL_MIX_DISTRIBUTIONS[@]}"; do
+			for read_ratio in "${PL_MIX_READ_RATIOS[@]}"; do
+				for ((i=1;i<=PL_MIX_RUNS;i++)); do
+					reinit_lsvbd "$ds"
+
+					# reads of the unmapped sectors are passed through, so the map is filled first
+					if [ "$read_ratio" != "0" ]; then
+						workload_independent_preconditioning "$wbs"
+					fi
+
+					echo "Running with rbs = $rbs, wbs = $wbs, iodepth = $id and nj = $nj, ds = $ds, read = $read_ratio%, dist = $dist ..."
+
+					log_file="$LOGS_PATH/fio_mix_${ds}_${rbs}_${wbs}_${dist/:/_}_${read_ratio}_run_${i}.json"
+
+					make fio_perf_mix FS=$VBD_NAME RW_TYPE="randrw" RWMIX_READ="$read_ratio" RWMIX_WRITE="$((100 - read_ratio))" \
+						MIX_RBS="$rbs" MIX_WBS="$wbs" RAND_DIST="$dist" ID="$id" NJ="$nj" \
+						EXTRA_OPTS="--group_reporting --output-format=json --output=$log_file" > /dev/null 2>&1
+
+					echo "$i $ds $rbs $wbs $read_ratio $dist $id $nj $log_file" >> "$MIX_RESULTS_FILE"
+				done
+			done
+		done
+	done
+
+	echo "Data collected in $MIX_RESULTS_FILE"
 }
 
 # Parse options
 while [[ "$#" -gt 0 ]]; do
     case $1 in
-        -h|--help) echo "Usage: $0 [--bd_size size of underlyiing block device] [--bd_name name of underlying block device]"; exit 1 ;;
-        *) echo "Unknown option: $1"; exit 1 ;;
+        -d|--ds)
+            IFS=',' read -r -a PL_AVAILABLE_DS <<< "$2"
+            shift
+            ;;
+        -m|--mix)
+            IFS=',' read -r -a PL_MIX_CFG <<< "$2"
+            shift
+            ;;
+        --mix-ratios)
+            IFS=',' read -r -a PL_MIX_READ_RATIOS <<< "$2"
+            shift
+            ;;
+        --mix-dist)
+            IFS=',' read -r -a PL_MIX_DISTRIBUTIONS <<< "$2"
+            shift
+            ;;
+        --mix-runs)
+            PL_MIX_RUNS="$2"
+            shift
+            ;;
+        -h|--help)
+            usage
+            ;;
+        *)
+            echo "Unknown option: $1"
+            usage
+            ;;
     esac
     shift
 done
@@ -400,5 +480,16 @@ for cfg_entry in "${PL_GENERAL_CONC_CFG[@]}"; do
 	run_general_conc_cases "$block_size" "$nj" "$id" "$metric"
 done
 
+for cfg_entry in "${PL_MIX_CFG[@]}"; do
+	read -r read_bs write_bs nj id <<< "$cfg_entry"
+
+	run_mixed_cases "$read_bs" "$write_bs" "$nj" "$id"
+done
+
+if [ ${#PL_MIX_CFG[@]} -ne 0 ]; then
+	python3 "$MIX_PLOTS_SCRIPT"
+	python3 "$BENCH_DB_SCRIPT" record --session "$BENCH_SESSION"
+fi
+
 echo -e "\nCleaning the logs directory"
 make clean > /dev/null
@@ -0,0 +1,87 @@
+#!/bin/bash
+
+###											###
+###		  BLOCK I/O TRACE CAPTURE			###
+###											###
+# Captures the queued requests of a device with blktrace and converts them into the replay trace
+# format ("<time_ns> <R|W|D|F> <sector> <nr_sectors>" per line, check replay.c).
+
+DEVICE=""
+DURATION=60
+INPUT=""
+OUTPUT="trace.txt"
+
+usage() {
+    echo "Usage: $0 (--dev sdX [--time seconds] | --input blktrace_basename) [--out trace.txt]"
+    echo "  --dev   - device to capture (without /dev/), the workload is expected to run meanwhile"
+    echo "  --input - convert the already captured blktrace files (<basename>.blktrace.<cpu>)"
+    exit 1
+}
+
+while [[ "$#" -gt 0 ]]; do
+    case $1 in
+        -d|--dev)
+            DEVICE="$2"
+            shift
+            ;;
+        -w|--time)
+            DURATION="$2"
+            shift
+            ;;
+        -i|--input)
+            INPUT="$2"
+            shift
+            ;;
+        -o|--out)
+            OUTPUT="$2"
+            shift
+            ;;
+        -h|--help)
+            usage
+            ;;
+        *)
+            echo "Unknown option: $1"
+            usage
+            ;;
+    esac
+	shift
+done
+
+if [[ -z "$DEVICE" && -z "$INPUT" ]]; then
+    usage
+fi
+
+if ! command -v blkparse &> /dev/null; then
+    echo "Error: 'blktrace' is not installed. Please install it and try again."
+    exit 1
+fi
+
+# Only the Q (queued) events are kept: they are the requests as the upper layers issued them,
+# before the merges and splits of the device the trace was taken on.
+convert() {
+	awk '
+	{
+		ns = $1 * 1000000000 + $2
+		if (!started) { first = ns; started = 1 }
+		rwbs = $3; sector = $4; n = $5
+		if (rwbs ~ /D/) op = "D"
+		else if (rwbs ~ /W/ && n > 0) op = "W"
+		else if (rwbs ~ /R/ && n > 0) op = "R"
+		else if (rwbs ~ /F/) { op = "F"; sector = 0; n = 0 }
+		else next
+		# %d is clamped to 2^31 - 1 by mawk, time and sector need %.0f (exact up to 2^53)
+		printf "%.0f %s %.0f %d\n", ns - first, op, sector, n
+	}'
+}
+
+{
+	echo "# time_ns op sector nr_sectors"
+	if [[ -n "$INPUT" ]]; then
+		blkparse -i "$INPUT" -a queue -q -f "%T %t %d %S %n\n" | convert
+	else
+		echo "Capturing /dev/$DEVICE for $DURATION s..." >&2
+		sudo blktrace -d "/dev/$DEVICE" -a queue -w "$DURATION" -o - | blkparse -i - -a queue -q -f "%T %t %d %S %n\n" | convert
+	fi
+} > "$OUTPUT"
+
+echo "Trace saved: $OUTPUT ($(($(wc -l < "$OUTPUT") - 1)) requests)"
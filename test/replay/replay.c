@@ -0,0 +1,467 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/*
+ * Block I/O trace replay against the virtual disk.
+ *
+ * Trace is a text file (see capture.sh), one request per line:
+ *   <time_ns> <op> <sector> <nr_sectors>
+ * op is R (read), W (write), D (discard) or F (flush), sectors are 512B, lines starting with '#' are skipped.
+ *
+ * Requests are taken in the trace order by the worker threads and issued with O_DIRECT, either at the
+ * original timing (scaled by -x) or as fast as possible. Sectors beyond the device are wrapped.
+ * If the debugfs stats of the disk are given (-S), map size is sampled every -i ms into the CSV (-o).
+ *
+ * Usage: make && ./replay -f trace.txt -d /dev/lsvbd1 -t 8 -m timed -S /sys/kernel/debug/lsbdd/lsvbd1/stats
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <linux/fs.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REPLAY_MAX_THREADS 256
+#define REPLAY_SECTOR_SIZE 512
+#define REPLAY_ALIGN 4096
+#define REPLAY_LATE_NS 1000000 // timed requests issued later than this are counted as late
+
+enum replay_op { REPLAY_READ, REPLAY_WRITE, REPLAY_DISCARD, REPLAY_FLUSH, REPLAY_OPS_NUM };
+
+static const char replay_op_chars[REPLAY_OPS_NUM] = { 'R', 'W', 'D', 'F' };
+static const char *replay_op_names[REPLAY_OPS_NUM] = { "read", "write", "discard", "flush" };
+
+struct replay_req {
+	uint64_t time_ns; // since the first request
+	uint64_t sector;
+	uint32_t nr_sectors;
+	enum replay_op op;
+	uint64_t lat_ns; // filled on completion
+	bool failed;
+};
+
+struct replay_cfg {
+	const char *trace_path;
+	const char *dev_path;
+	const char *stats_path;
+	const char *out_path;
+	uint32_t threads;
+	bool timed;
+	double speed; // timed mode: >1 replays faster than the original
+	uint32_t interval_ms;
+};
+
+static struct replay_cfg cfg = {
+	.threads = 1,
+	.timed = true,
+	.speed = 1.0,
+	.interval_ms = 1000,
+};
+
+static struct replay_req *reqs;
+static uint64_t reqs_num;
+static uint64_t max_sectors; // of a single request, sizes the buffers
+static uint64_t dev_sectors;
+static int dev_fd = -1;
+
+static uint64_t next_req; // index of the next request to issue
+static uint64_t done_reqs;
+static uint64_t late_reqs;
+static uint64_t start_ns;
+static volatile bool replay_done;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t ns)
+{
+	struct timespec ts = { .tv_sec = ns / 1000000000ull, .tv_nsec = ns % 1000000000ull };
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+static int load_trace(const char *path)
+{
+	struct replay_req *tmp = NULL;
+	uint64_t cap = 0;
+	uint64_t first_ns = 0;
+	char line[256];
+	char op = 0;
+	FILE *f = NULL;
+	int i = 0;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+
+	while (fgets(line, sizeof(line), f)) {
+		struct replay_req req = { 0 };
+
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, "%" SCNu64 " %c %" SCNu64 " %" SCNu32, &req.time_ns, &op, &req.sector, &req.nr_sectors) != 4)
+			goto parse_err;
+
+		for (i = 0; i < REPLAY_OPS_NUM && replay_op_chars[i] != op; i++)
+			;
+		if (i == REPLAY_OPS_NUM || (i != REPLAY_FLUSH && !req.nr_sectors))
+			goto parse_err;
+		req.op = i;
+
+		if (reqs_num == cap) {
+			cap = cap ? cap * 2 : 4096;
+			tmp = realloc(reqs, cap * sizeof(struct replay_req));
+			if (!tmp) {
+				fclose(f);
+				return -ENOMEM;
+			}
+			reqs = tmp;
+		}
+
+		if (!reqs_num)
+			first_ns = req.time_ns;
+		req.time_ns = req.time_ns > first_ns ? req.time_ns - first_ns : 0;
+		if (req.op != REPLAY_DISCARD && req.nr_sectors > max_sectors)
+			max_sectors = req.nr_sectors;
+		reqs[reqs_num++] = req;
+	}
+
+	fclose(f);
+	return reqs_num ? 0 : -ENODATA;
+
+parse_err:
+	fprintf(stderr, "Bad trace line: %s", line);
+	fclose(f);
+	return -EINVAL;
+}
+
+static int issue(struct replay_req *req, char *buf)
+{
+	uint64_t range[2] = { 0 };
+	uint64_t sector = 0;
+	size_t len = (size_t)req->nr_sectors * REPLAY_SECTOR_SIZE;
+
+	if (req->op == REPLAY_FLUSH)
+		return fdatasync(dev_fd);
+	if (req->nr_sectors > dev_sectors)
+		return -1;
+
+	// wrapped request must fit into the device as a whole
+	sector = req->sector % (dev_sectors - req->nr_sectors + 1);
+
+	switch (req->op) {
+	case REPLAY_READ:
+		return pread(dev_fd, buf, len, sector * REPLAY_SECTOR_SIZE) == (ssize_t)len ? 0 : -1;
+	case REPLAY_WRITE:
+		return pwrite(dev_fd, buf, len, sector * REPLAY_SECTOR_SIZE) == (ssize_t)len ? 0 : -1;
+	case REPLAY_DISCARD:
+		range[0] = sector * REPLAY_SECTOR_SIZE;
+		range[1] = len;
+		return ioctl(dev_fd, BLKDISCARD, range);
+	default:
+		return -1;
+	}
+}
+
+static void *worker_thread(void *data)
+{
+	struct replay_req *req = NULL;
+	uint64_t idx = 0;
+	uint64_t due = 0;
+	uint64_t t = 0;
+	char *buf = NULL;
+
+	if (posix_memalign((void **)&buf, REPLAY_ALIGN, max_sectors * REPLAY_SECTOR_SIZE + REPLAY_ALIGN))
+		return NULL;
+	memset(buf, 0xAA, max_sectors * REPLAY_SECTOR_SIZE);
+
+	while ((idx = __atomic_fetch_add(&next_req, 1, __ATOMIC_RELAXED)) < reqs_num) {
+		req = &reqs[idx];
+		if (cfg.timed) {
+			due = start_ns + (uint64_t)(req->time_ns / cfg.speed);
+			t = now_ns();
+			if (t < due)
+				sleep_until(due);
+			else if (t - due > REPLAY_LATE_NS)
+				__atomic_fetch_add(&late_reqs, 1, __ATOMIC_RELAXED);
+		}
+
+		t = now_ns();
+		req->failed = issue(req, buf) != 0;
+		req->lat_ns = now_ns() - t;
+		__atomic_fetch_add(&done_reqs, 1, __ATOMIC_RELAXED);
+	}
+
+	free(buf);
+	return NULL;
+}
+
+// @return value of the "name value" line of the debugfs stats, 0 if it isn't there
+static uint64_t stats_value(const char *stats, const char *name)
+{
+	size_t len = strlen(name);
+	const char *p = stats;
+
+	while (p && *p) {
+		if (!strncmp(p, name, len) && p[len] == ' ')
+			return strtoull(p + len + 1, NULL, 10);
+		p = strchr(p, '\n');
+		if (p)
+			p++;
+	}
+	return 0;
+}
+
+static void sample_map(FILE *out)
+{
+	char stats[4096];
+	size_t len = 0;
+	FILE *f = NULL;
+
+	f = fopen(cfg.stats_path, "r");
+	if (!f)
+		return;
+	len = fread(stats, 1, sizeof(stats) - 1, f);
+	stats[len] = '\0';
+	fclose(f);
+
+	fprintf(out, "%.3f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n", (now_ns() - start_ns) / 1e9,
+		__atomic_load_n(&done_reqs, __ATOMIC_RELAXED), stats_value(stats, "map_entries"),
+		stats_value(stats, "map_node_bytes"), stats_value(stats, "map_value_bytes"),
+		stats_value(stats, "live_sectors"));
+	fflush(out);
+}
+
+// Samples the map size of the disk every cfg.interval_ms, and once more after the replay
+static void *sampler_thread(void *data)
+{
+	FILE *out = data;
+	uint64_t next = start_ns;
+
+	fprintf(out, "time_s,done_reqs,map_entries,map_node_bytes,map_value_bytes,live_sectors\n");
+	while (!__atomic_load_n(&replay_done, __ATOMIC_ACQUIRE)) {
+		sample_map(out);
+		next += (uint64_t)cfg.interval_ms * 1000000ull;
+		sleep_until(next);
+	}
+	sample_map(out);
+
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void report(uint64_t elapsed_ns)
+{
+	uint64_t *lats[REPLAY_OPS_NUM] = { NULL };
+	uint64_t nums[REPLAY_OPS_NUM] = { 0 };
+	uint64_t fails[REPLAY_OPS_NUM] = { 0 };
+	uint64_t bytes[REPLAY_OPS_NUM] = { 0 };
+	uint64_t sums[REPLAY_OPS_NUM] = { 0 };
+	uint64_t failed = 0;
+	uint64_t i = 0;
+	uint64_t n = 0;
+	int op = 0;
+
+	for (op = 0; op < REPLAY_OPS_NUM; op++)
+		lats[op] = malloc(reqs_num * sizeof(uint64_t));
+
+	// failed requests are only counted, their bytes and latencies would skew the stats of the op
+	for (i = 0; i < reqs_num; i++) {
+		op = reqs[i].op;
+		if (reqs[i].failed) {
+			fails[op]++;
+			failed++;
+			continue;
+		}
+		if (lats[op])
+			lats[op][nums[op]] = reqs[i].lat_ns;
+		nums[op]++;
+		sums[op] += reqs[i].lat_ns;
+		bytes[op] += (uint64_t)reqs[i].nr_sectors * REPLAY_SECTOR_SIZE;
+	}
+
+	printf("trace=%s dev=%s threads=%u mode=%s speed=%.2f reqs=%" PRIu64 " failed=%" PRIu64 " late=%" PRIu64
+	       " ns=%" PRIu64 " iops=%.0f\n",
+	       cfg.trace_path, cfg.dev_path, cfg.threads, cfg.timed ? "timed" : "fast", cfg.speed, reqs_num, failed, late_reqs,
+	       elapsed_ns, (reqs_num - failed) * 1e9 / elapsed_ns);
+
+	// latencies are per completed request, exact percentiles (us)
+	for (op = 0; op < REPLAY_OPS_NUM; op++) {
+		n = nums[op];
+		if (!n && fails[op])
+			printf("op=%s reqs=0 failed=%" PRIu64 "\n", replay_op_names[op], fails[op]);
+		if (!n || !lats[op])
+			continue;
+		qsort(lats[op], n, sizeof(uint64_t), cmp_u64);
+		printf("op=%s reqs=%" PRIu64 " failed=%" PRIu64
+		       " mb_per_sec=%.2f avg_us=%.2f p50_us=%.2f p99_us=%.2f p999_us=%.2f max_us=%.2f\n",
+		       replay_op_names[op], n, fails[op], op == REPLAY_FLUSH ? 0 : bytes[op] / 1048576.0 / (elapsed_ns / 1e9),
+		       sums[op] / 1e3 / n, lats[op][n / 2] / 1e3, lats[op][n * 99 / 100] / 1e3, lats[op][n * 999 / 1000] / 1e3,
+		       lats[op][n - 1] / 1e3);
+	}
+
+	for (op = 0; op < REPLAY_OPS_NUM; op++)
+		free(lats[op]);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s -f trace -d device [options]\n"
+		"  -f path               trace file (see capture.sh)\n"
+		"  -d path               device to replay on (e.g. /dev/lsvbd1)\n"
+		"  -t threads            concurrent requests (default 1, max %d)\n"
+		"  -m timed|fast         original timing or as fast as possible (default timed)\n"
+		"  -x speed              timed mode speedup, 2 - twice as fast as the original (default 1)\n"
+		"  -S path               debugfs stats of the disk, to sample the map size (e.g. /sys/kernel/debug/lsbdd/lsvbd1/stats)\n"
+		"  -i ms                 map sampling interval (default 1000)\n"
+		"  -o path               map samples CSV (default - stdout)\n",
+		name, REPLAY_MAX_THREADS);
+}
+
+static int parse_args(int argc, char **argv)
+{
+	int opt = 0;
+
+	while ((opt = getopt(argc, argv, "f:d:t:m:x:S:i:o:h")) != -1) {
+		switch (opt) {
+		case 'f':
+			cfg.trace_path = optarg;
+			break;
+		case 'd':
+			cfg.dev_path = optarg;
+			break;
+		case 't':
+			cfg.threads = strtoul(optarg, NULL, 10);
+			break;
+		case 'm':
+			if (!strcmp(optarg, "timed"))
+				cfg.timed = true;
+			else if (!strcmp(optarg, "fast"))
+				cfg.timed = false;
+			else
+				return -EINVAL;
+			break;
+		case 'x':
+			cfg.speed = strtod(optarg, NULL);
+			break;
+		case 'S':
+			cfg.stats_path = optarg;
+			break;
+		case 'i':
+			cfg.interval_ms = strtoul(optarg, NULL, 10);
+			break;
+		case 'o':
+			cfg.out_path = optarg;
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+
+	if (!cfg.trace_path || !cfg.dev_path || !cfg.threads || cfg.threads > REPLAY_MAX_THREADS || cfg.speed <= 0 ||
+	    !cfg.interval_ms)
+		return -EINVAL;
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t threads[REPLAY_MAX_THREADS];
+	pthread_t sampler;
+	struct stat st;
+	FILE *out = stdout;
+	uint64_t dev_bytes = 0;
+	uint64_t elapsed_ns = 0;
+	uint32_t i = 0;
+	int status = 0;
+
+	if (parse_args(argc, argv)) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	status = load_trace(cfg.trace_path);
+	if (status) {
+		fprintf(stderr, "Failed to load %s: %s\n", cfg.trace_path, strerror(-status));
+		return EXIT_FAILURE;
+	}
+
+	// regular files are accepted too, to check the trace without the disk
+	dev_fd = open(cfg.dev_path, O_RDWR | O_DIRECT);
+	if (dev_fd >= 0 && ioctl(dev_fd, BLKGETSIZE64, &dev_bytes) && !fstat(dev_fd, &st))
+		dev_bytes = st.st_size;
+	if (dev_fd < 0 || !dev_bytes) {
+		fprintf(stderr, "Failed to open %s: %s\n", cfg.dev_path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	dev_sectors = dev_bytes / REPLAY_SECTOR_SIZE;
+	if (dev_sectors < max_sectors) {
+		fprintf(stderr, "Device is smaller than the largest request (%" PRIu64 " sectors)\n", max_sectors);
+		return EXIT_FAILURE;
+	}
+
+	if (cfg.stats_path && cfg.out_path) {
+		out = fopen(cfg.out_path, "w");
+		if (!out) {
+			fprintf(stderr, "Failed to open %s: %s\n", cfg.out_path, strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+
+	start_ns = now_ns();
+	if (cfg.stats_path && pthread_create(&sampler, NULL, sampler_thread, out))
+		cfg.stats_path = NULL;
+
+	for (i = 0; i < cfg.threads; i++) {
+		if (pthread_create(&threads[i], NULL, worker_thread, NULL)) {
+			fprintf(stderr, "Failed to start worker %u\n", i);
+			cfg.threads = i; // the started ones take the whole trace
+			break;
+		}
+	}
+	for (i = 0; i < cfg.threads; i++)
+		pthread_join(threads[i], NULL);
+	elapsed_ns = now_ns() - start_ns;
+
+	__atomic_store_n(&replay_done, true, __ATOMIC_RELEASE);
+	if (cfg.stats_path)
+		pthread_join(sampler, NULL);
+	if (out != stdout)
+		fclose(out);
+
+	if (done_reqs != reqs_num) {
+		fprintf(stderr, "Replay stopped after %" PRIu64 " of %" PRIu64 " requests\n", done_reqs, reqs_num);
+		status = EXIT_FAILURE;
+	}
+
+	report(elapsed_ns);
+	close(dev_fd);
+	free(reqs);
+
+	return status;
+}
@@ -0,0 +1,202 @@
+#!/bin/bash
+
+###											###
+###		  SCALABILITY SWEEP					###
+###											###
+# Runs fio on 1..N cores pinned with cpus_allowed (one job per core) for each data structure, under perf stat
+# counting cache misses on the same CPUs. Cores are taken from one NUMA node first (local) or round-robin over
+# the nodes (spread). scale_plots.py reports per-core scaling efficiency and cache misses per I/O.
+# shellcheck disable=SC1091
+source ./configurable_params.sh
+
+readonly LOGS_PATH="logs"
+readonly RESULTS_FILE="$LOGS_PATH/scale_results.csv"
+readonly SCALE_PLOTS_SCRIPT="scale_plots.py"
+readonly PERF_EVENTS="cache-misses,LLC-load-misses,instructions,cycles"
+
+usage() {
+    echo "Usage: $0 [--cores 1,2,4,8] [--placement local,spread] [--ds sl,ht] [--bs KB] [--rw randwrite/randread/randrw] [--runs N] [--no-plots]"
+    exit 1
+}
+
+# Reinits the lsbdd module
+reinit_lsvbd() {
+	local ds=$1
+
+	make -C ../src exit DBI=1 > /dev/null 2>&1
+
+	sync; echo 3 | sudo tee /proc/sys/vm/drop_caches > /dev/null
+
+	make -C ../src init_no_recompile DS="$ds" TY="$BD_TYPE" BD="$BD_NAME" > /dev/null
+}
+
+# Expands a cpulist ("0-3,8,10-11") into a space separated list of CPU's
+expand_cpulist() {
+	local range IFS=','
+
+	for range in $1; do
+		if [[ "$range" == *-* ]]; then
+			seq -s ' ' "${range%-*}" "${range#*-}"
+		else
+			echo "$range"
+		fi
+	done | tr '\n' ' '
+}
+
+<<docs
+Orders the online CPU's for the placement, so the first N of them are the cores of an N-core run.
+
+@param placement - local (fill node 0, then node 1, ...) / spread (round-robin over the nodes)
+docs
+order_cpus() {
+	local placement=$1 node_dirs nodes=() node i max_len=0 cpus
+
+	node_dirs=$(ls -d /sys/devices/system/node/node[0-9]* 2> /dev/null)
+	if [ -z "$node_dirs" ]; then
+		expand_cpulist "$(cat /sys/devices/system/cpu/online)"
+		return
+	fi
+
+	for node in $node_dirs; do
+		cpus=$(expand_cpulist "$(cat "$node/cpulist")")
+		[ -n "${cpus// /}" ] && nodes+=("$cpus")
+	done
+
+	if [ "$placement" == "local" ]; then
+		echo "${nodes[*]}"
+		return
+	fi
+
+	for node in "${nodes[@]}"; do
+		read -r -a cpus <<< "$node"
+		(( ${#cpus[@]} > max_len )) && max_len=${#cpus[@]}
+	done
+	for ((i=0;i<max_len;i++)); do
+		for node in "${nodes[@]}"; do
+			read -r -a cpus <<< "$node"
+			(( i < ${#cpus[@]} )) && echo -n "${cpus[$i]} "
+		done
+	done
+}
+
+# Performs warm-up after the module init (which drops the mapping): reads hit the mapped sectors
+# and writes overwrite them, so every run starts with the same filled structure
+precondition() {
+	fio --name=prep --rw=write --bs="$SC_BS"K --numjobs="$PL_PRECOND_JOBS_NUM" --iodepth="$PL_PRECOND_IODEPTH" --ioengine=io_uring \
+		--size="$((BD_SIZE / 10))"G --filename=/dev/"$VBD_NAME" --direct=1 --offset=16k --output="$LOGS_PATH/preconditioning.log"
+}
+
+<<docs
+Runs one pinned fio workload under perf stat and appends the results.
+
+@param ds - data structure
+@param placement - local/spread
+@param cores - number of cores (jobs)
+@param cpu_list - comma separated CPU's to run on
+@param run_id - number of the run (repeat id)
+docs
+run_pinned() {
+	local ds=$1 placement=$2 cores=$3 cpu_list=$4 run_id=$5 log_file perf_file iops
+
+	log_file="$LOGS_PATH/scale_${ds}_${placement}_${cores}_run_${run_id}.log"
+	perf_file="$LOGS_PATH/scale_${ds}_${placement}_${cores}_run_${run_id}.perf"
+
+	# split - each job gets its own CPU of the list, the driver submit path runs on the submitting CPU
+	# no ramp_time - perf counts the whole fio run, scale_plots.py divides the counters by iops * SC_RUNTIME,
+	# the run starts on the preconditioned device, so the counters aren't skewed by the empty structure
+	perf stat -e "$PERF_EVENTS" -a -C "$cpu_list" -x, -o "$perf_file" -- \
+		fio --name=scale --rw="$SC_RW" --bs="$SC_BS"k --numjobs="$cores" --iodepth="$SC_IODEPTH" --ioengine=io_uring --direct=1 \
+		--time_based --runtime="$SC_RUNTIME" --norandommap --randrepeat=0 --group_reporting \
+		--cpus_allowed="$cpu_list" --cpus_allowed_policy=split --filename=/dev/"$VBD_NAME" --offset=16k --output="$log_file"
+
+	iops=$(grep -oP 'IOPS=\K[0-9]+(\.[0-9]+)?[kKmM]?' "$log_file" | \
+		awk '{ val = $1; mul = 1; if (val ~ /[kK]$/) mul = 1000; else if (val ~ /[mM]$/) mul = 1000000; s += val * mul } END { printf "%.0f", s }')
+
+	# -x, lines: value,unit,event,... ("<not supported>" / "<not counted>" values are written as 0)
+	awk -F, -v prefix="$ds,$placement,$cores,$run_id,$iops,$SC_RUNTIME" '
+		$3 ~ /^cache-misses/ { cm = $1 } $3 ~ /^LLC-load-misses/ { llc = $1 }
+		$3 ~ /^instructions/ { ins = $1 } $3 ~ /^cycles/ { cyc = $1 }
+		END { printf "%s,%.0f,%.0f,%.0f,%.0f\n", prefix, cm, llc, ins, cyc }' "$perf_file" >> "$RESULTS_FILE"
+
+	echo "ds = $ds, placement = $placement, cores = $cores ($cpu_list): IOPS = $iops"
+}
+
+PLOTS="true"
+
+while [[ "$#" -gt 0 ]]; do
+    case $1 in
+        -c|--cores)
+            IFS=',' read -r -a SC_CORES_LIST <<< "$2"
+            shift
+            ;;
+        -p|--placement)
+            IFS=',' read -r -a SC_PLACEMENTS <<< "$2"
+            shift
+            ;;
+        -d|--ds)
+            IFS=',' read -r -a PL_AVAILABLE_DS <<< "$2"
+            shift
+            ;;
+        -b|--bs)
+            SC_BS="$2"
+            shift
+            ;;
+        -w|--rw)
+            SC_RW="$2"
+            shift
+            ;;
+        -r|--runs)
+            SC_RUNS="$2"
+            shift
+            ;;
+        --no-plots)
+            PLOTS="false"
+            ;;
+        -h|--help)
+            usage
+            ;;
+        *)
+            echo "Unknown option: $1"
+            usage
+            ;;
+    esac
+	shift
+done
+
+if ! command -v perf &> /dev/null; then
+    echo "Error: 'perf' is not installed. Please install it and try again."
+    exit 1
+fi
+
+mkdir -p "$LOGS_PATH"
+echo "ds,placement,cores,run,iops,runtime,cache_misses,llc_load_misses,instructions,cycles" > "$RESULTS_FILE"
+
+for ds in "${PL_AVAILABLE_DS[@]}"; do
+	for placement in "${SC_PLACEMENTS[@]}"; do
+		read -r -a cpus <<< "$(order_cpus "$placement")"
+
+		for cores in "${SC_CORES_LIST[@]}"; do
+			if (( cores > ${#cpus[@]} )); then
+				echo "Skipping $cores cores, only ${#cpus[@]} are online"
+				continue
+			fi
+			cpu_list=$(IFS=','; echo "${cpus[*]:0:$cores}")
+
+			for ((i=1;i<=SC_RUNS;i++)); do
+				reinit_lsvbd "$ds"
+				precondition
+				run_pinned "$ds" "$placement" "$cores" "$cpu_list" "$i"
+			done
+		done
+	done
+done
+
+make -C ../src exit DBI=1 > /dev/null 2>&1
+
+echo -e "\nResults are saved in $RESULTS_FILE"
+
+if [ "$PLOTS" == "true" ]; then
+	python3 "$SCALE_PLOTS_SCRIPT"
+fi
+
+python3 bench_db.py record
@@ -0,0 +1,89 @@
+import matplotlib.pyplot as plt
+import os
+import pandas as pd
+import config_parsers as cfg_parser
+
+# Plots of the scale.sh results: IOPS, per-core scaling efficiency and cache misses per I/O over the core count.
+
+RESULTS_FILE_PATH = "logs/scale_results.csv"
+SUMMARY_FILE_PATH = "logs/scale_summary.csv"
+PLOTS_PATH = "plots/scale"
+
+DEFAULT_DS_MAPPING = {
+    "ht": "Hash-table",
+    "sl": "Skiplist",
+    "bt": "B+ tree",
+    "rb": "Red-Black tree",
+}
+
+DS_COLORS = {"sl": "steelblue", "ht": "indianred", "rb": "seagreen", "bt": "darkkhaki"}
+PLACEMENT_STYLES = {"local": "-", "spread": "--"}
+
+DS_MAPPING = {**DEFAULT_DS_MAPPING, **cfg_parser.load_ds_mapping()}
+
+
+def process_df():
+    """
+    Medians over the runs, then per (ds, placement):
+      - efficiency - IOPS / (cores * IOPS of the smallest core count / its cores), 1.0 is linear scaling;
+      - misses per I/O - counters are system-wide on the pinned CPU's, so they include the completion side.
+    """
+    df = pd.read_csv(RESULTS_FILE_PATH)
+    df["ios"] = df["iops"] * df["runtime"]
+    for counter in ("cache_misses", "llc_load_misses"):
+        df[f"{counter}_per_io"] = df[counter] / df["ios"].where(df["ios"] > 0)
+    df["ipc"] = df["instructions"] / df["cycles"].where(df["cycles"] > 0)
+
+    summary = (
+        df.groupby(["ds", "placement", "cores"])
+        [["iops", "cache_misses_per_io", "llc_load_misses_per_io", "ipc"]]
+        .median()
+        .reset_index()
+        .sort_values(["ds", "placement", "cores"])
+    )
+
+    base = summary.groupby(["ds", "placement"])[["iops", "cores"]].transform("first")
+    summary["efficiency"] = summary["iops"] / (summary["cores"] * base["iops"] / base["cores"])
+    summary.to_csv(SUMMARY_FILE_PATH, index=False)
+    return summary
+
+
+def plot_metric(summary, column, y_label, title, filename):
+    """
+    One line per data structure and placement (solid - local, dashed - spread).
+    """
+    plt.figure(figsize=(10, 6))
+    for (ds, placement), case in summary.groupby(["ds", "placement"]):
+        plt.plot(
+            case["cores"],
+            case[column],
+            PLACEMENT_STYLES.get(placement, ":"),
+            marker="o",
+            color=DS_COLORS.get(ds, None),
+            label=f"{DS_MAPPING.get(ds, ds)}, {placement}",
+        )
+
+    plt.xscale("log", base=2)
+    plt.xticks(sorted(summary["cores"].unique()), [str(c) for c in sorted(summary["cores"].unique())])
+    plt.xlabel("Cores (one fio job per core)")
+    plt.ylabel(y_label)
+    plt.title(title)
+    plt.grid(True, alpha=0.3)
+    plt.legend()
+    plt.tight_layout()
+    plt.savefig(os.path.join(PLOTS_PATH, filename))
+    plt.close()
+    print(f"[ok] Saved scalability plot: {PLOTS_PATH}/{filename}")
+
+
+summary = process_df()
+print(summary.to_string(index=False))
+
+if summary.empty:
+    print("No scalability results, no plots will be generated.")
+else:
+    os.makedirs(PLOTS_PATH, exist_ok=True)
+    plot_metric(summary, "iops", "IOPS (ops/s)", "Median IOPS over the core count", "scale_iops.png")
+    plot_metric(summary, "efficiency", "IOPS per core / IOPS per core of 1 core", "Per-core scaling efficiency", "scale_efficiency.png")
+    plot_metric(summary, "cache_misses_per_io", "cache-misses per I/O", "Cache misses per I/O", "scale_cache_misses.png")
+    plot_metric(summary, "llc_load_misses_per_io", "LLC-load-misses per I/O", "LLC load misses per I/O", "scale_llc_misses.png")
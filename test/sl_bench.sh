@@ -0,0 +1,58 @@
+#!/bin/bash
+
+###											###
+###		  SKIPLIST INSERT MICROBENCHMARK		###
+###											###
+# Requires the module built with "make type=lf bench=1" and loaded.
+
+readonly BENCH_PARAM="/sys/module/lsbdd/parameters/bench_sl_insert"
+readonly THREADS_LIST=(1 2 4 8 16 32 64)
+readonly GENERATORS=("legacy" "xorshift")
+OPS=200000
+RESULT_FILE="logs/sl_bench.csv"
+
+usage() {
+    echo "Usage: $0 [--ops inserts_per_thread] [--out file.csv]"
+    exit 1
+}
+
+while [[ "$#" -gt 0 ]]; do
+    case $1 in
+        -o|--ops)
+            OPS="$2"
+            shift
+            ;;
+        --out)
+            RESULT_FILE="$2"
+            shift
+            ;;
+        -h|--help)
+            usage
+            ;;
+        *)
+            echo "Unknown option: $1"
+            usage
+            ;;
+    esac
+	shift
+done
+
+if [[ ! -w "$BENCH_PARAM" ]]; then
+    echo "Error: $BENCH_PARAM is not available. Build the module with 'make type=lf bench=1' and load it."
+    exit 1
+fi
+
+mkdir -p "$(dirname "$RESULT_FILE")"
+echo "generator,threads,total_ops,ns,kops_per_sec,max_lvl" > "$RESULT_FILE"
+
+for gen in "${GENERATORS[@]}"; do
+	for threads in "${THREADS_LIST[@]}"; do
+		echo -n "$threads $OPS $gen" > "$BENCH_PARAM" || exit 1
+		# threads=.. ops=.. gen=.. ns=.. kops_per_sec=.. max_lvl=..
+		read -r -a res < "$BENCH_PARAM"
+		echo "$gen,$threads,${res[1]#ops=},${res[3]#ns=},${res[4]#kops_per_sec=},${res[5]#max_lvl=}" >> "$RESULT_FILE"
+		echo "$gen: threads=$threads ${res[4]}"
+	done
+done
+
+echo -e "\nResults are saved in $RESULT_FILE"
@@ -0,0 +1,359 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/*
+ * Userspace B+tree with the layout of the kernel lib/btree.c: each node is NODESIZE bytes,
+ * keys (descending) go first, values (child pointers on the inner levels) follow them.
+ * Inner keys are the smallest keys of their children, empty slots have NULL values.
+ */
+
+#include "kshim.h"
+
+#define NODESIZE max(L1_CACHE_BYTES, 128)
+#define LONG_PER_U64 (64 / BITS_PER_LONG)
+
+struct btree_geo {
+	s32 keylen;
+	s32 no_pairs;
+	s32 no_longs;
+};
+
+struct btree_geo btree_geo64 = {
+	.keylen = LONG_PER_U64,
+	.no_pairs = NODESIZE / sizeof(long) / (1 + LONG_PER_U64),
+	.no_longs = LONG_PER_U64 * (NODESIZE / sizeof(long) / (1 + LONG_PER_U64)),
+};
+
+static void *btree_remove_level(struct btree_head *head, struct btree_geo *geo, unsigned long *key, s32 level);
+
+static unsigned long *node_alloc(void)
+{
+	return kshim_aligned_zalloc(NODESIZE, L1_CACHE_BYTES);
+}
+
+static s32 longcmp(const unsigned long *l1, const unsigned long *l2, size_t n)
+{
+	size_t i = 0;
+
+	for (i = 0; i < n; i++) {
+		if (l1[i] < l2[i])
+			return -1;
+		if (l1[i] > l2[i])
+			return 1;
+	}
+	return 0;
+}
+
+static unsigned long *bkey(struct btree_geo *geo, unsigned long *node, s32 n)
+{
+	return &node[n * geo->keylen];
+}
+
+static void *bval(struct btree_geo *geo, unsigned long *node, s32 n)
+{
+	return (void *)node[geo->no_longs + n];
+}
+
+static void setkey(struct btree_geo *geo, unsigned long *node, s32 n, unsigned long *key)
+{
+	memcpy(bkey(geo, node, n), key, geo->keylen * sizeof(unsigned long));
+}
+
+static void setval(struct btree_geo *geo, unsigned long *node, s32 n, void *val)
+{
+	node[geo->no_longs + n] = (unsigned long)val;
+}
+
+static void clearpair(struct btree_geo *geo, unsigned long *node, s32 n)
+{
+	memset(bkey(geo, node, n), 0, geo->keylen * sizeof(unsigned long));
+	node[geo->no_longs + n] = 0;
+}
+
+static s32 keycmp(struct btree_geo *geo, unsigned long *node, s32 pos, unsigned long *key)
+{
+	return longcmp(bkey(geo, node, pos), key, geo->keylen);
+}
+
+// @return first slot with key <= key
+static s32 getpos(struct btree_geo *geo, unsigned long *node, unsigned long *key)
+{
+	s32 i = 0;
+
+	for (i = 0; i < geo->no_pairs; i++) {
+		if (keycmp(geo, node, i, key) <= 0)
+			break;
+	}
+	return i;
+}
+
+// @return number of used slots
+static s32 getfill(struct btree_geo *geo, unsigned long *node, s32 start)
+{
+	s32 i = 0;
+
+	for (i = start; i < geo->no_pairs; i++) {
+		if (!bval(geo, node, i))
+			break;
+	}
+	return i;
+}
+
+s32 btree_init(struct btree_head *head)
+{
+	head->node = NULL;
+	head->mempool = NULL;
+	head->height = 0;
+	return 0;
+}
+
+static void btree_free_level(unsigned long *node, s32 height)
+{
+	s32 i = 0;
+
+	if (!node)
+		return;
+
+	if (height > 1) {
+		for (i = 0; i < btree_geo64.no_pairs && bval(&btree_geo64, node, i); i++)
+			btree_free_level(bval(&btree_geo64, node, i), height - 1);
+	}
+	free(node);
+}
+
+// unlike the kernel one (that frees only the root), frees all the nodes, values are owned by the caller
+void btree_destroy(struct btree_head *head)
+{
+	btree_free_level(head->node, head->height);
+	head->node = NULL;
+	head->height = 0;
+}
+
+void *btree_lookup(struct btree_head *head, struct btree_geo *geo, unsigned long *key)
+{
+	unsigned long *node = head->node;
+	s32 height = head->height;
+	s32 i = 0;
+
+	if (height == 0)
+		return NULL;
+
+	for (; height > 1; height--) {
+		i = getpos(geo, node, key);
+		if (i == geo->no_pairs)
+			return NULL;
+		node = bval(geo, node, i);
+		if (!node)
+			return NULL;
+	}
+
+	for (i = 0; i < geo->no_pairs; i++) {
+		if (keycmp(geo, node, i, key) == 0)
+			return bval(geo, node, i);
+	}
+	return NULL;
+}
+
+static unsigned long *find_level(struct btree_head *head, struct btree_geo *geo, unsigned long *key, s32 level)
+{
+	unsigned long *node = head->node;
+	s32 height = 0;
+	s32 i = 0;
+
+	for (height = head->height; height > level; height--) {
+		i = getpos(geo, node, key);
+		if (i == geo->no_pairs || !bval(geo, node, i)) {
+			// key is smaller than the whole subtree, so it becomes the smallest key of the last child
+			i--;
+			setkey(geo, node, i, key);
+		}
+		BUG_ON(i < 0);
+		node = bval(geo, node, i);
+	}
+	BUG_ON(!node);
+	return node;
+}
+
+static s32 btree_grow(struct btree_head *head, struct btree_geo *geo)
+{
+	unsigned long *node = node_alloc();
+	s32 fill = 0;
+
+	if (!node)
+		return -ENOMEM;
+
+	if (head->node) {
+		fill = getfill(geo, head->node, 0);
+		setkey(geo, node, 0, bkey(geo, head->node, fill - 1));
+		setval(geo, node, 0, head->node);
+	}
+	head->node = node;
+	head->height++;
+	return 0;
+}
+
+static void btree_shrink(struct btree_head *head, struct btree_geo *geo)
+{
+	unsigned long *node = head->node;
+
+	if (head->height <= 1)
+		return;
+
+	BUG_ON(getfill(geo, node, 0) > 1);
+	head->node = bval(geo, node, 0);
+	head->height--;
+	free(node);
+}
+
+static s32 btree_insert_level(struct btree_head *head, struct btree_geo *geo, unsigned long *key, void *val, s32 level)
+{
+	unsigned long *node = NULL;
+	unsigned long *new = NULL;
+	s32 i = 0, pos = 0, fill = 0, status = 0;
+
+	BUG_ON(!val);
+	if (head->height < level) {
+		status = btree_grow(head, geo);
+		if (status)
+			return status;
+	}
+
+retry:
+	node = find_level(head, geo, key, level);
+	pos = getpos(geo, node, key);
+	fill = getfill(geo, node, pos);
+	BUG_ON(pos < fill && keycmp(geo, node, pos, key) == 0); // duplicate keys aren't allowed
+
+	if (fill == geo->no_pairs) {
+		// split: the larger half goes to the new node, that is inserted into the parent
+		new = node_alloc();
+		if (!new)
+			return -ENOMEM;
+
+		status = btree_insert_level(head, geo, bkey(geo, node, fill / 2 - 1), new, level + 1);
+		if (status) {
+			free(new);
+			return status;
+		}
+
+		for (i = 0; i < fill / 2; i++) {
+			setkey(geo, new, i, bkey(geo, node, i));
+			setval(geo, new, i, bval(geo, node, i));
+			setkey(geo, node, i, bkey(geo, node, i + fill / 2));
+			setval(geo, node, i, bval(geo, node, i + fill / 2));
+			clearpair(geo, node, i + fill / 2);
+		}
+		if (fill & 1) {
+			setkey(geo, node, i, bkey(geo, node, fill - 1));
+			setval(geo, node, i, bval(geo, node, fill - 1));
+			clearpair(geo, node, fill - 1);
+		}
+		goto retry;
+	}
+
+	for (i = fill; i > pos; i--) {
+		setkey(geo, node, i, bkey(geo, node, i - 1));
+		setval(geo, node, i, bval(geo, node, i - 1));
+	}
+	setkey(geo, node, pos, key);
+	setval(geo, node, pos, val);
+	return 0;
+}
+
+s32 btree_insert(struct btree_head *head, struct btree_geo *geo, unsigned long *key, void *val, gfp_t gfp)
+{
+	return btree_insert_level(head, geo, key, val, 1);
+}
+
+static void merge(struct btree_head *head, struct btree_geo *geo, s32 level, unsigned long *left, s32 lfill, unsigned long *right,
+		  s32 rfill, unsigned long *parent, s32 lpos)
+{
+	s32 i = 0;
+
+	for (i = 0; i < rfill; i++) {
+		setkey(geo, left, lfill + i, bkey(geo, right, i));
+		setval(geo, left, lfill + i, bval(geo, right, i));
+	}
+	// merged node takes the place of the right one (its smallest key is the right's one), left slot is removed
+	setval(geo, parent, lpos, right);
+	setval(geo, parent, lpos + 1, left);
+	btree_remove_level(head, geo, bkey(geo, parent, lpos), level + 1);
+	free(right);
+}
+
+static void rebalance(struct btree_head *head, struct btree_geo *geo, unsigned long *key, s32 level, unsigned long *child, s32 fill)
+{
+	unsigned long *parent = NULL;
+	unsigned long *left = NULL;
+	unsigned long *right = NULL;
+	s32 i = 0, no_left = 0, no_right = 0;
+
+	if (fill == 0) {
+		// entries aren't stolen from the neighbours, so the only child of the parent can become empty
+		btree_remove_level(head, geo, key, level + 1);
+		free(child);
+		return;
+	}
+
+	parent = find_level(head, geo, key, level + 1);
+	i = getpos(geo, parent, key);
+	BUG_ON(bval(geo, parent, i) != child);
+
+	if (i > 0) {
+		left = bval(geo, parent, i - 1);
+		no_left = getfill(geo, left, 0);
+		if (fill + no_left <= geo->no_pairs) {
+			merge(head, geo, level, left, no_left, child, fill, parent, i - 1);
+			return;
+		}
+	}
+	if (i + 1 < getfill(geo, parent, i)) {
+		right = bval(geo, parent, i + 1);
+		no_right = getfill(geo, right, 0);
+		if (fill + no_right <= geo->no_pairs)
+			merge(head, geo, level, child, fill, right, no_right, parent, i);
+	}
+}
+
+static void *btree_remove_level(struct btree_head *head, struct btree_geo *geo, unsigned long *key, s32 level)
+{
+	unsigned long *node = NULL;
+	s32 i = 0, pos = 0, fill = 0;
+	void *ret = NULL;
+
+	if (level > head->height) {
+		// recursed all the way up
+		head->height = 0;
+		head->node = NULL;
+		return NULL;
+	}
+
+	node = find_level(head, geo, key, level);
+	pos = getpos(geo, node, key);
+	fill = getfill(geo, node, pos);
+	if (level == 1 && keycmp(geo, node, pos, key) != 0)
+		return NULL;
+	ret = bval(geo, node, pos);
+
+	for (i = pos; i < fill - 1; i++) {
+		setkey(geo, node, i, bkey(geo, node, i + 1));
+		setval(geo, node, i, bval(geo, node, i + 1));
+	}
+	clearpair(geo, node, fill - 1);
+
+	if (fill - 1 < geo->no_pairs / 2) {
+		if (level < head->height)
+			rebalance(head, geo, key, level, node, fill - 1);
+		else if (fill - 1 == 1)
+			btree_shrink(head, geo);
+	}
+
+	return ret;
+}
+
+void *btree_remove(struct btree_head *head, struct btree_geo *geo, unsigned long *key)
+{
+	if (head->height == 0)
+		return NULL;
+
+	return btree_remove_level(head, geo, key, 1);
+}
@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <sys/random.h>
+#include "kshim.h"
+
+static u32 kshim_next_cpu;
+static __thread u32 kshim_cpu = UINT_MAX;
+static __thread u64 kshim_rng;
+
+u32 kshim_cpu_id(void)
+{
+	if (unlikely(kshim_cpu == UINT_MAX))
+		kshim_cpu = __atomic_fetch_add(&kshim_next_cpu, 1, __ATOMIC_RELAXED) % KSHIM_NR_CPUS;
+
+	return kshim_cpu;
+}
+
+// splitmix64, seeded from getrandom() on the first call in the thread
+u32 get_random_u32(void)
+{
+	u64 z = 0;
+
+	if (unlikely(!kshim_rng) && getrandom(&kshim_rng, sizeof(kshim_rng), 0) != sizeof(kshim_rng))
+		kshim_rng = (u64)(uintptr_t)&kshim_rng;
+
+	z = (kshim_rng += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+
+	return (u32)((z ^ (z >> 31)) >> 32);
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, u32 size, u32 align, slab_flags_t flags, void (*ctor)(void *))
+{
+	struct kmem_cache *cache = calloc(1, sizeof(struct kmem_cache));
+
+	if (!cache)
+		return NULL;
+
+	cache->align = sizeof(void *);
+	if (align > cache->align)
+		cache->align = align;
+	if ((flags & SLAB_HWCACHE_ALIGN) && size > L1_CACHE_BYTES / 2)
+		cache->align = max_t(size_t, cache->align, L1_CACHE_BYTES);
+	cache->size = (size + cache->align - 1) & ~(cache->align - 1);
+	strscpy(cache->name, name, sizeof(cache->name));
+
+	return cache;
+}
+
+void kmem_cache_destroy(struct kmem_cache *cache)
+{
+	free(cache);
+}
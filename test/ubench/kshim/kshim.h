@@ -0,0 +1,569 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef KSHIM_H
+#define KSHIM_H
+
+/**
+ * Userspace shim of the kernel API used by the mapping data structures (src/utils/{lock-free,sync},
+ * ds_control.c and mag_cache.c), so they are built unmodified into the ubench binary.
+ *
+ * - atomics and cmpxchg are the gcc __atomic builtins (seq_cst, as the kernel full barrier variants);
+ * - kmem_cache is plain aligned malloc, so objects can be freed with kfree too;
+ * - per-CPU data: static DEFINE_PER_CPU variables are thread-local, dynamic (alloc_percpu) ones are arrays
+ *   of KSHIM_NR_CPUS slots, each thread uses slot (thread id % KSHIM_NR_CPUS), local locks are spinlocks,
+ *   as there can be more threads than slots;
+ * - btree (lib/btree.c) and rbtree (lib/rbtree.c) are reimplemented in btree.c and rbtree.c
+ *   with the same node layout, as btree_utils.c walks the nodes directly.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// types
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef long long s64;
+typedef u64 sector_t;
+typedef unsigned int gfp_t;
+typedef unsigned int slab_flags_t;
+
+#define BITS_PER_LONG 64
+#define BIT(nr) (1UL << (nr))
+#define BIT_ULL(nr) (1ULL << (nr))
+#define PAGE_SIZE 4096UL
+#define L1_CACHE_BYTES 64
+#define SMP_CACHE_BYTES L1_CACHE_BYTES
+
+#define __percpu
+#define __read_mostly
+#define ____cacheline_aligned_in_smp __attribute__((__aligned__(SMP_CACHE_BYTES)))
+#define ____cacheline_aligned ____cacheline_aligned_in_smp
+
+#define GFP_KERNEL 0u
+#define GFP_ATOMIC 1u
+#define GFP_NOIO 2u
+#define SLAB_HWCACHE_ALIGN 0x2000u
+
+// compiler and misc
+
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#define READ_ONCE(x) (*(const volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, val) (*(volatile __typeof__(x) *)&(x) = (val))
+#define barrier() __asm__ __volatile__("" ::: "memory")
+#define smp_mb() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define smp_rmb() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define smp_wmb() __atomic_thread_fence(__ATOMIC_RELEASE)
+
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define min(x, y) ((x) < (y) ? (x) : (y))
+#define max(x, y) ((x) > (y) ? (x) : (y))
+#define min_t(type, x, y) ((type)(x) < (type)(y) ? (type)(x) : (type)(y))
+#define max_t(type, x, y) ((type)(x) > (type)(y) ? (type)(x) : (type)(y))
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+#define IS_ALIGNED(x, a) (((x) & ((__typeof__(x))(a) - 1)) == 0)
+#define U32_MIN ((u32)0)
+#define U32_MAX ((u32)~0U)
+#define U64_MAX ((u64)~0ULL)
+#define S64_MAX ((s64)(U64_MAX >> 1))
+
+static inline u64 div64_u64(u64 dividend, u64 divisor)
+{
+	return dividend / divisor;
+}
+
+#define MAX_ERRNO 4095
+#define IS_ERR_VALUE(x) unlikely((unsigned long)(void *)(x) >= (unsigned long)-MAX_ERRNO)
+
+static inline void *ERR_PTR(long error)
+{
+	return (void *)error;
+}
+
+static inline long PTR_ERR(const void *ptr)
+{
+	return (long)ptr;
+}
+
+static inline bool IS_ERR(const void *ptr)
+{
+	return IS_ERR_VALUE((unsigned long)ptr);
+}
+
+#define BUG()                                                                                                                      \
+	do {                                                                                                                       \
+		fprintf(stderr, "BUG at %s:%d\n", __FILE__, __LINE__);                                                             \
+		abort();                                                                                                           \
+	} while (0)
+#define BUG_ON(cond)                                                                                                               \
+	do {                                                                                                                       \
+		if (unlikely(cond))                                                                                                \
+			BUG();                                                                                                     \
+	} while (0)
+#define WARN_ON(cond) ({ bool __c = !!(cond); if (unlikely(__c)) fprintf(stderr, "WARN at %s:%d\n", __FILE__, __LINE__); __c; })
+
+#define pr_err(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
+#define pr_warn(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
+#define pr_info(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
+#define pr_cont(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
+#ifdef KSHIM_DEBUG
+#define pr_debug(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
+#else
+#define pr_debug(fmt, ...)                                                                                                         \
+	do {                                                                                                                       \
+		if (0)                                                                                                             \
+			fprintf(stderr, fmt, ##__VA_ARGS__);                                                                       \
+	} while (0)
+#endif
+
+#define MODULE_DESCRIPTION(x)
+#define MODULE_AUTHOR(x)
+#define MODULE_LICENSE(x)
+#define EXPORT_SYMBOL(x)
+
+static inline s32 scnprintf(char *buf, size_t size, const char *fmt, ...)
+{
+	va_list args;
+	s32 len = 0;
+
+	if (!size)
+		return 0;
+
+	va_start(args, fmt);
+	len = vsnprintf(buf, size, fmt, args);
+	va_end(args);
+
+	return len >= (s32)size ? (s32)size - 1 : len;
+}
+
+static inline ssize_t strscpy(char *dest, const char *src, size_t count)
+{
+	size_t len = strnlen(src, count);
+
+	if (!count)
+		return -E2BIG;
+	if (len == count) {
+		memcpy(dest, src, count - 1);
+		dest[count - 1] = '\0';
+		return -E2BIG;
+	}
+	memcpy(dest, src, len + 1);
+
+	return len;
+}
+
+// atomics
+
+typedef struct {
+	s32 counter;
+} atomic_t;
+
+typedef struct {
+	s64 counter;
+} atomic64_t;
+
+#define ATOMIC_INIT(i) { (i) }
+#define ATOMIC64_INIT(i) { (i) }
+
+#define atomic_read(v) __atomic_load_n(&(v)->counter, __ATOMIC_RELAXED)
+#define atomic_set(v, i) __atomic_store_n(&(v)->counter, (i), __ATOMIC_RELAXED)
+#define atomic_inc(v) ((void)__atomic_fetch_add(&(v)->counter, 1, __ATOMIC_SEQ_CST))
+#define atomic_dec(v) ((void)__atomic_fetch_sub(&(v)->counter, 1, __ATOMIC_SEQ_CST))
+#define atomic_dec_and_test(v) (__atomic_sub_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST) == 0)
+
+static inline s64 atomic64_read(const atomic64_t *v)
+{
+	return __atomic_load_n(&v->counter, __ATOMIC_RELAXED);
+}
+
+static inline void atomic64_set(atomic64_t *v, s64 i)
+{
+	__atomic_store_n(&v->counter, i, __ATOMIC_RELAXED);
+}
+
+static inline void atomic64_inc(atomic64_t *v)
+{
+	__atomic_fetch_add(&v->counter, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline void atomic64_dec(atomic64_t *v)
+{
+	__atomic_fetch_sub(&v->counter, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline void atomic64_add(s64 i, atomic64_t *v)
+{
+	__atomic_fetch_add(&v->counter, i, __ATOMIC_SEQ_CST);
+}
+
+static inline s64 atomic64_fetch_add(s64 i, atomic64_t *v)
+{
+	return __atomic_fetch_add(&v->counter, i, __ATOMIC_SEQ_CST);
+}
+
+static inline s64 atomic64_fetch_sub(s64 i, atomic64_t *v)
+{
+	return __atomic_fetch_sub(&v->counter, i, __ATOMIC_SEQ_CST);
+}
+
+static inline s64 atomic64_cmpxchg(atomic64_t *v, s64 old, s64 new)
+{
+	__atomic_compare_exchange_n(&v->counter, &old, new, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return old;
+}
+
+static inline bool atomic64_try_cmpxchg(atomic64_t *v, s64 *old, s64 new)
+{
+	return __atomic_compare_exchange_n(&v->counter, old, new, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline s64 atomic64_xchg(atomic64_t *v, s64 new)
+{
+	return __atomic_exchange_n(&v->counter, new, __ATOMIC_SEQ_CST);
+}
+
+#define cmpxchg(ptr, old, new) __sync_val_compare_and_swap(ptr, old, new)
+#define cmpxchg64(ptr, old, new) __sync_val_compare_and_swap(ptr, old, new)
+#define xchg(ptr, val) __atomic_exchange_n(ptr, val, __ATOMIC_SEQ_CST)
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield" ::: "memory");
+#else
+	barrier();
+#endif
+}
+
+static inline void cond_resched(void)
+{
+	sched_yield();
+}
+
+// worker threads can always be rescheduled
+#define preemptible() 1
+
+// locks
+
+struct mutex {
+	pthread_mutex_t lock;
+};
+#define DEFINE_MUTEX(name) struct mutex name = { PTHREAD_MUTEX_INITIALIZER }
+#define mutex_init(m) pthread_mutex_init(&(m)->lock, NULL)
+#define mutex_lock(m) pthread_mutex_lock(&(m)->lock)
+#define mutex_unlock(m) pthread_mutex_unlock(&(m)->lock)
+
+typedef struct {
+	bool locked;
+} spinlock_t;
+
+static inline void spin_lock_init(spinlock_t *lock)
+{
+	lock->locked = false;
+}
+
+static inline void spin_lock(spinlock_t *lock)
+{
+	while (__atomic_exchange_n(&lock->locked, true, __ATOMIC_ACQUIRE)) {
+		while (__atomic_load_n(&lock->locked, __ATOMIC_RELAXED))
+			cpu_relax();
+	}
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+	__atomic_store_n(&lock->locked, false, __ATOMIC_RELEASE);
+}
+
+#define spin_lock_irqsave(lock, flags) ((void)(flags), spin_lock(lock))
+#define spin_unlock_irqrestore(lock, flags) ((void)(flags), spin_unlock(lock))
+
+// per-CPU data
+
+#define KSHIM_NR_CPUS 64
+
+// slot of the calling thread in the dynamic per-CPU arrays
+u32 kshim_cpu_id(void);
+
+#define DECLARE_PER_CPU(type, name) extern __thread __typeof__(type) name
+#define DEFINE_PER_CPU(type, name) __thread __typeof__(type) name
+#define this_cpu_inc(var) ((var)++)
+#define this_cpu_read(var) (var)
+#define get_cpu_ptr(ptr) (ptr)
+#define put_cpu_ptr(ptr) ((void)(ptr))
+
+/*
+ * Slots are KSHIM_PCPU_UNIT bytes apart for any type, as the kernel per-CPU areas are, so per_cpu_ptr()
+ * works for the members of per-CPU structures too (f.e. this_cpu_ptr(&mags->lock)).
+ */
+#define KSHIM_PCPU_UNIT 4096
+
+#define alloc_percpu(type)                                                                                                         \
+	({                                                                                                                         \
+		BUG_ON(sizeof(type) > KSHIM_PCPU_UNIT);                                                                            \
+		(type *)kshim_aligned_zalloc(KSHIM_NR_CPUS * KSHIM_PCPU_UNIT, L1_CACHE_BYTES);                                     \
+	})
+#define free_percpu(ptr) free(ptr)
+#define per_cpu_ptr(ptr, cpu) ((__typeof__(ptr))((char *)(ptr) + (size_t)(cpu) * KSHIM_PCPU_UNIT))
+#define this_cpu_ptr(ptr) per_cpu_ptr(ptr, kshim_cpu_id())
+#define raw_cpu_ptr(ptr) this_cpu_ptr(ptr)
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < KSHIM_NR_CPUS; (cpu)++)
+#define numa_mem_id() 0
+
+typedef spinlock_t local_lock_t;
+
+#define local_lock_init(lock) spin_lock_init(lock)
+#define local_lock_irqsave(lock, flags) ((void)(flags), spin_lock(this_cpu_ptr(lock)))
+#define local_unlock_irqrestore(lock, flags) ((void)(flags), spin_unlock(this_cpu_ptr(lock)))
+
+// memory
+
+static inline void *kshim_aligned_zalloc(size_t size, size_t align)
+{
+	void *ptr = NULL;
+
+	if (posix_memalign(&ptr, align, size))
+		return NULL;
+	memset(ptr, 0, size);
+
+	return ptr;
+}
+
+#define kmalloc(size, gfp) malloc(size)
+#define kzalloc(size, gfp) calloc(1, size)
+#define kcalloc(n, size, gfp) calloc(n, size)
+#define kfree(ptr) free((void *)(ptr))
+
+struct kmem_cache {
+	size_t size;
+	size_t align;
+	char name[32];
+};
+
+struct kmem_cache *kmem_cache_create(const char *name, u32 size, u32 align, slab_flags_t flags, void (*ctor)(void *));
+void kmem_cache_destroy(struct kmem_cache *cache);
+
+static inline void *kmem_cache_alloc(struct kmem_cache *cache, gfp_t gfp)
+{
+	void *ptr = NULL;
+
+	if (posix_memalign(&ptr, cache->align, cache->size))
+		return NULL;
+
+	return ptr;
+}
+
+static inline void *kmem_cache_zalloc(struct kmem_cache *cache, gfp_t gfp)
+{
+	void *ptr = kmem_cache_alloc(cache, gfp);
+
+	if (ptr)
+		memset(ptr, 0, cache->size);
+
+	return ptr;
+}
+
+#define kmem_cache_alloc_node(cache, gfp, node) ((void)(node), kmem_cache_alloc(cache, gfp))
+#define kmem_cache_free(cache, ptr) free(ptr)
+#define kmem_cache_size(cache) ((u32)(cache)->size)
+
+static inline void kmem_cache_free_bulk(struct kmem_cache *cache, size_t nr, void **objs)
+{
+	size_t i = 0;
+
+	for (i = 0; i < nr; i++)
+		free(objs[i]);
+}
+
+// random
+
+u32 get_random_u32(void);
+
+static inline u8 get_random_u8(void)
+{
+	return (u8)get_random_u32();
+}
+
+// lists and hashtable
+
+struct hlist_head {
+	struct hlist_node *first;
+};
+
+struct hlist_node {
+	struct hlist_node *next, **pprev;
+};
+
+struct llist_head {
+	struct llist_node *first;
+};
+
+struct llist_node {
+	struct llist_node *next;
+};
+
+#define INIT_HLIST_HEAD(ptr) ((ptr)->first = NULL)
+#define hlist_entry(ptr, type, member) container_of(ptr, type, member)
+#define hlist_entry_safe(ptr, type, member)                                                                                        \
+	({                                                                                                                         \
+		__typeof__(ptr) ____ptr = (ptr);                                                                                   \
+		____ptr ? hlist_entry(____ptr, type, member) : NULL;                                                               \
+	})
+
+static inline void hlist_add_head(struct hlist_node *n, struct hlist_head *h)
+{
+	struct hlist_node *first = h->first;
+
+	n->next = first;
+	if (first)
+		first->pprev = &n->next;
+	h->first = n;
+	n->pprev = &h->first;
+}
+
+static inline void hlist_del(struct hlist_node *n)
+{
+	struct hlist_node *next = n->next;
+	struct hlist_node **pprev = n->pprev;
+
+	*pprev = next;
+	if (next)
+		next->pprev = pprev;
+	n->next = NULL;
+	n->pprev = NULL;
+}
+
+#define hlist_for_each_entry(pos, head, member)                                                                                    \
+	for (pos = hlist_entry_safe((head)->first, __typeof__(*(pos)), member); pos;                                               \
+	     pos = hlist_entry_safe((pos)->member.next, __typeof__(*(pos)), member))
+
+#define hlist_for_each_entry_safe(pos, n, head, member)                                                                            \
+	for (pos = hlist_entry_safe((head)->first, __typeof__(*pos), member); pos && ({                                            \
+		     n = pos->member.next;                                                                                         \
+		     1;                                                                                                            \
+	     });                                                                                                                   \
+	     pos = hlist_entry_safe(n, __typeof__(*pos), member))
+
+#define llist_entry(ptr, type, member) container_of(ptr, type, member)
+#define member_address_is_nonnull(ptr, member) ((uintptr_t)(ptr) + offsetof(__typeof__(*(ptr)), member) != 0)
+#define llist_for_each_entry_safe(pos, n, node, member)                                                                            \
+	for (pos = llist_entry((node), __typeof__(*pos), member);                                                                  \
+	     member_address_is_nonnull(pos, member) && (n = llist_entry(pos->member.next, __typeof__(*n), member), true);          \
+	     pos = n)
+
+#define DECLARE_HASHTABLE(name, bits) struct hlist_head name[1 << (bits)]
+#define HASH_SIZE(name) (ARRAY_SIZE(name))
+#define HASH_BITS(name) ilog2(HASH_SIZE(name))
+#define ilog2(n) (63 - __builtin_clzll((u64)(n)))
+
+#define GOLDEN_RATIO_64 0x61C8864680B583EBull
+
+static inline u32 hash_64(u64 val, u32 bits)
+{
+	return val * GOLDEN_RATIO_64 >> (64 - bits);
+}
+
+#define hash_long(val, bits) hash_64(val, bits)
+#define hash_min(val, bits) hash_64(val, bits)
+
+static inline void __hash_init(struct hlist_head *ht, u32 sz)
+{
+	u32 i = 0;
+
+	for (i = 0; i < sz; i++)
+		INIT_HLIST_HEAD(&ht[i]);
+}
+
+#define hash_init(hashtable) __hash_init(hashtable, HASH_SIZE(hashtable))
+#define hash_add(hashtable, node, key) hlist_add_head(node, &hashtable[hash_min(key, HASH_BITS(hashtable))])
+#define hash_del(node) hlist_del(node)
+#define hash_for_each(name, bkt, obj, member)                                                                                      \
+	for ((bkt) = 0, obj = NULL; obj == NULL && (bkt) < HASH_SIZE(name); (bkt)++)                                               \
+		hlist_for_each_entry(obj, &name[bkt], member)
+#define hash_for_each_safe(name, bkt, tmp, obj, member)                                                                            \
+	for ((bkt) = 0, obj = NULL; obj == NULL && (bkt) < HASH_SIZE(name); (bkt)++)                                               \
+		hlist_for_each_entry_safe(obj, tmp, &name[bkt], member)
+
+// lib/rbtree.c
+
+struct rb_node {
+	struct rb_node *rb_parent;
+	struct rb_node *rb_right;
+	struct rb_node *rb_left;
+	bool rb_black;
+} __attribute__((aligned(sizeof(long))));
+
+struct rb_root {
+	struct rb_node *rb_node;
+};
+
+#define RB_ROOT ((struct rb_root){ NULL })
+#define rb_entry(ptr, type, member) container_of(ptr, type, member)
+#define rb_entry_safe(ptr, type, member)                                                                                           \
+	({                                                                                                                         \
+		__typeof__(ptr) ____ptr = (ptr);                                                                                   \
+		____ptr ? rb_entry(____ptr, type, member) : NULL;                                                                  \
+	})
+
+static inline void rb_link_node(struct rb_node *node, struct rb_node *parent, struct rb_node **rb_link)
+{
+	node->rb_parent = parent;
+	node->rb_black = false;
+	node->rb_left = node->rb_right = NULL;
+	*rb_link = node;
+}
+
+void rb_insert_color(struct rb_node *node, struct rb_root *root);
+void rb_erase(struct rb_node *node, struct rb_root *root);
+struct rb_node *rb_first(const struct rb_root *root);
+struct rb_node *rb_last(const struct rb_root *root);
+struct rb_node *rb_next(const struct rb_node *node);
+struct rb_node *rb_prev(const struct rb_node *node);
+struct rb_node *rb_first_postorder(const struct rb_root *root);
+struct rb_node *rb_next_postorder(const struct rb_node *node);
+
+#define rbtree_postorder_for_each_entry_safe(pos, n, root, field)                                                                  \
+	for (pos = rb_entry_safe(rb_first_postorder(root), __typeof__(*pos), field);                                               \
+	     pos && ({                                                                                                             \
+		     n = rb_entry_safe(rb_next_postorder(&pos->field), __typeof__(*pos), field);                                   \
+		     1;                                                                                                            \
+	     });                                                                                                                   \
+	     pos = n)
+
+// lib/btree.c, struct btree_geo is declared by the callers (check btree_utils.h)
+
+struct btree_head {
+	unsigned long *node;
+	void *mempool;
+	s32 height;
+};
+
+struct btree_geo;
+extern struct btree_geo btree_geo64;
+
+s32 btree_init(struct btree_head *head);
+void btree_destroy(struct btree_head *head);
+void *btree_lookup(struct btree_head *head, struct btree_geo *geo, unsigned long *key);
+s32 btree_insert(struct btree_head *head, struct btree_geo *geo, unsigned long *key, void *val, gfp_t gfp);
+void *btree_remove(struct btree_head *head, struct btree_geo *geo, unsigned long *key);
+
+#endif
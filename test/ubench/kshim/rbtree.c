@@ -0,0 +1,290 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/*
+ * Userspace red-black tree with the kernel lib/rbtree.c API: the caller links the node with rb_link_node()
+ * and rebalances with rb_insert_color(). Parent and color are plain fields here, nothing outside
+ * this file looks at them.
+ */
+
+#include "kshim.h"
+
+static inline bool is_red(const struct rb_node *node)
+{
+	return node && !node->rb_black;
+}
+
+static void change_child(struct rb_node *old, struct rb_node *new, struct rb_node *parent, struct rb_root *root)
+{
+	if (!parent)
+		root->rb_node = new;
+	else if (parent->rb_left == old)
+		parent->rb_left = new;
+	else
+		parent->rb_right = new;
+}
+
+static void rotate_left(struct rb_node *node, struct rb_root *root)
+{
+	struct rb_node *right = node->rb_right;
+
+	node->rb_right = right->rb_left;
+	if (right->rb_left)
+		right->rb_left->rb_parent = node;
+	right->rb_parent = node->rb_parent;
+	change_child(node, right, node->rb_parent, root);
+	right->rb_left = node;
+	node->rb_parent = right;
+}
+
+static void rotate_right(struct rb_node *node, struct rb_root *root)
+{
+	struct rb_node *left = node->rb_left;
+
+	node->rb_left = left->rb_right;
+	if (left->rb_right)
+		left->rb_right->rb_parent = node;
+	left->rb_parent = node->rb_parent;
+	change_child(node, left, node->rb_parent, root);
+	left->rb_right = node;
+	node->rb_parent = left;
+}
+
+void rb_insert_color(struct rb_node *node, struct rb_root *root)
+{
+	struct rb_node *parent = NULL;
+	struct rb_node *gparent = NULL;
+	struct rb_node *uncle = NULL;
+
+	while ((parent = node->rb_parent) && is_red(parent)) {
+		gparent = parent->rb_parent;
+
+		if (parent == gparent->rb_left) {
+			uncle = gparent->rb_right;
+			if (is_red(uncle)) {
+				uncle->rb_black = true;
+				parent->rb_black = true;
+				gparent->rb_black = false;
+				node = gparent;
+				continue;
+			}
+			if (node == parent->rb_right) {
+				rotate_left(parent, root);
+				node = parent;
+				parent = node->rb_parent;
+			}
+			parent->rb_black = true;
+			gparent->rb_black = false;
+			rotate_right(gparent, root);
+		} else {
+			uncle = gparent->rb_left;
+			if (is_red(uncle)) {
+				uncle->rb_black = true;
+				parent->rb_black = true;
+				gparent->rb_black = false;
+				node = gparent;
+				continue;
+			}
+			if (node == parent->rb_left) {
+				rotate_right(parent, root);
+				node = parent;
+				parent = node->rb_parent;
+			}
+			parent->rb_black = true;
+			gparent->rb_black = false;
+			rotate_left(gparent, root);
+		}
+	}
+	root->rb_node->rb_black = true;
+}
+
+// Restores the black height after a black node was removed above node (that can be NULL) under parent
+static void erase_fixup(struct rb_node *node, struct rb_node *parent, struct rb_root *root)
+{
+	struct rb_node *sibling = NULL;
+
+	while (node != root->rb_node && !is_red(node)) {
+		if (node == parent->rb_left) {
+			sibling = parent->rb_right;
+			if (is_red(sibling)) {
+				sibling->rb_black = true;
+				parent->rb_black = false;
+				rotate_left(parent, root);
+				sibling = parent->rb_right;
+			}
+			if (!is_red(sibling->rb_left) && !is_red(sibling->rb_right)) {
+				sibling->rb_black = false;
+				node = parent;
+				parent = node->rb_parent;
+				continue;
+			}
+			if (!is_red(sibling->rb_right)) {
+				sibling->rb_left->rb_black = true;
+				sibling->rb_black = false;
+				rotate_right(sibling, root);
+				sibling = parent->rb_right;
+			}
+			sibling->rb_black = parent->rb_black;
+			parent->rb_black = true;
+			sibling->rb_right->rb_black = true;
+			rotate_left(parent, root);
+		} else {
+			sibling = parent->rb_left;
+			if (is_red(sibling)) {
+				sibling->rb_black = true;
+				parent->rb_black = false;
+				rotate_right(parent, root);
+				sibling = parent->rb_left;
+			}
+			if (!is_red(sibling->rb_left) && !is_red(sibling->rb_right)) {
+				sibling->rb_black = false;
+				node = parent;
+				parent = node->rb_parent;
+				continue;
+			}
+			if (!is_red(sibling->rb_left)) {
+				sibling->rb_right->rb_black = true;
+				sibling->rb_black = false;
+				rotate_left(sibling, root);
+				sibling = parent->rb_left;
+			}
+			sibling->rb_black = parent->rb_black;
+			parent->rb_black = true;
+			sibling->rb_left->rb_black = true;
+			rotate_right(parent, root);
+		}
+		node = root->rb_node;
+		break;
+	}
+	if (node)
+		node->rb_black = true;
+}
+
+void rb_erase(struct rb_node *node, struct rb_root *root)
+{
+	struct rb_node *child = NULL;
+	struct rb_node *parent = NULL;
+	struct rb_node *succ = NULL;
+	bool black = node->rb_black;
+
+	if (!node->rb_left || !node->rb_right) {
+		child = node->rb_left ? node->rb_left : node->rb_right;
+		parent = node->rb_parent;
+		if (child)
+			child->rb_parent = parent;
+		change_child(node, child, parent, root);
+	} else {
+		// successor takes the place (and color) of the node, its own place is fixed up
+		succ = node->rb_right;
+		while (succ->rb_left)
+			succ = succ->rb_left;
+
+		black = succ->rb_black;
+		child = succ->rb_right;
+		parent = succ->rb_parent;
+
+		if (parent == node) {
+			parent = succ;
+		} else {
+			if (child)
+				child->rb_parent = parent;
+			parent->rb_left = child;
+			succ->rb_right = node->rb_right;
+			node->rb_right->rb_parent = succ;
+		}
+
+		succ->rb_left = node->rb_left;
+		node->rb_left->rb_parent = succ;
+		succ->rb_parent = node->rb_parent;
+		succ->rb_black = node->rb_black;
+		change_child(node, succ, node->rb_parent, root);
+	}
+
+	if (black && root->rb_node)
+		erase_fixup(child, parent, root);
+}
+
+struct rb_node *rb_first(const struct rb_root *root)
+{
+	struct rb_node *node = root->rb_node;
+
+	if (!node)
+		return NULL;
+	while (node->rb_left)
+		node = node->rb_left;
+	return node;
+}
+
+struct rb_node *rb_last(const struct rb_root *root)
+{
+	struct rb_node *node = root->rb_node;
+
+	if (!node)
+		return NULL;
+	while (node->rb_right)
+		node = node->rb_right;
+	return node;
+}
+
+struct rb_node *rb_next(const struct rb_node *node)
+{
+	struct rb_node *parent = NULL;
+
+	if (node->rb_right) {
+		node = node->rb_right;
+		while (node->rb_left)
+			node = node->rb_left;
+		return (struct rb_node *)node;
+	}
+
+	while ((parent = node->rb_parent) && node == parent->rb_right)
+		node = parent;
+	return parent;
+}
+
+struct rb_node *rb_prev(const struct rb_node *node)
+{
+	struct rb_node *parent = NULL;
+
+	if (node->rb_left) {
+		node = node->rb_left;
+		while (node->rb_right)
+			node = node->rb_right;
+		return (struct rb_node *)node;
+	}
+
+	while ((parent = node->rb_parent) && node == parent->rb_left)
+		node = parent;
+	return parent;
+}
+
+static struct rb_node *left_deepest(const struct rb_node *node)
+{
+	for (;;) {
+		if (node->rb_left)
+			node = node->rb_left;
+		else if (node->rb_right)
+			node = node->rb_right;
+		else
+			return (struct rb_node *)node;
+	}
+}
+
+struct rb_node *rb_first_postorder(const struct rb_root *root)
+{
+	if (!root->rb_node)
+		return NULL;
+	return left_deepest(root->rb_node);
+}
+
+struct rb_node *rb_next_postorder(const struct rb_node *node)
+{
+	const struct rb_node *parent = NULL;
+
+	if (!node)
+		return NULL;
+
+	parent = node->rb_parent;
+	if (parent && node == parent->rb_left && parent->rb_right)
+		return left_deepest(parent->rb_right);
+	return (struct rb_node *)parent;
+}
@@ -0,0 +1,495 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/*
+ * Userspace multithreaded microbenchmark of the mapping data structures.
+ * Drives ds_init/ds_insert/ds_lookup/ds_prev of src/utils (built against kshim, see Makefile)
+ * with the same operation sequences the driver issues:
+ *
+ * - write: ds_lookup + ds_remove (if mapped) + ds_insert, as update_mapping() does;
+ * - lookup: ds_lookup of the read start;
+ * - prev: ds_prev of the read start, as the read of an unaligned/unmapped block does.
+ *
+ * Structures that aren't thread safe (sync ones, lf bt/rb) are serialized by a global rwlock,
+ * (-L forces it for all of them), so the numbers are comparable to the driver in the same mode.
+ *
+ * Usage: make TY=lf && ./ubench_lf -d sl -t 8 -n 1000000 -k 1048576 -D zipf -r 70
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <time.h>
+#include <linux/types.h>
+#include "ds_control.h"
+#include "mag_cache.h"
+#include "value_redir.h"
+
+#ifdef LF_MODE
+#include "backoff.h"
+#define UBENCH_MODE "lf"
+#else
+#define UBENCH_MODE "sy"
+#endif
+
+#define UBENCH_MAX_THREADS 256
+#define UBENCH_ZIPF_THETA 0.99
+
+enum ubench_dist { UBENCH_UNIFORM, UBENCH_SEQ, UBENCH_ZIPF };
+
+static const char *ubench_dist_names[] = { "uniform", "seq", "zipf" };
+
+struct ubench_cfg {
+	char ds[3];
+	u32 threads;
+	u64 ops; // per thread
+	u64 keys; // key space, in 4K blocks
+	u64 prefill;
+	enum ubench_dist dist;
+	u32 read_pct;
+	u32 prev_pct; // share of ds_prev among the reads
+	enum lsbdd_value_enc enc;
+	bool lock;
+	u64 seed;
+	double theta;
+};
+
+// YCSB-style zipfian generator over [0, n), ranks are scattered over the key space
+struct ubench_zipf {
+	u64 n;
+	double theta;
+	double alpha;
+	double zetan;
+	double eta;
+};
+
+struct ubench_worker {
+	pthread_t thread;
+	u32 id;
+	u64 rng;
+	u64 seq;
+	u64 lookups;
+	u64 prevs;
+	u64 writes;
+	u64 hits; // lookups/prevs that found a value
+	u64 failed; // ds_insert errors
+	u64 sink;
+#ifdef LF_MODE
+	struct lsbdd_cas_stats cas;
+#endif
+};
+
+static struct ubench_cfg cfg = {
+	.ds = "sl",
+	.threads = 1,
+	.ops = 1000000,
+	.keys = 1 << 20,
+	.prefill = ULLONG_MAX, // whole key space
+	.dist = UBENCH_UNIFORM,
+	.read_pct = 50,
+	.prev_pct = 0,
+	.enc = LSBDD_VALUE_FULL,
+	.lock = false,
+	.seed = 1,
+	.theta = UBENCH_ZIPF_THETA,
+};
+
+static struct lsbdd_ds ds;
+static struct lsbdd_cache_mng cache_mng;
+static struct kmem_cache *value_cache;
+static struct ubench_zipf zipf;
+static pthread_rwlock_t ds_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_barrier_t start_barrier;
+
+static u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// xorshift64*, state must never be 0
+static u64 rng_next(u64 *state)
+{
+	u64 x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+
+	return x * 0x2545F4914F6CDD1Dull;
+}
+
+static double rng_double(u64 *state)
+{
+	return (rng_next(state) >> 11) * (1.0 / (1ull << 53));
+}
+
+static void zipf_init(struct ubench_zipf *z, u64 n, double theta)
+{
+	double zeta2 = 1.0 + pow(0.5, theta);
+	u64 i = 0;
+
+	z->n = n;
+	z->theta = theta;
+	z->zetan = 0;
+	for (i = 1; i <= n; i++)
+		z->zetan += 1.0 / pow((double)i, theta);
+
+	z->alpha = 1.0 / (1.0 - theta);
+	z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+}
+
+static u64 zipf_next(struct ubench_zipf *z, u64 *state)
+{
+	double u = rng_double(state);
+	double uz = u * z->zetan;
+	u64 rank = 0;
+
+	if (uz < 1.0)
+		rank = 0;
+	else if (uz < 1.0 + pow(0.5, z->theta))
+		rank = 1;
+	else
+		rank = (u64)(z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+
+	if (rank >= z->n)
+		rank = z->n - 1;
+
+	// hot ranks shouldn't be neighbours, otherwise it is a sequential workload
+	return (rank * GOLDEN_RATIO_64) % z->n;
+}
+
+// @return LBA (in sectors) of the next 4K block, LBA 0 is never used (rbtree treats key 0 as invalid)
+static sector_t next_key(struct ubench_worker *w)
+{
+	u64 block = 0;
+
+	switch (cfg.dist) {
+	case UBENCH_UNIFORM:
+		block = rng_next(&w->rng) % cfg.keys;
+		break;
+	case UBENCH_SEQ:
+		// each thread streams through its own part of the key space
+		block = (w->id * (cfg.keys / cfg.threads) + w->seq++) % cfg.keys;
+		break;
+	case UBENCH_ZIPF:
+		block = zipf_next(&zipf, &w->rng);
+		break;
+	}
+
+	return (block + 1) * LSBDD_COMPACT_BLOCK_SECTORS;
+}
+
+static void *build_value(sector_t pba)
+{
+	struct lsbdd_value_redir *value = NULL;
+
+	if (cfg.enc == LSBDD_VALUE_COMPACT)
+		return lsbdd_value_compact(pba, LSBDD_COMPACT_BLOCK_SIZE);
+
+	value = lsbdd_mag_zalloc(value_cache, GFP_KERNEL);
+	if (!value)
+		return NULL;
+	value->redirected_sector = pba;
+	value->block_size = LSBDD_COMPACT_BLOCK_SIZE;
+
+	return value;
+}
+
+static s32 ds_write(sector_t lba, sector_t pba)
+{
+	void *value = build_value(pba);
+	s32 status = 0;
+
+	if (!value)
+		return -ENOMEM;
+
+	if (cfg.lock)
+		pthread_rwlock_wrlock(&ds_lock);
+	if (ds_lookup(&ds, lba))
+		ds_remove(&ds, lba, value_cache);
+	status = ds_insert(&ds, lba, value, &cache_mng, value_cache);
+	if (cfg.lock)
+		pthread_rwlock_unlock(&ds_lock);
+
+	return status;
+}
+
+static void *ds_read(sector_t lba, bool prev)
+{
+	sector_t prev_key = 0;
+	void *value = NULL;
+
+	if (cfg.lock)
+		pthread_rwlock_rdlock(&ds_lock);
+	value = prev ? ds_prev(&ds, lba, &prev_key) : ds_lookup(&ds, lba);
+	if (cfg.lock)
+		pthread_rwlock_unlock(&ds_lock);
+
+	return value;
+}
+
+static void *worker_thread(void *data)
+{
+	struct ubench_worker *w = data;
+	struct lsbdd_value_redir ext = { 0 };
+	sector_t lba = 0;
+	sector_t pba = 0;
+	void *value = NULL;
+	bool prev = false;
+	u64 i = 0;
+
+	pthread_barrier_wait(&start_barrier);
+
+	for (i = 0; i < cfg.ops; i++) {
+		lba = next_key(w);
+		if (rng_next(&w->rng) % 100 < cfg.read_pct) {
+			prev = rng_next(&w->rng) % 100 < cfg.prev_pct;
+			value = ds_read(lba, prev);
+			if (prev)
+				w->prevs++;
+			else
+				w->lookups++;
+			if (value) {
+				ext = lsbdd_value_get(value);
+				w->sink += ext.redirected_sector;
+				w->hits++;
+			}
+		} else {
+			// PBAs are never reused, as in the driver, and don't overlap the prefilled ones
+			pba = ((cfg.keys + 1) + i * cfg.threads + w->id) * LSBDD_COMPACT_BLOCK_SECTORS;
+			if (ds_write(lba, pba))
+				w->failed++;
+			w->writes++;
+		}
+	}
+
+#ifdef LF_MODE
+	w->cas = lsbdd_cas_stats; // per-CPU stats of backoff.c are thread-local in kshim
+#endif
+
+	return NULL;
+}
+
+static s32 prefill(void)
+{
+	u64 i = 0;
+
+	for (i = 0; i < cfg.prefill; i++) {
+		if (ds_write((i + 1) * LSBDD_COMPACT_BLOCK_SECTORS, (i + 1) * LSBDD_COMPACT_BLOCK_SECTORS))
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -d bt|sl|ht|rb        data structure (default sl)\n"
+		"  -t threads            worker threads (default 1, max %d)\n"
+		"  -n ops                operations per thread (default 1000000)\n"
+		"  -k keys               key space in 4K blocks (default 1048576)\n"
+		"  -p keys               prefilled keys (default - whole key space)\n"
+		"  -D uniform|seq|zipf   key distribution (default uniform)\n"
+		"  -z theta              zipf skew in (0, 1) (default %.2f)\n"
+		"  -r pct                reads percentage, the rest are writes (default 50)\n"
+		"  -P pct                ds_prev percentage among the reads (default 0)\n"
+		"  -v full|compact       mapping value encoding (default full)\n"
+		"  -L                    serialize all the operations with a global rwlock\n"
+		"  -s seed               seed of the key generators (default 1)\n",
+		name, UBENCH_MAX_THREADS, UBENCH_ZIPF_THETA);
+}
+
+static s32 parse_args(s32 argc, char **argv)
+{
+	s32 opt = 0;
+	u32 i = 0;
+
+	while ((opt = getopt(argc, argv, "d:t:n:k:p:D:z:r:P:v:Ls:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			if (strcmp(optarg, "bt") && strcmp(optarg, "sl") && strcmp(optarg, "ht") && strcmp(optarg, "rb"))
+				return -EINVAL;
+			strscpy(cfg.ds, optarg, sizeof(cfg.ds));
+			break;
+		case 't':
+			cfg.threads = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			cfg.ops = strtoull(optarg, NULL, 10);
+			break;
+		case 'k':
+			cfg.keys = strtoull(optarg, NULL, 10);
+			break;
+		case 'p':
+			cfg.prefill = strtoull(optarg, NULL, 10);
+			break;
+		case 'D':
+			for (i = 0; i < ARRAY_SIZE(ubench_dist_names); i++) {
+				if (!strcmp(optarg, ubench_dist_names[i]))
+					break;
+			}
+			if (i == ARRAY_SIZE(ubench_dist_names))
+				return -EINVAL;
+			cfg.dist = i;
+			break;
+		case 'z':
+			cfg.theta = strtod(optarg, NULL);
+			break;
+		case 'r':
+			cfg.read_pct = strtoul(optarg, NULL, 10);
+			break;
+		case 'P':
+			cfg.prev_pct = strtoul(optarg, NULL, 10);
+			break;
+		case 'v':
+			if (!strcmp(optarg, "full"))
+				cfg.enc = LSBDD_VALUE_FULL;
+			else if (!strcmp(optarg, "compact"))
+				cfg.enc = LSBDD_VALUE_COMPACT;
+			else
+				return -EINVAL;
+			break;
+		case 'L':
+			cfg.lock = true;
+			break;
+		case 's':
+			cfg.seed = strtoull(optarg, NULL, 10);
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+
+	if (!cfg.threads || cfg.threads > UBENCH_MAX_THREADS || !cfg.ops || !cfg.keys || cfg.read_pct > 100 || cfg.prev_pct > 100 ||
+	    cfg.theta <= 0 || cfg.theta >= 1)
+		return -EINVAL;
+
+	cfg.prefill = min(cfg.prefill, cfg.keys);
+
+#ifdef LF_MODE
+	// only the lock-free skiplist and hashtable are safe for concurrent updates
+	if (strcmp(cfg.ds, "sl") && strcmp(cfg.ds, "ht"))
+		cfg.lock = true;
+#else
+	cfg.lock = true;
+#endif
+
+	return 0;
+}
+
+static s32 ubench_init(void)
+{
+	s32 status = 0;
+
+	value_cache = lsbdd_mag_cache_create("lsbdd_value_cache", sizeof(struct lsbdd_value_redir), 0, SLAB_HWCACHE_ALIGN);
+	if (!value_cache)
+		return -ENOMEM;
+
+	status = ds_init(&ds, cfg.ds, &cache_mng);
+	if (status) {
+		lsbdd_mag_cache_destroy(value_cache);
+		return status;
+	}
+
+	return 0;
+}
+
+static void ubench_free(void)
+{
+	ds_free(&ds, &cache_mng, value_cache);
+	lsbdd_mag_cache_destroy(value_cache);
+}
+
+s32 main(s32 argc, char **argv)
+{
+	struct ubench_worker *workers = NULL;
+	struct ubench_worker total = { 0 };
+	u64 fill_ns = 0;
+	u64 elapsed_ns = 0;
+	u64 ops = 0;
+	u32 i = 0;
+	s32 status = 0;
+
+	if (parse_args(argc, argv)) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (cfg.dist == UBENCH_ZIPF)
+		zipf_init(&zipf, cfg.keys, cfg.theta);
+
+	workers = calloc(cfg.threads, sizeof(struct ubench_worker));
+	if (!workers || ubench_init()) {
+		pr_err("Initialization failed\n");
+		free(workers);
+		return EXIT_FAILURE;
+	}
+
+	fill_ns = now_ns();
+	status = prefill();
+	fill_ns = now_ns() - fill_ns;
+	if (status) {
+		pr_err("Prefill failed\n");
+		goto out;
+	}
+
+	pthread_barrier_init(&start_barrier, NULL, cfg.threads + 1);
+	for (i = 0; i < cfg.threads; i++) {
+		workers[i].id = i;
+		workers[i].rng = (cfg.seed + i) * 0x9E3779B97F4A7C15ull | 1;
+		if (pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i])) {
+			// barrier counts all the threads, so the ones that did start would wait forever
+			pr_err("Failed to start worker %u\n", i);
+			abort();
+		}
+	}
+
+	pthread_barrier_wait(&start_barrier);
+	elapsed_ns = now_ns();
+	for (i = 0; i < cfg.threads; i++)
+		pthread_join(workers[i].thread, NULL);
+	elapsed_ns = now_ns() - elapsed_ns;
+	pthread_barrier_destroy(&start_barrier);
+
+	for (i = 0; i < cfg.threads; i++) {
+		total.lookups += workers[i].lookups;
+		total.prevs += workers[i].prevs;
+		total.writes += workers[i].writes;
+		total.hits += workers[i].hits;
+		total.failed += workers[i].failed;
+		total.sink += workers[i].sink;
+	}
+	ops = total.lookups + total.prevs + total.writes;
+
+	printf("ds=%s mode=%s threads=%u ops=%llu keys=%llu prefill=%llu dist=%s read=%u prev=%u enc=%s lock=%d fill_ns=%llu ns=%llu "
+	       "kops_per_sec=%llu lookups=%llu prevs=%llu writes=%llu hits=%llu failed=%llu\n",
+	       cfg.ds, UBENCH_MODE, cfg.threads, ops, cfg.keys, cfg.prefill, ubench_dist_names[cfg.dist], cfg.read_pct, cfg.prev_pct,
+	       cfg.enc == LSBDD_VALUE_COMPACT ? "compact" : "full", cfg.lock, fill_ns, elapsed_ns,
+	       div64_u64(ops * 1000000ull, elapsed_ns ?: 1), total.lookups, total.prevs, total.writes, total.hits, total.failed);
+
+#ifdef LF_MODE
+	printf("site retries contended_ops rescheds\n");
+	for (u32 site = 0; site < LSBDD_CAS_SITES_NUM; site++) {
+		for (i = 0; i < cfg.threads; i++) {
+			total.cas.retries[site] += workers[i].cas.retries[site];
+			total.cas.contended[site] += workers[i].cas.contended[site];
+			total.cas.rescheds[site] += workers[i].cas.rescheds[site];
+		}
+		printf("%s %llu %llu %llu\n", lsbdd_cas_site_name(site), total.cas.retries[site], total.cas.contended[site],
+		       total.cas.rescheds[site]);
+	}
+#endif
+
+	if (total.failed)
+		status = -ENOMEM;
+
+out:
+	ubench_free();
+	free(workers);
+
+	return status ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,162 @@
+#!/bin/bash
+
+###											###
+###	  WRITE AMPLIFICATION BENCHMARK		###
+###											###
+# Sustained random overwrite of the virtual disk: a region of WA_REGION_GB is overwritten WA_PASSES times with
+# fio randwrite for each block size and data structure. Host and backing bytes written, map memory and
+# live vs allocated space are sampled every WA_SAMPLE_INTERVAL seconds, wa_plots.py plots them.
+# The backing device has to account its I/O in /sys/block/<bd>/stat (null_blk does) and fit the passes: there is no GC.
+# shellcheck disable=SC1091
+source ./configurable_params.sh
+
+readonly LOGS_PATH="logs"
+readonly SAMPLES_FILE="$LOGS_PATH/wa_samples.csv"
+readonly RUNS_FILE="$LOGS_PATH/wa_runs.csv"
+readonly WA_PLOTS_SCRIPT="wa_plots.py"
+readonly STATS_FILE="/sys/kernel/debug/lsbdd/$VBD_NAME/stats"
+readonly BD_STAT_FILE="/sys/block/$BD_NAME/stat"
+
+usage() {
+    echo "Usage: $0 [--passes N] [--region size_in_GB] [--bs 4,16,64] [--ds sl,ht] [--interval seconds] [--no-plots]"
+    exit 1
+}
+
+# Reinits the lsbdd module, so each run starts with an empty map and log
+reinit_lsvbd() {
+	local ds=$1
+
+	make -C ../src exit DBI=1 > /dev/null 2>&1
+
+	sync; echo 3 | sudo tee /proc/sys/vm/drop_caches > /dev/null
+
+	make -C ../src init_no_recompile DS="$ds" TY="$BD_TYPE" BD="$BD_NAME" > /dev/null
+}
+
+# @return sectors written to the backing device (7th field of the block device stat)
+backing_sectors_written() {
+	awk '{ print $7 }' "$BD_STAT_FILE"
+}
+
+<<docs
+Appends a sample of the disk state to the samples file until killed.
+
+@param ds - data structure
+@param bs - write block size in KB
+@param backing_base - sectors written to the backing device before the run
+docs
+sample_loop() {
+	local ds=$1 bs=$2 backing_base=$3 start
+
+	start=$(date +%s.%N)
+	while true; do
+		awk -v ds="$ds" -v bs="$bs" -v start="$start" -v now="$(date +%s.%N)" -v region="$((WA_REGION_GB * 1073741824))" \
+			-v backing="$(( ($(backing_sectors_written) - backing_base) * 512 ))" '
+			{ stat[$1] = $2 }
+			END {
+				printf "%s,%s,%.3f,%s,%s,%s,%s,%s,%s,%s,%s\n", ds, bs, now - start, region, stat["write_bytes"], backing, stat["writes"],
+					stat["map_node_bytes"] + stat["map_value_bytes"], stat["map_entries"], stat["live_sectors"], stat["allocated_sectors"]
+			}' "$STATS_FILE" >> "$SAMPLES_FILE"
+		sleep "$WA_SAMPLE_INTERVAL"
+	done
+}
+
+<<docs
+Overwrites the region WA_PASSES times with one block size, sampling the disk state meanwhile.
+
+@param ds - data structure
+@param bs - write block size in KB
+docs
+run_overwrite() {
+	local ds=$1 bs=$2 log_file io_size_mb backing_base sampler_pid iops
+
+	log_file="$LOGS_PATH/wa_${ds}_${bs}k.log"
+	io_size_mb=$((WA_REGION_GB * 1024 * WA_PASSES / JOBS_NUM))
+	backing_base=$(backing_sectors_written)
+
+	sample_loop "$ds" "$bs" "$backing_base" &
+	sampler_pid=$!
+
+	fio --name=wa --rw=randwrite --bs="$bs"k --size="$WA_REGION_GB"G --io_size="$io_size_mb"M --norandommap --randrepeat=0 \
+		--numjobs="$JOBS_NUM" --iodepth="$IO_DEPTH" --ioengine=io_uring --direct=1 --group_reporting \
+		--filename=/dev/"$VBD_NAME" --offset=16k --output="$log_file"
+
+	kill "$sampler_pid"
+	wait "$sampler_pid" 2> /dev/null
+
+	iops=$(grep -oP 'IOPS=\K[0-9]+(\.[0-9]+)?[kKmM]?' "$log_file" | head -1 | \
+		awk '{ val = $1; mul = 1; if (val ~ /[kK]$/) mul = 1000; else if (val ~ /[mM]$/) mul = 1000000; printf "%.0f", val * mul }')
+	echo "$ds,$bs,$WA_PASSES,$iops" >> "$RUNS_FILE"
+	echo "ds = $ds, bs = ${bs}k: IOPS = $iops"
+}
+
+PLOTS="true"
+
+while [[ "$#" -gt 0 ]]; do
+    case $1 in
+        -p|--passes)
+            WA_PASSES="$2"
+            shift
+            ;;
+        -r|--region)
+            WA_REGION_GB="$2"
+            shift
+            ;;
+        -b|--bs)
+            IFS=',' read -r -a WA_BS_LIST <<< "$2"
+            shift
+            ;;
+        -d|--ds)
+            IFS=',' read -r -a PL_AVAILABLE_DS <<< "$2"
+            shift
+            ;;
+        -i|--interval)
+            WA_SAMPLE_INTERVAL="$2"
+            shift
+            ;;
+        --no-plots)
+            PLOTS="false"
+            ;;
+        -h|--help)
+            usage
+            ;;
+        *)
+            echo "Unknown option: $1"
+            usage
+            ;;
+    esac
+	shift
+done
+
+if [[ ! -r "$BD_STAT_FILE" ]]; then
+    echo "Error: $BD_STAT_FILE is not available, check BD_NAME in configurable_params.sh."
+    exit 1
+fi
+
+mkdir -p "$LOGS_PATH"
+echo "ds,bs,t,region_bytes,host_bytes,backing_bytes,writes,map_bytes,map_entries,live_sectors,allocated_sectors" > "$SAMPLES_FILE"
+echo "ds,bs,passes,fio_iops" > "$RUNS_FILE"
+
+for ds in "${PL_AVAILABLE_DS[@]}"; do
+	for bs in "${WA_BS_LIST[@]}"; do
+		echo "Overwriting ${WA_REGION_GB}G x $WA_PASSES with bs = ${bs}k, ds = $ds ..."
+		reinit_lsvbd "$ds"
+
+		if [[ ! -r "$STATS_FILE" ]]; then
+			echo "Error: $STATS_FILE is not available (is debugfs mounted?)."
+			exit 1
+		fi
+
+		run_overwrite "$ds" "$bs"
+	done
+done
+
+make -C ../src exit DBI=1 > /dev/null 2>&1
+
+echo -e "\nSamples are saved in $SAMPLES_FILE, runs in $RUNS_FILE"
+
+if [ "$PLOTS" == "true" ]; then
+	python3 "$WA_PLOTS_SCRIPT"
+fi
+
+python3 bench_db.py record
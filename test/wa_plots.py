@@ -0,0 +1,142 @@
+import matplotlib.pyplot as plt
+import argparse
+import os
+import numpy as np
+import pandas as pd
+
+# Plots of the wa_bench.sh results: write amplification over the overwrite passes, steady-state IOPS
+# and space efficiency (map memory, live vs allocated sectors) per data structure and block size.
+
+SAMPLES_FILE_PATH = "logs/wa_samples.csv"
+RUNS_FILE_PATH = "logs/wa_runs.csv"
+SUMMARY_FILE_PATH = "logs/wa_summary.csv"
+PLOTS_PATH = "plots/wa"
+
+DS_MAPPING = {
+    "ht": "Hash-table",
+    "sl": "Skiplist",
+    "bt": "B+ tree",
+    "rb": "Red-Black tree",
+}
+
+DS_COLORS = {"sl": "steelblue", "ht": "indianred", "rb": "seagreen", "bt": "darkkhaki"}
+
+parser = argparse.ArgumentParser(description="Generate write amplification plots from wa_bench.sh results.")
+parser.add_argument("--samples", default=SAMPLES_FILE_PATH, help="Samples of the disk state")
+parser.add_argument("--runs", default=RUNS_FILE_PATH, help="fio results of the runs")
+parser.add_argument(
+    "--steady-from",
+    type=float,
+    default=None,
+    help="Pass (region overwrites) the steady state starts at, the last pass by default",
+)
+args = parser.parse_args()
+
+
+def add_derived(df):
+    """
+    Adds per-sample metrics: passes done, cumulative write amplification, space amplification and interval IOPS.
+    """
+    df = df.sort_values(["ds", "bs", "t"]).copy()
+    df["passes"] = df["host_bytes"] / df["region_bytes"]
+    df["wa"] = df["backing_bytes"] / df["host_bytes"].where(df["host_bytes"] > 0)
+    df["space_amp"] = df["allocated_sectors"] / df["live_sectors"].where(df["live_sectors"] > 0)
+    grouped = df.groupby(["ds", "bs"])
+    df["iops"] = grouped["writes"].diff() / grouped["t"].diff()
+    return df
+
+
+def summarize(df, runs):
+    """
+    One row per run: final amplification, steady-state IOPS (interval IOPS after steady_from passes) and space.
+    """
+    rows = []
+    for (ds, bs), run in df.groupby(["ds", "bs"]):
+        last = run.iloc[-1]
+        steady_from = args.steady_from if args.steady_from is not None else max(last["passes"] - 1, 0)
+        steady = run[run["passes"] >= steady_from]["iops"].dropna()
+        row = {
+            "ds": ds,
+            "bs": bs,
+            "passes": round(last["passes"], 2),
+            "wa": round(last["wa"], 3),
+            "space_amp": round(last["space_amp"], 3),
+            "steady_iops": round(steady.median()) if not steady.empty else 0,
+            "map_bytes": int(last["map_bytes"]),
+            "map_bytes_per_entry": round(last["map_bytes"] / last["map_entries"], 1) if last["map_entries"] else 0,
+        }
+        fio = runs[(runs["ds"] == ds) & (runs["bs"] == bs)]
+        row["fio_iops"] = int(fio["fio_iops"].iloc[0]) if not fio.empty else 0
+        rows.append(row)
+    return pd.DataFrame(rows)
+
+
+def plot_over_passes(df, column, y_label, title, filename):
+    """
+    One subplot per block size, one line per data structure, x - region overwrites done.
+    """
+    bs_values = sorted(df["bs"].unique())
+    fig, axes = plt.subplots(1, len(bs_values), figsize=(6 * len(bs_values), 5), squeeze=False)
+    for ax, bs in zip(axes[0], bs_values):
+        for ds, run in df[df["bs"] == bs].groupby("ds"):
+            ax.plot(run["passes"], run[column], label=DS_MAPPING.get(ds, ds), color=DS_COLORS.get(ds, None))
+        ax.set_title(f"BS {bs}K")
+        ax.set_xlabel("Region overwrites")
+        ax.set_ylabel(y_label)
+        ax.grid(True, alpha=0.3)
+        ax.legend()
+    fig.suptitle(title)
+    fig.tight_layout()
+    fig.savefig(os.path.join(PLOTS_PATH, filename))
+    plt.close(fig)
+
+
+def plot_summary_bars(summary, column, y_label, title, filename):
+    bs_values = sorted(summary["bs"].unique())
+    ds_values = list(summary["ds"].unique())
+    x = np.arange(len(bs_values))
+    width = 0.8 / len(ds_values)
+
+    plt.figure(figsize=(10, 6))
+    for idx, ds in enumerate(ds_values):
+        values = []
+        for bs in bs_values:
+            row = summary[(summary["ds"] == ds) & (summary["bs"] == bs)]
+            values.append(row[column].iloc[0] if not row.empty else 0)
+        plt.bar(x + idx * width, values, width, color=DS_COLORS.get(ds, None), label=DS_MAPPING.get(ds, ds))
+
+    plt.xticks(x + width * (len(ds_values) - 1) / 2, [f"{bs}K" for bs in bs_values])
+    plt.xlabel("Write block size")
+    plt.ylabel(y_label)
+    plt.title(title)
+    plt.legend()
+    plt.tight_layout()
+    plt.savefig(os.path.join(PLOTS_PATH, filename))
+    plt.close()
+
+
+def main():
+    df = pd.read_csv(args.samples)
+    if df.empty:
+        print(f"No samples in {args.samples}")
+        return
+    runs = pd.read_csv(args.runs) if os.path.exists(args.runs) else pd.DataFrame(columns=["ds", "bs", "fio_iops"])
+
+    os.makedirs(PLOTS_PATH, exist_ok=True)
+    df = add_derived(df)
+    summary = summarize(df, runs)
+    summary.to_csv(SUMMARY_FILE_PATH, index=False)
+    print(summary.to_string(index=False))
+
+    plot_over_passes(df, "wa", "Backing bytes / host bytes", "Write amplification", "wa_over_passes.png")
+    plot_over_passes(df, "iops", "Write IOPS", "Write IOPS during the overwrite", "iops_over_passes.png")
+    plot_over_passes(df, "space_amp", "Allocated / live sectors", "Space amplification", "space_amp_over_passes.png")
+    plot_over_passes(df, "map_bytes", "Map memory (bytes)", "Map memory", "map_bytes_over_passes.png")
+    plot_summary_bars(summary, "wa", "Backing bytes / host bytes", "Write amplification after the overwrite", "wa_final.png")
+    plot_summary_bars(summary, "steady_iops", "Write IOPS", "Steady-state IOPS (median)", "steady_iops.png")
+
+    print(f"Summary is saved in {SUMMARY_FILE_PATH}, plots in {PLOTS_PATH}")
+
+
+if __name__ == "__main__":
+    main()